@@ -10,7 +10,6 @@
  * Checks whether some sectors is included in a bio
  */
 static inline bool bio_contains(struct bio *bio, sector_t sector, size_t nr_sec) {
-	JPRINTK("does bio contain %u?", (unsigned int)sector);
 	return sector >= bio->bi_sector && 
 		sector + nr_sec <= bio->bi_sector + bio_sectors(bio);
 }
@@ -0,0 +1,440 @@
+/*
+ * bitmap.c -- free space tracking from guest block bitmaps
+ */
+
+#include <linux/slab.h>
+#include <linux/highmem.h>
+#include <linux/bitops.h>
+#include <linux/blkdev.h>
+#include <linux/list_sort.h>
+#include <linux/moduleparam.h>
+#include <linux/ext3_fs.h>
+
+#include "bitmap.h"
+
+/* how long freed blocks are batched up before being discarded */
+#define LJX_DISCARD_DELAY	HZ
+
+static bool discard_synth;
+module_param(discard_synth, bool, 0444);
+MODULE_PARM_DESC(discard_synth,
+		"Discard blocks the guest frees in its ext3 block bitmaps");
+
+static bool skip_free_reads;
+module_param(skip_free_reads, bool, 0444);
+MODULE_PARM_DESC(skip_free_reads,
+		"Complete reads of blocks free in the guest filesystem with zeroes");
+
+static struct workqueue_struct *ljx_discard_wq;
+
+static inline unsigned int block_group(struct ljx_ext3_superblock *lsb,
+		ext3_fsblk_t block) {
+	return (block - lsb->first_data_block) / lsb->blocks_per_group;
+}
+
+static inline unsigned int group_offset(struct ljx_ext3_superblock *lsb,
+		ext3_fsblk_t block) {
+	return (block - lsb->first_data_block) % lsb->blocks_per_group;
+}
+
+static inline ext3_fsblk_t group_first_block(struct ljx_ext3_superblock *lsb,
+		unsigned int group) {
+	return lsb->first_data_block + (ext3_fsblk_t) group * lsb->blocks_per_group;
+}
+
+/* number of blocks in a group; the last one may be short */
+static inline unsigned int group_nr_blocks(struct ljx_ext3_superblock *lsb,
+		unsigned int group) {
+	return min_t(ext3_fsblk_t, lsb->blocks_per_group,
+			lsb->blocks_count - group_first_block(lsb, group));
+}
+
+/* makes sure the per-group bitmaps exist */
+static int alloc_group(struct ljx_block_bitmap *bm, unsigned int group, gfp_t gfp) {
+	size_t size = BITS_TO_LONGS(bm->lsb->blocks_per_group) * sizeof(long);
+	unsigned long *in_use = NULL, *written = NULL, flags;
+
+	if (bm->in_use[group])
+		return 0;
+	in_use = kzalloc(size, gfp);
+	written = kzalloc(size, gfp);
+	if (! in_use || ! written) {
+		kfree(in_use);
+		kfree(written);
+		return -ENOMEM;
+	}
+
+	spin_lock_irqsave(&bm->lock, flags);
+	if (! bm->in_use[group]) {
+		bm->in_use[group] = in_use;
+		bm->written[group] = written;
+		bm->nr_groups++;
+		in_use = written = NULL;
+	}
+	spin_unlock_irqrestore(&bm->lock, flags);
+	kfree(in_use);
+	kfree(written);
+	return 0;
+}
+
+extern int ljx_bitmap_init(void) {
+	ljx_discard_wq = alloc_workqueue("ljx_discard",
+			WQ_NON_REENTRANT | WQ_MEM_RECLAIM, 0);
+	return ljx_discard_wq ? 0 : -ENOMEM;
+}
+
+extern void ljx_bitmap_exit(void) {
+	if (ljx_discard_wq)
+		destroy_workqueue(ljx_discard_wq);
+	ljx_discard_wq = NULL;
+}
+
+static void discard_work(struct work_struct *);
+
+extern struct ljx_block_bitmap *ljx_bitmap_alloc(
+		struct xen_vbd *vbd,
+		struct ljx_ext3_superblock *lsb
+) {
+	struct request_queue *q = bdev_get_queue(vbd->bdev);
+	struct ljx_block_bitmap *bm;
+	bool discard;
+
+	discard = discard_synth && ljx_discard_wq && q && blk_queue_discard(q);
+	if (! discard && ! skip_free_reads)
+		return NULL;
+
+	bm = kzalloc(sizeof(struct ljx_block_bitmap), GFP_ATOMIC);
+	if (! bm)
+		return NULL;
+	bm->seen = kzalloc(BITS_TO_LONGS(lsb->groups_count) * sizeof(long),
+			GFP_ATOMIC);
+	bm->lost = kzalloc(BITS_TO_LONGS(lsb->groups_count) * sizeof(long),
+			GFP_ATOMIC);
+	bm->synced = kzalloc(BITS_TO_LONGS(lsb->groups_count) * sizeof(long),
+			GFP_ATOMIC);
+	bm->in_use = kzalloc(lsb->groups_count * sizeof(unsigned long *), GFP_ATOMIC);
+	bm->written = kzalloc(lsb->groups_count * sizeof(unsigned long *), GFP_ATOMIC);
+	if (! bm->seen || ! bm->lost || ! bm->synced || ! bm->in_use ||
+	    ! bm->written) {
+		kfree(bm->seen);
+		kfree(bm->lost);
+		kfree(bm->synced);
+		kfree(bm->in_use);
+		kfree(bm->written);
+		kfree(bm);
+		return NULL;
+	}
+	spin_lock_init(&bm->lock);
+	bm->discard = discard;
+	bm->skip_reads = skip_free_reads;
+	/* a mounted guest leaves this set, as does one that crashed */
+	bm->clean = ! (lsb->feature_incompat & EXT3_FEATURE_INCOMPAT_RECOVER);
+	bm->bdev = vbd->bdev;
+	bm->lsb = lsb;
+	INIT_LIST_HEAD(&bm->pending);
+	init_waitqueue_head(&bm->wq);
+	INIT_DELAYED_WORK(&bm->work, discard_work);
+	return bm;
+}
+
+extern void ljx_bitmap_free(struct ljx_block_bitmap *bm) {
+	struct ljx_free_run *run, *n;
+	unsigned int i;
+
+	if (! bm)
+		return;
+	cancel_delayed_work_sync(&bm->work);
+	list_for_each_entry_safe(run, n, &bm->pending, list)
+		kfree(run);
+	for (i = 0; i < bm->lsb->groups_count; i++) {
+		kfree(bm->in_use[i]);
+		kfree(bm->written[i]);
+	}
+	kfree(bm->seen);
+	kfree(bm->lost);
+	kfree(bm->synced);
+	kfree(bm->in_use);
+	kfree(bm->written);
+	kfree(bm);
+}
+
+extern void ljx_bitmap_stop(struct ljx_block_bitmap *bm) {
+	unsigned long flags;
+
+	if (! bm)
+		return;
+	spin_lock_irqsave(&bm->lock, flags);
+	bm->discard = false;
+	spin_unlock_irqrestore(&bm->lock, flags);
+	cancel_delayed_work_sync(&bm->work);
+}
+
+/* must be called with bm->lock held */
+static void queue_run(struct ljx_block_bitmap *bm, ext3_fsblk_t start,
+		unsigned int len) {
+	struct ljx_free_run *run;
+
+	if (! list_empty(&bm->pending)) {
+		run = list_entry(bm->pending.prev, struct ljx_free_run, list);
+		if (run->start + run->len == start) {
+			run->len += len;
+			return;
+		}
+	}
+	if (bm->nr_pending >= LJX_MAX_FREE_RUNS ||
+	    ! (run = kmalloc(sizeof(struct ljx_free_run), GFP_ATOMIC))) {
+		bm->dropped_blocks += len;
+		return;
+	}
+	run->start = start;
+	run->len = len;
+	list_add_tail(&run->list, &bm->pending);
+	bm->nr_pending++;
+}
+
+extern int ljx_bitmap_update(
+		struct ljx_block_bitmap *bm,
+		unsigned int group,
+		const void *bits,
+		int write
+) {
+	struct ljx_ext3_superblock *lsb = bm->lsb;
+	const unsigned long *disk = bits;
+	unsigned long *in_use, *written, *freed = NULL, old, flags;
+	unsigned int nbits, i, start, end;
+	bool queued = false;
+	int ret;
+
+	if (group >= lsb->groups_count)
+		return -EINVAL;
+	if ((ret = alloc_group(bm, group, GFP_ATOMIC)))
+		return ret;
+	nbits = group_nr_blocks(lsb, group);
+	if (write && bm->discard) {
+		freed = kzalloc(BITS_TO_LONGS(nbits) * sizeof(long), GFP_ATOMIC);
+		if (! freed)
+			return -ENOMEM;
+	}
+
+	spin_lock_irqsave(&bm->lock, flags);
+	in_use = bm->in_use[group];
+	written = bm->written[group];
+	for (i = 0; i < BITS_TO_LONGS(nbits); i++) {
+		old = in_use[i];
+		in_use[i] = disk[i] | written[i];
+		/* these allocations have made it into the bitmap */
+		written[i] &= ~disk[i];
+		if (freed && test_bit(group, bm->seen))
+			freed[i] = old & ~in_use[i];
+	}
+	__set_bit(group, bm->seen);
+	if (write)
+		__set_bit(group, bm->synced);
+
+	/* the bitmap is little endian on disk, and so are our copies */
+	if (freed && bm->discard) {
+		for (start = find_next_bit_le(freed, nbits, 0); start < nbits;
+				start = find_next_bit_le(freed, nbits, end)) {
+			end = find_next_zero_bit_le(freed, nbits, start);
+			queue_run(bm, group_first_block(lsb, group) + start, end - start);
+			queued = true;
+		}
+	}
+	spin_unlock_irqrestore(&bm->lock, flags);
+
+	kfree(freed);
+	if (queued)
+		queue_delayed_work(ljx_discard_wq, &bm->work, LJX_DISCARD_DELAY);
+	return 0;
+}
+
+static bool range_busy(struct ljx_block_bitmap *bm, ext3_fsblk_t start,
+		ext3_fsblk_t end) {
+	unsigned long flags;
+	bool busy;
+
+	spin_lock_irqsave(&bm->lock, flags);
+	busy = bm->busy_start < end && start < bm->busy_end;
+	spin_unlock_irqrestore(&bm->lock, flags);
+	return busy;
+}
+
+extern void ljx_bitmap_note_write(
+		struct ljx_block_bitmap *bm,
+		ext3_fsblk_t block,
+		unsigned int nr_blocks
+) {
+	struct ljx_ext3_superblock *lsb = bm->lsb;
+	ext3_fsblk_t b, start, end = block + nr_blocks;
+	unsigned int group;
+	unsigned long flags;
+
+	start = max_t(ext3_fsblk_t, block, lsb->first_data_block);
+	end = min_t(ext3_fsblk_t, end, lsb->blocks_count);
+	if (start >= end)
+		return;
+	for (group = block_group(lsb, start); group <= block_group(lsb, end - 1); group++)
+		alloc_group(bm, group, GFP_NOIO);
+
+	spin_lock_irqsave(&bm->lock, flags);
+	for (b = start; b < end; b++) {
+		group = block_group(lsb, b);
+		if (! bm->in_use[group]) {
+			/* we can no longer tell what is free in this group */
+			__set_bit(group, bm->lost);
+			continue;
+		}
+		__set_bit_le(group_offset(lsb, b), bm->in_use[group]);
+		__set_bit_le(group_offset(lsb, b), bm->written[group]);
+	}
+	spin_unlock_irqrestore(&bm->lock, flags);
+
+	/* a discard that was checked before we got here may still be running */
+	wait_event(bm->wq, ! range_busy(bm, start, end));
+}
+
+/* must be called with bm->lock held */
+static inline bool block_in_use(struct ljx_block_bitmap *bm, ext3_fsblk_t block) {
+	unsigned long *in_use = bm->in_use[block_group(bm->lsb, block)];
+
+	return ! in_use || test_bit_le(group_offset(bm->lsb, block), in_use);
+}
+
+extern int ljx_bitmap_zero_read(
+		struct ljx_block_bitmap *bm,
+		ext3_fsblk_t block,
+		unsigned int nr_blocks,
+		struct bio_vec *vec,
+		int nvec
+) {
+	struct ljx_ext3_superblock *lsb = bm->lsb;
+	ext3_fsblk_t b, end = block + nr_blocks;
+	unsigned int group;
+	unsigned long flags;
+	char *dst;
+	int i;
+
+	if (! bm->skip_reads || block < lsb->first_data_block ||
+	    end > lsb->blocks_count)
+		return 1;
+
+	spin_lock_irqsave(&bm->lock, flags);
+	for (b = block; b < end; b++) {
+		group = block_group(lsb, b);
+		/* a bitmap read before the journal was recovered may be stale */
+		if (! test_bit(group, bm->seen) || test_bit(group, bm->lost) ||
+		    (! bm->clean && ! test_bit(group, bm->synced)) ||
+		    block_in_use(bm, b)) {
+			spin_unlock_irqrestore(&bm->lock, flags);
+			return 1;
+		}
+	}
+	spin_unlock_irqrestore(&bm->lock, flags);
+
+	/* guest writes are noted by the same thread, so nothing can race us here */
+	for (i = 0; i < nvec; i++) {
+		dst = kmap_atomic(vec[i].bv_page);
+		memset(dst + vec[i].bv_offset, 0, vec[i].bv_len);
+		kunmap_atomic(dst);
+		bm->skipped_bytes += vec[i].bv_len;
+	}
+	return 0;
+}
+
+static sector_t align_offset(sector_t sector, unsigned int gran, unsigned int align) {
+	sector_t tmp = sector + gran - align;
+
+	return sector_div(tmp, gran);
+}
+
+/* discards the part of [block, block + nr_blocks) the device can reclaim */
+static void issue_discard(struct ljx_block_bitmap *bm, ext3_fsblk_t block,
+		unsigned int nr_blocks) {
+	struct request_queue *q = bdev_get_queue(bm->bdev);
+	sector_t start = ljx_block_to_sector(bm->lsb, block);
+	sector_t end = ljx_block_to_sector(bm->lsb, block + nr_blocks);
+	unsigned int gran, align;
+	sector_t off;
+
+	gran = max(q->limits.discard_granularity >> 9, 1U);
+	align = (q->limits.discard_alignment >> 9) % gran;
+	if ((off = align_offset(start, gran, align)))
+		start += gran - off;
+	end -= align_offset(end, gran, align);
+	if (end <= start)
+		return;
+	if (! blkdev_issue_discard(bm->bdev, start, end - start, GFP_NOIO, 0))
+		bm->discarded_sect += end - start;
+}
+
+/* discards whatever in a freed run is still free */
+static void discard_run(struct ljx_block_bitmap *bm, ext3_fsblk_t block,
+		ext3_fsblk_t end) {
+	ext3_fsblk_t next;
+	unsigned long flags;
+
+	while (block < end) {
+		spin_lock_irqsave(&bm->lock, flags);
+		while (block < end && block_in_use(bm, block)) {
+			/* reallocated since it was freed */
+			bm->reused_blocks++;
+			block++;
+		}
+		for (next = block; next < end && ! block_in_use(bm, next); next++)
+			;
+		bm->busy_start = block;
+		bm->busy_end = next;
+		spin_unlock_irqrestore(&bm->lock, flags);
+
+		if (next > block)
+			issue_discard(bm, block, next - block);
+
+		spin_lock_irqsave(&bm->lock, flags);
+		bm->busy_start = bm->busy_end = 0;
+		spin_unlock_irqrestore(&bm->lock, flags);
+		wake_up_all(&bm->wq);
+		block = next;
+	}
+}
+
+static int run_cmp(void *priv, struct list_head *a, struct list_head *b) {
+	struct ljx_free_run *ra = list_entry(a, struct ljx_free_run, list);
+	struct ljx_free_run *rb = list_entry(b, struct ljx_free_run, list);
+
+	if (ra->start < rb->start)
+		return -1;
+	return ra->start > rb->start;
+}
+
+static void discard_work(struct work_struct *work) {
+	struct ljx_block_bitmap *bm =
+		container_of(work, struct ljx_block_bitmap, work.work);
+	struct ljx_free_run *run, *next;
+	unsigned long flags;
+	LIST_HEAD(runs);
+
+	spin_lock_irqsave(&bm->lock, flags);
+	/* queued just as ljx_bitmap_stop() ran; the device may be gone */
+	if (! bm->discard) {
+		spin_unlock_irqrestore(&bm->lock, flags);
+		return;
+	}
+	list_splice_init(&bm->pending, &runs);
+	bm->nr_pending = 0;
+	spin_unlock_irqrestore(&bm->lock, flags);
+
+	/* sort and coalesce so the device sees as few, large discards as possible */
+	list_sort(NULL, &runs, run_cmp);
+	list_for_each_entry_safe(run, next, &runs, list) {
+		while (&next->list != &runs && next->start <= run->start + run->len) {
+			run->len = max(run->start + run->len, next->start + next->len)
+				- run->start;
+			list_del(&next->list);
+			kfree(next);
+			next = list_entry(run->list.next, struct ljx_free_run, list);
+		}
+		discard_run(bm, run->start, run->start + run->len);
+		list_del(&run->list);
+		kfree(run);
+	}
+}
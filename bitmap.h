@@ -0,0 +1,101 @@
+#ifndef _BITMAP_H
+#define _BITMAP_H
+
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <linux/bio.h>
+
+#include "ext3.h"
+
+#define LJX_MAX_FREE_RUNS	4096	/* pending discard runs per filesystem */
+
+/* a run of blocks the guest freed, waiting to be discarded */
+struct ljx_free_run {
+	struct list_head	list;
+	ext3_fsblk_t		start;
+	unsigned int		len;
+};
+
+/**
+ * Our view of the guest's block allocation bitmaps. For each group we keep
+ * the blocks that may be in use: what the bitmap on disk says, plus blocks
+ * the guest wrote since, whose allocation may still sit in the journal.
+ * Blocks that drop out of that set are queued for discard.
+ *
+ * Allocations the guest made before we attached may also sit only in the
+ * journal, unless it was clean then. Until the guest writes such a group's
+ * bitmap back, no read of it is served with zeroes.
+ */
+struct ljx_block_bitmap {
+	spinlock_t		lock;
+	struct block_device	*bdev;
+	struct ljx_ext3_superblock *lsb;
+	bool			discard;	/* queue discards for freed blocks */
+	bool			skip_reads;	/* serve reads of free blocks */
+	bool			clean;		/* no journal to recover at attach */
+	unsigned long		*seen;		/* groups whose bitmap we have read */
+	unsigned long		*synced;	/* groups whose bitmap the guest
+						 * wrote since attach */
+	unsigned long		*lost;		/* groups with unrecorded writes */
+	unsigned long		**in_use;	/* per group, allocated lazily */
+	unsigned long		**written;	/* per group: allocations not
+						 * yet seen in the bitmap */
+	unsigned int		nr_groups;	/* groups with bitmaps allocated */
+	struct list_head	pending;
+	unsigned int		nr_pending;
+	/* blocks currently being discarded; writes to them must wait */
+	ext3_fsblk_t		busy_start;
+	ext3_fsblk_t		busy_end;
+	wait_queue_head_t	wq;
+	struct delayed_work	work;
+	/* statistics */
+	u64			discarded_sect;
+	u64			reused_blocks;	/* reallocated before discard */
+	u64			dropped_blocks;	/* pending queue overflowed */
+	u64			skipped_bytes;	/* reads served without the device */
+};
+
+extern int ljx_bitmap_init(void);
+extern void ljx_bitmap_exit(void);
+
+/**
+ * Allocates the bitmap tracker for a filesystem. Returns NULL if neither
+ * discard synthesis nor free read skipping is enabled.
+ */
+extern struct ljx_block_bitmap *ljx_bitmap_alloc(struct xen_vbd *,
+		struct ljx_ext3_superblock *);
+extern void ljx_bitmap_free(struct ljx_block_bitmap *);
+
+/**
+ * Stops queueing discards and waits for any being issued. Must be called
+ * before the vbd lets go of its device.
+ */
+extern void ljx_bitmap_stop(struct ljx_block_bitmap *);
+
+/**
+ * Takes in the on-disk contents of a group's block bitmap. If write is set,
+ * blocks that became free are queued for discard.
+ */
+extern int ljx_bitmap_update(struct ljx_block_bitmap *, unsigned int group,
+		const void *bits, int write);
+
+/**
+ * Marks blocks as in use because the guest is writing them. Waits for any
+ * overlapping discard to finish, so must be called from process context
+ * before the write is submitted.
+ */
+extern void ljx_bitmap_note_write(struct ljx_block_bitmap *, ext3_fsblk_t block,
+		unsigned int nr_blocks);
+
+/**
+ * Completes a guest read with zeroes if every block it covers is free in the
+ * guest filesystem. vec describes where the data should go. Returns 0 if the
+ * read was served, 1 otherwise.
+ */
+extern int ljx_bitmap_zero_read(struct ljx_block_bitmap *, ext3_fsblk_t block,
+		unsigned int nr_blocks, struct bio_vec *vec, int nvec);
+
+#endif
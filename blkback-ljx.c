@@ -51,7 +51,20 @@
 #include <asm/xen/hypercall.h>
 #include "common.h"
 #include "label.h"
+#include "label_io.h"
+#include "events.h"
+#include "heat.h"
+#include "hot_files.h"
+
+#define CREATE_TRACE_POINTS
+#include "trace.h"
 #include "ljx.h"
+#include "inode_map.h"
+#include "readahead.h"
+#include "bitmap.h"
+#include "journal.h"
+#include "scan.h"
+#include "persist.h"
 
 /*
  * These are rather arbitrary. They are fairly large because adjacent requests
@@ -80,11 +93,21 @@ module_param(log_stats, int, 0644);
 struct pending_req {
 	struct xen_blkif	*blkif;
 	u64			id;
+	sector_t		sector;
 	int			nr_pages;
 	atomic_t		pendcnt;
 	unsigned short		operation;
 	int			status;
 	struct list_head	free_list;
+	/* where each bio started; completion advances bi_sector/bi_size */
+	int			nr_bios;
+	struct bio		*bios[BLKIF_MAX_SEGMENTS_PER_REQUEST];
+	sector_t		bio_sector[BLKIF_MAX_SEGMENTS_PER_REQUEST];
+	unsigned int		bio_size[BLKIF_MAX_SEGMENTS_PER_REQUEST];
+	/* when it was taken off the ring, mapped and submitted */
+	ktime_t			consumed;
+	ktime_t			mapped;
+	ktime_t			submitted;
 };
 
 #define BLKBACK_INVALID_HANDLE (~0)
@@ -263,24 +286,36 @@ irqreturn_t xen_blkif_be_int(int irq, void *dev_id)
  * SCHEDULER FUNCTIONS
  */
 
+/* what a counter has done since the last print, which then becomes the base */
+static unsigned long long stat_delta(struct xen_blkif *blkif,
+				     enum ljx_stat stat)
+{
+	u64 now = ljx_stat_read(blkif->stats, stat);
+	u64 delta = now - blkif->st_logged[stat];
+
+	blkif->st_logged[stat] = now;
+	return delta;
+}
+
 static void print_stats(struct xen_blkif *blkif)
 {
-	pr_info("xen-blkback (%s): oo %3d  |  rd %4d  |  wr %4d  |  f %4d"
-		 "  |  ds %4d\n",
-		 current->comm, blkif->st_oo_req,
-		 blkif->st_rd_req, blkif->st_wr_req,
-		 blkif->st_f_req, blkif->st_ds_req);
+	unsigned long long oo, rd, wr, f, ds;
+
+	oo = stat_delta(blkif, LJX_ST_OO_REQ);
+	rd = stat_delta(blkif, LJX_ST_RD_REQ);
+	wr = stat_delta(blkif, LJX_ST_WR_REQ);
+	f = stat_delta(blkif, LJX_ST_F_REQ);
+	ds = stat_delta(blkif, LJX_ST_DS_REQ);
+	pr_info("xen-blkback (%s): oo %3llu  |  rd %4llu  |  wr %4llu  |  f %4llu"
+		 "  |  ds %4llu\n", current->comm, oo, rd, wr, f, ds);
 	blkif->st_print = jiffies + msecs_to_jiffies(10 * 1000);
-	blkif->st_rd_req = 0;
-	blkif->st_wr_req = 0;
-	blkif->st_oo_req = 0;
-	blkif->st_ds_req = 0;
 }
 
 int xen_blkif_schedule(void *arg)
 {
 	struct xen_blkif *blkif = arg;
 	struct xen_vbd *vbd = &blkif->vbd;
+	ktime_t start;
 
 	xen_blkif_get(blkif);
 
@@ -301,8 +336,11 @@ int xen_blkif_schedule(void *arg)
 		blkif->waiting_reqs = 0;
 		smp_mb(); /* clear flag *before* checking for work */
 
+		start = ktime_get();
 		if (do_block_io_op(blkif))
 			blkif->waiting_reqs = 1;
+		ljx_sample_load(&vbd->sample,
+				ktime_to_ns(ktime_sub(ktime_get(), start)));
 
 		if (log_stats && time_after(jiffies, blkif->st_print))
 			print_stats(blkif);
@@ -332,6 +370,8 @@ static void xen_blkbk_unmap(struct pending_req *req)
 	grant_handle_t handle;
 	int ret;
 
+	trace_ljx_grant_unmap(req->blkif, req->sector, req->nr_pages,
+			      req->operation);
 	for (i = 0; i < req->nr_pages; i++) {
 		handle = pending_handle(req, i);
 		if (handle == BLKBACK_INVALID_HANDLE)
@@ -353,8 +393,8 @@ static void xen_blkbk_unmap(struct pending_req *req)
 		ret = m2p_remove_override(
 			virt_to_page(unmap[i].host_addr), false);
 		if (ret) {
-			pr_alert(DRV_PFX "Failed to remove M2P override for %lx\n",
-				 (unsigned long)unmap[i].host_addr);
+			LJX_ERR(LJX_LOG_GRANT, "Failed to remove M2P override for %lx",
+				(unsigned long)unmap[i].host_addr);
 			continue;
 		}
 	}
@@ -395,7 +435,7 @@ static int xen_blkbk_map(struct blkif_request *req,
 	 */
 	for (i = 0; i < nseg; i++) {
 		if (unlikely(map[i].status != 0)) {
-			pr_debug(DRV_PFX "invalid buffer -- could not remap it\n");
+			LJX_ERR(LJX_LOG_GRANT, "invalid buffer -- could not remap it");
 			map[i].handle = BLKBACK_INVALID_HANDLE;
 			ret |= 1;
 		}
@@ -408,8 +448,8 @@ static int xen_blkbk_map(struct blkif_request *req,
 		ret = m2p_add_override(PFN_DOWN(map[i].dev_bus_addr),
 			blkbk->pending_page(pending_req, i), NULL);
 		if (ret) {
-			pr_alert(DRV_PFX "Failed to install M2P override for %lx (ret: %d)\n",
-				 (unsigned long)map[i].dev_bus_addr, ret);
+			LJX_ERR(LJX_LOG_GRANT, "Failed to install M2P override for %lx (ret: %d)",
+				(unsigned long)map[i].dev_bus_addr, ret);
 			/* We could switch over to GNTTABOP_copy */
 			continue;
 		}
@@ -427,7 +467,12 @@ static int dispatch_discard_io(struct xen_blkif *blkif,
 	int status = BLKIF_RSP_OKAY;
 	struct block_device *bdev = blkif->vbd.bdev;
 
-	blkif->st_ds_req++;
+	ljx_stat_inc(blkif->stats, LJX_ST_DS_REQ);
+	ljx_stat_add(blkif->stats, LJX_ST_DS_SECT, req->u.discard.nr_sectors);
+
+	if (blkif->vbd.ra)
+		ljx_ra_invalidate(blkif->vbd.ra, req->u.discard.sector_number,
+				  req->u.discard.nr_sectors);
 
 	xen_blkif_get(blkif);
 	if (blkif->blk_backend_type == BLKIF_BACKEND_PHY ||
@@ -443,12 +488,14 @@ static int dispatch_discard_io(struct xen_blkif *blkif,
 		err = -EOPNOTSUPP;
 
 	if (err == -EOPNOTSUPP) {
-		pr_debug(DRV_PFX "discard op failed, not supported\n");
+		LJX_DEBUG(LJX_LOG_RING, "discard op failed, not supported");
 		status = BLKIF_RSP_EOPNOTSUPP;
 	} else if (err)
 		status = BLKIF_RSP_ERROR;
 
 	make_response(blkif, req->u.discard.id, req->operation, status);
+	trace_ljx_response(blkif, req->u.discard.sector_number, 0,
+			   req->operation, status);
 	xen_blkif_put(blkif);
 	return err;
 }
@@ -474,22 +521,23 @@ static void xen_blk_drain_io(struct xen_blkif *blkif)
  * Completion callback on the bio's. Called as bh->b_end_io()
  */
 
-static void __end_block_io_op(struct pending_req *pending_req, int error)
+static void __end_block_io_op(struct pending_req *pending_req, int error,
+			      ktime_t done)
 {
 	/* An error fails the entire request. */
 	if ((pending_req->operation == BLKIF_OP_FLUSH_DISKCACHE) &&
 	    (error == -EOPNOTSUPP)) {
-		pr_debug(DRV_PFX "flush diskcache op failed, not supported\n");
+		LJX_DEBUG(LJX_LOG_RING, "flush diskcache op failed, not supported");
 		xen_blkbk_flush_diskcache(XBT_NIL, pending_req->blkif->be, 0);
 		pending_req->status = BLKIF_RSP_EOPNOTSUPP;
 	} else if ((pending_req->operation == BLKIF_OP_WRITE_BARRIER) &&
 		    (error == -EOPNOTSUPP)) {
-		pr_debug(DRV_PFX "write barrier op failed, not supported\n");
+		LJX_DEBUG(LJX_LOG_RING, "write barrier op failed, not supported");
 		xen_blkbk_barrier(XBT_NIL, pending_req->blkif->be, 0);
 		pending_req->status = BLKIF_RSP_EOPNOTSUPP;
 	} else if (error) {
-		pr_debug(DRV_PFX "Buffer not up-to-date at end of operation,"
-			 " error=%d\n", error);
+		LJX_INFO(LJX_LOG_RING, "Buffer not up-to-date at end of operation,"
+			 " error=%d", error);
 		pending_req->status = BLKIF_RSP_ERROR;
 	}
 
@@ -502,6 +550,11 @@ static void __end_block_io_op(struct pending_req *pending_req, int error)
 		xen_blkbk_unmap(pending_req);
 		make_response(pending_req->blkif, pending_req->id,
 			      pending_req->operation, pending_req->status);
+		trace_ljx_response(pending_req->blkif, pending_req->sector,
+				   pending_req->nr_pages, pending_req->operation,
+				   pending_req->status);
+		ljx_lat_since(pending_req->blkif->vbd.lat, LJX_LAT_RESPONSE,
+			      done);
 		xen_blkif_put(pending_req->blkif);
 		if (atomic_read(&pending_req->blkif->refcnt) <= 2) {
 			if (atomic_read(&pending_req->blkif->drain))
@@ -555,98 +608,215 @@ static bool try_ascii(struct bio *bio, char *ascii) {
 }
 */
 
-/**
- * Tries to parse some data as if it were an ext3 superblock.
- * @bio: the block io
- * @data: pointer to the data that was read/written in bio
+/*
+ * Finds the file data the bio moved. Data is known by the inode map, not
+ * labelled, so only a bio with unlabelled sectors can have any; those the
+ * map knows count as DATA from here on. They are charged to the guest files
+ * that own them if there is a hot file report.
  */
-static int parse_ext3_superblock(struct xen_vbd *vbd, char *data) {
-	/* note: for now we just assume that the whole superblock is within the first
-	 * page of the bio_vec -- should fix this later */
-	struct ext3_super_block *ext3_sb;
-	//struct list_head *label_list = &vbd->label_list;
-	struct ljx_ext3_superblock **superblock = &vbd->superblock;
-	int ret;
-
-	ext3_sb = (struct ext3_super_block *) data;
-	ret = ljx_ext3_fill_super(vbd, ext3_sb, 0);
-	if (ret)
-		return ret;
-	printk(KERN_INFO "\tinodes_count: %d", (int) (*superblock)->inodes_count);
-	printk(KERN_INFO "\tblocks_count: %d", (int) (*superblock)->blocks_count);
-	printk(KERN_INFO "\tinode_size: %d", (int) (*superblock)->inode_size);
+static void account_file_io(struct bio *bio, struct xen_vbd *vbd,
+		unsigned int *nr_sec, unsigned int weight) {
+	unsigned int fs_sec = bio_sectors(bio), data;
+	struct ljx_ext3_superblock *lsb;
 
-	/* insert labels for group descriptors */
-
-	return 0;
+	if (! nr_sec[UNLABELED])
+		return;
+	lsb = ljx_partition_fs(vbd, bio->bi_sector, &fs_sec);
+	if (! lsb || ! fs_sec)
+		return;
+	/* a sampled bio is charged for the ones skipped around it */
+	data = ljx_hot_files_account(vbd->hot, lsb, bio->bi_sector, fs_sec,
+			weight, bio->bi_rw & REQ_WRITE);
+	data = min(data, nr_sec[UNLABELED]);
+	nr_sec[UNLABELED] -= data;
+	nr_sec[DATA] += data;
 }
 
 /*
-static int parse_boot_block(struct bio *bio, char *data) {
-	// TODO 
-	return 0;
+ * Counts the bio under the label types it covers.
+ */
+static void account_label_io(struct bio *bio, struct xen_vbd *vbd,
+		const unsigned int *nr_sec, unsigned int weight, u64 device_ns) {
+	u32 types = bio->bi_rw & REQ_WRITE ? LJX_EV_BIO_WRITE : 0;
+	int type;
+
+	if (vbd->label_io)
+		ljx_label_io_add(vbd->label_io, bio->bi_rw & REQ_WRITE, nr_sec,
+				weight, device_ns);
+	if (!ljx_events_enabled)
+		return;
+	for (type = 0; type < LJX_LABEL_TYPES; type++)
+		if (nr_sec[type])
+			types |= LJX_EV_BIO_TYPE(type);
+	ljx_event(LJX_EV_BIO, vbd->pdevice, bio->bi_sector, bio_sectors(bio),
+			types);
+}
+
+/* how much of a bio fell under labels of metadata */
+static unsigned int metadata_sectors(const unsigned int *nr_sec) {
+	unsigned int type, n = 0;
+
+	for (type = 0; type < DATA; type++)
+		n += nr_sec[type];
+	return n;
 }
-*/
 
 /*
  * reflect on the bio, printk-ing some stuff about it
  */
-static void reflect_on_bio(struct bio *bio) {
+static void reflect_on_bio(struct bio *bio, u64 device_ns) {
 	struct pending_req *preq = bio->bi_private;
-	struct label *label;
-	unsigned int sectors = bio_sectors(bio), num;
-	char *buf;
+	struct xen_vbd *vbd = &preq->blkif->vbd;
+	unsigned int sectors = bio_sectors(bio);
+	unsigned int nr_sec[LJX_LABEL_TYPES];
+	unsigned int weight;
+
+	if (bio->bi_io_vec) {
+		/* stale readahead must go whether we look at the bio or not */
+		if ((bio->bi_rw & REQ_WRITE) && vbd->ra)
+			ljx_ra_invalidate(vbd->ra, bio->bi_sector, sectors);
+		/* and metadata, read or written, is always followed */
+		if (ljx_process_labels(bio, vbd, nr_sec) &&
+		    metadata_sectors(nr_sec)) {
+			ljx_sample_metadata(&vbd->sample);
+			account_file_io(bio, vbd, nr_sec, 1);
+			account_label_io(bio, vbd, nr_sec, 1, device_ns);
+			return;
+		}
+	}
+	weight = ljx_sample_bio(&vbd->sample);
+	if (! weight)
+		return;
 
-	printk(KERN_INFO "bio:");
 	if (! bio->bi_io_vec)
-		printk(KERN_INFO "\tbio_vec null");
+		LJX_DEBUG(LJX_LOG_RING, "bio: bio_vec null");
 	else {
-		if (bio->bi_rw & REQ_WRITE)
-			printk(KERN_INFO "\ttype: write");
-		else
-			printk(KERN_INFO "\ttype: read");
-
-		printk(KERN_INFO "\tbi_sector: %llu - %llu", 
-				(long long) bio->bi_sector, 
-				(long long) bio->bi_sector + sectors - 1);
-		printk(KERN_INFO "\txen_blkif->domid: %d", (int) preq->blkif->domid);
-		printk(KERN_INFO "\tblock device: %d", (int) preq->blkif->vbd.handle);
-
-		/* try to parse the block */
-		buf = kzalloc(sizeof(char) * 1024, GFP_KERNEL);
-		if (!preq->blkif->vbd.superblock && !valid_ext3_superblock(bio, buf)) {
-			JPRINTK("parsing superblock");
-			if (parse_ext3_superblock(
-				&preq->blkif->vbd,
-				buf))
-				JPRINTK("parse_ext3_superblock returned error");
-			else
-				superblock_label(&preq->blkif->vbd);
-		}
-		if ((num = find_labels(
-				bio->bi_sector,
-				bio_sectors(bio),
-				&label,
-				&preq->blkif->vbd.label_list))) {
-			label->processor(bio, &preq->blkif->vbd, label);
-		}
-		kfree(buf);
+		LJX_DEBUG(LJX_LOG_RING, "bio: %s of %llu - %llu, domid %d, device %d",
+				bio->bi_rw & REQ_WRITE ? "write" : "read",
+				(unsigned long long) bio->bi_sector,
+				(unsigned long long) bio->bi_sector + sectors - 1,
+				(int) preq->blkif->domid, (int) vbd->handle);
+
+		account_file_io(bio, vbd, nr_sec, weight);
+		account_label_io(bio, vbd, nr_sec, weight, device_ns);
 		/* soon there will be more tests here */
 	}
 }
 
+/*
+ * Tells the filesystem trackers about a guest write before it is submitted:
+ * the journal starts timing a commit, and the bitmap tracker makes sure the
+ * blocks are not discarded under it.
+ */
+static void note_fs_write(struct xen_vbd *vbd, sector_t sector,
+			  unsigned int nr_sec)
+{
+	struct ljx_ext3_superblock *lsb;
+	ext3_fsblk_t first, last;
+
+	lsb = ljx_partition_fs(vbd, sector, &nr_sec);
+	if (!lsb || !nr_sec)
+		return;
+	if (lsb->journal)
+		ljx_journal_note_write(lsb->journal, sector, nr_sec);
+	if (!lsb->block_bitmap)
+		return;
+	first = ljx_sector_to_block(lsb, sector);
+	last = ljx_sector_to_block(lsb, sector + nr_sec - 1);
+	ljx_bitmap_note_write(lsb->block_bitmap, first, last - first + 1);
+}
+
+/*
+ * Completes a read with zeroes if the guest filesystem has nothing in the
+ * blocks it covers. Returns 0 if the read was served.
+ */
+static int serve_free_read(struct xen_vbd *vbd, sector_t sector,
+			   unsigned int nr_sec, struct bio_vec *vec, int nvec)
+{
+	struct ljx_ext3_superblock *lsb;
+	unsigned int nr = nr_sec;
+	ext3_fsblk_t first, last;
+
+	/* a read running past the partition is left to the device */
+	lsb = ljx_partition_fs(vbd, sector, &nr);
+	if (!lsb || !lsb->block_bitmap || !nr_sec || nr != nr_sec)
+		return 1;
+	first = ljx_sector_to_block(lsb, sector);
+	last = ljx_sector_to_block(lsb, sector + nr_sec - 1);
+	return ljx_bitmap_zero_read(lsb->block_bitmap, first, last - first + 1,
+				    vec, nvec);
+}
+
+/*
+ * Puts back the sector and size a bio was submitted with, which the block
+ * layer has advanced (and partition-remapped) by the time it completes.
+ */
+static void restore_bio(struct bio *bio)
+{
+	struct pending_req *preq = bio->bi_private;
+	int i;
+
+	for (i = 0; i < preq->nr_bios; i++) {
+		if (preq->bios[i] != bio)
+			continue;
+		bio->bi_sector = preq->bio_sector[i];
+		bio->bi_size = preq->bio_size[i];
+		bio->bi_idx = 0;
+		return;
+	}
+}
+
 /*
  * bio callback.
  */
 static void end_block_io_op(struct bio *bio, int error)
 {
-	reflect_on_bio(bio);
-	__end_block_io_op(bio->bi_private, error);
+	struct pending_req *preq = bio->bi_private;
+	struct ljx_lat __percpu *lat = preq->blkif->vbd.lat;
+	ktime_t done;
+
+	done = ljx_lat_since(lat, LJX_LAT_DEVICE, preq->submitted);
+	restore_bio(bio);
+	if (preq->blkif->vbd.heat && bio_sectors(bio))
+		ljx_heat_add(preq->blkif->vbd.heat, bio->bi_sector,
+			     bio_sectors(bio));
+	trace_ljx_bio_complete(preq->blkif, bio->bi_sector, bio->bi_vcnt,
+			       preq->operation, error);
+	trace_ljx_introspect_start(preq->blkif, bio->bi_sector, bio->bi_vcnt,
+				   preq->operation);
+	reflect_on_bio(bio, ktime_to_ns(ktime_sub(done, preq->submitted)));
+	trace_ljx_introspect_end(preq->blkif, bio->bi_sector, bio->bi_vcnt,
+				 preq->operation);
+	ljx_lat_since(lat, LJX_LAT_INTROSPECT, done);
+	__end_block_io_op(preq, error, done);
 	bio_put(bio);
 }
 
 
 
+/*
+ * Is this a plain write into the guest's journal? Flushes and barriers are
+ * commit boundaries and don't count.
+ */
+static bool journal_write(struct xen_blkif *blkif, struct blkif_request *req)
+{
+	struct ljx_ext3_superblock *lsb;
+	unsigned int i, nr_sec = 0;
+
+	if (req->operation != BLKIF_OP_WRITE)
+		return false;
+	lsb = ljx_partition_fs(&blkif->vbd, req->u.rw.sector_number, NULL);
+	if (!lsb || !lsb->journal)
+		return false;
+	if (req->u.rw.nr_segments > BLKIF_MAX_SEGMENTS_PER_REQUEST)
+		return false;
+	for (i = 0; i < req->u.rw.nr_segments; i++)
+		nr_sec += req->u.rw.seg[i].last_sect -
+			req->u.rw.seg[i].first_sect + 1;
+	return ljx_journal_contains(lsb->journal, req->u.rw.sector_number,
+				    nr_sec);
+}
+
 /*
  * Function to copy the from the ring buffer the 'struct blkif_request'
  * (which has the sectors we want, number of them, grant references, etc),
@@ -660,10 +830,13 @@ __do_block_io_op(struct xen_blkif *blkif)
 	struct pending_req *pending_req;
 	RING_IDX rc, rp;
 	int more_to_do = 0;
+	struct blk_plug plug;
+	bool plugged = false;
 
 	rc = blk_rings->common.req_cons;
 	rp = blk_rings->common.sring->req_prod;
 	rmb(); /* Ensure we see queued requests up to 'rp'. */
+	ljx_sample_ring(&blkif->vbd.sample, rp - rc, RING_SIZE(&blk_rings->common));
 
 	while (rc != rp) {
 
@@ -677,7 +850,7 @@ __do_block_io_op(struct xen_blkif *blkif)
 
 		pending_req = alloc_req();
 		if (NULL == pending_req) {
-			blkif->st_oo_req++;
+			ljx_stat_inc(blkif->stats, LJX_ST_OO_REQ);
 			more_to_do = 1;
 			break;
 		}
@@ -696,9 +869,36 @@ __do_block_io_op(struct xen_blkif *blkif)
 			BUG();
 		}
 		blk_rings->common.req_cons = ++rc; /* before make_response() */
+		pending_req->consumed = ktime_get();
+		if (req.operation == BLKIF_OP_DISCARD)
+			trace_ljx_ring_consume(blkif, req.u.discard.sector_number,
+					       0, req.operation);
+		else
+			trace_ljx_ring_consume(blkif, req.u.rw.sector_number,
+					       req.u.rw.nr_segments,
+					       req.operation);
 
 		/* Apply all sanity checks to /private copy/ of request. */
 		barrier();
+
+		/*
+		 * Keep one plug open across a run of journal writes so the
+		 * block layer can merge the log into large sequential
+		 * requests. It is released before anything else, in particular
+		 * before the flush that carries the commit block.
+		 */
+		if (journal_write(blkif, &req)) {
+			if (!plugged) {
+				blk_start_plug(&plug);
+				plugged = true;
+				ljx_stat_inc(blkif->stats, LJX_ST_JNL_BATCH);
+			}
+			ljx_stat_inc(blkif->stats, LJX_ST_JNL_REQ);
+		} else if (plugged) {
+			blk_finish_plug(&plug);
+			plugged = false;
+		}
+
 		if (unlikely(req.operation == BLKIF_OP_DISCARD)) {
 			free_req(pending_req);
 			if (dispatch_discard_io(blkif, &req))
@@ -710,6 +910,9 @@ __do_block_io_op(struct xen_blkif *blkif)
 		cond_resched();
 	}
 
+	if (plugged)
+		blk_finish_plug(&plug);
+
 	return more_to_do;
 }
 
@@ -733,6 +936,23 @@ do_block_io_op(struct xen_blkif *blkif)
  * Transmutation of the 'struct blkif_request' to a proper 'struct bio'
  * and call the 'submit_bio' to pass it to the underlying storage.
  */
+/* counts the data of a read or write request, flushes included */
+static void count_sectors(struct xen_blkif *blkif, int operation,
+			  unsigned int nr_sects)
+{
+	enum ljx_stat sect = LJX_ST_WR_SECT, bytes = LJX_ST_WR_BYTES;
+
+	if (operation == READ) {
+		sect = LJX_ST_RD_SECT;
+		bytes = LJX_ST_RD_BYTES;
+	} else if (!(operation & WRITE))
+		return;
+	ljx_stat_add(blkif->stats, sect, nr_sects);
+	ljx_stat_add(blkif->stats, bytes, (u64)nr_sects << 9);
+	if (operation == WRITE_FLUSH)
+		ljx_stat_add(blkif->stats, LJX_ST_F_SECT, nr_sects);
+}
+
 static int dispatch_rw_block_io(struct xen_blkif *blkif,
 				struct blkif_request *req,
 				struct pending_req *pending_req)
@@ -745,22 +965,25 @@ static int dispatch_rw_block_io(struct xen_blkif *blkif,
 	int i, nbio = 0;
 	int operation;
 	struct blk_plug plug;
+	struct bio_vec vec[BLKIF_MAX_SEGMENTS_PER_REQUEST];
+	struct ljx_readahead *ra = blkif->vbd.ra;
+	sector_t start_sector;
 	bool drain = false;
 
 	switch (req->operation) {
 	case BLKIF_OP_READ:
-		blkif->st_rd_req++;
+		ljx_stat_inc(blkif->stats, LJX_ST_RD_REQ);
 		operation = READ;
 		break;
 	case BLKIF_OP_WRITE:
-		blkif->st_wr_req++;
+		ljx_stat_inc(blkif->stats, LJX_ST_WR_REQ);
 		operation = WRITE_ODIRECT;
 		break;
 	case BLKIF_OP_WRITE_BARRIER:
 		drain = true;
 		// no break
 	case BLKIF_OP_FLUSH_DISKCACHE:
-		blkif->st_f_req++;
+		ljx_stat_inc(blkif->stats, LJX_ST_F_REQ);
 		operation = WRITE_FLUSH;
 		break;
 	default:
@@ -774,7 +997,7 @@ static int dispatch_rw_block_io(struct xen_blkif *blkif,
 
 	if (unlikely(nseg == 0 && operation != WRITE_FLUSH) ||
 	    unlikely(nseg > BLKIF_MAX_SEGMENTS_PER_REQUEST)) {
-		pr_debug(DRV_PFX "Bad number of segments in request (%d)\n",
+		LJX_INFO(LJX_LOG_RING, "Bad number of segments in request (%d)",
 			 nseg);
 		/* Haven't submitted any bio's yet. */
 		goto fail_response;
@@ -786,6 +1009,7 @@ static int dispatch_rw_block_io(struct xen_blkif *blkif,
 
 	pending_req->blkif     = blkif;
 	pending_req->id        = req->u.rw.id;
+	pending_req->sector    = req->u.rw.sector_number;
 	pending_req->operation = req->operation;
 	pending_req->status    = BLKIF_RSP_OKAY;
 	pending_req->nr_pages  = nseg;
@@ -801,7 +1025,7 @@ static int dispatch_rw_block_io(struct xen_blkif *blkif,
 	}
 
 	if (xen_vbd_translate(&preq, blkif, operation) != 0) {
-		pr_debug(DRV_PFX "access denied: %s of [%llu,%llu] on dev=%04x\n",
+		LJX_INFO(LJX_LOG_RING, "access denied: %s of [%llu,%llu] on dev=%04x",
 			 operation == READ ? "read" : "write",
 			 preq.sector_number,
 			 preq.sector_number + preq.nr_sects, preq.dev);
@@ -815,11 +1039,12 @@ static int dispatch_rw_block_io(struct xen_blkif *blkif,
 	for (i = 0; i < nseg; i++) {
 		if (((int)preq.sector_number|(int)seg[i].nsec) &
 		    ((bdev_logical_block_size(preq.bdev) >> 9) - 1)) {
-			pr_debug(DRV_PFX "Misaligned I/O request from domain %d",
+			LJX_INFO(LJX_LOG_RING, "Misaligned I/O request from domain %d",
 				 blkif->domid);
 			goto fail_response;
 		}
 	}
+	start_sector = preq.sector_number;
 
 	/* Wait on all outstanding I/O's and once that has been completed
 	 * issue the WRITE_FLUSH.
@@ -835,6 +1060,39 @@ static int dispatch_rw_block_io(struct xen_blkif *blkif,
 	 */
 	if (xen_blkbk_map(req, pending_req, seg))
 		goto fail_flush;
+	pending_req->mapped = ljx_lat_since(blkif->vbd.lat, LJX_LAT_MAP,
+					    pending_req->consumed);
+	trace_ljx_grant_map(blkif, start_sector, nseg, req->operation);
+
+	/*
+	 * Serve reads of free blocks, and reads that file readahead has
+	 * already fetched, without going to the device.
+	 */
+	if (operation == READ) {
+		for (i = 0; i < nseg; i++) {
+			vec[i].bv_page   = blkbk->pending_page(pending_req, i);
+			vec[i].bv_offset = seg[i].buf & ~PAGE_MASK;
+			vec[i].bv_len    = seg[i].nsec << 9;
+		}
+		if (!serve_free_read(&blkif->vbd, start_sector, preq.nr_sects,
+				     vec, nseg) ||
+		    (ra && !ljx_ra_read(ra, start_sector, vec, nseg))) {
+			xen_blkbk_unmap(pending_req);
+			make_response(blkif, req->u.rw.id, req->operation,
+				      BLKIF_RSP_OKAY);
+			trace_ljx_response(blkif, start_sector, nseg,
+					   req->operation, BLKIF_RSP_OKAY);
+			free_req(pending_req);
+			count_sectors(blkif, operation, preq.nr_sects);
+			if (ra)
+				ljx_ra_note_read(ra, start_sector, preq.nr_sects);
+			return 0;
+		}
+	}
+	if (ra && (operation & WRITE) && preq.nr_sects)
+		ljx_ra_invalidate(ra, start_sector, preq.nr_sects);
+	if ((operation & WRITE) && preq.nr_sects)
+		note_fs_write(&blkif->vbd, start_sector, preq.nr_sects);
 
 	/*
 	 * This corresponding xen_blkif_put is done in __end_block_io_op, or
@@ -883,19 +1141,33 @@ static int dispatch_rw_block_io(struct xen_blkif *blkif,
 	 */
 	atomic_set(&pending_req->pendcnt, nbio);
 
+	pending_req->nr_bios = nbio;
+	for (i = 0; i < nbio; i++) {
+		pending_req->bios[i]       = biolist[i];
+		pending_req->bio_sector[i] = biolist[i]->bi_sector;
+		pending_req->bio_size[i]   = biolist[i]->bi_size;
+	}
+
+	pending_req->submitted = ljx_lat_since(blkif->vbd.lat, LJX_LAT_SUBMIT,
+					       pending_req->mapped);
+
 	/* Get a reference count for the disk queue and start sending I/O */
 	blk_start_plug(&plug);
 
-	for (i = 0; i < nbio; i++)
+	for (i = 0; i < nbio; i++) {
+		trace_ljx_bio_submit(blkif, biolist[i]->bi_sector,
+				     biolist[i]->bi_vcnt, req->operation);
 		submit_bio(operation, biolist[i]);
+	}
 
 	/* Let the I/Os go.. */
 	blk_finish_plug(&plug);
 
-	if (operation == READ)
-		blkif->st_rd_sect += preq.nr_sects;
-	else if (operation & WRITE)
-		blkif->st_wr_sect += preq.nr_sects;
+	/* Follow up on the guest's read with readahead of the same file. */
+	if (ra && operation == READ)
+		ljx_ra_note_read(ra, start_sector, preq.nr_sects);
+
+	count_sectors(blkif, operation, preq.nr_sects);
 
 	return 0;
 
@@ -904,14 +1176,18 @@ static int dispatch_rw_block_io(struct xen_blkif *blkif,
  fail_response:
 	/* Haven't submitted any bio's yet. */
 	make_response(blkif, req->u.rw.id, req->operation, BLKIF_RSP_ERROR);
+	trace_ljx_response(blkif, req->u.rw.sector_number,
+			   req->u.rw.nr_segments, req->operation,
+			   BLKIF_RSP_ERROR);
 	free_req(pending_req);
 	msleep(1); /* back off a bit */
 	return -EIO;
 
  fail_put_bio:
+	ljx_stat_inc(blkif->stats, LJX_ST_OO_BIO);
 	for (i = 0; i < nbio; i++)
 		bio_put(biolist[i]);
-	__end_block_io_op(pending_req, -EINVAL);
+	__end_block_io_op(pending_req, -EINVAL, ktime_get());
 	msleep(1); /* back off a bit */
 	return -EIO;
 }
@@ -932,6 +1208,8 @@ static void make_response(struct xen_blkif *blkif, u64 id,
 	resp.id        = id;
 	resp.operation = op;
 	resp.status    = st;
+	if (st != BLKIF_RSP_OKAY)
+		ljx_stat_inc(blkif->stats, LJX_ST_ERRORS);
 
 	spin_lock_irqsave(&blkif->blk_ring_lock, flags);
 	/* Place on the response ring for the relevant domain. */
@@ -1009,14 +1287,28 @@ static int __init xen_blkif_init(void)
 		list_add_tail(&blkbk->pending_reqs[i].free_list,
 			      &blkbk->pending_free);
 
+	/* before registering: vbds that already exist connect straight away */
+	if (ljx_init())
+		pr_warn(DRV_PFX "no memory for event rings, /proc/ljx disabled\n");
+	if (ljx_bitmap_init())
+		pr_warn(DRV_PFX "no discard workqueue, discard synthesis disabled\n");
+	if (ljx_scan_init())
+		pr_warn(DRV_PFX "no scan workqueue, metadata is learned lazily\n");
+	if (ljx_persist_init())
+		pr_warn(DRV_PFX "no persist workqueue, label maps are not saved\n");
+
 	rc = xen_blkif_xenbus_init();
 	if (rc)
-		goto failed_init;
-
-	//ljx_init();
+		goto failed_xenbus;
 
 	return 0;
 
+ failed_xenbus:
+	ljx_persist_exit();
+	ljx_scan_exit();
+	ljx_bitmap_exit();
+	ljx_exit();
+	goto failed_init;
  out_of_memory:
 	pr_alert(DRV_PFX "%s: out of memory\n", __func__);
  failed_init:
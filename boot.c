@@ -1,35 +1,395 @@
+#include <linux/slab.h>
+#include <linux/crc32.h>
+
 #include "boot.h"
+#include "label.h"
 #include "bio_fixup.h"
 #include "util.h"
 
+static int process_boot_block(struct bio *, struct xen_vbd *, struct label *);
+
+extern struct ljx_bootblock *ljx_bootblock_alloc(void) {
+	struct ljx_bootblock *bb;
+
+	bb = kzalloc(sizeof(struct ljx_bootblock), GFP_KERNEL);
+	if (! bb)
+		return NULL;
+	spin_lock_init(&bb->lock);
+	return bb;
+}
+
+extern void ljx_bootblock_free(struct ljx_bootblock *bb) {
+	unsigned int i;
+
+	if (! bb)
+		return;
+	for (i = 0; i < bb->nr_parts; i++)
+		ljx_ext3_free_super(bb->partition[i].superblock);
+	kfree(bb->gpt);
+	kfree(bb);
+}
+
+/* labels a sector holding a partition table, the MBR or an EBR */
+static int boot_label(struct xen_vbd *vbd, sector_t sector) {
+	return ljx_insert_label(vbd->labels, sector, 1, BOOTBLOCK, &process_boot_block);
+}
+
+/* labels where the superblock of a filesystem starting at sector would be */
+static int superblock_label(struct xen_vbd *vbd, sector_t sector) {
+	return ljx_insert_label(vbd->labels, sector + LJX_SB_OFFSET,
+			sizeof(struct ext3_super_block) / SECTOR_SIZE, SUPERBLOCK,
+			&ljx_ext3_probe);
+}
+
+extern int ljx_boot_label(struct xen_vbd *vbd) {
+	int ret;
+
+	if ((ret = boot_label(vbd, 0)))
+		return ret;
+	return superblock_label(vbd, 0);
+}
+
+extern struct partition_record *ljx_find_partition(struct xen_vbd *vbd, sector_t sector) {
+	struct ljx_bootblock *bb = vbd->bootblock;
+	struct partition_record *part;
+	unsigned int i, nr;
+
+	if (! bb)
+		return NULL;
+	nr = ACCESS_ONCE(bb->nr_parts);
+	smp_rmb();
+	for (i = 0; i < nr; i++) {
+		part = &bb->partition[i];
+		if (sector >= part->sector && sector - part->sector < part->size)
+			return part;
+	}
+	return NULL;
+}
+
+extern struct partition_record *ljx_add_partition(
+		struct xen_vbd *vbd,
+		sector_t sector,
+		sector_t size,
+		unsigned char type,
+		unsigned char status
+) {
+	struct ljx_bootblock *bb = vbd->bootblock;
+	struct partition_record *part;
+	unsigned long flags;
+	unsigned int i;
+
+	if (! bb || ! size || sector >= vbd->size)
+		return NULL;
+	size = min(size, vbd->size - sector);
+
+	spin_lock_irqsave(&bb->lock, flags);
+	for (i = 0; i < bb->nr_parts; i++) {
+		part = &bb->partition[i];
+		if (sector < part->sector + part->size && part->sector < sector + size)
+			goto fail;
+	}
+	if (bb->nr_parts == LJX_MAX_PARTITIONS)
+		goto fail;
+	part = &bb->partition[bb->nr_parts];
+	part->status = status;
+	part->type = type;
+	part->sector = sector;
+	part->size = size;
+	part->superblock = NULL;
+	/* lookups walk the records without the lock */
+	smp_wmb();
+	bb->nr_parts++;
+	spin_unlock_irqrestore(&bb->lock, flags);
+
+	LJX_INFO(LJX_LOG_BOOT, "partition at %llu, %llu sectors, type %s",
+			(unsigned long long) sector, (unsigned long long) size,
+			decode_partition(type));
+	if (superblock_label(vbd, sector))
+		LJX_ERR(LJX_LOG_LABEL, "no memory to label superblock at %llu",
+				(unsigned long long) sector);
+	return part;
+
+fail:
+	spin_unlock_irqrestore(&bb->lock, flags);
+	return NULL;
+}
+
+extern struct ljx_ext3_superblock *ljx_partition_fs(
+		struct xen_vbd *vbd,
+		sector_t sector,
+		unsigned int *nr_sec
+) {
+	struct partition_record *part = ljx_find_partition(vbd, sector);
+	struct ljx_ext3_superblock *lsb;
+
+	if (! part || ! (lsb = ACCESS_ONCE(part->superblock)))
+		return NULL;
+	smp_rmb();
+	if (nr_sec)
+		*nr_sec = min_t(sector_t, *nr_sec, part->sector + part->size - sector);
+	return lsb;
+}
+
 /**
- * Tests whether the block I/O included a valid boot block. If it is not valid, return 1.
- * If there is an error, return an error code. If it is valid, return 0. After calling,
- * buf will contain the boot block (or what would have been the boot block if it had been
- * valid.
+ * Tests whether the block I/O included a valid boot block at sector: the MBR,
+ * or an EBR of a logical partition. If it is not valid, return 1. If there is
+ * an error, return an error code. If it is valid, return 0. After calling,
+ * buf will contain the boot block (or what would have been the boot block if
+ * it had been valid.
  */
-extern int valid_boot_block(struct bio *bio, char *buf) {
+extern int valid_boot_block(struct bio *bio, sector_t sector, char *buf) {
 	struct bootblock *bb;
 	size_t start_offset;
 	int ret;
 
-	JPRINTK("testing boot block...");
-
-	if (! bio_contains(bio, 1, 1))
+	if (! bio_contains(bio, sector, 1))
 		return 1;
 
 	/* first byte of boot block */
-	start_offset = (1 - bio->bi_sector) * 512;
+	start_offset = (sector - bio->bi_sector) * 512;
 
 	if ((ret = copy_block(bio, buf, start_offset, sizeof(struct bootblock))))
 		return ret;
 	bb = (struct bootblock *) buf;
 
 	/* sanity check */
-	if (bb->signature == MBR_SIGNATURE) {
-		JPRINTK("valid boot block");
+	if (le16_to_cpu(bb->signature) == MBR_SIGNATURE) {
+		LJX_DEBUG(LJX_LOG_BOOT, "valid boot block");
 		return 0;
 	}
 	return 1;
 }
 
+/* the GPT header is wherever a protective MBR or a bad primary sent us */
+static int gpt_label(struct xen_vbd *vbd, sector_t sector) {
+	vbd->bootblock->gpt_header = sector;
+	return boot_label(vbd, sector);
+}
+
+static inline u32 gpt_crc(const void *buf, size_t len) {
+	return crc32_le(~0, buf, len) ^ ~0;
+}
+
+static bool protective_mbr(struct bootblock *raw) {
+	int i;
+
+	/* a hybrid MBR may list other partitions too; the GPT wins, as in Linux */
+	for (i = 0; i < 4; i++)
+		if (raw->partition[i].partition_type == gpt_protective)
+			return true;
+	return false;
+}
+
+/* checks the GPT header read from sector, and labels its partition entries */
+static int parse_gpt_header(struct xen_vbd *vbd, sector_t sector, char *buf) {
+	struct ljx_bootblock *bb = vbd->bootblock;
+	struct gpt_header *hdr = (struct gpt_header *) buf;
+	unsigned int size = le32_to_cpu(hdr->header_size);
+	u32 crc = le32_to_cpu(hdr->header_crc32);
+	unsigned int nr_entries, entry_size, nr_sectors;
+	struct ljx_gpt *gpt;
+	unsigned long flags;
+	sector_t entries;
+
+	if (bb->gpt)
+		return 0;
+	if (le64_to_cpu(hdr->signature) != GPT_SIGNATURE ||
+	    size < GPT_MIN_HEADER_SIZE || size > SECTOR_SIZE ||
+	    le64_to_cpu(hdr->my_lba) != sector)
+		goto bad;
+	hdr->header_crc32 = 0;
+	if (gpt_crc(buf, size) != crc)
+		goto bad;
+
+	nr_entries = le32_to_cpu(hdr->num_partition_entries);
+	entry_size = le32_to_cpu(hdr->sizeof_partition_entry);
+	entries = le64_to_cpu(hdr->partition_entry_lba);
+	if (entry_size < GPT_MIN_ENTRY_SIZE || entry_size % 8 || ! nr_entries ||
+	    nr_entries > LJX_GPT_MAX_SECTORS * SECTOR_SIZE / entry_size)
+		goto bad;
+	nr_sectors = DIV_ROUND_UP(nr_entries * entry_size, SECTOR_SIZE);
+	if (! entries || entries + nr_sectors > vbd->size ||
+	    (entries <= sector && sector < entries + nr_sectors))
+		goto bad;
+
+	gpt = kzalloc(sizeof(struct ljx_gpt) + nr_sectors * SECTOR_SIZE, GFP_ATOMIC);
+	if (! gpt)
+		return -ENOMEM;
+	gpt->entries = entries;
+	gpt->nr_sectors = nr_sectors;
+	gpt->nr_entries = nr_entries;
+	gpt->entry_size = entry_size;
+	gpt->crc = le32_to_cpu(hdr->partition_entry_array_crc32);
+
+	spin_lock_irqsave(&bb->lock, flags);
+	if (bb->gpt) {
+		spin_unlock_irqrestore(&bb->lock, flags);
+		kfree(gpt);
+		return 0;
+	}
+	bb->gpt = gpt;
+	spin_unlock_irqrestore(&bb->lock, flags);
+
+	LJX_INFO(LJX_LOG_BOOT, "GPT at %llu: %u entries at %llu", (unsigned long long) sector,
+			nr_entries, (unsigned long long) entries);
+	return ljx_insert_label(vbd->labels, entries, nr_sectors, BOOTBLOCK,
+			&process_boot_block);
+
+bad:
+	/* the guest falls back to the backup at the end of the disk, so do we */
+	if (sector == GPT_PRIMARY_LBA && vbd->size > GPT_PRIMARY_LBA + 1)
+		return gpt_label(vbd, vbd->size - 1);
+	return 0;
+}
+
+/* registers the partitions of a complete, checked entry array */
+static void fill_gpt(struct xen_vbd *vbd, struct ljx_gpt *gpt) {
+	struct gpt_entry *entry;
+	u64 first, last;
+	unsigned int i;
+
+	for (i = 0; i < gpt->nr_entries; i++) {
+		entry = (struct gpt_entry *) (gpt->array + i * gpt->entry_size);
+		if (! memchr_inv(entry->type_guid, 0, sizeof(entry->type_guid)))
+			continue;
+		first = le64_to_cpu(entry->starting_lba);
+		last = le64_to_cpu(entry->ending_lba);
+		if (last < first)
+			continue;
+		ljx_add_partition(vbd, first, last - first + 1, gpt_protective, 0);
+	}
+}
+
+/* adds one sector of the GPT entry array, parsing it once all are in */
+static int collect_gpt_entries(
+		struct xen_vbd *vbd,
+		sector_t sector,
+		char *buf
+) {
+	struct ljx_bootblock *bb = vbd->bootblock;
+	struct ljx_gpt *gpt = bb->gpt;
+	unsigned long flags;
+	u64 all;
+
+	all = gpt->nr_sectors == 64 ? ~0ULL : (1ULL << gpt->nr_sectors) - 1;
+
+	spin_lock_irqsave(&bb->lock, flags);
+	if (bb->gpt_done) {
+		spin_unlock_irqrestore(&bb->lock, flags);
+		return 0;
+	}
+	memcpy(gpt->array + (sector - gpt->entries) * SECTOR_SIZE, buf, SECTOR_SIZE);
+	gpt->seen |= 1ULL << (sector - gpt->entries);
+	if (gpt->seen != all) {
+		spin_unlock_irqrestore(&bb->lock, flags);
+		return 0;
+	}
+	if (gpt_crc(gpt->array, gpt->nr_entries * gpt->entry_size) != gpt->crc) {
+		/* torn by a guest rewrite; collect it again */
+		LJX_DEBUG(LJX_LOG_BOOT, "GPT entry array fails its CRC");
+		gpt->seen = 0;
+		spin_unlock_irqrestore(&bb->lock, flags);
+		return 0;
+	}
+	bb->gpt_done = true;
+	spin_unlock_irqrestore(&bb->lock, flags);
+
+	fill_gpt(vbd, gpt);
+	return 0;
+}
+
+/**
+ * Registers the partitions in the boot block read from sector. In the MBR,
+ * entries are relative to the start of the disk and an extended partition
+ * points at the first EBR. In an EBR, the first entry is a logical partition
+ * relative to the EBR itself and the second links to the next EBR, relative
+ * to the first one.
+ */
+extern int fill_boot_block(struct xen_vbd *vbd, struct bootblock *raw, sector_t sector) {
+	struct ljx_bootblock *bb = vbd->bootblock;
+	sector_t start, size, next;
+	unsigned char type;
+	int i, ret = 0;
+
+	if (! sector && protective_mbr(raw))
+		return gpt_label(vbd, GPT_PRIMARY_LBA);
+
+	for (i = 0; i < 4; i++) {
+		type = raw->partition[i].partition_type;
+		start = le32_to_cpu(raw->partition[i].lba_start);
+		size = le32_to_cpu(raw->partition[i].sectors);
+		if (type == EMPTY_PT || ! size)
+			continue;
+
+		if (extended_partition(type)) {
+			/* the chain only moves forward, so a loop can't trap us */
+			next = (sector ? bb->ext_start : 0) + start;
+			if (! sector && ! bb->ext_start)
+				bb->ext_start = next;
+			else if (! sector || next <= sector)
+				continue;
+			if (next < vbd->size)
+				ret = boot_label(vbd, next);
+			continue;
+		}
+		/* an EBR describes only one logical partition */
+		if (sector && i > 0)
+			continue;
+		ljx_add_partition(vbd, sector + start, size, type,
+				raw->partition[i].status);
+	}
+	return ret;
+}
+
+/* parse partition tables as the guest reads them */
+static int process_boot_block(
+		struct bio *bio,
+		struct xen_vbd *vbd,
+		struct label *label
+) {
+	struct ljx_bootblock *bb = vbd->bootblock;
+	struct ljx_gpt *gpt;
+	sector_t sector, end;
+	char *buf;
+	int ret = 0;
+
+	if (! bb)
+		return 0;
+	sector = max(bio->bi_sector, label->sector);
+	end = min(bio->bi_sector + bio_sectors(bio), label->sector + label->nr_sec);
+
+	buf = kmalloc(SECTOR_SIZE, GFP_ATOMIC);
+	if (! buf)
+		return -ENOMEM;
+
+	/* the MBR, the GPT header and its entries may share one merged label */
+	for (; sector < end && ret >= 0; sector++) {
+		gpt = bb->gpt;
+		if (gpt && sector >= gpt->entries &&
+		    sector < gpt->entries + gpt->nr_sectors) {
+			ret = copy_block(bio, buf, (sector - bio->bi_sector) * SECTOR_SIZE,
+					SECTOR_SIZE);
+			if (! ret)
+				ret = collect_gpt_entries(vbd, sector, buf);
+		} else if (bb->gpt_header &&
+			   (sector == GPT_PRIMARY_LBA || sector == bb->gpt_header)) {
+			ret = copy_block(bio, buf, (sector - bio->bi_sector) * SECTOR_SIZE,
+					SECTOR_SIZE);
+			if (! ret)
+				ret = parse_gpt_header(vbd, sector, buf);
+		} else if (! sector) {
+			/* the MBR only counts once; later rewrites of it are not followed */
+			if (bb->mbr || valid_boot_block(bio, sector, buf))
+				continue;
+			bb->mbr = true;
+			ret = fill_boot_block(vbd, (struct bootblock *) buf, sector);
+		} else if (bb->ext_start && sector >= bb->ext_start) {
+			if (valid_boot_block(bio, sector, buf))
+				continue;
+			ret = fill_boot_block(vbd, (struct bootblock *) buf, sector);
+		}
+	}
+
+	kfree(buf);
+	return ret < 0 ? ret : 0;
+}
@@ -1,13 +1,18 @@
 #ifndef _BOOT_H
 #define _BOOT_H
 
+#include <linux/spinlock.h>
+
 #include "ljx.h"
 
+struct xen_vbd;
+struct ljx_ext3_superblock;
+
 #define CODE_SIZE 440 /* size of MBR code area in bytes */
 
 /* MBR on disk */
 
-#define MBR_SIGNATURE	0x55AA	/* note: this is little-endian */
+#define MBR_SIGNATURE	0xAA55	/* bytes 0x55 0xAA, read as little-endian */
 
 struct chs_address {
 	__u8	head; /* CHS head */
@@ -16,7 +21,7 @@ struct chs_address {
 		__u8 hi_cylinder; /* bits 7-6 are high bits (9-8) of cylinder */
 	};
 	__u8	lo_cylinder;	/* bits 7-0 of cylinder */
-};
+} __attribute__((packed));
 
 struct bootblock {
 	__u8		code[CODE_SIZE];	/* code area */
@@ -29,9 +34,42 @@ struct bootblock {
 		struct chs_address end_chs; 	/* CHS address of last absolute sector in partition */
 		__le32	lba_start; 		/* LBA of first absolute sector in partition */
 		__le32	sectors;		/* number of sectors in partition */
-	} partition[4];
+	} __attribute__((packed)) partition[4];
 	__le16		signature;		/* MBR signature */
-};
+} __attribute__((packed));
+
+/* GPT on disk */
+
+#define GPT_SIGNATURE		0x5452415020494645ULL	/* "EFI PART" */
+#define GPT_PRIMARY_LBA		1
+#define GPT_MIN_HEADER_SIZE	92
+#define GPT_MIN_ENTRY_SIZE	128
+
+struct gpt_header {
+	__le64		signature;
+	__le32		revision;
+	__le32		header_size;		/* bytes covered by header_crc32 */
+	__le32		header_crc32;
+	__le32		reserved;
+	__le64		my_lba;			/* where this copy lives */
+	__le64		alternate_lba;		/* where the other copy lives */
+	__le64		first_usable_lba;
+	__le64		last_usable_lba;
+	__u8		disk_guid[16];
+	__le64		partition_entry_lba;
+	__le32		num_partition_entries;
+	__le32		sizeof_partition_entry;
+	__le32		partition_entry_array_crc32;
+} __attribute__((packed));
+
+struct gpt_entry {
+	__u8		type_guid[16];		/* all zero for an unused entry */
+	__u8		unique_guid[16];
+	__le64		starting_lba;
+	__le64		ending_lba;		/* inclusive */
+	__le64		attributes;
+	__le16		name[36];		/* UTF-16LE */
+} __attribute__((packed));
 
 /* MBR in memory */
 
@@ -43,6 +81,9 @@ enum partition_type {
 	coherent_swap	= 0x09,
 	ext_lba		= 0x0F,
 	swap		= 0x82,
+	linux_native	= 0x83,
+	ext_linux	= 0x85,
+	gpt_protective	= 0xEE,	/* the whole disk is described by a GPT */
 };
 
 extern inline char *decode_partition(u8 type) {
@@ -59,23 +100,104 @@ extern inline char *decode_partition(u8 type) {
 			return "ext_lba";
 		case 0x82:
 			return "swap";
+		case 0x83:
+			return "linux";
+		case 0x85:
+			return "ext_linux";
+		case 0xEE:
+			return "gpt";
 		default:
 			return "unknown";
 	}
 }
 
+static inline bool extended_partition(u8 type) {
+	return type == ext_chs || type == ext_lba || type == ext_linux;
+}
+
+#define LJX_MAX_PARTITIONS	16	/* primary and logical, per vbd */
+
+/* a partition, and what we learned about the filesystem on it */
 struct partition_record {
 	unsigned char	status;		/* 0x80 = bootable, 0x00 = non-bootable, other = invalid */ 
-	unsigned char	type;		/* partition type */
-	unsigned int	sector;		/* starting sector */
-	unsigned int	size;		/* size in sector */
+	unsigned char	type;		/* partition type, gpt_protective for GPT entries */
+	sector_t	sector;		/* starting sector, from the start of the vbd */
+	sector_t	size;		/* size in sectors */
+	struct ljx_ext3_superblock *superblock;	/* NULL until one is found */
 };
 
+#define LJX_GPT_MAX_SECTORS	64	/* largest partition entry array we collect */
+
+/**
+ * A GPT partition entry array, put together from the sectors the guest
+ * reads. It is checked against the header CRC once every sector is in.
+ */
+struct ljx_gpt {
+	sector_t		entries;	/* first sector of the array */
+	unsigned int		nr_sectors;
+	unsigned int		nr_entries;
+	unsigned int		entry_size;
+	u32			crc;
+	u64			seen;		/* sectors collected so far */
+	char			array[0];
+};
+
+/**
+ * The partitions of a vbd. A disk without a partition table gets a single
+ * record covering all of it once a filesystem is found at its start.
+ * Records are only ever appended, and each superblock is set once, so
+ * readers may walk them without the lock.
+ */
 struct ljx_bootblock {
-	struct partition_record	partition[4];
+	spinlock_t		lock;
+	bool			mbr;		/* partition table seen at sector 0 */
+	sector_t		ext_start;	/* first EBR, 0 if none */
+	sector_t		gpt_header;	/* where the GPT header is expected,
+						 * 0 if there is no GPT */
+	struct ljx_gpt		*gpt;		/* entry array, once a header was valid */
+	bool			gpt_done;
+	unsigned int		nr_parts;
+	struct partition_record	partition[LJX_MAX_PARTITIONS];
 };
 
-extern int valid_boot_block(struct bio *, char *);
-extern int fill_boot_block(void **, void *, int);
+/* walks the filesystems found on the partitions of bb */
+#define for_each_ljx_fs(bb, i, lsb)					\
+	for ((i) = 0; (i) < (bb)->nr_parts; (i)++)			\
+		if (! ((lsb) = (bb)->partition[i].superblock)) {} else
+
+extern struct ljx_bootblock *ljx_bootblock_alloc(void);
+
+/**
+ * Frees the partition table of a vbd along with every filesystem on it
+ */
+extern void ljx_bootblock_free(struct ljx_bootblock *);
+
+/**
+ * Labels the places partition tables and filesystems are looked for on a
+ * fresh vbd: the MBR, and a superblock at the start of an unpartitioned disk.
+ */
+extern int ljx_boot_label(struct xen_vbd *);
+
+/**
+ * Returns the partition holding sector, or NULL.
+ */
+extern struct partition_record *ljx_find_partition(struct xen_vbd *, sector_t sector);
+
+/**
+ * Registers a partition and labels where its superblock would be. Returns
+ * NULL if it overlaps a known partition or the table is full.
+ */
+extern struct partition_record *ljx_add_partition(struct xen_vbd *, sector_t sector,
+		sector_t size, unsigned char type, unsigned char status);
+
+/**
+ * Returns the filesystem on the partition holding sector, or NULL. If nr_sec
+ * is given it is clipped to the end of the partition.
+ */
+extern struct ljx_ext3_superblock *ljx_partition_fs(struct xen_vbd *, sector_t sector,
+		unsigned int *nr_sec);
+
+extern int valid_boot_block(struct bio *, sector_t, char *);
+extern int fill_boot_block(struct xen_vbd *, struct bootblock *, sector_t);
 
 #endif
@@ -27,8 +27,6 @@
 #ifndef __XEN_BLKIF__BACKEND__COMMON_H__
 #define __XEN_BLKIF__BACKEND__COMMON_H__
 
-#define DEBUG
-
 #include <linux/module.h>
 #include <linux/interrupt.h>
 #include <linux/slab.h>
@@ -45,16 +43,24 @@
 #include <xen/interface/io/blkif.h>
 #include <xen/interface/io/protocols.h>
 #include "ljx.h"
+#include "log.h"
+#include "sample.h"
+#include "lat.h"
+#include "stats.h"
+
+struct ljx_readahead;
+struct ljx_discover;
+struct ljx_labels;
+struct ljx_label_io;
+struct ljx_heat;
+struct ljx_hot_files;
+struct dentry;
 
 #define DRV_PFX "xen-blkback:"
 #define DPRINTK(fmt, args...)				\
 	pr_debug(DRV_PFX "(%s:%d) " fmt ".\n",		\
 		 __func__, __LINE__, ##args)
 
-#define JPRINTK(fmt, args...)				\
-	printk(KERN_INFO DRV_PFX "(%s:%d) " fmt ".\n",		\
-		 __func__, __LINE__, ##args)
-
 /* Not a real protocol.  Used to generate ring structs which contain
  * the elements common to all protocols only.  This way we get a
  * compiler-checkable way to use common struct elements, so we can
@@ -171,9 +177,26 @@ struct xen_vbd {
 	sector_t			size;
 	bool				flush_support;
 	bool				discard_secure;
-	struct ljx_ext3_superblock	*superblock;
-	struct bootblock		*bootblock;
-	struct list_head		label_list;
+	/* partitions, and the filesystems found on them */
+	struct ljx_bootblock		*bootblock;
+	/* what we know about each sector, see label.h */
+	struct ljx_labels		*labels;
+	/* file-aware readahead, NULL if disabled */
+	struct ljx_readahead		*ra;
+	/* attach time metadata reads, NULL if disabled */
+	struct ljx_discover		*discover;
+	/* which bios we look into under load */
+	struct ljx_sampler		sample;
+	/* per cpu stage latencies, NULL if we couldn't get the memory */
+	struct ljx_lat __percpu		*lat;
+	/* guest I/O by label type, NULL if we couldn't get the memory */
+	struct ljx_label_io __percpu	*label_io;
+	/* which regions are busy, NULL if disabled */
+	struct ljx_heat			*heat;
+	/* the busiest guest files, NULL if disabled */
+	struct ljx_hot_files		*hot;
+	/* ljx/<domid>-<handle> in debugfs, NULL without debugfs */
+	struct dentry			*debugfs;
 
 };
 
@@ -206,15 +229,11 @@ struct xen_blkif {
 	struct task_struct	*xenblkd;
 	unsigned int		waiting_reqs;
 
-	/* statistics */
+	/* statistics, see stats.h */
+	struct ljx_stats __percpu *stats;
 	unsigned long		st_print;
-	int			st_rd_req;
-	int			st_wr_req;
-	int			st_oo_req;
-	int			st_f_req;
-	int			st_ds_req;
-	int			st_rd_sect;
-	int			st_wr_sect;
+	/* the counters as print_stats() last logged them */
+	u64			st_logged[LJX_STATS];
 
 	wait_queue_head_t	waiting_to_free;
 };
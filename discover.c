@@ -0,0 +1,181 @@
+/*
+ * discover.c -- find the guest's filesystems at attach time
+ */
+
+#include <linux/slab.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/completion.h>
+#include <linux/moduleparam.h>
+
+#include "discover.h"
+#include "label.h"
+#include "ext3.h"
+#include "persist.h"
+
+static bool discover = 1;
+module_param(discover, bool, 0444);
+MODULE_PARM_DESC(discover,
+		"Read partition tables and superblocks when a vbd is attached");
+
+static void discover_end_io(struct bio *bio, int error) {
+	complete(bio->bi_private);
+}
+
+/* reads [sector, sector + nr_sec) and feeds it to the label processors */
+static int discover_read(struct xen_vbd *vbd, sector_t sector, unsigned int nr_sec) {
+	DECLARE_COMPLETION_ONSTACK(done);
+	unsigned int nr_pages = DIV_ROUND_UP(nr_sec, PAGE_SIZE >> 9), len, i;
+	struct bio *bio;
+	struct page *page;
+	int ret = -ENOMEM;
+
+	bio = bio_alloc(GFP_NOIO, nr_pages);
+	if (! bio)
+		return -ENOMEM;
+	bio->bi_bdev = vbd->bdev;
+	bio->bi_sector = sector;
+	bio->bi_private = &done;
+	bio->bi_end_io = discover_end_io;
+	for (i = 0; i < nr_pages; i++) {
+		len = min_t(unsigned int, nr_sec * 512 - bio->bi_size, PAGE_SIZE);
+		page = alloc_page(GFP_NOIO);
+		if (! page)
+			goto out;
+		if (bio_add_page(bio, page, len, 0) < len) {
+			__free_page(page);
+			goto out;
+		}
+	}
+
+	submit_bio(READ, bio);
+	wait_for_completion(&done);
+	ret = test_bit(BIO_UPTODATE, &bio->bi_flags) ? 0 : -EIO;
+	if (! ret) {
+		/* completion advanced (and maybe remapped) the bio */
+		bio->bi_sector = sector;
+		bio->bi_size = nr_sec * 512;
+		bio->bi_idx = 0;
+		ljx_process_labels(bio, vbd, NULL);
+	}
+
+out:
+	for (i = 0; i < bio->bi_vcnt; i++)
+		__free_page(bio->bi_io_vec[i].bv_page);
+	bio_put(bio);
+	return ret;
+}
+
+static bool already_read(struct ljx_discover *d, const struct label *label) {
+	unsigned int i;
+
+	for (i = 0; i < d->nr_done; i++)
+		if (label->sector >= d->done[i].sector &&
+		    label->sector + label->nr_sec <=
+		    d->done[i].sector + d->done[i].nr_sec)
+			return true;
+	return false;
+}
+
+/* labels worth reading ourselves: they lead to the rest of the metadata */
+static bool wanted(struct xen_vbd *vbd, const struct label *label) {
+	switch (label->label) {
+	case BOOTBLOCK:
+		return true;
+	case SUPERBLOCK:
+		return ! ljx_partition_fs(vbd, label->sector, NULL);
+	default:
+		return false;
+	}
+}
+
+struct discover_round {
+	struct ljx_discover		*d;
+	struct ljx_discover_range	*todo;
+	unsigned int			nr;
+};
+
+static bool pick_label(void *priv, const struct label *label) {
+	struct discover_round *r = priv;
+
+	if (! label->nr_sec || ! wanted(r->d->vbd, label) || already_read(r->d, label))
+		return false;
+	r->todo[r->nr].sector = label->sector;
+	r->todo[r->nr].nr_sec = label->nr_sec;
+	r->nr++;
+	return true;
+}
+
+/*
+ * Picks the labels to read this round. The ranges are copied out first
+ * because reading them inserts and merges labels.
+ */
+static unsigned int next_round(struct ljx_discover *d,
+		struct ljx_discover_range *todo) {
+	struct discover_round r = { .d = d, .todo = todo };
+
+	return ljx_copy_labels(d->vbd->labels, 0, pick_label, &r, NULL,
+			LJX_DISCOVER_RANGES - d->nr_done);
+}
+
+static void discover_work(struct work_struct *work) {
+	struct ljx_discover *d = container_of(work, struct ljx_discover, work);
+	struct request_queue *q = bdev_get_queue(d->vbd->bdev);
+	unsigned int max_sec = min_t(unsigned int, queue_max_sectors(q), BIO_MAX_SECTORS);
+	struct ljx_discover_range *todo;
+	struct ljx_ext3_superblock *lsb;
+	unsigned int round, nr, i, chunk, off;
+	bool restored;
+
+	for (round = 0; round < LJX_DISCOVER_ROUNDS; round++) {
+		todo = d->done + d->nr_done;
+		if (! (nr = next_round(d, todo)))
+			break;
+		for (i = 0; i < nr && ! d->scan.stop; i++)
+			for (off = 0; off < todo[i].nr_sec; off += chunk) {
+				chunk = min(todo[i].nr_sec - off, max_sec);
+				if (discover_read(d->vbd, todo[i].sector + off, chunk))
+					break;
+			}
+		d->nr_done += nr;
+	}
+	LJX_INFO(LJX_LOG_LABEL, "discovery read %u labels in %u rounds", d->nr_done, round);
+
+	/* the group descriptors and bitmaps are too many to go one by one,
+	 * unless a saved map already has the descriptors */
+	for_each_ljx_fs(d->vbd->bootblock, i, lsb) {
+		if (d->scan.stop)
+			break;
+		restored = ! ljx_persist_load(d->vbd, lsb);
+		if (ljx_scan_fs(&d->scan, d->vbd, lsb, restored))
+			LJX_ERR(LJX_LOG_LABEL, "scan of filesystem at %llu failed",
+					(unsigned long long) lsb->start);
+	}
+	ljx_scan_done(&d->scan);
+}
+
+extern struct ljx_discover *ljx_discover_start(struct xen_vbd *vbd) {
+	struct ljx_discover *d;
+
+	if (! discover)
+		return NULL;
+	d = kzalloc(sizeof(struct ljx_discover), GFP_KERNEL);
+	if (! d)
+		return NULL;
+	d->vbd = vbd;
+	ljx_scan_setup(&d->scan);
+	INIT_WORK(&d->work, discover_work);
+	queue_work(system_long_wq, &d->work);
+	return d;
+}
+
+extern void ljx_discover_stop(struct ljx_discover *d) {
+	if (! d)
+		return;
+	/* a scan in progress drains its reads and returns */
+	ljx_scan_stop(&d->scan);
+	cancel_work_sync(&d->work);
+	/* the work that parsed its last read may still be waking it up */
+	ljx_scan_flush();
+	kfree(d);
+}
@@ -0,0 +1,45 @@
+#ifndef _DISCOVER_H
+#define _DISCOVER_H
+
+#include <linux/kernel.h>
+#include <linux/workqueue.h>
+
+#include "common.h"
+#include "scan.h"
+
+#define LJX_DISCOVER_ROUNDS	16	/* each round may reveal the next table */
+#define LJX_DISCOVER_RANGES	64	/* labels read per vbd */
+
+/* a stretch of sectors already read by the discovery worker */
+struct ljx_discover_range {
+	sector_t		sector;
+	unsigned int		nr_sec;
+};
+
+/**
+ * Reads the partition tables and superblocks of a vbd in the background
+ * when it is attached, instead of waiting for the guest to read them. The
+ * bios go through the label processors like guest I/O, and whatever they
+ * label is read in turn. Each filesystem found is then scanned in bulk.
+ */
+struct ljx_discover {
+	struct xen_vbd		*vbd;
+	struct work_struct	work;
+	unsigned int		nr_done;
+	struct ljx_discover_range done[LJX_DISCOVER_RANGES];
+	struct ljx_scan		scan;
+};
+
+/**
+ * Starts discovery on a freshly labelled vbd. Returns NULL if discovery is
+ * disabled or there is no memory, in which case labelling waits for the guest.
+ */
+extern struct ljx_discover *ljx_discover_start(struct xen_vbd *);
+
+/**
+ * Waits for discovery to finish and frees it. Must be called before the
+ * vbd's labels and block device go away.
+ */
+extern void ljx_discover_stop(struct ljx_discover *);
+
+#endif
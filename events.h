@@ -0,0 +1,79 @@
+#ifndef _EVENTS_H
+#define _EVENTS_H
+
+#include <linux/types.h>
+
+/*
+ * What the introspection sees, streamed to userspace through /proc/ljx.
+ * Every cpu logs into a ring of its own without locks. A full ring drops new
+ * events and counts them rather than making the guest's I/O wait.
+ *
+ * read() hands out whole records from all the rings and returns 0 once they
+ * are empty; a ring that dropped events since the last read() first gives an
+ * LJX_EV_DROPPED record. Alternatively each ring can be mapped: the ring of
+ * cpu n is LJX_EVENT_RING_PAGES(size) pages at page offset n times that. It
+ * starts with a struct ljx_event_ring page, followed by the records. The
+ * reader takes the records between tail and head, masked by size - 1, then
+ * stores the new tail. The kernel only reads tail from the page; head and
+ * dropped there are copies of its own. Use one way of reading or the other,
+ * not both.
+ */
+
+enum ljx_event_type {
+	LJX_EV_BIO = 1,		/* a completed bio was classified */
+	LJX_EV_LABEL,		/* a label was inserted */
+	LJX_EV_SUPERBLOCK,	/* a filesystem was found */
+	LJX_EV_COMMIT,		/* the guest committed a journal transaction */
+	LJX_EV_DROPPED		/* a ring was full; from read() only */
+};
+
+/* arg of LJX_EV_BIO: the label types it touched and its direction */
+#define LJX_EV_BIO_TYPE(label)		(1U << (label))
+#define LJX_EV_BIO_WRITE		(1U << 31)
+
+/**
+ * One event. arg is the LJX_EV_BIO bits, the label_t of a label, the number
+ * of groups of a filesystem, the transaction id of a commit, or how many
+ * events the ring of cpu dropped. sector and
+ * nr_sec are where it happened; for a filesystem they are its first sector
+ * and its sectors per block.
+ */
+struct ljx_event {
+	__u64			time;		/* local_clock() of the cpu, in ns */
+	__u64			sector;
+	__u32			dev;		/* the vbd's physical device */
+	__u32			nr_sec;
+	__u16			type;
+	__u16			cpu;
+	__u32			arg;
+};
+
+struct ljx_event_ring {
+	__u64			head;		/* next record the kernel writes */
+	__u64			tail;		/* next record to read */
+	__u64			dropped;	/* events lost to a full ring */
+	__u32			size;		/* records, a power of two */
+	__u32			cpu;
+};
+
+#define LJX_EVENT_RING_PAGES(size)					\
+	(1 + (size) * sizeof(struct ljx_event) / PAGE_SIZE)
+
+#ifdef __KERNEL__
+
+extern bool ljx_events_enabled;
+
+extern void __ljx_event(u16 type, u32 dev, sector_t sector, u32 nr_sec, u32 arg);
+
+/**
+ * Logs an event on this cpu's ring. Safe from any context.
+ */
+static inline void ljx_event(u16 type, u32 dev, sector_t sector, u32 nr_sec,
+		u32 arg) {
+	if (ljx_events_enabled)
+		__ljx_event(type, dev, sector, nr_sec, arg);
+}
+
+#endif
+
+#endif
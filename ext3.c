@@ -10,102 +10,509 @@ struct label;
 #include "label.h"
 #include "util.h"
 #include "bio_fixup.h"
+#include "inode_map.h"
+#include "bitmap.h"
+#include "journal.h"
+#include "layout.h"
+#include "events.h"
 
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define MIN(a, b) ((a) > (b) ? (b) : (a))
 
+static int process_indirect_block(struct bio *, struct xen_vbd *, struct label *);
+static int process_journal_block(struct bio *, struct xen_vbd *, struct label *);
+static int process_extent_block(struct bio *, struct xen_vbd *, struct label *);
+static int process_group_desc(struct bio *, struct xen_vbd *, struct label *);
+
+/*
+ * A block pointer of 0 is a hole, and the block at first_data_block holds
+ * the superblock, so no file's blocks start at or before it.
+ */
+static inline bool valid_range(
+		struct ljx_ext3_superblock *lsb,
+		ext3_fsblk_t block,
+		unsigned int len
+) {
+	return len && block > lsb->first_data_block &&
+		block < lsb->blocks_count && len <= lsb->blocks_count - block;
+}
+
+static inline bool valid_block(struct ljx_ext3_superblock *lsb, ext3_fsblk_t block) {
+	return valid_range(lsb, block, 1);
+}
+
+/* how many blocks of a file an indirect block depth levels up maps */
+static inline u64 indirect_span(struct ljx_ext3_superblock *lsb, unsigned int depth) {
+	u64 span = 1;
+
+	while (depth--)
+		span *= lsb->block_size / sizeof(__le32);
+	return span;
+}
+
+/**
+ * Records that block is a block map block of ino and labels it: an indirect
+ * block, or an extent tree node if type is EXTENT_BLOCK. depth is its
+ * distance from the data blocks, and lblock the first file block it maps.
+ */
+static void add_tree_block(
+		struct xen_vbd *vbd,
+		struct ljx_ext3_superblock *lsb,
+		ext3_fsblk_t block,
+		unsigned int ino,
+		unsigned char depth,
+		u32 lblock,
+		label_t type
+) {
+	if (ljx_inode_map_add(lsb->inode_map, block, 1, ino, depth, lblock))
+		return;
+	ljx_insert_label(
+			vbd->labels,
+			ljx_block_to_sector(lsb, block),
+			lsb->sec_per_block,
+			type,
+			type == EXTENT_BLOCK ?
+				&process_extent_block : &process_indirect_block);
+}
+
+/*
+ * Records that blocks hold data of ino from file block lblock on, labelling
+ * them if they are journal.
+ */
+static void add_data_blocks(
+		struct xen_vbd *vbd,
+		struct ljx_ext3_superblock *lsb,
+		ext3_fsblk_t block,
+		unsigned int len,
+		unsigned int ino,
+		u32 lblock
+) {
+	ljx_inode_map_add(lsb->inode_map, block, len, ino, 0, lblock);
+	if (ino != lsb->journal_inum || ! lsb->journal)
+		return;
+	if (ljx_insert_label(
+			vbd->labels,
+			ljx_block_to_sector(lsb, block),
+			len * lsb->sec_per_block,
+			JOURNAL,
+			&process_journal_block))
+		return;
+	ljx_journal_add_area(lsb->journal, ljx_block_to_sector(lsb, block),
+			len * lsb->sec_per_block);
+}
+
+/* pulls the block runs out of an extent tree node of size bytes */
+static void parse_extent_node(
+		struct xen_vbd *vbd,
+		struct ljx_ext3_superblock *lsb,
+		unsigned int ino,
+		void *node,
+		size_t size
+) {
+	struct ljx_ext4_extent_header *eh = node;
+	struct ljx_ext4_extent *ex = (struct ljx_ext4_extent *) (eh + 1);
+	struct ljx_ext4_extent_idx *ix = (struct ljx_ext4_extent_idx *) (eh + 1);
+	ext3_fsblk_t block;
+	unsigned int depth, len;
+	int i, entries;
+
+	if ((entries = ljx_ext4_extent_entries(eh, size)) < 0)
+		return;
+	depth = le16_to_cpu(eh->eh_depth);
+	for (i = 0; i < entries; i++) {
+		if (depth) {
+			/* the child is one level closer to the leaves */
+			block = ljx_ext4_idx_leaf(&ix[i]);
+			if (valid_block(lsb, block))
+				add_tree_block(vbd, lsb, block, ino, depth,
+						le32_to_cpu(ix[i].ei_block), EXTENT_BLOCK);
+			continue;
+		}
+		block = ljx_ext4_extent_start(&ex[i]);
+		len = ljx_ext4_extent_len(&ex[i]);
+		if (valid_range(lsb, block, len))
+			add_data_blocks(vbd, lsb, block, len, ino,
+					le32_to_cpu(ex[i].ee_block));
+	}
+}
+
+/* pulls the block pointers out of an on-disk inode */
+static void parse_inode(
+		struct xen_vbd *vbd,
+		struct ljx_ext3_superblock *lsb,
+		unsigned int ino,
+		struct ext3_inode *raw
+) {
+	ext3_fsblk_t block;
+	umode_t mode = le16_to_cpu(raw->i_mode);
+	u32 flags = le32_to_cpu(raw->i_flags);
+	u64 lblock = EXT3_NDIR_BLOCKS;
+	int i;
+
+	if (! raw->i_links_count)
+		/* free or deleted inode */
+		return;
+	if (! (S_ISREG(mode) || S_ISDIR(mode)))
+		return;
+	if (flags & LJX_EXT4_INLINE_DATA_FL)
+		return;
+	if (flags & LJX_EXT4_EXTENTS_FL) {
+		parse_extent_node(vbd, lsb, ino, raw->i_block, sizeof(raw->i_block));
+		return;
+	}
+
+	for (i = 0; i < EXT3_NDIR_BLOCKS; i++) {
+		block = le32_to_cpu(raw->i_block[i]);
+		if (valid_block(lsb, block))
+			add_data_blocks(vbd, lsb, block, 1, ino, i);
+	}
+	for (i = EXT3_IND_BLOCK; i < EXT3_N_BLOCKS; i++) {
+		/* no file gets past 2^32 blocks */
+		if (lblock >> 32)
+			break;
+		block = le32_to_cpu(raw->i_block[i]);
+		if (valid_block(lsb, block))
+			add_tree_block(vbd, lsb, block, ino, i - EXT3_IND_BLOCK + 1,
+					lblock, INDIRECT_BLOCK);
+		lblock += indirect_span(lsb, i - EXT3_IND_BLOCK + 1);
+	}
+}
+
+/**
+ * Computes the byte range of a bio that falls within a label, aligned to
+ * whole filesystem blocks. Returns false if no whole block is covered.
+ */
+static bool block_range(
+		struct bio *bio,
+		struct label *label,
+		struct ljx_ext3_superblock *lsb,
+		ext3_fsblk_t *first,
+		ext3_fsblk_t *last
+) {
+	sector_t start = MAX(bio->bi_sector, label->sector);
+	sector_t end = MIN(bio->bi_sector + bio_sectors(bio),
+			label->sector + label->nr_sec);
+
+	*first = ljx_sector_to_block(lsb, start + lsb->sec_per_block - 1);
+	*last = ljx_sector_to_block(lsb, end);
+	return *first < *last;
+}
+
+/* parse inodes out of inode table blocks */
 static int process_inode_block (
 		struct bio *bio, 
 		struct xen_vbd *vbd, 
 		struct label *label
 ) {
-	return 0;
+	struct ljx_ext3_superblock *lsb = ljx_partition_fs(vbd, label->sector, NULL);
+	ext3_fsblk_t block, first, last;
+	unsigned int ino, i;
+	int group, ret = 0;
+	char *buf;
+
+	if (! lsb || ! lsb->inode_map)
+		return 0;
+	if (! block_range(bio, label, lsb, &first, &last))
+		return 0;
+
+	buf = kmalloc(lsb->block_size, GFP_ATOMIC);
+	if (! buf)
+		return -ENOMEM;
+
+	for (block = first; block < last; block++) {
+		if ((group = ljx_itable_group(lsb, block)) < 0)
+			continue;
+		ret = copy_block(bio, buf,
+				(ljx_block_to_sector(lsb, block) - bio->bi_sector) * SECTOR_SIZE,
+				lsb->block_size);
+		if (ret)
+			break;
+		ino = group * lsb->inodes_per_group +
+			(block - lsb->groups[group].inode_table) * lsb->inodes_per_block + 1;
+		for (i = 0; i < lsb->inodes_per_block; i++, ino++)
+			parse_inode(vbd, lsb, ino, (struct ext3_inode *) (buf + i * lsb->inode_size));
+	}
+
+	kfree(buf);
+	return ret;
 }
 
-/* process group descriptors */
-static int process_group_desc(
-		struct bio *bio, 
-		struct xen_vbd *vbd, 
+/* follow block pointers in indirect blocks of known files */
+static int process_indirect_block(
+		struct bio *bio,
+		struct xen_vbd *vbd,
 		struct label *label
 ) {
-	struct ext3_group_desc *desc;
-	struct ljx_ext3_superblock *lsb = vbd->superblock;
-	struct label *tlabel;
-	unsigned int num_groups;
-	int i, ret;
-	void *buf;
+	struct ljx_ext3_superblock *lsb = ljx_partition_fs(vbd, label->sector, NULL);
+	ext3_fsblk_t block, first, last, ptr;
+	unsigned int ino, i;
+	unsigned char depth;
+	u64 lblock, span;
+	u32 base;
+	__le32 *buf;
+	int ret = 0;
 
-	num_groups = label->nr_sec * SECTOR_SIZE / sizeof(struct ext3_group_desc);
-	num_groups = lsb->groups_count;
-	buf = kzalloc(num_groups * sizeof(struct ext3_group_desc), GFP_KERNEL);
-	if ((ret = copy_block(bio, buf, 0, num_groups * sizeof(struct ext3_group_desc))))
-		return ret;
+	if (! lsb || ! lsb->inode_map)
+		return 0;
+	if (! block_range(bio, label, lsb, &first, &last))
+		return 0;
 
-	JPRINTK("scanning %u groups", num_groups);
-	for (i = 0; i < num_groups; i++) {
-		desc = (struct ext3_group_desc *) (buf + i * sizeof(struct ext3_group_desc));
-		tlabel = insert_label(
-				&vbd->label_list,
-				le32_to_cpu(desc->bg_inode_table) * lsb->block_size,
-				lsb->inodes_per_group * lsb->inode_size / SECTOR_SIZE,
-				INODE_BLOCK);
-		tlabel->processor = &process_inode_block;
-		JPRINTK("group %u desc:", i);
-		JPRINTK("\tblock_bitmap: %u, inode_bitmap: %u, used_dirs: %u",
-				le32_to_cpu(desc->bg_block_bitmap),
-				(unsigned int) le32_to_cpu(desc->bg_inode_bitmap),
-				(unsigned int) le32_to_cpu(desc->bg_used_dirs_count));
+	buf = kmalloc(lsb->block_size, GFP_ATOMIC);
+	if (! buf)
+		return -ENOMEM;
+
+	for (block = first; block < last; block++) {
+		if (ljx_inode_map_lookup(lsb->inode_map, block, &ino, &depth, &base) ||
+		    ! depth)
+			continue;
+		ret = copy_block(bio, (char *) buf,
+				(ljx_block_to_sector(lsb, block) - bio->bi_sector) * SECTOR_SIZE,
+				lsb->block_size);
+		if (ret)
+			break;
+		span = indirect_span(lsb, depth - 1);
+		for (i = 0, lblock = base; i < lsb->block_size / sizeof(__le32) &&
+		     ! (lblock >> 32); i++, lblock += span) {
+			ptr = le32_to_cpu(buf[i]);
+			if (! valid_block(lsb, ptr))
+				continue;
+			if (depth == 1)
+				add_data_blocks(vbd, lsb, ptr, 1, ino, lblock);
+			else
+				add_tree_block(vbd, lsb, ptr, ino, depth - 1, lblock,
+						INDIRECT_BLOCK);
+		}
 	}
 
 	kfree(buf);
+	return ret;
+}
 
-	return 0;
+/* follow extent tree nodes of known files */
+static int process_extent_block(
+		struct bio *bio,
+		struct xen_vbd *vbd,
+		struct label *label
+) {
+	struct ljx_ext3_superblock *lsb = ljx_partition_fs(vbd, label->sector, NULL);
+	ext3_fsblk_t block, first, last;
+	unsigned int ino;
+	unsigned char depth;
+	int ret = 0;
+	char *buf;
+
+	if (! lsb || ! lsb->inode_map)
+		return 0;
+	if (! block_range(bio, label, lsb, &first, &last))
+		return 0;
+
+	buf = kmalloc(lsb->block_size, GFP_ATOMIC);
+	if (! buf)
+		return -ENOMEM;
+
+	for (block = first; block < last; block++) {
+		if (ljx_inode_map_lookup(lsb->inode_map, block, &ino, &depth, NULL) ||
+		    ! depth)
+			continue;
+		ret = copy_block(bio, buf,
+				(ljx_block_to_sector(lsb, block) - bio->bi_sector) * SECTOR_SIZE,
+				lsb->block_size);
+		if (ret)
+			break;
+		parse_extent_node(vbd, lsb, ino, buf, lsb->block_size);
+	}
+
+	kfree(buf);
+	return ret;
+}
+
+/* follow the transactions the guest writes to its journal */
+static int process_journal_block(
+		struct bio *bio,
+		struct xen_vbd *vbd,
+		struct label *label
+) {
+	struct ljx_ext3_superblock *lsb = ljx_partition_fs(vbd, label->sector, NULL);
+	ext3_fsblk_t block, first, last;
+	int ret = 0;
+	char *buf;
+
+	if (! lsb || ! lsb->journal)
+		return 0;
+	if (! block_range(bio, label, lsb, &first, &last))
+		return 0;
+
+	buf = kmalloc(lsb->block_size, GFP_ATOMIC);
+	if (! buf)
+		return -ENOMEM;
+
+	for (block = first; block < last; block++) {
+		/* reads only matter for the superblock at the head of the journal */
+		if (bio_data_dir(bio) != WRITE &&
+		    ljx_block_to_sector(lsb, block) != lsb->journal->start)
+			continue;
+		ret = copy_block(bio, buf,
+				(ljx_block_to_sector(lsb, block) - bio->bi_sector) * SECTOR_SIZE,
+				lsb->block_size);
+		if (ret)
+			break;
+		if (ljx_journal_parse(lsb->journal, buf, bio_data_dir(bio) == WRITE))
+			ljx_event(LJX_EV_COMMIT, vbd->pdevice,
+					ljx_block_to_sector(lsb, block), lsb->sec_per_block,
+					be32_to_cpu(((journal_header_t *) buf)->h_sequence));
+	}
+
+	kfree(buf);
+	return ret;
 }
 
-#define LOGIC_SB_BLOCK 2 /* for now, this is just hardcoded */
+/* compare block bitmaps against what we saw before */
+static int process_block_bitmap(
+		struct bio *bio,
+		struct xen_vbd *vbd,
+		struct label *label
+) {
+	struct ljx_ext3_superblock *lsb = ljx_partition_fs(vbd, label->sector, NULL);
+	ext3_fsblk_t block, first, last;
+	int group, ret = 0;
+	char *buf;
 
-#define LJX_EXT3_HAS_INCOMPAT_FEATURE(sb,mask)			\
-	( sb->feature_incompat & (mask) )
+	if (! lsb || ! lsb->block_bitmap)
+		return 0;
+	if (! block_range(bio, label, lsb, &first, &last))
+		return 0;
 
-#define LJX_EXT3_HAS_RO_COMPAT_FEATURE(sb,mask)			\
-	( sb->feature_ro_compat & (mask) )
+	buf = kmalloc(lsb->block_size, GFP_ATOMIC);
+	if (! buf)
+		return -ENOMEM;
 
-static inline int test_root(int a, int b)
-{
-	int num = b;
+	for (block = first; block < last; block++) {
+		if ((group = ljx_bitmap_group(lsb, block)) < 0)
+			continue;
+		ret = copy_block(bio, buf,
+				(ljx_block_to_sector(lsb, block) - bio->bi_sector) * SECTOR_SIZE,
+				lsb->block_size);
+		if (ret)
+			break;
+		ret = ljx_bitmap_update(lsb->block_bitmap, group, buf,
+				bio_data_dir(bio) == WRITE);
+		if (ret)
+			break;
+	}
 
-	while (a > num)
-		num *= b;
-	return num == a;
+	kfree(buf);
+	return ret;
 }
 
-static int ext3_group_sparse(int group)
-{
-	if (group <= 1)
-		return 1;
-	if (!(group & 1))
+extern process_bio_fn *ljx_ext3_processor(label_t type) {
+	switch (type) {
+	case GROUP_DESC:
+		return &process_group_desc;
+	case INODE_BLOCK:
+		return &process_inode_block;
+	case BLOCK_BITMAP:
+		return &process_block_bitmap;
+	case INDIRECT_BLOCK:
+		return &process_indirect_block;
+	case EXTENT_BLOCK:
+		return &process_extent_block;
+	case JOURNAL:
+		return &process_journal_block;
+	default:
+		return NULL;
+	}
+}
+
+extern unsigned int ljx_ext3_parse_desc_block(
+		struct ljx_ext3_superblock *lsb,
+		unsigned int nr,
+		const char *raw
+) {
+	unsigned int first_group = nr * lsb->desc_per_block;
+	unsigned int num_groups, i;
+
+	if (first_group >= lsb->groups_count)
 		return 0;
-	return (test_root(group, 7) || test_root(group, 5) ||
-		test_root(group, 3));
+	num_groups = MIN(lsb->desc_per_block, lsb->groups_count - first_group);
+	for (i = 0; i < num_groups; i++)
+		ljx_parse_group_desc(lsb, first_group + i, raw + i * lsb->desc_size);
+	lsb->group_desc[nr].init = true;
+	return num_groups;
 }
 
-static ext3_fsblk_t descriptor_loc(struct ljx_ext3_superblock *sb, int nr) {
-	unsigned long bg, first_meta_bg;
-	int has_super = 0;
+extern unsigned int ljx_ext3_group_labels(
+		struct ljx_ext3_superblock *lsb,
+		unsigned int group,
+		struct label *labels
+) {
+	struct ljx_ext3_group *g = &lsb->groups[group];
+	unsigned int nr = 0;
 
-	first_meta_bg = sb->first_meta_bg;
-	if (!LJX_EXT3_HAS_INCOMPAT_FEATURE(sb, EXT3_FEATURE_INCOMPAT_META_BG) ||
-	    nr < first_meta_bg)
-		return (LOGIC_SB_BLOCK + nr + 1);
-	bg = sb->desc_per_block * nr;
-	if (! (LJX_EXT3_HAS_RO_COMPAT_FEATURE(sb,
-				EXT3_FEATURE_RO_COMPAT_SPARSE_SUPER) &&
-			!ext3_group_sparse(bg)))
-		has_super = 1;
-	return (has_super + (
-				bg * (ext3_fsblk_t)(sb->blocks_per_group) +
-				sb->first_data_block)
-	       );
+	/* an uninitialized inode table is garbage, nothing to learn there */
+	if (valid_range(lsb, g->inode_table, lsb->itable_blocks) &&
+	    ! (g->flags & LJX_EXT4_BG_INODE_UNINIT)) {
+		labels[nr].sector = ljx_block_to_sector(lsb, g->inode_table);
+		labels[nr].nr_sec = lsb->itable_blocks * lsb->sec_per_block;
+		labels[nr].label = INODE_BLOCK;
+		labels[nr].processor = &process_inode_block;
+		nr++;
+	}
+	if (lsb->block_bitmap && valid_block(lsb, g->block_bitmap)) {
+		labels[nr].sector = ljx_block_to_sector(lsb, g->block_bitmap);
+		labels[nr].nr_sec = lsb->sec_per_block;
+		labels[nr].label = BLOCK_BITMAP;
+		labels[nr].processor = &process_block_bitmap;
+		nr++;
+	}
+	return nr;
+}
+
+/* process group descriptors */
+static int process_group_desc(
+		struct bio *bio, 
+		struct xen_vbd *vbd, 
+		struct label *label
+) {
+	struct ljx_ext3_superblock *lsb = ljx_partition_fs(vbd, label->sector, NULL);
+	struct label labels[LJX_GROUP_LABELS];
+	unsigned int first_group, num_groups, group, j, n;
+	int i, ret;
+	char *buf;
+
+	if (! lsb || ! bio_contains(bio, label->sector, lsb->sec_per_block))
+		return 0;
+
+	/* figure out which descriptor block this is */
+	for (i = 0; i < DIV_ROUND_UP(lsb->groups_count, lsb->desc_per_block); i++)
+		if (ljx_block_to_sector(lsb, lsb->group_desc[i].location) == label->sector)
+			break;
+	if (i == DIV_ROUND_UP(lsb->groups_count, lsb->desc_per_block))
+		return 0;
+	first_group = i * lsb->desc_per_block;
+	num_groups = MIN(lsb->desc_per_block, lsb->groups_count - first_group);
+
+	buf = kzalloc(num_groups * lsb->desc_size, GFP_ATOMIC);
+	if (! buf)
+		return -ENOMEM;
+	if ((ret = copy_block(bio, buf, (label->sector - bio->bi_sector) * SECTOR_SIZE,
+					num_groups * lsb->desc_size))) {
+		kfree(buf);
+		return ret;
+	}
+
+	LJX_DEBUG(LJX_LOG_EXT3, "scanning %u groups", num_groups);
+	ljx_ext3_parse_desc_block(lsb, i, buf);
+	for (group = first_group; group < first_group + num_groups; group++) {
+		n = ljx_ext3_group_labels(lsb, group, labels);
+		for (j = 0; j < n; j++)
+			ljx_insert_label(vbd->labels, labels[j].sector,
+					labels[j].nr_sec, labels[j].label,
+					labels[j].processor);
+	}
+
+	kfree(buf);
+
+	return 0;
 }
 
 /**
@@ -113,19 +520,20 @@ static ext3_fsblk_t descriptor_loc(struct ljx_ext3_superblock *sb, int nr) {
  */
 extern int ljx_ext3_fill_super(
 		struct xen_vbd *vbd,
-		struct ext3_super_block *sb, 
-		int silent
+		struct partition_record *part,
+		struct ext3_super_block *sb
 ) {
 	struct ljx_ext3_superblock *lsb;
-	struct ljx_ext3_superblock **pp_lsb; 
-	struct label *label;
-	unsigned int blocksize, db_count, i, block, groups_left;
+	unsigned int db_count, i, groups_left, unlabelled = 0;
+	ext3_fsblk_t block;
+	unsigned long flags;
+	int ret = -ENOMEM;
 
-	lsb = kzalloc(sizeof(struct ljx_ext3_superblock), GFP_KERNEL);
+	/* the probe may run from bio completion */
+	lsb = kzalloc(sizeof(struct ljx_ext3_superblock), GFP_ATOMIC);
 	if (! lsb)
 		return -ENOMEM;
-	pp_lsb = &vbd->superblock;
-	*pp_lsb = lsb;
+	lsb->start = part->sector;
 
 	/* compute blocksize
 	minsize = bdev_logical_block_size(vbd->bdev);
@@ -133,53 +541,152 @@ extern int ljx_ext3_fill_super(
 	if (size < minsize)
 		size = minsize;
 	*/
-	blocksize = vbd->bdev->bd_block_size;
-
-	lsb->inodes_count      =  le32_to_cpu(sb->s_inodes_count);
-	lsb->blocks_count      =  le32_to_cpu(sb->s_blocks_count);
-	lsb->inode_size        =  le32_to_cpu(sb->s_inode_size);
-	lsb->first_data_block  =  le32_to_cpu(sb->s_first_data_block);
-	lsb->log_block_size    =  le32_to_cpu(sb->s_log_block_size);
-	lsb->log_frag_size     =  le32_to_cpu(sb->s_log_frag_size);
-	lsb->blocks_per_group  =  le32_to_cpu(sb->s_blocks_per_group);
-	lsb->frags_per_group   =  le32_to_cpu(sb->s_frags_per_group);
-	lsb->inodes_per_group  =  le32_to_cpu(sb->s_inodes_per_group);
-	lsb->first_inode       =  le32_to_cpu(sb->s_first_ino);
-	lsb->journal_inum      =  le32_to_cpu(sb->s_journal_inum);
-	lsb->inodes_per_block  =  blocksize / le32_to_cpu(sb->s_inode_size);
-	lsb->desc_per_block    =  blocksize / sizeof(struct ext3_group_desc);
-	lsb->groups_count      =  ((le32_to_cpu(sb->s_blocks_count) -
-			       le32_to_cpu(sb->s_first_data_block) - 1)
-				       / lsb->blocks_per_group) + 1;
-	lsb->first_meta_bg     =  le32_to_cpu(sb->s_first_meta_bg);
-	lsb->feature_incompat  =  le32_to_cpu(sb->s_feature_incompat);
-	lsb->feature_ro_compat  =  le32_to_cpu(sb->s_feature_ro_compat);
-	lsb->block_size		=  EXT3_MIN_BLOCK_SIZE << lsb->log_block_size;
+
+	if (ljx_layout_init(lsb, sb)) {
+		LJX_INFO(LJX_LOG_EXT3, "unsupported filesystem layout");
+		ret = -EINVAL;
+		goto fail;
+	}
+	if (ljx_block_to_sector(lsb, lsb->blocks_count) > part->sector + part->size) {
+		LJX_INFO(LJX_LOG_EXT3, "filesystem overruns its partition");
+		ret = -EINVAL;
+		goto fail;
+	}
 
 	db_count = DIV_ROUND_UP(lsb->groups_count, lsb->desc_per_block);
-	lsb->group_desc = kzalloc(db_count * sizeof(struct ljx_ext3_group_desc *),
-			GFP_KERNEL);
-	if (lsb->group_desc == NULL)
-		return -ENOMEM;
-	lsb->group_desc = kzalloc(db_count * sizeof(*lsb->group_desc), GFP_KERNEL);
+	lsb->group_desc = kzalloc(db_count * sizeof(*lsb->group_desc), GFP_ATOMIC);
+	lsb->groups = kzalloc(lsb->groups_count * sizeof(*lsb->groups), GFP_ATOMIC);
+	lsb->inode_map = ljx_inode_map_alloc();
+	if (! lsb->group_desc || ! lsb->groups || ! lsb->inode_map)
+		goto fail;
+	lsb->block_bitmap = ljx_bitmap_alloc(vbd, lsb);
+	if (lsb->journal_inum)
+		lsb->journal = ljx_journal_alloc(lsb->block_size);
+
+	/* publish before labelling, so the processors can find it */
+	spin_lock_irqsave(&vbd->bootblock->lock, flags);
+	if (part->superblock) {
+		/* someone else got here first */
+		spin_unlock_irqrestore(&vbd->bootblock->lock, flags);
+		ret = 0;
+		goto fail;
+	}
+	smp_wmb();
+	part->superblock = lsb;
+	spin_unlock_irqrestore(&vbd->bootblock->lock, flags);
+	if (ljx_labels_add_fs(vbd->labels, lsb->start, lsb->blocks_count,
+				lsb->sec_per_block))
+		LJX_ERR(LJX_LOG_LABEL, "no room to keep labels by block");
+	ljx_event(LJX_EV_SUPERBLOCK, vbd->pdevice, lsb->start, lsb->sec_per_block,
+			lsb->groups_count);
+
 	groups_left = lsb->groups_count;
 	for (i = 0; i < db_count; i++) {
-		block = descriptor_loc(lsb, i);
+		block = ljx_descriptor_loc(lsb, i);
 		lsb->group_desc[i].init = false;
 		lsb->group_desc[i].location = block;
-		JPRINTK("group desc at %u", block);
-		label = insert_label(
-				&vbd->label_list, 
-				block, 
-				8,
-				GROUP_DESC
-		);
-		label->processor = &process_group_desc;
-	}
-	JPRINTK("Total number of groups: %u", lsb->groups_count);
-	print_label_list(&vbd->label_list);
+		LJX_DEBUG(LJX_LOG_EXT3, "group desc at %lu", (unsigned long) block);
+		/* meta_bg puts descriptors in their groups, which may not exist */
+		if (! valid_block(lsb, block))
+			continue;
+		if (ljx_insert_label(
+				vbd->labels,
+				ljx_block_to_sector(lsb, block),
+				lsb->sec_per_block,
+				GROUP_DESC,
+				&process_group_desc))
+			unlabelled++;
+	}
+	/* lsb is published by now; the attach scan reads them by location */
+	if (unlabelled)
+		LJX_ERR(LJX_LOG_LABEL, "no room to label %u group descriptor blocks",
+				unlabelled);
+	LJX_DEBUG(LJX_LOG_EXT3, "Total number of groups: %u", lsb->groups_count);
+	ljx_print_labels(vbd->labels);
 
 	return 0;
+
+fail:
+	ljx_ext3_free_super(lsb);
+	return ret;
+}
+
+extern int ljx_ext3_probe(
+		struct bio *bio,
+		struct xen_vbd *vbd,
+		struct label *label
+) {
+	struct partition_record *part;
+	char *buf;
+	int ret;
+
+	part = ljx_find_partition(vbd, label->sector);
+	if (part && part->superblock)
+		return 0;
+	/* a disk without a partition table may hold a filesystem of its own */
+	if (! part && (label->sector != LJX_SB_OFFSET || vbd->bootblock->mbr))
+		return 0;
+
+	buf = kmalloc(sizeof(struct ext3_super_block), GFP_ATOMIC);
+	if (! buf)
+		return -ENOMEM;
+	if ((ret = valid_ext3_superblock(bio, label->sector, buf)))
+		goto out;
+	if (! part && ! (part = ljx_add_partition(vbd, 0, vbd->size, EMPTY_PT, 0)))
+		goto out;
+
+	LJX_DEBUG(LJX_LOG_EXT3, "parsing superblock");
+	ret = ljx_ext3_fill_super(vbd, part, (struct ext3_super_block *) buf);
+	if (ret)
+		LJX_INFO(LJX_LOG_EXT3, "ljx_ext3_fill_super returned error");
+	else
+		LJX_INFO(LJX_LOG_EXT3, "ext3 at sector %llu: %llu blocks of %u bytes",
+				(unsigned long long) part->sector,
+				(unsigned long long) part->superblock->blocks_count,
+				part->superblock->block_size);
+out:
+	kfree(buf);
+	return ret < 0 ? ret : 0;
+}
+
+extern void ljx_ext3_free_super(struct ljx_ext3_superblock *lsb) {
+	if (! lsb)
+		return;
+	ljx_bitmap_free(lsb->block_bitmap);
+	ljx_journal_free(lsb->journal);
+	kfree(lsb->group_desc);
+	kfree(lsb->groups);
+	ljx_inode_map_free(lsb->inode_map);
+	kfree(lsb);
+}
+
+extern ssize_t ljx_ext3_show_mem(
+		struct ljx_ext3_superblock *lsb,
+		char *buf,
+		size_t size
+) {
+	struct ljx_block_bitmap *bm = lsb->block_bitmap;
+	size_t super, map = 0, bitmap = 0;
+
+	super = sizeof(*lsb) +
+		DIV_ROUND_UP(lsb->groups_count, lsb->desc_per_block) *
+			sizeof(*lsb->group_desc) +
+		lsb->groups_count * sizeof(*lsb->groups);
+	if (lsb->journal)
+		super += sizeof(*lsb->journal);
+	/* the counts are read unlocked; this is only an estimate anyway */
+	if (lsb->inode_map)
+		map = sizeof(*lsb->inode_map) +
+			lsb->inode_map->nr_extents * sizeof(struct ljx_extent);
+	if (bm)
+		bitmap = sizeof(*bm) +
+			3 * BITS_TO_LONGS(lsb->groups_count) * sizeof(long) +
+			2 * lsb->groups_count * sizeof(unsigned long *) +
+			2 * bm->nr_groups * BITS_TO_LONGS(lsb->blocks_per_group) *
+				sizeof(long) +
+			bm->nr_pending * sizeof(struct ljx_free_run);
+	return scnprintf(buf, size, "fs %llu super %zu inode_map %zu bitmap %zu\n",
+			(unsigned long long) lsb->start, super, map, bitmap);
 }
 
 /**
@@ -188,22 +695,18 @@ extern int ljx_ext3_fill_super(
  * buf will contain the superblock (or what would have been the superblock if it had been
  * valid.
  */
-extern int valid_ext3_superblock(struct bio *bio, char *buf) {
+extern int valid_ext3_superblock(struct bio *bio, sector_t sector, char *buf) {
 	/* TODO: make more sophisticated */
 	struct ext3_super_block *sb;
 	size_t start_offset;
 	int ret;
 
-	JPRINTK("testing superblock for validity");
-	if (!bio_contains(bio, 2, 2)) {
-		/* bio doesn't contain sector 2 or 3 */
-		JPRINTK("no");
+	if (!bio_contains(bio, sector, 2))
+		/* bio doesn't contain the superblock */
 		return 1;
-	}
-	JPRINTK("yes");
 
 	/* compute the first byte of the superblock's expected location */
-	start_offset = (2 - bio->bi_sector) * 512;
+	start_offset = (sector - bio->bi_sector) * 512;
 
 	/* traverse data and load into buffer */
 	if ((ret = copy_block(bio, buf, start_offset, sizeof(struct ext3_super_block))))
@@ -213,15 +716,16 @@ extern int valid_ext3_superblock(struct bio *bio, char *buf) {
 	/* do some sanity checks */
 	/* TODO: this is pretty scant at best; also would be nice to detect when the 
 	 * superblock is corrupt and wait until the OS repairs it */
-	JPRINTK("inodes count: %d. blocks count: %d.", le32_to_cpu(sb->s_inodes_count), le32_to_cpu(sb->s_blocks_count));
+	LJX_DEBUG(LJX_LOG_EXT3, "inodes count: %d. blocks count: %d",
+			le32_to_cpu(sb->s_inodes_count), le32_to_cpu(sb->s_blocks_count));
+	if (le16_to_cpu(sb->s_magic) != EXT3_SUPER_MAGIC)
+		return 1;
 	if (!(sb->s_inodes_count && 
 	      sb->s_blocks_count &&
 	      sb->s_inode_size &&
 	      !(sb->s_inode_size & (sb->s_inode_size - 1)) // check power of 2
 	      )) {
-		JPRINTK("one was false!");
-		JPRINTK("%d", le32_to_cpu(sb->s_inodes_count));
-		JPRINTK("%d", le32_to_cpu(sb->s_blocks_count));
+		LJX_DEBUG(LJX_LOG_EXT3, "superblock fails its sanity checks");
 		return 1;
 	}
 
@@ -4,17 +4,30 @@
 #include "common.h"
 
 #define SECTOR_SIZE 512
+#define LJX_SB_OFFSET 2		/* sectors from partition start to superblock */
 
 struct xen_vbd;
+struct ljx_inode_map;
+struct ljx_block_bitmap;
+struct ljx_journal;
 
 struct ljx_ext3_group_desc {
 	bool init;
 	unsigned long location;
 };
 
+/* per-group locations, filled in as group descriptor blocks are seen */
+struct ljx_ext3_group {
+	ext3_fsblk_t block_bitmap;
+	ext3_fsblk_t inode_bitmap;
+	ext3_fsblk_t inode_table;
+	unsigned int flags;			/* ext4 bg_flags */
+};
+
 struct ljx_ext3_superblock {
+	sector_t start;				/* first sector of the partition */
 	unsigned int inodes_count;
-	unsigned int blocks_count;
+	ext3_fsblk_t blocks_count;
 	unsigned int inode_size;
 	unsigned int first_data_block;
 	unsigned int log_block_size;
@@ -26,26 +39,91 @@ struct ljx_ext3_superblock {
 	unsigned int journal_inum;		/* inode number of journal file */
 	unsigned int inodes_per_block;
 	unsigned int desc_per_block;
+	unsigned int desc_size;			/* 32 unless ext4 with 64bit */
+	unsigned int flex_size;			/* groups per flex group */
 	unsigned int groups_count;
 	unsigned int first_meta_bg;
 	unsigned int feature_incompat;
 	unsigned int feature_ro_compat;
 	unsigned int block_size;
+	unsigned int sec_per_block;
+	unsigned int itable_blocks;		/* inode table size per group */
+	/* identity, to tell a saved label map still applies */
+	u8 uuid[16];
+	unsigned int mnt_count;
+	unsigned int wtime;			/* last superblock write */
 	struct ljx_ext3_group_desc *group_desc;
+	struct ljx_ext3_group *groups;
+	struct ljx_inode_map *inode_map;	/* block -> owning inode */
+	struct ljx_block_bitmap *block_bitmap;	/* free space tracking, may be NULL */
+	struct ljx_journal *journal;		/* NULL without a journal inode */
 };
 
+static inline sector_t ljx_block_to_sector(
+		struct ljx_ext3_superblock *lsb,
+		ext3_fsblk_t block
+) {
+	return lsb->start + (sector_t) block * lsb->sec_per_block;
+}
+
+static inline ext3_fsblk_t ljx_sector_to_block(
+		struct ljx_ext3_superblock *lsb,
+		sector_t sector
+) {
+	return (sector - lsb->start) / lsb->sec_per_block;
+}
+
+struct bio;
+struct label;
+struct partition_record;
+
 /**
- * Based on fs/ext3/super.c:1630. Can't use bread, however
+ * Based on fs/ext3/super.c:1630. Can't use bread, however. Sets up the
+ * filesystem on part and starts labelling its metadata.
  */
 extern int ljx_ext3_fill_super(
 		struct xen_vbd *, 
-		struct ext3_super_block *, 
-		int
+		struct partition_record *,
+		struct ext3_super_block *
 );
 
 /**
- * Tests whether the block I/O included a valid superblock
+ * Label processor for the place a superblock may be: sets up the filesystem
+ * of the enclosing partition once a valid superblock goes by.
+ */
+extern int ljx_ext3_probe(struct bio *, struct xen_vbd *, struct label *);
+
+/**
+ * Decodes the groups described by descriptor block nr, whose contents are in
+ * raw. Returns the number of groups it describes.
+ */
+extern unsigned int ljx_ext3_parse_desc_block(struct ljx_ext3_superblock *,
+		unsigned int nr, const char *raw);
+
+#define LJX_GROUP_LABELS	2	/* inode table and block bitmap */
+
+/**
+ * Fills in labels for the metadata a parsed group descriptor points at, and
+ * returns how many there are, at most LJX_GROUP_LABELS.
+ */
+extern unsigned int ljx_ext3_group_labels(struct ljx_ext3_superblock *,
+		unsigned int group, struct label *);
+
+/**
+ * Frees a superblock allocated by ljx_ext3_fill_super and everything parsed
+ * from it
+ */
+extern void ljx_ext3_free_super(struct ljx_ext3_superblock *);
+
+/**
+ * Formats the memory held by the superblock and the indexes parsed from it
+ * into buf.
+ */
+extern ssize_t ljx_ext3_show_mem(struct ljx_ext3_superblock *, char *buf, size_t size);
+
+/**
+ * Tests whether the block I/O included a valid superblock at sector
  */
-extern int valid_ext3_superblock(struct bio *, char *);
+extern int valid_ext3_superblock(struct bio *, sector_t, char *);
 
 #endif
@@ -0,0 +1,243 @@
+/*
+ * heat.c -- decaying per region access counts, exported through debugfs
+ */
+
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/irqflags.h>
+#include <linux/log2.h>
+#include <linux/moduleparam.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+
+#include "common.h"
+#include "heat.h"
+#include "label.h"
+
+static unsigned int heat_region_kb = 1024;
+module_param(heat_region_kb, uint, 0444);
+MODULE_PARM_DESC(heat_region_kb,
+		"KiB per heatmap region, rounded up to a power of two (0 disables heatmaps)");
+
+static unsigned int heat_max_regions = 65536;
+module_param(heat_max_regions, uint, 0444);
+MODULE_PARM_DESC(heat_max_regions,
+		"Most regions in a heatmap; regions grow on larger vbds");
+
+static unsigned int heat_period_ms = 60000;
+module_param(heat_period_ms, uint, 0444);
+MODULE_PARM_DESC(heat_period_ms, "How often heatmaps decay");
+
+static unsigned int heat_decay_shift = 1;
+module_param(heat_decay_shift, uint, 0644);
+MODULE_PARM_DESC(heat_decay_shift,
+		"Heat left after a period is divided by 2 to this power");
+
+/* labels read at a time when a snapshot is taken */
+#define LJX_HEAT_LABEL_BATCH	128
+
+extern void ljx_heat_add(struct ljx_heat *heat, sector_t sector, unsigned int nr_sec) {
+	sector_t end = sector + nr_sec, next;
+	unsigned long flags, region;
+	u32 *counts;
+
+	local_irq_save(flags);
+	counts = heat->counts[smp_processor_id()];
+	while (sector < end) {
+		region = sector >> heat->region_shift;
+		if (region >= heat->nr_regions)
+			break;
+		next = min(end, (sector_t) (region + 1) << heat->region_shift);
+		counts[region] += next - sector;
+		sector = next;
+	}
+	local_irq_restore(flags);
+}
+
+/* what the cpus counted in region, summed; wraps like the counts do */
+static u32 sum_counts(struct ljx_heat *heat, unsigned long region) {
+	unsigned int cpu;
+	u32 sum = 0;
+
+	for_each_possible_cpu(cpu)
+		sum += ACCESS_ONCE(heat->counts[cpu][region]);
+	return sum;
+}
+
+static void fold_work(struct work_struct *work) {
+	struct ljx_heat *heat = container_of(to_delayed_work(work),
+			struct ljx_heat, fold);
+	unsigned int shift = min(ACCESS_ONCE(heat_decay_shift), 31U);
+	unsigned long region;
+	u32 sum;
+
+	mutex_lock(&heat->lock);
+	for (region = 0; region < heat->nr_regions; region++) {
+		sum = sum_counts(heat, region);
+		heat->heat[region] -= heat->heat[region] >> shift;
+		heat->heat[region] += sum - heat->last[region];
+		heat->last[region] = sum;
+	}
+	heat->periods++;
+	mutex_unlock(&heat->lock);
+	schedule_delayed_work(&heat->fold, msecs_to_jiffies(heat->period_ms));
+}
+
+static bool any_label(void *priv, const struct label *label) {
+	return true;
+}
+
+/* marks the label types in each region */
+static void snapshot_types(struct ljx_heat *heat, u16 *types) {
+	sector_t sector = 0, end, s;
+	unsigned long region;
+	struct label *batch;
+	unsigned int i, n;
+
+	if (! heat->vbd->labels)
+		return;
+	batch = kmalloc(LJX_HEAT_LABEL_BATCH * sizeof(*batch), GFP_KERNEL);
+	if (! batch)
+		return;
+	while ((n = ljx_copy_labels(heat->vbd->labels, sector, any_label, NULL,
+					batch, LJX_HEAT_LABEL_BATCH))) {
+		for (i = 0; i < n; i++) {
+			end = batch[i].sector + batch[i].nr_sec;
+			/* every label returned ends past sector, so this moves on */
+			sector = max(sector, end);
+			s = batch[i].sector;
+			while (s < end) {
+				region = s >> heat->region_shift;
+				if (region >= heat->nr_regions)
+					break;
+				types[region] |= 1 << batch[i].label;
+				s = (sector_t) (region + 1) << heat->region_shift;
+			}
+		}
+	}
+	kfree(batch);
+}
+
+/* the snapshot a reader gets, built when the file is opened */
+struct heat_file {
+	size_t			len;
+	char			data[0];
+};
+
+static int heatmap_open(struct inode *inode, struct file *file) {
+	struct ljx_heat *heat = inode->i_private;
+	struct ljx_heat_snapshot *snap;
+	struct heat_file *hf;
+	unsigned long region;
+	u32 *values;
+	u16 *types;
+	size_t len;
+
+	len = sizeof(*snap) + heat->nr_regions * (sizeof(*values) + sizeof(*types));
+	hf = vzalloc(sizeof(*hf) + len);
+	if (! hf)
+		return -ENOMEM;
+	hf->len = len;
+	snap = (struct ljx_heat_snapshot *) hf->data;
+	values = (u32 *) (snap + 1);
+	types = (u16 *) (values + heat->nr_regions);
+
+	snap->magic = LJX_HEAT_MAGIC;
+	snap->nr_regions = heat->nr_regions;
+	snap->sectors = heat->sectors;
+	snap->region_sectors = 1U << heat->region_shift;
+	snap->decay_shift = heat_decay_shift;
+	snap->period_ms = heat->period_ms;
+	mutex_lock(&heat->lock);
+	snap->periods = heat->periods;
+	/* with what came in since the last fold, undecayed */
+	for (region = 0; region < heat->nr_regions; region++)
+		values[region] = heat->heat[region] +
+			sum_counts(heat, region) - heat->last[region];
+	mutex_unlock(&heat->lock);
+	snapshot_types(heat, types);
+
+	file->private_data = hf;
+	return 0;
+}
+
+static ssize_t heatmap_read(struct file *file, char __user *buf, size_t count,
+		loff_t *ppos) {
+	struct heat_file *hf = file->private_data;
+
+	return simple_read_from_buffer(buf, count, ppos, hf->data, hf->len);
+}
+
+static int heatmap_release(struct inode *inode, struct file *file) {
+	vfree(file->private_data);
+	return 0;
+}
+
+static const struct file_operations heatmap_fops = {
+	.owner		= THIS_MODULE,
+	.open		= heatmap_open,
+	.read		= heatmap_read,
+	.llseek		= default_llseek,
+	.release	= heatmap_release,
+};
+
+extern struct ljx_heat *ljx_heat_alloc(struct xen_vbd *vbd) {
+	struct ljx_heat *heat;
+	unsigned int cpu;
+
+	if (! heat_region_kb || ! vbd->debugfs || ! vbd->size)
+		return NULL;
+	heat = kzalloc(sizeof(*heat), GFP_KERNEL);
+	if (! heat)
+		return NULL;
+	heat->vbd = vbd;
+	heat->sectors = vbd->size;
+	heat->period_ms = max(heat_period_ms, 1000U);
+	heat->region_shift = ilog2(roundup_pow_of_two(heat_region_kb * 2));
+	while (((heat->sectors - 1) >> heat->region_shift) + 1 > max(heat_max_regions, 1U))
+		heat->region_shift++;
+	heat->nr_regions = ((heat->sectors - 1) >> heat->region_shift) + 1;
+	mutex_init(&heat->lock);
+	INIT_DELAYED_WORK(&heat->fold, fold_work);
+
+	heat->counts = kcalloc(nr_cpu_ids, sizeof(*heat->counts), GFP_KERNEL);
+	heat->last = vzalloc(heat->nr_regions * sizeof(u32));
+	heat->heat = vzalloc(heat->nr_regions * sizeof(u32));
+	if (! heat->counts || ! heat->last || ! heat->heat)
+		goto fail;
+	for_each_possible_cpu(cpu) {
+		heat->counts[cpu] = vzalloc(heat->nr_regions * sizeof(u32));
+		if (! heat->counts[cpu])
+			goto fail;
+	}
+
+	heat->file = debugfs_create_file("heatmap", S_IRUSR, vbd->debugfs, heat,
+			&heatmap_fops);
+	if (IS_ERR_OR_NULL(heat->file))
+		goto fail;
+	schedule_delayed_work(&heat->fold, msecs_to_jiffies(heat->period_ms));
+	return heat;
+
+fail:
+	ljx_heat_free(heat);
+	return NULL;
+}
+
+extern void ljx_heat_free(struct ljx_heat *heat) {
+	unsigned int cpu;
+
+	if (! heat)
+		return;
+	if (! IS_ERR_OR_NULL(heat->file))
+		debugfs_remove(heat->file);
+	cancel_delayed_work_sync(&heat->fold);
+	if (heat->counts) {
+		for_each_possible_cpu(cpu)
+			vfree(heat->counts[cpu]);
+		kfree(heat->counts);
+	}
+	vfree(heat->last);
+	vfree(heat->heat);
+	kfree(heat);
+}
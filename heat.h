@@ -0,0 +1,67 @@
+#ifndef _HEAT_H
+#define _HEAT_H
+
+#include <linux/types.h>
+
+/*
+ * Which regions of a vbd the guest uses, as a debugfs file per vbd:
+ * ljx/<domid>-<handle>/heatmap. Reading it gives a snapshot of the header
+ * below, then the heat of every region as a __u32, then the label types in
+ * every region as a __u16 of 1 << label_t, so hot metadata can be told
+ * from hot data.
+ *
+ * Heat is the sectors the guest moved in a region, with what came before
+ * the last period divided by 2^decay_shift once per period.
+ */
+
+#define LJX_HEAT_MAGIC		0x4c4a5848	/* "LJXH" */
+
+struct ljx_heat_snapshot {
+	__u32			magic;
+	__u32			nr_regions;
+	__u64			sectors;	/* of the vbd when it was attached */
+	__u32			region_sectors;
+	__u32			decay_shift;
+	__u32			period_ms;
+	__u32			pad;
+	__u64			periods;	/* decayed so far */
+};
+
+#ifdef __KERNEL__
+
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+
+struct xen_vbd;
+struct dentry;
+
+struct ljx_heat {
+	struct xen_vbd		*vbd;
+	sector_t		sectors;
+	unsigned int		region_shift;	/* log2 of sectors per region */
+	unsigned long		nr_regions;
+	u32			**counts;	/* per cpu, they only go up */
+	u32			*last;		/* the counts summed at the last fold */
+	u32			*heat;		/* decayed up to the last fold */
+	u64			periods;
+	unsigned int		period_ms;
+	struct mutex		lock;		/* the fold against snapshots */
+	struct delayed_work	fold;
+	struct dentry		*file;
+};
+
+/**
+ * Returns a heatmap of vbd, or NULL if heatmaps or debugfs are off or
+ * there's no memory.
+ */
+extern struct ljx_heat *ljx_heat_alloc(struct xen_vbd *);
+extern void ljx_heat_free(struct ljx_heat *);
+
+/**
+ * Counts nr_sec sectors moved at sector. Safe from bio completion.
+ */
+extern void ljx_heat_add(struct ljx_heat *, sector_t sector, unsigned int nr_sec);
+
+#endif
+
+#endif
@@ -0,0 +1,24 @@
+/*
+ * hist.c -- power of two histograms
+ */
+
+#include "hist.h"
+
+extern ssize_t ljx_hist_show(const struct ljx_hist *hist, char *buf, size_t size) {
+	unsigned long long low, high;
+	ssize_t len;
+	int i;
+
+	len = scnprintf(buf, size, "%llu %llu\n",
+			(unsigned long long) hist->count,
+			(unsigned long long) hist->sum);
+	for (i = 0; i < LJX_HIST_BUCKETS; i++) {
+		if (! hist->buckets[i])
+			continue;
+		low = i ? 1ULL << (i - 1) : 0;
+		high = i == LJX_HIST_BUCKETS - 1 ? ~0ULL : (1ULL << i) - 1;
+		len += scnprintf(buf + len, size - len, "%llu %llu %llu\n",
+				low, high, (unsigned long long) hist->buckets[i]);
+	}
+	return len;
+}
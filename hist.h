@@ -0,0 +1,40 @@
+#ifndef _HIST_H
+#define _HIST_H
+
+#include <linux/kernel.h>
+#include <linux/bitops.h>
+
+#define LJX_HIST_BUCKETS	32
+
+/**
+ * Power of two histogram. Bucket 0 counts zeroes and bucket n counts values
+ * in [2^(n-1), 2^n); the last bucket also takes everything larger.
+ */
+struct ljx_hist {
+	u64			buckets[LJX_HIST_BUCKETS];
+	u64			count;
+	u64			sum;
+};
+
+static inline void ljx_hist_add(struct ljx_hist *hist, u64 value) {
+	hist->buckets[min(fls64(value), LJX_HIST_BUCKETS - 1)]++;
+	hist->count++;
+	hist->sum += value;
+}
+
+static inline void ljx_hist_merge(struct ljx_hist *hist, const struct ljx_hist *from) {
+	int i;
+
+	for (i = 0; i < LJX_HIST_BUCKETS; i++)
+		hist->buckets[i] += from->buckets[i];
+	hist->count += from->count;
+	hist->sum += from->sum;
+}
+
+/**
+ * Formats a histogram as a "count sum" line followed by one "low high count"
+ * line per non-empty bucket. Returns the number of bytes written.
+ */
+extern ssize_t ljx_hist_show(const struct ljx_hist *, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,253 @@
+/*
+ * hot_files.c -- the busiest guest files, by count-min sketch and top-K heap
+ */
+
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/seq_file.h>
+#include <linux/sort.h>
+#include <linux/vmalloc.h>
+
+#include "common.h"
+#include "hot_files.h"
+#include "ext3.h"
+#include "inode_map.h"
+
+/* the guest picks its inode numbers, so the seeds are random */
+static inline unsigned int cell_index(struct ljx_hot_files *hot, int row,
+		u64 fs, unsigned int ino) {
+	return jhash_3words(ino, (u32) fs, (u32) (fs >> 32), hot->seed[row]) &
+		(LJX_HOT_WIDTH - 1);
+}
+
+static inline bool same_file(struct ljx_hot_file *f, u64 fs, unsigned int ino) {
+	return f->ino == ino && f->fs == fs;
+}
+
+static inline void swap_files(struct ljx_hot_file *a, struct ljx_hot_file *b) {
+	struct ljx_hot_file tmp = *a;
+
+	*a = *b;
+	*b = tmp;
+}
+
+static void sift_up(struct ljx_hot_files *hot, unsigned int i) {
+	unsigned int parent;
+
+	while (i) {
+		parent = (i - 1) / 2;
+		if (hot->heap[parent].bytes <= hot->heap[i].bytes)
+			break;
+		swap_files(&hot->heap[parent], &hot->heap[i]);
+		i = parent;
+	}
+}
+
+/* estimates only grow, so an entry that was counted can only sink */
+static void sift_down(struct ljx_hot_files *hot, unsigned int i) {
+	unsigned int child;
+
+	while ((child = 2 * i + 1) < hot->nr) {
+		if (child + 1 < hot->nr &&
+		    hot->heap[child + 1].bytes < hot->heap[child].bytes)
+			child++;
+		if (hot->heap[i].bytes <= hot->heap[child].bytes)
+			break;
+		swap_files(&hot->heap[i], &hot->heap[child]);
+		i = child;
+	}
+}
+
+extern void ljx_hot_files_add(
+		struct ljx_hot_files *hot,
+		u64 fs,
+		unsigned int ino,
+		u64 bytes,
+		unsigned int ops,
+		bool write
+) {
+	struct ljx_hot_cell *cell;
+	unsigned long flags;
+	u64 estimate = ~0ULL;
+	unsigned int i;
+	int row;
+
+	spin_lock_irqsave(&hot->lock, flags);
+	for (row = 0; row < LJX_HOT_ROWS; row++) {
+		cell = &hot->cells[row][cell_index(hot, row, fs, ino)];
+		if (write) {
+			cell->wr_bytes += bytes;
+			cell->wr_ops += ops;
+		} else {
+			cell->rd_bytes += bytes;
+			cell->rd_ops += ops;
+		}
+		estimate = min(estimate, cell->rd_bytes + cell->wr_bytes);
+	}
+
+	/* the heap is small enough that a scan beats keeping an index */
+	for (i = 0; i < hot->nr; i++)
+		if (same_file(&hot->heap[i], fs, ino))
+			break;
+	if (i < hot->nr) {
+		hot->heap[i].bytes = estimate;
+		sift_down(hot, i);
+	} else if (hot->nr < LJX_HOT_FILES) {
+		hot->heap[hot->nr].fs = fs;
+		hot->heap[hot->nr].ino = ino;
+		hot->heap[hot->nr].bytes = estimate;
+		sift_up(hot, hot->nr++);
+	} else if (estimate > hot->heap[0].bytes) {
+		/* the coolest file makes room */
+		hot->heap[0].fs = fs;
+		hot->heap[0].ino = ino;
+		hot->heap[0].bytes = estimate;
+		sift_down(hot, 0);
+	}
+	spin_unlock_irqrestore(&hot->lock, flags);
+}
+
+/* an I/O being charged to the files it touches */
+struct file_io {
+	struct ljx_hot_files		*hot;
+	struct ljx_ext3_superblock	*lsb;
+	unsigned int			weight;
+	bool				write;
+	unsigned int			blocks;		/* of data, so far */
+};
+
+static void charge_file(void *priv, unsigned int ino, unsigned int nr_blocks) {
+	struct file_io *io = priv;
+
+	io->blocks += nr_blocks;
+	if (io->hot)
+		ljx_hot_files_add(io->hot, io->lsb->start, ino,
+				(u64) nr_blocks * io->lsb->block_size * io->weight,
+				io->weight, io->write);
+}
+
+extern unsigned int ljx_hot_files_account(
+		struct ljx_hot_files *hot,
+		struct ljx_ext3_superblock *lsb,
+		sector_t sector,
+		unsigned int nr_sec,
+		unsigned int weight,
+		bool write
+) {
+	struct file_io io = {
+		.hot	= hot,
+		.lsb	= lsb,
+		.weight	= weight,
+		.write	= write,
+	};
+	ext3_fsblk_t first, last;
+
+	if (! lsb->inode_map || ! nr_sec)
+		return 0;
+	first = ljx_sector_to_block(lsb, sector);
+	last = ljx_sector_to_block(lsb, sector + nr_sec - 1);
+	ljx_inode_map_account(lsb->inode_map, first, last - first + 1,
+			charge_file, &io);
+	/* the blocks at either end may be only partly in the I/O */
+	return min_t(u64, (u64) io.blocks * lsb->sec_per_block, nr_sec);
+}
+
+/* what a reader gets for one file */
+struct hot_line {
+	u64			fs;
+	unsigned int		ino;
+	struct ljx_hot_cell	est;
+};
+
+/* the smallest count of each field over the rows; must hold hot->lock */
+static void estimate(struct ljx_hot_files *hot, struct hot_line *line) {
+	struct ljx_hot_cell *cell;
+	int row;
+
+	memset(&line->est, 0xff, sizeof(line->est));
+	for (row = 0; row < LJX_HOT_ROWS; row++) {
+		cell = &hot->cells[row][cell_index(hot, row, line->fs, line->ino)];
+		line->est.rd_bytes = min(line->est.rd_bytes, cell->rd_bytes);
+		line->est.wr_bytes = min(line->est.wr_bytes, cell->wr_bytes);
+		line->est.rd_ops = min(line->est.rd_ops, cell->rd_ops);
+		line->est.wr_ops = min(line->est.wr_ops, cell->wr_ops);
+	}
+}
+
+static int hotter(const void *a, const void *b) {
+	const struct hot_line *x = a, *y = b;
+	u64 bx = x->est.rd_bytes + x->est.wr_bytes;
+	u64 by = y->est.rd_bytes + y->est.wr_bytes;
+
+	return bx > by ? -1 : bx < by;
+}
+
+static int hot_files_show(struct seq_file *m, void *v) {
+	struct ljx_hot_files *hot = m->private;
+	struct hot_line *lines;
+	unsigned long flags;
+	unsigned int i, nr;
+
+	lines = kmalloc(LJX_HOT_FILES * sizeof(*lines), GFP_KERNEL);
+	if (! lines)
+		return -ENOMEM;
+	spin_lock_irqsave(&hot->lock, flags);
+	nr = hot->nr;
+	for (i = 0; i < nr; i++) {
+		lines[i].fs = hot->heap[i].fs;
+		lines[i].ino = hot->heap[i].ino;
+		estimate(hot, &lines[i]);
+	}
+	spin_unlock_irqrestore(&hot->lock, flags);
+
+	sort(lines, nr, sizeof(*lines), hotter, NULL);
+	for (i = 0; i < nr; i++)
+		seq_printf(m, "%llu %u %llu %llu %llu %llu\n",
+				(unsigned long long) lines[i].fs, lines[i].ino,
+				(unsigned long long) lines[i].est.rd_bytes,
+				(unsigned long long) lines[i].est.wr_bytes,
+				(unsigned long long) lines[i].est.rd_ops,
+				(unsigned long long) lines[i].est.wr_ops);
+	kfree(lines);
+	return 0;
+}
+
+static int hot_files_open(struct inode *inode, struct file *file) {
+	return single_open(file, hot_files_show, inode->i_private);
+}
+
+static const struct file_operations hot_files_fops = {
+	.owner		= THIS_MODULE,
+	.open		= hot_files_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+extern struct ljx_hot_files *ljx_hot_files_alloc(struct xen_vbd *vbd) {
+	struct ljx_hot_files *hot;
+
+	if (! vbd->debugfs)
+		return NULL;
+	hot = vzalloc(sizeof(*hot));
+	if (! hot)
+		return NULL;
+	spin_lock_init(&hot->lock);
+	get_random_bytes(hot->seed, sizeof(hot->seed));
+	hot->file = debugfs_create_file("hot_files", S_IRUSR, vbd->debugfs, hot,
+			&hot_files_fops);
+	if (IS_ERR_OR_NULL(hot->file)) {
+		vfree(hot);
+		return NULL;
+	}
+	return hot;
+}
+
+extern void ljx_hot_files_free(struct ljx_hot_files *hot) {
+	if (! hot)
+		return;
+	debugfs_remove(hot->file);
+	vfree(hot);
+}
@@ -0,0 +1,74 @@
+#ifndef _HOT_FILES_H
+#define _HOT_FILES_H
+
+#include <linux/kernel.h>
+#include <linux/spinlock.h>
+
+/*
+ * The busiest guest files of a vbd, in fixed memory however many files the
+ * guest has. Every data block I/O whose owning inode is known goes into a
+ * count-min sketch, and the LJX_HOT_FILES files with the most bytes by that
+ * sketch are kept in a min-heap. The sketch only ever overestimates, by at
+ * most e / LJX_HOT_WIDTH of all the bytes counted in all but 1 / e^rows of
+ * cases, so a file that really is among the busiest stays in the heap.
+ *
+ * Read as debugfs ljx/<domid>-<handle>/hot_files, hottest first, one
+ * "fs ino rd_bytes wr_bytes rd_ops wr_ops" line per file, where fs is the
+ * first sector of the filesystem the inode number belongs to.
+ */
+
+#define LJX_HOT_ROWS		4
+#define LJX_HOT_WIDTH		1024	/* a power of two */
+#define LJX_HOT_FILES		64
+
+struct ljx_hot_cell {
+	u64			rd_bytes;
+	u64			wr_bytes;
+	u64			rd_ops;
+	u64			wr_ops;
+};
+
+struct ljx_hot_file {
+	u64			fs;
+	u64			bytes;	/* the estimate when last counted */
+	unsigned int		ino;
+};
+
+struct xen_vbd;
+struct dentry;
+struct ljx_ext3_superblock;
+
+struct ljx_hot_files {
+	spinlock_t		lock;
+	u32			seed[LJX_HOT_ROWS];
+	unsigned int		nr;
+	struct ljx_hot_file	heap[LJX_HOT_FILES];
+	struct ljx_hot_cell	cells[LJX_HOT_ROWS][LJX_HOT_WIDTH];
+	struct dentry		*file;
+};
+
+/**
+ * Returns an empty report for vbd, or NULL if debugfs is off or there's no
+ * memory.
+ */
+extern struct ljx_hot_files *ljx_hot_files_alloc(struct xen_vbd *);
+extern void ljx_hot_files_free(struct ljx_hot_files *);
+
+/**
+ * Counts ops I/Os moving bytes to or from inode ino of the filesystem at fs.
+ * Safe from bio completion.
+ */
+extern void ljx_hot_files_add(struct ljx_hot_files *, u64 fs, unsigned int ino,
+		u64 bytes, unsigned int ops, bool write);
+
+/**
+ * Counts an I/O of nr_sec sectors at sector, inside filesystem lsb, against
+ * the files owning the data blocks it covers, as weight I/Os. With a NULL
+ * report nothing is counted. Returns how many of the sectors are file data,
+ * by the inode map. Safe from bio completion.
+ */
+extern unsigned int ljx_hot_files_account(struct ljx_hot_files *,
+		struct ljx_ext3_superblock *, sector_t sector, unsigned int nr_sec,
+		unsigned int weight, bool write);
+
+#endif
@@ -0,0 +1,378 @@
+/*
+ * inode_map.c -- reverse map from guest filesystem blocks to owning inodes
+ */
+
+#include <linux/slab.h>
+
+#include "inode_map.h"
+
+extern struct ljx_inode_map *ljx_inode_map_alloc(void) {
+	struct ljx_inode_map *map;
+
+	map = kzalloc(sizeof(struct ljx_inode_map), GFP_ATOMIC);
+	if (! map)
+		return NULL;
+	spin_lock_init(&map->lock);
+	map->extents = RB_ROOT;
+	map->files = RB_ROOT;
+	return map;
+}
+
+extern void ljx_inode_map_free(struct ljx_inode_map *map) {
+	struct rb_node *node;
+
+	if (! map)
+		return;
+	while ((node = rb_first(&map->extents))) {
+		rb_erase(node, &map->extents);
+		kfree(rb_entry(node, struct ljx_extent, node));
+	}
+	kfree(map);
+}
+
+static inline ext3_fsblk_t extent_end(struct ljx_extent *ext) {
+	return ext->start + ext->len;
+}
+
+/* returns the extent with the greatest start <= block, or NULL */
+static struct ljx_extent *extent_search(struct rb_root *root, ext3_fsblk_t block) {
+	struct rb_node *node = root->rb_node;
+	struct ljx_extent *ext, *best = NULL;
+
+	while (node) {
+		ext = rb_entry(node, struct ljx_extent, node);
+		if (block < ext->start)
+			node = node->rb_left;
+		else {
+			best = ext;
+			node = node->rb_right;
+		}
+	}
+	return best;
+}
+
+/* returns the first extent that ends after block, or NULL */
+static struct ljx_extent *extent_first_after(struct rb_root *root, ext3_fsblk_t block) {
+	struct ljx_extent *ext;
+	struct rb_node *node;
+
+	ext = extent_search(root, block);
+	if (ext && extent_end(ext) > block)
+		return ext;
+	node = ext ? rb_next(&ext->node) : rb_first(root);
+	return node ? rb_entry(node, struct ljx_extent, node) : NULL;
+}
+
+static void extent_insert(struct rb_root *root, struct ljx_extent *new) {
+	struct rb_node **p = &root->rb_node, *parent = NULL;
+	struct ljx_extent *ext;
+
+	while (*p) {
+		parent = *p;
+		ext = rb_entry(parent, struct ljx_extent, node);
+		if (new->start < ext->start)
+			p = &(*p)->rb_left;
+		else
+			p = &(*p)->rb_right;
+	}
+	rb_link_node(&new->node, parent, p);
+	rb_insert_color(&new->node, root);
+}
+
+/* data extents are in file order by inode, then by file block */
+static void file_insert(struct rb_root *root, struct ljx_extent *new) {
+	struct rb_node **p = &root->rb_node, *parent = NULL;
+	struct ljx_extent *ext;
+
+	while (*p) {
+		parent = *p;
+		ext = rb_entry(parent, struct ljx_extent, file_node);
+		if (new->ino < ext->ino ||
+		    (new->ino == ext->ino && new->lblock < ext->lblock))
+			p = &(*p)->rb_left;
+		else
+			p = &(*p)->rb_right;
+	}
+	rb_link_node(&new->file_node, parent, p);
+	rb_insert_color(&new->file_node, root);
+}
+
+/* returns the first data extent of ino that ends after lblock, or NULL */
+static struct ljx_extent *file_first_after(struct rb_root *root, unsigned int ino,
+		u32 lblock) {
+	struct rb_node *node = root->rb_node;
+	struct ljx_extent *ext, *best = NULL;
+
+	/* the last one starting at or before lblock may still cover it */
+	while (node) {
+		ext = rb_entry(node, struct ljx_extent, file_node);
+		if (ext->ino < ino || (ext->ino == ino && ext->lblock <= lblock)) {
+			best = ext;
+			node = node->rb_right;
+		} else
+			node = node->rb_left;
+	}
+	if (best && best->ino == ino && (u64) best->lblock + best->len > lblock)
+		return best;
+	node = best ? rb_next(&best->file_node) : rb_first(root);
+	if (! node)
+		return NULL;
+	ext = rb_entry(node, struct ljx_extent, file_node);
+	return ext->ino == ino ? ext : NULL;
+}
+
+/* puts an extent into the map, and data into file order too */
+static void extent_link(struct ljx_inode_map *map, struct ljx_extent *ext) {
+	extent_insert(&map->extents, ext);
+	if (! ext->depth)
+		file_insert(&map->files, ext);
+	map->nr_extents++;
+}
+
+/* takes an extent out of the map and frees it */
+static void extent_unlink(struct ljx_inode_map *map, struct ljx_extent *ext) {
+	rb_erase(&ext->node, &map->extents);
+	if (! ext->depth)
+		rb_erase(&ext->file_node, &map->files);
+	map->nr_extents--;
+	kfree(ext);
+}
+
+/*
+ * Moves the start of an extent, keeping its end. The new start must not take
+ * it past a neighbour on the disk, but its place in the file may change.
+ */
+static void extent_set_start(struct ljx_inode_map *map, struct ljx_extent *ext,
+		ext3_fsblk_t start, u32 lblock) {
+	ext->len = extent_end(ext) - start;
+	ext->start = start;
+	if (ext->depth) {
+		ext->lblock = lblock;
+		return;
+	}
+	rb_erase(&ext->file_node, &map->files);
+	ext->lblock = lblock;
+	file_insert(&map->files, ext);
+}
+
+static inline struct ljx_extent *next_extent(struct ljx_extent *ext) {
+	struct rb_node *node = rb_next(&ext->node);
+	return node ? rb_entry(node, struct ljx_extent, node) : NULL;
+}
+
+static inline struct ljx_extent *prev_extent(struct ljx_extent *ext) {
+	struct rb_node *node = rb_prev(&ext->node);
+	return node ? rb_entry(node, struct ljx_extent, node) : NULL;
+}
+
+static inline bool same_owner(struct ljx_extent *ext, unsigned int ino,
+		unsigned char depth) {
+	return ext->ino == ino && ext->depth == depth;
+}
+
+/* the file block that block of ext holds */
+static inline u32 block_lblock(struct ljx_extent *ext, ext3_fsblk_t block) {
+	return ext->lblock + (u32) (block - ext->start);
+}
+
+extern int ljx_inode_map_add(
+		struct ljx_inode_map *map,
+		ext3_fsblk_t start,
+		unsigned int len,
+		unsigned int ino,
+		unsigned char depth,
+		u32 lblock
+) {
+	struct ljx_extent *ext, *next, *prev, *spare[2];
+	ext3_fsblk_t end = start + len;
+	unsigned long flags;
+	int nspare = 2;
+
+	if (! len)
+		return 0;
+
+	/* allocate up front: at most one split and one new node are needed */
+	spare[0] = kmalloc(sizeof(struct ljx_extent), GFP_ATOMIC);
+	spare[1] = kmalloc(sizeof(struct ljx_extent), GFP_ATOMIC);
+	if (! spare[0] || ! spare[1]) {
+		kfree(spare[0]);
+		kfree(spare[1]);
+		return -ENOMEM;
+	}
+
+	spin_lock_irqsave(&map->lock, flags);
+
+	/* carve [start, end) out of whatever currently covers it */
+	ext = extent_first_after(&map->extents, start);
+	while (ext && ext->start < end) {
+		next = next_extent(ext);
+		if (ext->start <= start && extent_end(ext) >= end &&
+				same_owner(ext, ino, depth) &&
+				block_lblock(ext, start) == lblock)
+			/* already known */
+			goto out;
+		if (ext->start < start) {
+			if (extent_end(ext) > end) {
+				/* split: keep the tail as its own extent */
+				struct ljx_extent *tail = spare[--nspare];
+				tail->start = end;
+				tail->len = extent_end(ext) - end;
+				tail->ino = ext->ino;
+				tail->depth = ext->depth;
+				tail->lblock = block_lblock(ext, end);
+				ext->len = start - ext->start;
+				extent_link(map, tail);
+				break;
+			}
+			ext->len = start - ext->start;
+		} else if (extent_end(ext) <= end) {
+			extent_unlink(map, ext);
+		} else {
+			/* moving the start forward keeps the tree ordered */
+			extent_set_start(map, ext, end, block_lblock(ext, end));
+			break;
+		}
+		ext = next;
+	}
+
+	/*
+	 * Run-length encode: try to extend a neighbour instead of inserting.
+	 * Block map blocks seldom map neighbouring parts of the file, so they
+	 * mostly get an extent each.
+	 */
+	prev = extent_search(&map->extents, start);
+	next = prev ? next_extent(prev) : extent_first_after(&map->extents, start);
+	if (prev && extent_end(prev) == start && same_owner(prev, ino, depth) &&
+	    block_lblock(prev, start) == lblock) {
+		prev->len += len;
+		if (next && next->start == end && same_owner(next, ino, depth) &&
+		    next->lblock == lblock + len) {
+			prev->len += next->len;
+			extent_unlink(map, next);
+		}
+	} else if (next && next->start == end && same_owner(next, ino, depth) &&
+		   next->lblock == lblock + len) {
+		extent_set_start(map, next, start, lblock);
+	} else {
+		ext = spare[--nspare];
+		ext->start = start;
+		ext->len = len;
+		ext->ino = ino;
+		ext->depth = depth;
+		ext->lblock = lblock;
+		extent_link(map, ext);
+	}
+
+out:
+	spin_unlock_irqrestore(&map->lock, flags);
+	while (nspare)
+		kfree(spare[--nspare]);
+	return 0;
+}
+
+extern int ljx_inode_map_lookup(
+		struct ljx_inode_map *map,
+		ext3_fsblk_t block,
+		unsigned int *ino,
+		unsigned char *depth,
+		u32 *lblock
+) {
+	struct ljx_extent *ext;
+	unsigned long flags;
+	int ret = 1;
+
+	spin_lock_irqsave(&map->lock, flags);
+	ext = extent_search(&map->extents, block);
+	if (ext && block < extent_end(ext)) {
+		*ino = ext->ino;
+		*depth = ext->depth;
+		if (lblock)
+			*lblock = block_lblock(ext, block);
+		ret = 0;
+	}
+	spin_unlock_irqrestore(&map->lock, flags);
+	return ret;
+}
+
+extern int ljx_inode_map_file_runs(
+		struct ljx_inode_map *map,
+		unsigned int ino,
+		u32 *lblock,
+		unsigned int max_blocks,
+		ext3_fsblk_t *starts,
+		unsigned int *lens,
+		int max_runs
+) {
+	struct ljx_extent *ext;
+	struct rb_node *node;
+	unsigned long flags;
+	unsigned int skip;
+	int nr = 0, scanned = 0;
+
+	spin_lock_irqsave(&map->lock, flags);
+	for (ext = file_first_after(&map->files, ino, *lblock);
+			ext && ext->ino == ino && nr < max_runs && max_blocks &&
+			scanned < LJX_RUN_SCAN_LIMIT;
+			ext = node ? rb_entry(node, struct ljx_extent, file_node) : NULL,
+			scanned++) {
+		node = rb_next(&ext->file_node);
+		/* blocks the guest moved may leave stale runs over the same part */
+		if ((u64) ext->lblock + ext->len <= *lblock)
+			continue;
+		skip = ext->lblock < *lblock ? *lblock - ext->lblock : 0;
+		starts[nr] = ext->start + skip;
+		lens[nr] = min(ext->len - skip, max_blocks);
+		max_blocks -= lens[nr];
+		*lblock = ext->lblock + skip + lens[nr];
+		nr++;
+	}
+	spin_unlock_irqrestore(&map->lock, flags);
+	return nr;
+}
+
+extern void ljx_inode_map_account(
+		struct ljx_inode_map *map,
+		ext3_fsblk_t block,
+		unsigned int nr_blocks,
+		void (*fn)(void *, unsigned int ino, unsigned int nr_blocks),
+		void *priv
+) {
+	struct ljx_extent *ext;
+	ext3_fsblk_t end = block + nr_blocks;
+	unsigned int ino = 0, blocks = 0;
+	unsigned long flags;
+
+	spin_lock_irqsave(&map->lock, flags);
+	for (ext = extent_first_after(&map->extents, block);
+			ext && ext->start < end;
+			ext = next_extent(ext)) {
+		if (ext->depth)
+			continue;
+		/* neighbouring extents of one file are one I/O to it */
+		if (blocks && ext->ino != ino) {
+			fn(priv, ino, blocks);
+			blocks = 0;
+		}
+		ino = ext->ino;
+		blocks += min(extent_end(ext), end) - max(ext->start, block);
+	}
+	if (blocks)
+		fn(priv, ino, blocks);
+	spin_unlock_irqrestore(&map->lock, flags);
+}
+
+extern unsigned long ljx_inode_map_walk(
+		struct ljx_inode_map *map,
+		void (*fn)(void *, struct ljx_extent *),
+		void *priv,
+		unsigned long max
+) {
+	struct rb_node *node;
+	unsigned long flags, nr = 0;
+
+	spin_lock_irqsave(&map->lock, flags);
+	for (node = rb_first(&map->extents); node && nr < max; node = rb_next(node), nr++)
+		fn(priv, rb_entry(node, struct ljx_extent, node));
+	spin_unlock_irqrestore(&map->lock, flags);
+	return nr;
+}
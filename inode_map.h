@@ -0,0 +1,88 @@
+#ifndef _INODE_MAP_H
+#define _INODE_MAP_H
+
+#include <linux/kernel.h>
+#include <linux/rbtree.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+
+#include "ext3.h"
+
+/**
+ * A run of filesystem blocks owned by one inode. depth is 0 for data blocks
+ * and 1-3 for single, double and triple indirect blocks respectively, or
+ * the levels above the leaves of an extent tree node. lblock is the block of
+ * the file that start holds, or for a block map block the first one it maps;
+ * a run is contiguous in the file as well as on the disk.
+ */
+struct ljx_extent {
+	struct rb_node		node;
+	struct rb_node		file_node;	/* data blocks only */
+	ext3_fsblk_t		start;
+	unsigned int		len;
+	unsigned int		ino;
+	u32			lblock;
+	unsigned char		depth;
+};
+
+/**
+ * Reverse map from filesystem blocks to the inodes that own them, kept as a
+ * run-length encoded extent tree. The data runs are also kept in file order,
+ * by inode and then file block, to follow a file the way it is read.
+ */
+struct ljx_inode_map {
+	spinlock_t		lock;
+	struct rb_root		extents;
+	struct rb_root		files;
+	unsigned long		nr_extents;
+};
+
+extern struct ljx_inode_map *ljx_inode_map_alloc(void);
+extern void ljx_inode_map_free(struct ljx_inode_map *);
+
+/**
+ * Records that blocks [start, start + len) belong to ino at the given depth,
+ * from file block lblock on, replacing any previous owner. Safe to call from
+ * bio completion.
+ */
+extern int ljx_inode_map_add(struct ljx_inode_map *, ext3_fsblk_t start,
+		unsigned int len, unsigned int ino, unsigned char depth, u32 lblock);
+
+/**
+ * Looks up the owner of a block. Returns 0 and fills in ino, depth and, if
+ * it isn't NULL, the file block it holds (see struct ljx_extent) if it is
+ * known, 1 otherwise.
+ */
+extern int ljx_inode_map_lookup(struct ljx_inode_map *, ext3_fsblk_t block,
+		unsigned int *ino, unsigned char *depth, u32 *lblock);
+
+/**
+ * Collects up to max_runs runs of the data blocks of ino from file block
+ * *lblock on, in file order, stopping after max_blocks blocks or after
+ * scanning LJX_RUN_SCAN_LIMIT extents. Holes in the file are skipped. Moves
+ * *lblock past the last run and returns the number of runs found.
+ */
+#define LJX_RUN_SCAN_LIMIT	64
+extern int ljx_inode_map_file_runs(struct ljx_inode_map *, unsigned int ino,
+		u32 *lblock, unsigned int max_blocks,
+		ext3_fsblk_t *starts, unsigned int *lens, int max_runs);
+
+/**
+ * Splits an I/O of nr_blocks blocks starting at block among the files owning
+ * those blocks, calling fn once for each file with the number of its data
+ * blocks (depth 0) the I/O covers. fn runs with the map locked, so it must
+ * not sleep.
+ */
+extern void ljx_inode_map_account(struct ljx_inode_map *, ext3_fsblk_t block,
+		unsigned int nr_blocks,
+		void (*fn)(void *, unsigned int ino, unsigned int nr_blocks),
+		void *priv);
+
+/**
+ * Calls fn on up to max extents in block order, with the map locked, so fn
+ * must not sleep. Returns the number of extents visited.
+ */
+extern unsigned long ljx_inode_map_walk(struct ljx_inode_map *,
+		void (*fn)(void *, struct ljx_extent *), void *priv, unsigned long max);
+
+#endif
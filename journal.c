@@ -0,0 +1,198 @@
+/*
+ * journal.c -- following guest JBD transactions through the log
+ */
+
+#include <linux/slab.h>
+#include <linux/jbd.h>
+
+#include "journal.h"
+
+/* JBD2 features that change the descriptor format (ext4 journals) */
+#define LJX_JBD2_FEATURE_INCOMPAT_64BIT		0x00000002
+#define LJX_JBD2_FEATURE_INCOMPAT_CSUM_V2	0x00000008
+#define LJX_JBD2_FEATURE_INCOMPAT_CSUM_V3	0x00000010
+#define LJX_JBD2_TAG3_SIZE			16
+#define LJX_JBD2_TAIL_SIZE			4
+
+extern struct ljx_journal *ljx_journal_alloc(unsigned int block_size) {
+	struct ljx_journal *j;
+
+	j = kzalloc(sizeof(struct ljx_journal), GFP_ATOMIC);
+	if (! j)
+		return NULL;
+	spin_lock_init(&j->lock);
+	j->block_size = block_size;
+	j->tag_size = sizeof(journal_block_tag_t);
+	j->revoke_size = sizeof(__be32);
+	return j;
+}
+
+extern void ljx_journal_free(struct ljx_journal *j) {
+	kfree(j);
+}
+
+extern void ljx_journal_add_area(
+		struct ljx_journal *j,
+		sector_t sector,
+		unsigned int nr_sec
+) {
+	unsigned long flags;
+
+	spin_lock_irqsave(&j->lock, flags);
+	if (! j->end || sector < j->start)
+		j->start = sector;
+	if (sector + nr_sec > j->end)
+		j->end = sector + nr_sec;
+	spin_unlock_irqrestore(&j->lock, flags);
+}
+
+extern bool ljx_journal_contains(
+		struct ljx_journal *j,
+		sector_t sector,
+		unsigned int nr_sec
+) {
+	/* the bounds only ever grow, so a racy read errs on the safe side */
+	return j->end && sector >= j->start && sector + nr_sec <= j->end;
+}
+
+extern void ljx_journal_note_write(
+		struct ljx_journal *j,
+		sector_t sector,
+		unsigned int nr_sec
+) {
+	unsigned long flags;
+
+	if (! ljx_journal_contains(j, sector, nr_sec))
+		return;
+	spin_lock_irqsave(&j->lock, flags);
+	/* the first journal block is the journal superblock, not the log */
+	if (! j->timed && sector >= j->start + j->block_size / 512) {
+		j->first_write = ktime_get();
+		j->timed = true;
+	}
+	spin_unlock_irqrestore(&j->lock, flags);
+}
+
+/* must be called with j->lock held */
+static void start_txn(struct ljx_journal *j, u32 tid) {
+	if (j->open && j->tid == tid)
+		return;
+	if (j->open)
+		/* never saw the previous one commit */
+		j->partial++;
+	j->open = true;
+	j->tid = tid;
+	j->log_blocks = 0;
+	j->meta_blocks = 0;
+}
+
+/* must be called with j->lock held */
+static void end_txn(struct ljx_journal *j, u32 tid) {
+	if (! j->open || j->tid != tid) {
+		j->partial++;
+	} else {
+		j->commits++;
+		ljx_hist_add(&j->txn_log_blocks, j->log_blocks + 1);
+		ljx_hist_add(&j->txn_meta_blocks, j->meta_blocks);
+		if (j->timed)
+			ljx_hist_add(&j->commit_us,
+					ktime_to_us(ktime_sub(ktime_get(), j->first_write)));
+	}
+	j->open = false;
+	j->timed = false;
+}
+
+/* must be called with j->lock held; sizes as jbd2's journal_tag_bytes() */
+static void parse_superblock(struct ljx_journal *j, const journal_superblock_t *sb) {
+	u32 incompat = be32_to_cpu(sb->s_feature_incompat);
+
+	j->tag_size = sizeof(journal_block_tag_t);
+	j->tail_size = 0;
+	j->revoke_size = sizeof(__be32);
+	if (incompat & LJX_JBD2_FEATURE_INCOMPAT_CSUM_V3) {
+		j->tag_size = LJX_JBD2_TAG3_SIZE;
+	} else {
+		if (incompat & LJX_JBD2_FEATURE_INCOMPAT_64BIT)
+			j->tag_size += sizeof(__be32);
+		/* the tag's own checksum of the block */
+		if (incompat & LJX_JBD2_FEATURE_INCOMPAT_CSUM_V2)
+			j->tag_size += sizeof(__be16);
+	}
+	if (incompat & (LJX_JBD2_FEATURE_INCOMPAT_CSUM_V2 |
+				LJX_JBD2_FEATURE_INCOMPAT_CSUM_V3))
+		j->tail_size = LJX_JBD2_TAIL_SIZE;
+	if (incompat & LJX_JBD2_FEATURE_INCOMPAT_64BIT)
+		j->revoke_size = sizeof(__be64);
+}
+
+/* counts the tags in a descriptor block */
+static unsigned int count_tags(struct ljx_journal *j, const char *block) {
+	const char *p = block + sizeof(journal_header_t);
+	const char *end = block + j->block_size - j->tail_size;
+	const journal_block_tag_t *tag;
+	unsigned int flags, nr = 0;
+
+	while (p + j->tag_size <= end) {
+		tag = (const journal_block_tag_t *) p;
+		/* JBD2 keeps a 16 bit checksum above the flags */
+		flags = be32_to_cpu(tag->t_flags) & 0xffff;
+		nr++;
+		p += j->tag_size;
+		if (! (flags & JFS_FLAG_SAME_UUID))
+			p += 16;
+		if (flags & JFS_FLAG_LAST_TAG)
+			break;
+	}
+	return nr;
+}
+
+extern bool ljx_journal_parse(struct ljx_journal *j, const void *block, int write) {
+	const journal_header_t *header = block;
+	const journal_revoke_header_t *revoke = block;
+	unsigned long flags;
+	unsigned int count;
+	bool commit = false;
+	u32 tid;
+
+	spin_lock_irqsave(&j->lock, flags);
+	if (header->h_magic == cpu_to_be32(JFS_MAGIC_NUMBER) &&
+	    be32_to_cpu(header->h_blocktype) == JFS_SUPERBLOCK_V2) {
+		parse_superblock(j, block);
+		goto out;
+	}
+	if (! write)
+		goto out;
+	if (header->h_magic != cpu_to_be32(JFS_MAGIC_NUMBER)) {
+		/* a journalled copy of a metadata block */
+		if (j->open)
+			j->log_blocks++;
+		goto out;
+	}
+
+	tid = be32_to_cpu(header->h_sequence);
+	switch (be32_to_cpu(header->h_blocktype)) {
+	case JFS_DESCRIPTOR_BLOCK:
+		start_txn(j, tid);
+		j->log_blocks++;
+		j->meta_blocks += count_tags(j, block);
+		break;
+	case JFS_REVOKE_BLOCK:
+		start_txn(j, tid);
+		j->log_blocks++;
+		count = min(be32_to_cpu(revoke->r_count), j->block_size);
+		if (count > sizeof(journal_revoke_header_t))
+			j->revoke_records += (count - sizeof(journal_revoke_header_t))
+				/ j->revoke_size;
+		break;
+	case JFS_COMMIT_BLOCK:
+		end_txn(j, tid);
+		commit = true;
+		break;
+	default:
+		/* version 1 superblock */
+		break;
+	}
+out:
+	spin_unlock_irqrestore(&j->lock, flags);
+	return commit;
+}
@@ -0,0 +1,68 @@
+#ifndef _JOURNAL_H
+#define _JOURNAL_H
+
+#include <linux/kernel.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+
+#include "hist.h"
+
+/**
+ * State of the guest's JBD journal, parsed from the log blocks it writes.
+ * JBD commits one transaction at a time, so we only follow the one being
+ * written to the log.
+ */
+struct ljx_journal {
+	spinlock_t		lock;
+	unsigned int		block_size;
+	unsigned int		tag_size;	/* descriptor tag size, JBD2 varies */
+	unsigned int		tail_size;	/* checksum tail of descriptors */
+	unsigned int		revoke_size;	/* revoke record size */
+	sector_t		start;		/* sectors spanned by the journal */
+	sector_t		end;
+	/* the transaction being committed */
+	bool			open;
+	u32			tid;
+	bool			timed;		/* first_write is valid */
+	ktime_t			first_write;	/* dispatch of its first log write */
+	unsigned int		log_blocks;	/* log blocks written */
+	unsigned int		meta_blocks;	/* metadata blocks it carries */
+	/* statistics */
+	u64			commits;
+	u64			partial;	/* transactions only seen in part */
+	u64			revoke_records;
+	struct ljx_hist		txn_log_blocks;
+	struct ljx_hist		txn_meta_blocks;
+	struct ljx_hist		commit_us;
+};
+
+extern struct ljx_journal *ljx_journal_alloc(unsigned int block_size);
+extern void ljx_journal_free(struct ljx_journal *);
+
+/**
+ * Adds sectors to the journal area as its blocks are found.
+ */
+extern void ljx_journal_add_area(struct ljx_journal *, sector_t sector,
+		unsigned int nr_sec);
+
+/**
+ * Returns true if the range lies within the journal area.
+ */
+extern bool ljx_journal_contains(struct ljx_journal *, sector_t sector,
+		unsigned int nr_sec);
+
+/**
+ * Notes the dispatch of a guest write, starting the commit clock if it is
+ * the first log write of a transaction.
+ */
+extern void ljx_journal_note_write(struct ljx_journal *, sector_t sector,
+		unsigned int nr_sec);
+
+/**
+ * Parses one block of the log. block must hold block_size bytes. Blocks the
+ * guest reads are only checked for the journal superblock. Returns true if
+ * the block commits a transaction.
+ */
+extern bool ljx_journal_parse(struct ljx_journal *, const void *block, int write);
+
+#endif
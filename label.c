@@ -1,4 +1,893 @@
+#include <linux/gfp.h>
+#include <linux/vmalloc.h>
+#include <linux/moduleparam.h>
+
 #include "label.h"
+#include "events.h"
+#include "trace.h"
+
+/* labels copied out for a bio at a time */
+#define MAX_BIO_LABELS 8
+
+static unsigned int label_mem = 16384;
+module_param(label_mem, uint, 0644);
+MODULE_PARM_DESC(label_mem,
+		"KiB of labels kept per vbd before neighbouring labels are merged (0 for no limit)");
+
+/* how far apart the labels merged to make room may be at most */
+#define LJX_MAX_COARSE_GAP	(1U << 24)
+
+/* list labels in a filesystem before we first weigh a map of it */
+#define LJX_MAP_FIRST_CHECK	1024
+
+static void convert_work(struct work_struct *);
+
+extern struct ljx_labels *ljx_labels_alloc(u32 dev) {
+	struct ljx_labels *labels;
+
+	labels = kzalloc(sizeof(struct ljx_labels), GFP_KERNEL);
+	if (! labels)
+		return NULL;
+	labels->dev = dev;
+	spin_lock_init(&labels->lock);
+	INIT_LIST_HEAD(&labels->list);
+	labels->tree = RB_ROOT;
+	INIT_LIST_HEAD(&labels->chunks);
+	INIT_LIST_HEAD(&labels->free);
+	labels->limit = (size_t) label_mem << 10;
+	INIT_WORK(&labels->convert, convert_work);
+	return labels;
+}
+
+extern void ljx_labels_free(struct ljx_labels *labels) {
+	struct ljx_label_chunk *chunk, *tmp;
+	struct ljx_label_map *map;
+	unsigned int i;
+	unsigned long j;
+
+	if (! labels)
+		return;
+	cancel_work_sync(&labels->convert);
+	for (i = 0; i < labels->nr_maps; i++) {
+		map = &labels->maps[i];
+		if (! map->leaves)
+			continue;
+		for (j = 0; j < map->nr_leaves; j++)
+			if (map->leaves[j])
+				free_page((unsigned long) map->leaves[j]);
+		vfree(map->leaves);
+	}
+	list_for_each_entry_safe(chunk, tmp, &labels->chunks, list)
+		free_page((unsigned long) chunk);
+	kfree(labels);
+}
+
+static struct ljx_label_map *map_of(struct ljx_labels *labels, sector_t sector) {
+	struct ljx_label_map *map;
+	unsigned int i;
+
+	for (i = 0; i < labels->nr_maps; i++) {
+		map = &labels->maps[i];
+		if (sector >= map->start &&
+		    sector - map->start < (sector_t) map->nr_blocks * map->sec_per_block)
+			return map;
+	}
+	return NULL;
+}
+
+/* the map with the lowest start at or after sector */
+static struct ljx_label_map *next_map(struct ljx_labels *labels, sector_t sector) {
+	struct ljx_label_map *map, *best = NULL;
+	unsigned int i;
+
+	for (i = 0; i < labels->nr_maps; i++) {
+		map = &labels->maps[i];
+		if (map->start >= sector && (! best || map->start < best->start))
+			best = map;
+	}
+	return best;
+}
+
+static inline sector_t map_end(struct ljx_label_map *map) {
+	return map->start + (sector_t) map->nr_blocks * map->sec_per_block;
+}
+
+/* whether a label can be kept in map and dispatched by its type alone */
+static bool map_fits(struct ljx_label_map *map, const struct label *label) {
+	sector_t off = label->sector - map->start;
+
+	return label->processor && label->label < UNLABELED &&
+		ljx_ext3_processor(label->label) == label->processor &&
+		label->nr_sec && ! (label->nr_sec % map->sec_per_block) &&
+		! sector_div(off, map->sec_per_block) &&
+		off + label->nr_sec / map->sec_per_block <= map->nr_blocks;
+}
+
+/* keeps count of the list labels that could move to a map */
+static void account(struct ljx_labels *labels, struct label *label, int delta) {
+	struct ljx_label_map *map = map_of(labels, label->sector);
+
+	if (! map || map->leaves || ! map_fits(map, label))
+		return;
+	if (delta < 0) {
+		if (map->nr_list)
+			map->nr_list--;
+		return;
+	}
+	if (++map->nr_list >= map->next_check && ! map->converting) {
+		map->converting = true;
+		schedule_work(&labels->convert);
+	}
+}
+
+/*
+ * Puts a label just moved onto the list into the tree, in the same place.
+ * The tree is never searched by key while it is out of order, so it takes
+ * its order from the list.
+ */
+static void link_label(struct ljx_labels *labels, struct label *label) {
+	struct rb_node **link = &labels->tree.rb_node, *parent = NULL;
+
+	if (label->list.prev == &labels->list) {
+		while (*link) {
+			parent = *link;
+			link = &parent->rb_left;
+		}
+	} else {
+		parent = &list_entry(label->list.prev, struct label, list)->node;
+		link = &parent->rb_right;
+		if (*link) {
+			parent = rb_next(parent);
+			link = &parent->rb_left;
+		}
+	}
+	rb_link_node(&label->node, parent, link);
+	rb_insert_color(&label->node, &labels->tree);
+}
+
+static void free_label(struct ljx_labels *labels, struct label *label) {
+	account(labels, label, -1);
+	rb_erase(&label->node, &labels->tree);
+	list_move(&label->list, &labels->free);
+	labels->nr_labels--;
+}
+
+/* moves or resizes a label, which may take it in or out of a map */
+static void move_label(struct ljx_labels *labels, struct label *label,
+		sector_t sector, unsigned int nr_sec) {
+	account(labels, label, -1);
+	label->sector = sector;
+	label->nr_sec = nr_sec;
+	account(labels, label, 1);
+}
+
+static inline unsigned int get_code(struct ljx_label_map *map, unsigned long block) {
+	u8 *leaf = map->leaves[block / LJX_BLOCKS_PER_LEAF];
+	unsigned long i = block % LJX_BLOCKS_PER_LEAF;
+
+	if (! leaf)
+		return 0;
+	return (leaf[i / 2] >> (i & 1) * 4) & 0xf;
+}
+
+static int set_codes(
+		struct ljx_label_map *map,
+		unsigned long block,
+		unsigned long nr,
+		unsigned int code,
+		gfp_t gfp
+) {
+	unsigned long end = block + nr, i;
+	u8 **leaf;
+
+	if (! nr)
+		return 0;
+	/*
+	 * Get every leaf first: a label that fails here stays on the list,
+	 * so none of its blocks may be left labelled in the map as well.
+	 */
+	for (i = block / LJX_BLOCKS_PER_LEAF;
+	     i <= (end - 1) / LJX_BLOCKS_PER_LEAF; i++) {
+		leaf = &map->leaves[i];
+		if (*leaf)
+			continue;
+		if (! (*leaf = (u8 *) get_zeroed_page(gfp)))
+			return -ENOMEM;
+		map->nr_used++;
+	}
+	for (; block < end; block++) {
+		leaf = &map->leaves[block / LJX_BLOCKS_PER_LEAF];
+		i = block % LJX_BLOCKS_PER_LEAF;
+		(*leaf)[i / 2] &= ~(0xf << (i & 1) * 4);
+		(*leaf)[i / 2] |= code << (i & 1) * 4;
+	}
+	return 0;
+}
+
+static int map_label(struct ljx_label_map *map, const struct label *label, gfp_t gfp) {
+	sector_t block = label->sector - map->start;
+
+	sector_div(block, map->sec_per_block);
+	return set_codes(map, block, label->nr_sec / map->sec_per_block,
+			label->label + 1, gfp);
+}
+
+/*
+ * Finds the first run of blocks in [block, end) with the same label, and
+ * describes it in run. Returns false if there is none.
+ */
+static bool next_run(
+		struct ljx_label_map *map,
+		unsigned long block,
+		unsigned long end,
+		struct label *run
+) {
+	unsigned long first, leaf_end, len;
+	unsigned int code;
+	u8 *leaf, *p;
+
+	while (block < end && ! get_code(map, block)) {
+		leaf = map->leaves[block / LJX_BLOCKS_PER_LEAF];
+		leaf_end = (block / LJX_BLOCKS_PER_LEAF + 1) * LJX_BLOCKS_PER_LEAF;
+		if (! leaf || (block & 1)) {
+			block = leaf ? block + 1 : leaf_end;
+			continue;
+		}
+		/* skip unlabelled blocks a byte at a time */
+		len = DIV_ROUND_UP(min(leaf_end, end) - block, 2);
+		p = memchr_inv(leaf + block % LJX_BLOCKS_PER_LEAF / 2, 0, len);
+		if (! p) {
+			block = leaf_end;
+			continue;
+		}
+		block = block - block % LJX_BLOCKS_PER_LEAF + (p - leaf) * 2;
+		/* the byte may hold only the odd block's code */
+		if (! get_code(map, block))
+			block++;
+	}
+	if (block >= end)
+		return false;
+
+	code = get_code(map, block);
+	first = block;
+	while (block < end && get_code(map, block) == code &&
+	       (block + 1 - first) * map->sec_per_block <= UINT_MAX)
+		block++;
+	run->sector = map->start + (sector_t) first * map->sec_per_block;
+	run->nr_sec = (block - first) * map->sec_per_block;
+	run->label = code - 1;
+	run->processor = ljx_ext3_processor(run->label);
+	return true;
+}
+
+/*
+ * Weighs a map of a filesystem against the labels it would replace, and
+ * moves them over if it is the smaller. Otherwise we look again once there
+ * are twice as many.
+ */
+static void convert_map(struct ljx_labels *labels, struct ljx_label_map *map) {
+	unsigned long nr_leaves = DIV_ROUND_UP(map->nr_blocks, LJX_BLOCKS_PER_LEAF);
+	unsigned long *touched, first, last, i, nr_touched = 0;
+	struct label *label, *tmp;
+	unsigned int nr = 0;
+	unsigned long flags;
+	sector_t off;
+	u8 **leaves;
+
+	leaves = vzalloc(nr_leaves * sizeof(u8 *));
+	touched = vzalloc(BITS_TO_LONGS(nr_leaves) * sizeof(long));
+	if (! leaves || ! touched)
+		goto fail;
+
+	spin_lock_irqsave(&labels->lock, flags);
+	list_for_each_entry(label, &labels->list, list) {
+		if (label->sector < map->start)
+			continue;
+		if (map_of(labels, label->sector) != map)
+			break;
+		if (! map_fits(map, label))
+			continue;
+		off = label->sector - map->start;
+		sector_div(off, map->sec_per_block);
+		first = off / LJX_BLOCKS_PER_LEAF;
+		last = (off + label->nr_sec / map->sec_per_block - 1) / LJX_BLOCKS_PER_LEAF;
+		for (; first <= last; first++)
+			if (! __test_and_set_bit(first, touched))
+				nr_touched++;
+		nr++;
+	}
+	spin_unlock_irqrestore(&labels->lock, flags);
+
+	if (nr_leaves * sizeof(u8 *) + nr_touched * PAGE_SIZE >= nr * sizeof(struct label))
+		goto fail;
+	for (i = 0; i < nr_leaves; i++)
+		if (test_bit(i, touched))
+			/* whatever we don't get is allocated when labelled */
+			leaves[i] = (u8 *) get_zeroed_page(GFP_KERNEL);
+	vfree(touched);
+
+	spin_lock_irqsave(&labels->lock, flags);
+	map->leaves = leaves;
+	map->nr_leaves = nr_leaves;
+	for (i = 0; i < nr_leaves; i++)
+		if (leaves[i])
+			map->nr_used++;
+	list_for_each_entry_safe(label, tmp, &labels->list, list) {
+		if (label->sector < map->start)
+			continue;
+		if (label->sector >= map_end(map))
+			break;
+		if (map_fits(map, label) && ! map_label(map, label, GFP_ATOMIC)) {
+			rb_erase(&label->node, &labels->tree);
+			list_move(&label->list, &labels->free);
+			labels->nr_labels--;
+		}
+	}
+	map->nr_list = 0;
+	map->converting = false;
+	spin_unlock_irqrestore(&labels->lock, flags);
+	LJX_INFO(LJX_LOG_LABEL, "labels of filesystem at %llu moved to a map of %lu leaves",
+			(unsigned long long) map->start, map->nr_used);
+	return;
+
+fail:
+	vfree(leaves);
+	vfree(touched);
+	spin_lock_irqsave(&labels->lock, flags);
+	map->next_check = max(map->nr_list, nr) * 2;
+	map->converting = false;
+	spin_unlock_irqrestore(&labels->lock, flags);
+}
+
+static void convert_work(struct work_struct *work) {
+	struct ljx_labels *labels = container_of(work, struct ljx_labels, convert);
+	struct ljx_label_map *map;
+	unsigned long flags;
+	unsigned int i;
+	bool pending;
+
+	for (i = 0; i < LJX_LABEL_MAPS; i++) {
+		spin_lock_irqsave(&labels->lock, flags);
+		map = i < labels->nr_maps ? &labels->maps[i] : NULL;
+		pending = map && map->converting;
+		spin_unlock_irqrestore(&labels->lock, flags);
+		if (! map)
+			break;
+		if (pending)
+			convert_map(labels, map);
+	}
+}
+
+extern int ljx_labels_add_fs(
+		struct ljx_labels *labels,
+		sector_t start,
+		unsigned long nr_blocks,
+		unsigned int sec_per_block
+) {
+	struct ljx_label_map *map;
+	struct label *label;
+	unsigned long flags;
+	int ret = 0;
+
+	spin_lock_irqsave(&labels->lock, flags);
+	if (labels->nr_maps == LJX_LABEL_MAPS || map_of(labels, start)) {
+		ret = -EEXIST;
+		goto out;
+	}
+	/* never moved once added, so the work item can hold on to it */
+	map = &labels->maps[labels->nr_maps++];
+	map->start = start;
+	map->nr_blocks = nr_blocks;
+	map->sec_per_block = sec_per_block;
+	map->next_check = LJX_MAP_FIRST_CHECK;
+	list_for_each_entry(label, &labels->list, list)
+		if (map_of(labels, label->sector) == map)
+			account(labels, label, 1);
+out:
+	spin_unlock_irqrestore(&labels->lock, flags);
+	return ret;
+}
+
+/*
+ * Merges neighbours of the same type that are at most gap sectors apart,
+ * until at most target labels are left. The merged labels cover sectors
+ * that may not be what they claim; their processors check what they read.
+ */
+static void coarsen(struct ljx_labels *labels, unsigned int gap, unsigned int target) {
+	struct label *cur, *next;
+
+	if (list_empty(&labels->list))
+		return;
+	cur = list_first_entry(&labels->list, struct label, list);
+	while (cur->list.next != &labels->list && labels->nr_labels > target) {
+		next = list_entry(cur->list.next, struct label, list);
+		if (next->label == cur->label && next->processor == cur->processor &&
+		    next->sector - (cur->sector + cur->nr_sec) <= gap &&
+		    next->sector + next->nr_sec - cur->sector <= UINT_MAX) {
+			move_label(labels, cur, cur->sector,
+					next->sector + next->nr_sec - cur->sector);
+			free_label(labels, next);
+			labels->coarsened++;
+		} else
+			cur = next;
+	}
+}
+
+/*
+ * Takes a label off the free list, which it stays on until the caller moves
+ * it. Only if make_room is set may labels be merged away to stay within the
+ * limit.
+ */
+static struct label *alloc_label(struct ljx_labels *labels, bool make_room) {
+	struct ljx_label_chunk *chunk;
+	unsigned int capacity, i;
+
+	if (list_empty(&labels->free) && labels->limit && labels->nr_chunks &&
+	    (labels->nr_chunks + 1) * PAGE_SIZE > labels->limit) {
+		/* make room a quarter at a time, widening the gaps we close */
+		capacity = labels->nr_chunks * LJX_LABELS_PER_CHUNK;
+		if (! labels->coarse_gap)
+			labels->coarse_gap = 8;
+		while (make_room && list_empty(&labels->free) &&
+		       labels->coarse_gap <= LJX_MAX_COARSE_GAP) {
+			coarsen(labels, labels->coarse_gap, capacity - capacity / 4);
+			if (list_empty(&labels->free))
+				labels->coarse_gap <<= 1;
+		}
+		if (list_empty(&labels->free)) {
+			labels->dropped++;
+			return NULL;
+		}
+	}
+	if (list_empty(&labels->free)) {
+		/* labels are inserted from bio completion, so this must not sleep */
+		chunk = (struct ljx_label_chunk *) get_zeroed_page(GFP_ATOMIC);
+		if (! chunk) {
+			labels->dropped++;
+			return NULL;
+		}
+		list_add(&chunk->list, &labels->chunks);
+		labels->nr_chunks++;
+		for (i = 0; i < LJX_LABELS_PER_CHUNK; i++)
+			list_add_tail(&chunk->labels[i].list, &labels->free);
+	}
+	labels->nr_labels++;
+	return list_first_entry(&labels->free, struct label, list);
+}
+
+/* the sector after a label */
+static inline sector_t label_end(const struct label *label) {
+	return label->sector + label->nr_sec;
+}
+
+/*
+ * Finds the first label on the list that ends after start and starts at or
+ * after from, or the list head if there is none. Labels on the list do not
+ * overlap, so both their starts and their ends only grow along it.
+ */
+static struct list_head *seek(struct ljx_labels *labels, sector_t start,
+		sector_t from) {
+	struct rb_node *node = labels->tree.rb_node;
+	struct label *label, *found = NULL;
+
+	while (node) {
+		label = rb_entry(node, struct label, node);
+		if (label_end(label) > start && label->sector >= from) {
+			found = label;
+			node = node->rb_left;
+		} else
+			node = node->rb_right;
+	}
+	return found ? &found->list : &labels->list;
+}
+
+/*
+ * Makes cur, just put in its place on the list, the only label of its
+ * sectors. Neighbours of its type that overlap or touch it are merged into
+ * it, and labels of other types give up the sectors it covers, splitting in
+ * two if it lands inside one. If there is no room for the second half of
+ * such a split, that half is dropped.
+ */
+static void merge(struct ljx_labels *labels, struct label *cur) {
+	struct list_head *head = &labels->list;
+	struct label *next, *prev, *tail;
+	sector_t end;
+
+	while (cur->list.next != head) {
+		next = list_entry(cur->list.next, struct label, list);
+		if (next->sector > label_end(cur))
+			break;
+		end = max(label_end(cur), label_end(next));
+		if (next->label == cur->label && end - cur->sector <= UINT_MAX) {
+			move_label(labels, cur, cur->sector, end - cur->sector);
+			free_label(labels, next);
+		} else if (label_end(next) <= label_end(cur))
+			free_label(labels, next);
+		else {
+			/* there is something after us */
+			if (next->sector < label_end(cur))
+				move_label(labels, next, label_end(cur), end - label_end(cur));
+			break;
+		}
+	}
+	while (cur->list.prev != head) {
+		prev = list_entry(cur->list.prev, struct label, list);
+		if (label_end(prev) < cur->sector)
+			break;
+		end = max(label_end(cur), label_end(prev));
+		if (prev->label == cur->label && end - prev->sector <= UINT_MAX) {
+			move_label(labels, cur, prev->sector, end - prev->sector);
+			free_label(labels, prev);
+			continue;
+		}
+		if (label_end(prev) == cur->sector)
+			break;
+		/* there is something before us */
+		if (label_end(prev) > label_end(cur) &&
+		    (tail = alloc_label(labels, false))) {
+			/* what it had after us is a label of its own */
+			tail->sector = label_end(cur);
+			tail->nr_sec = label_end(prev) - label_end(cur);
+			tail->label = prev->label;
+			tail->processor = prev->processor;
+			list_move(&tail->list, &cur->list);
+			link_label(labels, tail);
+			account(labels, tail, 1);
+		}
+		if (prev->sector < cur->sector) {
+			move_label(labels, prev, prev->sector, cur->sector - prev->sector);
+			break;
+		}
+		free_label(labels, prev);
+	}
+}
+
+static struct list_head *find_pos(
+		struct list_head *pos,
+		struct list_head *head,
+		sector_t sector
+) {
+	struct label *cur;
+
+	/* keep the list sorted: insert before the first label that starts
+	 * after us */
+	for (; pos != head; pos = pos->next) {
+		cur = list_entry(pos, struct label, list);
+		if (cur->sector > sector)
+			break;
+	}
+	return pos;
+}
+
+/*
+ * Adds a copy of from, to the map of its filesystem if it has one, or to
+ * the list, looking for its place from *hint onwards. *hint must not be
+ * after that place, and is moved past the new label.
+ */
+static int add_label(
+		struct ljx_labels *labels,
+		struct list_head **hint,
+		const struct label *from
+) {
+	struct ljx_label_map *map = map_of(labels, from->sector);
+	unsigned long coarsened = labels->coarsened;
+	struct label *new;
+
+	if (! from->nr_sec)
+		return 0;
+	if (map && map->leaves && map_fits(map, from) &&
+	    ! map_label(map, from, GFP_ATOMIC))
+		goto out;
+	new = alloc_label(labels, true);
+	if (! new)
+		return -ENOMEM;
+	/* making room may have freed hint */
+	if (coarsened != labels->coarsened)
+		*hint = seek(labels, 0, from->sector + 1);
+	new->sector	= from->sector;
+	new->nr_sec	= from->nr_sec;
+	new->label	= from->label;
+	new->processor	= from->processor;
+	list_move_tail(&new->list, find_pos(*hint, &labels->list, from->sector));
+	link_label(labels, new);
+	account(labels, new, 1);
+	merge(labels, new);
+	/* merging may have freed the old hint, but never new */
+	*hint = new->list.next;
+out:
+	trace_ljx_label_insert(labels->dev, from->sector, from->nr_sec, from->label);
+	ljx_event(LJX_EV_LABEL, labels->dev, from->sector, from->nr_sec, from->label);
+	return 0;
+}
+
+extern int ljx_insert_label(
+		struct ljx_labels *labels,
+		sector_t sector,
+		unsigned int nr_sec,
+		label_t type,
+		process_bio_fn *processor
+) {
+	struct label label = {
+		.sector		= sector,
+		.nr_sec		= nr_sec,
+		.label		= type,
+		.processor	= processor,
+	};
+	struct list_head *hint;
+	unsigned long flags;
+	int ret;
+
+	spin_lock_irqsave(&labels->lock, flags);
+	hint = seek(labels, 0, sector + 1);
+	ret = add_label(labels, &hint, &label);
+	spin_unlock_irqrestore(&labels->lock, flags);
+	return ret;
+}
+
+/*
+ * Inserts n labels, sorted by sector, in a single walk of the list from the
+ * first one's place. Each one is merged with its neighbours as
+ * ljx_insert_label() would.
+ */
+extern int ljx_insert_labels(
+		struct ljx_labels *labels,
+		const struct label *from,
+		unsigned int n
+) {
+	struct list_head *hint;
+	unsigned long flags;
+	unsigned int i;
+	int ret = 0;
+
+	spin_lock_irqsave(&labels->lock, flags);
+	hint = n ? seek(labels, 0, from[0].sector + 1) : labels->list.next;
+	for (i = 0; i < n && ! ret; i++)
+		ret = add_label(labels, &hint, &from[i]);
+	spin_unlock_irqrestore(&labels->lock, flags);
+	return ret;
+}
+
+/* walks the runs of every map in sector order */
+struct map_cursor {
+	struct ljx_label_map	*map;
+	unsigned long		block;
+	bool			have;
+	struct label		run;
+};
+
+static void cursor_next(struct ljx_labels *labels, struct map_cursor *c) {
+	for (;;) {
+		if (c->map && c->map->leaves &&
+		    next_run(c->map, c->block, c->map->nr_blocks, &c->run)) {
+			c->block = (c->run.sector - c->map->start + c->run.nr_sec) /
+				c->map->sec_per_block;
+			c->have = true;
+			return;
+		}
+		c->map = next_map(labels, c->map ? map_end(c->map) : 0);
+		c->block = 0;
+		if (! c->map) {
+			c->have = false;
+			return;
+		}
+	}
+}
+
+struct copy_state {
+	sector_t		sector;
+	bool			(*fn)(void *, const struct label *);
+	void			*priv;
+	struct label		*out;
+	unsigned int		nr;
+};
+
+static void copy_label(struct copy_state *s, const struct label *label) {
+	if (label->sector + label->nr_sec <= s->sector || ! s->fn(s->priv, label))
+		return;
+	if (s->out)
+		s->out[s->nr] = *label;
+	s->nr++;
+}
+
+extern unsigned int ljx_copy_labels(
+		struct ljx_labels *labels,
+		sector_t sector,
+		bool (*fn)(void *, const struct label *),
+		void *priv,
+		struct label *out,
+		unsigned int max
+) {
+	struct copy_state s = {
+		.sector	= sector,
+		.fn	= fn,
+		.priv	= priv,
+		.out	= out,
+	};
+	struct map_cursor c = { .map = NULL };
+	struct label *label;
+	unsigned long flags;
+
+	spin_lock_irqsave(&labels->lock, flags);
+	cursor_next(labels, &c);
+	list_for_each_entry(label, &labels->list, list) {
+		for (; c.have && c.run.sector < label->sector && s.nr < max;
+		     cursor_next(labels, &c))
+			copy_label(&s, &c.run);
+		if (s.nr == max)
+			break;
+		copy_label(&s, label);
+	}
+	for (; c.have && s.nr < max; cursor_next(labels, &c))
+		copy_label(&s, &c.run);
+	spin_unlock_irqrestore(&labels->lock, flags);
+	return s.nr;
+}
+
+extern void ljx_print_labels(struct ljx_labels *labels) {
+	struct label *label;
+	unsigned long flags;
+
+	if (! ljx_log_on(LJX_LOG_LABEL, LJX_LOG_DEBUG))
+		return;
+	LJX_DEBUG(LJX_LOG_LABEL, "Label list:");
+	spin_lock_irqsave(&labels->lock, flags);
+	list_for_each_entry(label, &labels->list, list)
+		LJX_DEBUG(LJX_LOG_LABEL, "\tsector: %lu, size: %u, label: %d",
+				(unsigned long) label->sector, label->nr_sec, label->label);
+	spin_unlock_irqrestore(&labels->lock, flags);
+}
+
+extern ssize_t ljx_labels_show_mem(struct ljx_labels *labels, char *buf, size_t size) {
+	unsigned long map_bytes = 0;
+	unsigned int i, nr_maps = 0;
+
+	for (i = 0; i < labels->nr_maps; i++)
+		if (labels->maps[i].leaves) {
+			map_bytes += labels->maps[i].nr_leaves * sizeof(u8 *) +
+				labels->maps[i].nr_used * PAGE_SIZE;
+			nr_maps++;
+		}
+	return scnprintf(buf, size,
+			"labels %u %lu\nmaps %u %lu\nlimit %lu\ncoarsened %lu\ndropped %lu\n",
+			labels->nr_labels, labels->nr_chunks * PAGE_SIZE,
+			nr_maps, map_bytes,
+			(unsigned long) labels->limit, labels->coarsened, labels->dropped);
+}
+
+extern const char *ljx_label_name(label_t label) {
+	static const char * const names[LJX_LABEL_TYPES] = {
+		[SUPERBLOCK]		= "superblock",
+		[BOOTBLOCK]		= "bootblock",
+		[INODE_BLOCK]		= "inode_block",
+		[GROUP_DESC]		= "group_desc",
+		[BLOCK_BITMAP]		= "block_bitmap",
+		[INDIRECT_BLOCK]	= "indirect_block",
+		[EXTENT_BLOCK]		= "extent_block",
+		[JOURNAL]		= "journal",
+		[DATA]			= "data",
+		[UNLABELED]		= "unlabeled",
+	};
+
+	return label < LJX_LABEL_TYPES ? names[label] : "unknown";
+}
+
+/* adds how many sectors of the bio each type covers, returns them all */
+static unsigned int count_types(struct bio *bio, const struct label *labels,
+		unsigned int num, unsigned int nr_sec[LJX_LABEL_TYPES]) {
+	sector_t end = bio->bi_sector + bio_sectors(bio), from, to;
+	unsigned int i, covered = 0;
+
+	for (i = 0; i < num; i++) {
+		from = max(bio->bi_sector, labels[i].sector);
+		to = min(end, labels[i].sector + labels[i].nr_sec);
+		if (from >= to || labels[i].label >= LJX_LABEL_TYPES)
+			continue;
+		nr_sec[labels[i].label] += to - from;
+		covered += to - from;
+	}
+	return covered;
+}
+
+/* where the labels of a bio have been copied out up to */
+struct bio_cursor {
+	sector_t		start, end;	/* of the bio */
+	bool			list_done;
+	bool			have_last;
+	sector_t		last;		/* start of the last list label */
+	unsigned int		map;		/* the map being walked */
+	unsigned long		block;		/* next block in it to look at */
+	bool			in_map;
+};
+
+/*
+ * Copies out up to MAX_BIO_LABELS labels the bio touches that the cursor
+ * is not past yet, those on the list first, and moves the cursor past them.
+ * Returns how many there were.
+ */
+static unsigned int next_bio_labels(
+		struct ljx_labels *labels,
+		struct bio_cursor *c,
+		struct label *out
+) {
+	struct ljx_label_map *map;
+	struct list_head *pos;
+	struct label *label;
+	sector_t from, to;
+	unsigned int num = 0;
+
+	if (! c->list_done) {
+		/* the bio may start in a gap, before its first label */
+		pos = seek(labels, c->start, c->have_last ? c->last + 1 : 0);
+		for (; pos != &labels->list && num < MAX_BIO_LABELS; pos = pos->next) {
+			label = list_entry(pos, struct label, list);
+			if (label->sector >= c->end)
+				break;
+			out[num++] = *label;
+		}
+		if (num) {
+			c->last = out[num - 1].sector;
+			c->have_last = true;
+		}
+		if (num == MAX_BIO_LABELS)
+			return num;
+		c->list_done = true;
+	}
+	/* labels kept by block are dispatched by their type */
+	for (; c->map < labels->nr_maps; c->map++, c->in_map = false) {
+		map = &labels->maps[c->map];
+		if (! map->leaves || c->end <= map->start || c->start >= map_end(map))
+			continue;
+		if (! c->in_map) {
+			from = max(c->start, map->start) - map->start;
+			sector_div(from, map->sec_per_block);
+			c->block = from;
+			c->in_map = true;
+		}
+		to = min(c->end, map_end(map)) - map->start + map->sec_per_block - 1;
+		sector_div(to, map->sec_per_block);
+		while (num < MAX_BIO_LABELS && next_run(map, c->block, to, &out[num])) {
+			c->block = (out[num].sector + out[num].nr_sec - map->start) /
+				map->sec_per_block;
+			num++;
+		}
+		if (num == MAX_BIO_LABELS)
+			break;
+	}
+	return num;
+}
+
+/*
+ * Hands the bio to the processor of every label it touches. The labels are
+ * copied out a few at a time because processors insert (and merge away)
+ * labels; those they add further into the bio are processed too.
+ */
+extern unsigned int ljx_process_labels(
+		struct bio *bio,
+		struct xen_vbd *vbd,
+		unsigned int nr_sec[LJX_LABEL_TYPES]
+) {
+	struct label labels[MAX_BIO_LABELS];
+	struct bio_cursor c = {
+		.start	= bio->bi_sector,
+		.end	= bio->bi_sector + bio_sectors(bio),
+	};
+	unsigned long flags;
+	unsigned int i, num, total = 0, covered = 0;
 
-extern void superblock_label(struct xen_vbd *vbd) {
+	if (nr_sec)
+		memset(nr_sec, 0, LJX_LABEL_TYPES * sizeof(*nr_sec));
+	do {
+		spin_lock_irqsave(&vbd->labels->lock, flags);
+		num = next_bio_labels(vbd->labels, &c, labels);
+		spin_unlock_irqrestore(&vbd->labels->lock, flags);
+		if (nr_sec)
+			covered += count_types(bio, labels, num, nr_sec);
+		for (i = 0; i < num; i++)
+			if (labels[i].processor)
+				labels[i].processor(bio, vbd, &labels[i]);
+		total += num;
+	} while (num == MAX_BIO_LABELS);
+	if (nr_sec && covered < bio_sectors(bio))
+		nr_sec[UNLABELED] += bio_sectors(bio) - covered;
+	return total;
 }
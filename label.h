@@ -4,6 +4,9 @@
 #include <linux/slab.h>
 #include <linux/kernel.h>
 #include <linux/list.h>
+#include <linux/rbtree.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
 
 #include "common.h"
 
@@ -12,157 +15,144 @@ typedef enum {
 	BOOTBLOCK,
 	INODE_BLOCK,
 	GROUP_DESC,
+	BLOCK_BITMAP,
+	INDIRECT_BLOCK,
+	EXTENT_BLOCK,
 	JOURNAL,
 	DATA,
 	UNLABELED
 } label_t;
 
+#define LJX_LABEL_TYPES		(UNLABELED + 1)
+
+/**
+ * Returns the lower case name of a label type, for sysfs
+ */
+extern const char *ljx_label_name(label_t);
+
 struct label;
 
 typedef int (process_bio_fn) (struct bio *, struct xen_vbd *, struct label *);
 
 struct label {
 	struct list_head	list;
+	struct rb_node		node;		/* in the tree while on the list */
 	sector_t		sector;
 	unsigned int		nr_sec;
 	label_t			label;
 	process_bio_fn		*processor;
 };
 
-static inline struct label *new_label(sector_t sector, unsigned int nr_sec, label_t label) {
-	struct label *ret = kzalloc(sizeof(struct label), GFP_KERNEL);
-	if (! ret)
-		return NULL;
-	INIT_LIST_HEAD(&ret->list);
-	ret->sector	= sector;
-	ret->nr_sec	= nr_sec;
-	ret->label	= label;
-	return ret;
-}
-
-static inline void merge(
-		struct list_head *new,
-		struct list_head *head
-) {
-	struct label *next, *prev, *cur;
-	bool moretodo;
-
-	cur = list_entry(new, struct label, list);
-
-	do {
-		if (new->next == head)
-			/* this is at the end of the list */
-			goto end;
-		next = list_entry(new->next, struct label, list);
-		moretodo = false;
-		if (next->sector <= cur->sector + cur->nr_sec) {
-			/* there is something after us */
-			if (next->label == cur->label) {
-				cur->nr_sec = next->sector - cur->sector + next->nr_sec;
-				list_del(&next->list); 
-				kfree(next);
-				moretodo = true;
-			}
-			else
-				next->sector = cur->sector + cur->nr_sec;
-		}
-	} while (moretodo);
-end:
-	do {
-		if (new->prev == head)
-			/* this is at the beginning of the list */
-			return;
-		prev = list_entry(new->prev, struct label, list);
-		moretodo = false;
-		if (prev->sector + prev->nr_sec >= cur->sector) {
-			/* there is something before us */
-			if (prev->label == cur->label) {
-				cur->sector = prev->sector;
-				list_del(&prev->list); 
-				kfree(prev);
-				moretodo = true;
-			}
-			else
-				prev->nr_sec = cur->sector - prev->sector;
-		}
-	} while (moretodo);
-}
-
-static inline struct label *insert_label(
-		struct list_head *head, 
-		sector_t sector,
-		unsigned int size,
-		label_t label
-) {
-	struct list_head *pos;
-	struct label *cur, *next, *new;
-	int start, end;
-
-	new = new_label(sector, size, label);
-	if (! new)
-		return NULL;
-
-	list_for_each(pos, head) {
-		cur = list_entry(pos, struct label, list);
-		next = list_entry(pos->next, struct label, list);
-		start = cur->sector;
-		end = cur->sector + cur->nr_sec;
-		if (start >= cur->sector && start <= next->sector) {
-			break;
-		}
-	}
-
-	list_add(&new->list, pos);
-	merge(&new->list, head);
-	return new;
-}
-
-static inline void print_label_list(struct list_head *head) {
-	struct list_head *pos;
-	struct label *label;
-
-	JPRINTK("Label list:");
-	list_for_each(pos, head) {
-		label = list_entry(pos, struct label, list);
-		JPRINTK("\tsector: %lu, size: %u, label: %d",
-				(unsigned long) label->sector, label->nr_sec, label->label);
-	}
-}
-
-static inline unsigned int find_labels(
-		sector_t sector, 
-		unsigned int nr_sec, 
-		struct label **label,
-		struct list_head *head
-) {
-	struct list_head *pos;
-	struct label *cur, *first_label = NULL;
-	unsigned int num;
-
-	JPRINTK("searching %u - %u", (unsigned int) sector, (unsigned int) sector + nr_sec - 1);
-
-	num = 0;
-	list_for_each(pos, head) {
-		cur = list_entry(pos, struct label, list);
-		if (first_label != NULL) {
-			JPRINTK("found another label");
-			/* already found the first relevant label */
-			if (sector + nr_sec <= cur->sector)
-				break;
-			num++;
-		}
-		else if (sector >= cur->sector && sector < cur->sector + cur->nr_sec) {
-			JPRINTK("found first label");
-			first_label = cur;
-			num++;
-		}
-	}
-
-	JPRINTK("returning %u", num);
-	*label = first_label;
-	return num;
-}
-
-extern void superblock_label(struct xen_vbd *);
+/**
+ * Returns the processor ext3.c uses for a filesystem label type, or NULL
+ * for types it does not handle
+ */
+extern process_bio_fn *ljx_ext3_processor(label_t);
+
+/* labels are carved out of pages, which are only given back on detach */
+struct ljx_label_chunk {
+	struct list_head	list;
+	struct label		labels[0];
+};
+
+#define LJX_LABELS_PER_CHUNK						\
+	((PAGE_SIZE - sizeof(struct ljx_label_chunk)) / sizeof(struct label))
+
+#define LJX_LABEL_MAPS		16	/* one per filesystem */
+#define LJX_BLOCKS_PER_LEAF	(PAGE_SIZE * 2)
+
+/**
+ * Labels of one filesystem by block, 4 bits each: the label type plus one,
+ * or 0 for none. The leaves are allocated as blocks in them are labelled.
+ * Only labels whose processor ljx_ext3_processor() can give back go here;
+ * everything else stays on the list.
+ */
+struct ljx_label_map {
+	sector_t		start;
+	unsigned int		sec_per_block;
+	unsigned long		nr_blocks;
+	u8			**leaves;	/* NULL while the list is cheaper */
+	unsigned long		nr_leaves;
+	unsigned long		nr_used;	/* leaves allocated */
+	/* while sparse: labels on the list that could move here */
+	unsigned int		nr_list;
+	unsigned int		next_check;	/* nr_list to weigh the map at */
+	bool			converting;
+};
+
+/**
+ * The labels of a vbd, kept sorted by sector, and the memory they live in.
+ * Once the chunks reach limit bytes, neighbouring labels of the same type
+ * are merged across the gaps between them rather than allocating more.
+ * The labels inside a filesystem move to a map of it once that takes less
+ * memory than the list.
+ */
+struct ljx_labels {
+	u32			dev;		/* the vbd's, for events */
+	spinlock_t		lock;		/* protects everything below */
+	struct list_head	list;
+	struct rb_root		tree;		/* the list again, to search */
+	struct list_head	chunks;
+	struct list_head	free;		/* unused labels in the chunks */
+	unsigned int		nr_labels;
+	unsigned int		nr_chunks;
+	size_t			limit;		/* 0 for no limit */
+	unsigned int		coarse_gap;	/* widest gap merged so far */
+	unsigned long		coarsened;	/* labels merged away to fit */
+	unsigned long		dropped;	/* labels we had no room for */
+	unsigned int		nr_maps;
+	struct ljx_label_map	maps[LJX_LABEL_MAPS];	/* sorted by start */
+	struct work_struct	convert;
+};
+
+extern struct ljx_labels *ljx_labels_alloc(u32 dev);
+
+/**
+ * Frees every label at once. Nothing may look at the labels any more.
+ */
+extern void ljx_labels_free(struct ljx_labels *);
+
+/**
+ * Tells the labels where a filesystem lies, so that its labels can be kept
+ * by block once there are enough of them.
+ */
+extern int ljx_labels_add_fs(struct ljx_labels *, sector_t start,
+		unsigned long nr_blocks, unsigned int sec_per_block);
+
+/**
+ * Labels nr_sec sectors at sector, merging with neighbours of the same type
+ * and trimming those of other types. Safe to call from bio completion.
+ */
+extern int ljx_insert_label(struct ljx_labels *, sector_t sector, unsigned int nr_sec,
+		label_t, process_bio_fn *);
+
+/**
+ * Inserts an array of labels sorted by sector, with their processors, in one
+ * pass over the list. Returns -ENOMEM if it could not insert them all.
+ */
+extern int ljx_insert_labels(struct ljx_labels *, const struct label *, unsigned int);
+
+/**
+ * Copies up to max labels at or after sector that fn accepts into out,
+ * with the labels locked, so fn must not sleep. Returns the number copied.
+ */
+extern unsigned int ljx_copy_labels(struct ljx_labels *, sector_t sector,
+		bool (*fn)(void *, const struct label *), void *priv,
+		struct label *out, unsigned int max);
+
+extern void ljx_print_labels(struct ljx_labels *);
+
+/**
+ * Formats the memory used by the labels into buf.
+ */
+extern ssize_t ljx_labels_show_mem(struct ljx_labels *, char *buf, size_t size);
+
+/**
+ * Runs the processors of the labels a completed bio covers, and returns how
+ * many there were. If nr_sec isn't NULL, it gets how many sectors of the bio
+ * each label type covers, with those no label covers as UNLABELED.
+ */
+extern unsigned int ljx_process_labels(struct bio *, struct xen_vbd *,
+		unsigned int nr_sec[LJX_LABEL_TYPES]);
 
 #endif
@@ -0,0 +1,80 @@
+/*
+ * label_io.c -- guest I/O by label type
+ */
+
+#include <linux/irqflags.h>
+
+#include "label_io.h"
+
+extern struct ljx_label_io __percpu *ljx_label_io_alloc(void) {
+	return alloc_percpu(struct ljx_label_io);
+}
+
+extern void ljx_label_io_free(struct ljx_label_io __percpu *io) {
+	if (io)
+		free_percpu(io);
+}
+
+extern void ljx_label_io_add(
+		struct ljx_label_io __percpu *io,
+		bool write,
+		const unsigned int nr_sec[LJX_LABEL_TYPES],
+		unsigned int weight,
+		u64 ns
+) {
+	struct ljx_label_io *cpu_io;
+	unsigned long flags;
+	int type;
+
+	local_irq_save(flags);
+	cpu_io = this_cpu_ptr(io);
+	for (type = 0; type < LJX_LABEL_TYPES; type++) {
+		if (! nr_sec[type])
+			continue;
+		cpu_io->ops[write][type] += weight;
+		cpu_io->bytes[write][type] += (u64) nr_sec[type] * weight << 9;
+		ljx_hist_add(&cpu_io->lat[type], ns);
+	}
+	local_irq_restore(flags);
+}
+
+extern ssize_t ljx_label_io_show(
+		struct ljx_label_io __percpu *io,
+		char *buf,
+		size_t size
+) {
+	const struct ljx_label_io *cpu_io;
+	unsigned long long ops[2], bytes[2];
+	ssize_t len = 0;
+	int type, cpu, rw;
+
+	for (type = 0; type < LJX_LABEL_TYPES; type++) {
+		memset(ops, 0, sizeof(ops));
+		memset(bytes, 0, sizeof(bytes));
+		for_each_possible_cpu(cpu) {
+			cpu_io = per_cpu_ptr(io, cpu);
+			for (rw = 0; rw < 2; rw++) {
+				ops[rw] += cpu_io->ops[rw][type];
+				bytes[rw] += cpu_io->bytes[rw][type];
+			}
+		}
+		len += scnprintf(buf + len, size - len, "%s %llu %llu %llu %llu\n",
+				ljx_label_name(type), ops[0], bytes[0], ops[1], bytes[1]);
+	}
+	return len;
+}
+
+extern ssize_t ljx_label_io_show_lat(
+		struct ljx_label_io __percpu *io,
+		label_t type,
+		char *buf,
+		size_t size
+) {
+	struct ljx_hist sum;
+	int cpu;
+
+	memset(&sum, 0, sizeof(sum));
+	for_each_possible_cpu(cpu)
+		ljx_hist_merge(&sum, &per_cpu_ptr(io, cpu)->lat[type]);
+	return ljx_hist_show(&sum, buf, size);
+}
@@ -0,0 +1,46 @@
+#ifndef _LABEL_IO_H
+#define _LABEL_IO_H
+
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+
+#include "hist.h"
+#include "label.h"
+
+/**
+ * Guest I/O split by what the labels say it touched, to tell metadata from
+ * data. A bio is counted once under every type it covers, with the bytes
+ * that type covers, and its device latency goes into the histogram of each
+ * of those types. Kept per cpu like struct ljx_lat.
+ */
+struct ljx_label_io {
+	u64			ops[2][LJX_LABEL_TYPES];	/* read, write */
+	u64			bytes[2][LJX_LABEL_TYPES];
+	struct ljx_hist		lat[LJX_LABEL_TYPES];
+};
+
+extern struct ljx_label_io __percpu *ljx_label_io_alloc(void);
+extern void ljx_label_io_free(struct ljx_label_io __percpu *);
+
+/**
+ * Counts a completed bio from the sectors ljx_process_labels() found of each
+ * type, with the unlabelled ones the inode map knows moved to DATA (data is
+ * never labelled). A sampled bio stands for weight of them; its latency is one sample.
+ */
+extern void ljx_label_io_add(struct ljx_label_io __percpu *, bool write,
+		const unsigned int nr_sec[LJX_LABEL_TYPES], unsigned int weight,
+		u64 ns);
+
+/**
+ * Formats one "type rd_ops rd_bytes wr_ops wr_bytes" line per label type.
+ */
+extern ssize_t ljx_label_io_show(struct ljx_label_io __percpu *, char *buf,
+		size_t size);
+
+/**
+ * Formats the device latency histogram of one label type, in nanoseconds.
+ */
+extern ssize_t ljx_label_io_show_lat(struct ljx_label_io __percpu *, label_t,
+		char *buf, size_t size);
+
+#endif
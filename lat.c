@@ -0,0 +1,44 @@
+/*
+ * lat.c -- per cpu latency histograms of the request lifecycle
+ */
+
+#include <linux/irqflags.h>
+
+#include "lat.h"
+
+extern struct ljx_lat __percpu *ljx_lat_alloc(void) {
+	return alloc_percpu(struct ljx_lat);
+}
+
+extern void ljx_lat_free(struct ljx_lat __percpu *lat) {
+	if (lat)
+		free_percpu(lat);
+}
+
+extern void ljx_lat_add(
+		struct ljx_lat __percpu *lat,
+		enum ljx_lat_stage stage,
+		u64 ns
+) {
+	unsigned long flags;
+
+	local_irq_save(flags);
+	ljx_hist_add(&this_cpu_ptr(lat)->stage[stage], ns);
+	local_irq_restore(flags);
+}
+
+extern ssize_t ljx_lat_show(
+		struct ljx_lat __percpu *lat,
+		enum ljx_lat_stage stage,
+		char *buf,
+		size_t size
+) {
+	struct ljx_hist sum;
+	int cpu;
+
+	memset(&sum, 0, sizeof(sum));
+	/* a cpu may be halfway through an update; that is only one sample */
+	for_each_possible_cpu(cpu)
+		ljx_hist_merge(&sum, &per_cpu_ptr(lat, cpu)->stage[stage]);
+	return ljx_hist_show(&sum, buf, size);
+}
@@ -0,0 +1,57 @@
+#ifndef _LAT_H
+#define _LAT_H
+
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/percpu.h>
+
+#include "hist.h"
+
+/*
+ * Where a request spends its time, from the moment xenblkd takes it off the
+ * ring to the moment its response is pushed back.
+ */
+enum ljx_lat_stage {
+	LJX_LAT_MAP,		/* ring consume -> grants mapped */
+	LJX_LAT_SUBMIT,		/* grants mapped -> bios submitted */
+	LJX_LAT_DEVICE,		/* bio submitted -> bio completed */
+	LJX_LAT_INTROSPECT,	/* looking into a completed bio */
+	LJX_LAT_RESPONSE,	/* last bio completed -> response pushed */
+	LJX_LAT_STAGES
+};
+
+/**
+ * Nanosecond histograms of each stage. There is one copy per cpu, updated
+ * with interrupts off since bios complete in interrupt context, and summed
+ * when read.
+ */
+struct ljx_lat {
+	struct ljx_hist		stage[LJX_LAT_STAGES];
+};
+
+extern struct ljx_lat __percpu *ljx_lat_alloc(void);
+extern void ljx_lat_free(struct ljx_lat __percpu *);
+
+extern void ljx_lat_add(struct ljx_lat __percpu *, enum ljx_lat_stage, u64 ns);
+
+/**
+ * Counts the time from since to now against stage, and returns now so the
+ * next stage can be timed from it.
+ */
+static inline ktime_t ljx_lat_since(struct ljx_lat __percpu *lat,
+		enum ljx_lat_stage stage, ktime_t since) {
+	ktime_t now = ktime_get();
+
+	if (lat)
+		ljx_lat_add(lat, stage, ktime_to_ns(ktime_sub(now, since)));
+	return now;
+}
+
+/**
+ * Formats the histogram of one stage, summed over all cpus, as ljx_hist_show
+ * does.
+ */
+extern ssize_t ljx_lat_show(struct ljx_lat __percpu *, enum ljx_lat_stage,
+		char *buf, size_t size);
+
+#endif
@@ -0,0 +1,206 @@
+/*
+ * layout.c -- where ext3 and ext4 keep their metadata
+ */
+
+#include <linux/fs.h>
+#include <linux/ext3_fs.h>
+
+#include "layout.h"
+
+#define LJX_EXT3_HAS_INCOMPAT_FEATURE(sb,mask)			\
+	( sb->feature_incompat & (mask) )
+
+#define LJX_EXT3_HAS_RO_COMPAT_FEATURE(sb,mask)			\
+	( sb->feature_ro_compat & (mask) )
+
+static inline int test_root(int a, int b)
+{
+	int num = b;
+
+	while (a > num)
+		num *= b;
+	return num == a;
+}
+
+static int ext3_group_sparse(int group)
+{
+	if (group <= 1)
+		return 1;
+	if (!(group & 1))
+		return 0;
+	return (test_root(group, 7) || test_root(group, 5) ||
+		test_root(group, 3));
+}
+
+extern int ljx_layout_init(
+		struct ljx_ext3_superblock *lsb,
+		struct ext3_super_block *sb
+) {
+	const unsigned char *raw = (const unsigned char *) sb;
+	u32 blocks_hi = 0;
+
+	lsb->inodes_count      =  le32_to_cpu(sb->s_inodes_count);
+	lsb->blocks_count      =  le32_to_cpu(sb->s_blocks_count);
+	lsb->inode_size        =  le16_to_cpu(sb->s_inode_size);
+	lsb->first_data_block  =  le32_to_cpu(sb->s_first_data_block);
+	lsb->log_block_size    =  le32_to_cpu(sb->s_log_block_size);
+	lsb->log_frag_size     =  le32_to_cpu(sb->s_log_frag_size);
+	lsb->blocks_per_group  =  le32_to_cpu(sb->s_blocks_per_group);
+	lsb->frags_per_group   =  le32_to_cpu(sb->s_frags_per_group);
+	lsb->inodes_per_group  =  le32_to_cpu(sb->s_inodes_per_group);
+	lsb->first_inode       =  le32_to_cpu(sb->s_first_ino);
+	lsb->journal_inum      =  le32_to_cpu(sb->s_journal_inum);
+	lsb->first_meta_bg     =  le32_to_cpu(sb->s_first_meta_bg);
+	lsb->feature_incompat  =  le32_to_cpu(sb->s_feature_incompat);
+	lsb->feature_ro_compat =  le32_to_cpu(sb->s_feature_ro_compat);
+	lsb->mnt_count         =  le16_to_cpu(sb->s_mnt_count);
+	lsb->wtime             =  le32_to_cpu(sb->s_wtime);
+	memcpy(lsb->uuid, sb->s_uuid, sizeof(lsb->uuid));
+
+	/* 64k is the largest block size either filesystem supports */
+	if (lsb->log_block_size > 6)
+		return -EINVAL;
+	lsb->block_size		=  EXT3_MIN_BLOCK_SIZE << lsb->log_block_size;
+	lsb->sec_per_block	=  lsb->block_size / SECTOR_SIZE;
+
+	if (LJX_EXT3_HAS_INCOMPAT_FEATURE(lsb, LJX_EXT4_FEATURE_INCOMPAT_64BIT)) {
+		blocks_hi = le32_to_cpup((__le32 *) (raw + LJX_EXT4_SB_BLOCKS_COUNT_HI));
+		lsb->desc_size = le16_to_cpup((__le16 *) (raw + LJX_EXT4_SB_DESC_SIZE));
+		if (lsb->desc_size < LJX_EXT4_MIN_DESC_SIZE_64BIT ||
+		    lsb->desc_size > lsb->block_size ||
+		    (lsb->desc_size & (lsb->desc_size - 1)))
+			return -EINVAL;
+	} else
+		lsb->desc_size = LJX_EXT4_MIN_DESC_SIZE;
+	if (blocks_hi) {
+		if (sizeof(ext3_fsblk_t) < sizeof(u64))
+			return -EINVAL;
+		lsb->blocks_count |= (ext3_fsblk_t) blocks_hi << 31 << 1;
+	}
+
+	/* bitmaps would describe clusters rather than blocks */
+	if (LJX_EXT3_HAS_RO_COMPAT_FEATURE(lsb, LJX_EXT4_FEATURE_RO_COMPAT_BIGALLOC))
+		return -EINVAL;
+
+	lsb->flex_size = 1;
+	if (LJX_EXT3_HAS_INCOMPAT_FEATURE(lsb, LJX_EXT4_FEATURE_INCOMPAT_FLEX_BG)) {
+		if (raw[LJX_EXT4_SB_LOG_GROUPS_PER_FLEX] > 16)
+			return -EINVAL;
+		lsb->flex_size = 1 << raw[LJX_EXT4_SB_LOG_GROUPS_PER_FLEX];
+	}
+
+	if (! lsb->blocks_per_group || lsb->blocks_per_group > lsb->block_size * 8 ||
+	    ! lsb->inodes_per_group || lsb->inode_size > lsb->block_size ||
+	    /* the inode parser reads the whole of the old inode */
+	    lsb->inode_size < EXT3_GOOD_OLD_INODE_SIZE ||
+	    lsb->first_data_block >= lsb->blocks_count)
+		return -EINVAL;
+
+	lsb->inodes_per_block  =  lsb->block_size / lsb->inode_size;
+	lsb->desc_per_block    =  lsb->block_size / lsb->desc_size;
+	lsb->itable_blocks     =  DIV_ROUND_UP(lsb->inodes_per_group,
+			lsb->inodes_per_block);
+	lsb->groups_count      =  ((lsb->blocks_count - lsb->first_data_block - 1)
+				       / lsb->blocks_per_group) + 1;
+	return 0;
+}
+
+extern ext3_fsblk_t ljx_descriptor_loc(struct ljx_ext3_superblock *sb, unsigned int nr) {
+	unsigned long bg, first_meta_bg;
+	int has_super = 0;
+
+	first_meta_bg = sb->first_meta_bg;
+	if (!LJX_EXT3_HAS_INCOMPAT_FEATURE(sb, EXT3_FEATURE_INCOMPAT_META_BG) ||
+	    nr < first_meta_bg)
+		/* descriptors follow the block holding the primary superblock */
+		return (sb->first_data_block + nr + 1);
+	bg = sb->desc_per_block * nr;
+	if (! (LJX_EXT3_HAS_RO_COMPAT_FEATURE(sb,
+				EXT3_FEATURE_RO_COMPAT_SPARSE_SUPER) &&
+			!ext3_group_sparse(bg)))
+		has_super = 1;
+	return (has_super + (
+				bg * (ext3_fsblk_t)(sb->blocks_per_group) +
+				sb->first_data_block)
+	       );
+}
+
+extern void ljx_parse_group_desc(
+		struct ljx_ext3_superblock *lsb,
+		unsigned int group,
+		const void *raw
+) {
+	const struct ljx_ext4_group_desc *desc = raw;
+	struct ljx_ext3_group *g = &lsb->groups[group];
+
+	g->block_bitmap = le32_to_cpu(desc->bg_block_bitmap_lo);
+	g->inode_bitmap = le32_to_cpu(desc->bg_inode_bitmap_lo);
+	g->inode_table = le32_to_cpu(desc->bg_inode_table_lo);
+	/* ext3 calls this field bg_pad, and leaves it zero */
+	g->flags = le16_to_cpu(desc->bg_flags);
+	if (lsb->desc_size >= LJX_EXT4_MIN_DESC_SIZE_64BIT) {
+		g->block_bitmap |= (ext3_fsblk_t)
+			le32_to_cpu(desc->bg_block_bitmap_hi) << 31 << 1;
+		g->inode_bitmap |= (ext3_fsblk_t)
+			le32_to_cpu(desc->bg_inode_bitmap_hi) << 31 << 1;
+		g->inode_table |= (ext3_fsblk_t)
+			le32_to_cpu(desc->bg_inode_table_hi) << 31 << 1;
+	}
+}
+
+/* the groups whose metadata may be stored in the group holding block */
+static bool flex_window(
+		struct ljx_ext3_superblock *lsb,
+		ext3_fsblk_t block,
+		unsigned int *first,
+		unsigned int *last
+) {
+	unsigned int home;
+
+	if (block < lsb->first_data_block)
+		return false;
+	home = (block - lsb->first_data_block) / lsb->blocks_per_group;
+	if (home >= lsb->groups_count)
+		return false;
+	/* without flex_bg this is just the group itself */
+	*first = home & ~(lsb->flex_size - 1);
+	*last = min(*first + lsb->flex_size, lsb->groups_count);
+	return true;
+}
+
+extern int ljx_itable_group(struct ljx_ext3_superblock *lsb, ext3_fsblk_t block) {
+	unsigned int group, last;
+	struct ljx_ext3_group *g;
+
+	if (! flex_window(lsb, block, &group, &last))
+		return -1;
+	for (; group < last; group++) {
+		g = &lsb->groups[group];
+		if (g->inode_table && block >= g->inode_table &&
+		    block < g->inode_table + lsb->itable_blocks)
+			return group;
+	}
+	return -1;
+}
+
+extern int ljx_bitmap_group(struct ljx_ext3_superblock *lsb, ext3_fsblk_t block) {
+	unsigned int group, last;
+
+	if (! flex_window(lsb, block, &group, &last))
+		return -1;
+	for (; group < last; group++)
+		if (lsb->groups[group].block_bitmap == block)
+			return group;
+	return -1;
+}
+
+extern int ljx_ext4_extent_entries(struct ljx_ext4_extent_header *eh, size_t size) {
+	unsigned int entries = le16_to_cpu(eh->eh_entries);
+
+	if (le16_to_cpu(eh->eh_magic) != LJX_EXT4_EXT_MAGIC ||
+	    le16_to_cpu(eh->eh_depth) > LJX_EXT4_EXT_MAX_DEPTH ||
+	    entries > le16_to_cpu(eh->eh_max) ||
+	    sizeof(*eh) + entries * sizeof(struct ljx_ext4_extent) > size)
+		return -1;
+	return entries;
+}
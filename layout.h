@@ -0,0 +1,128 @@
+#ifndef _LAYOUT_H
+#define _LAYOUT_H
+
+#include <linux/kernel.h>
+#include <linux/ext3_fs.h>
+
+#include "ext3.h"
+
+/*
+ * ext4 on-disk definitions. The kernel keeps these private to fs/ext4, so
+ * the parts we need are repeated here.
+ */
+
+#define LJX_EXT4_FEATURE_INCOMPAT_EXTENTS	0x0040
+#define LJX_EXT4_FEATURE_INCOMPAT_64BIT		0x0080
+#define LJX_EXT4_FEATURE_INCOMPAT_FLEX_BG	0x0200
+#define LJX_EXT4_FEATURE_RO_COMPAT_BIGALLOC	0x0200
+
+/* ext4 superblock fields beyond what struct ext3_super_block names */
+#define LJX_EXT4_SB_DESC_SIZE		0x0fe	/* __le16 s_desc_size */
+#define LJX_EXT4_SB_BLOCKS_COUNT_HI	0x150	/* __le32 s_blocks_count_hi */
+#define LJX_EXT4_SB_LOG_GROUPS_PER_FLEX	0x174	/* __u8 s_log_groups_per_flex */
+
+#define LJX_EXT4_MIN_DESC_SIZE		32
+#define LJX_EXT4_MIN_DESC_SIZE_64BIT	64
+
+struct ljx_ext4_group_desc {
+	__le32	bg_block_bitmap_lo;
+	__le32	bg_inode_bitmap_lo;
+	__le32	bg_inode_table_lo;
+	__le16	bg_free_blocks_count_lo;
+	__le16	bg_free_inodes_count_lo;
+	__le16	bg_used_dirs_count_lo;
+	__le16	bg_flags;
+	__le32	bg_exclude_bitmap_lo;
+	__le16	bg_block_bitmap_csum_lo;
+	__le16	bg_inode_bitmap_csum_lo;
+	__le16	bg_itable_unused_lo;
+	__le16	bg_checksum;
+	/* only present with a descriptor size of 64 or more */
+	__le32	bg_block_bitmap_hi;
+	__le32	bg_inode_bitmap_hi;
+	__le32	bg_inode_table_hi;
+};
+
+#define LJX_EXT4_BG_INODE_UNINIT	0x0001
+#define LJX_EXT4_BG_BLOCK_UNINIT	0x0002
+
+#define LJX_EXT4_EXTENTS_FL		0x00080000
+#define LJX_EXT4_INLINE_DATA_FL		0x10000000
+
+#define LJX_EXT4_EXT_MAGIC		0xf30a
+#define LJX_EXT4_EXT_MAX_DEPTH		5
+#define LJX_EXT4_EXT_INIT_MAX_LEN	(1 << 15)
+
+struct ljx_ext4_extent_header {
+	__le16	eh_magic;
+	__le16	eh_entries;
+	__le16	eh_max;
+	__le16	eh_depth;
+	__le32	eh_generation;
+};
+
+/* leaf entry: a run of data blocks */
+struct ljx_ext4_extent {
+	__le32	ee_block;
+	__le16	ee_len;
+	__le16	ee_start_hi;
+	__le32	ee_start_lo;
+};
+
+/* index entry: points to the next level of the tree */
+struct ljx_ext4_extent_idx {
+	__le32	ei_block;
+	__le32	ei_leaf_lo;
+	__le16	ei_leaf_hi;
+	__u16	ei_unused;
+};
+
+static inline ext3_fsblk_t ljx_ext4_extent_start(struct ljx_ext4_extent *ex) {
+	return ((ext3_fsblk_t) le16_to_cpu(ex->ee_start_hi) << 31 << 1) |
+		le32_to_cpu(ex->ee_start_lo);
+}
+
+static inline unsigned int ljx_ext4_extent_len(struct ljx_ext4_extent *ex) {
+	unsigned int len = le16_to_cpu(ex->ee_len);
+
+	/* lengths above the maximum mark uninitialized extents */
+	return len <= LJX_EXT4_EXT_INIT_MAX_LEN ? len : len - LJX_EXT4_EXT_INIT_MAX_LEN;
+}
+
+static inline ext3_fsblk_t ljx_ext4_idx_leaf(struct ljx_ext4_extent_idx *ix) {
+	return ((ext3_fsblk_t) le16_to_cpu(ix->ei_leaf_hi) << 31 << 1) |
+		le32_to_cpu(ix->ei_leaf_lo);
+}
+
+/**
+ * Checks an extent tree node of size bytes and returns its number of entries,
+ * or -1 if it isn't a sane node.
+ */
+extern int ljx_ext4_extent_entries(struct ljx_ext4_extent_header *, size_t size);
+
+/**
+ * Fills in the filesystem geometry of lsb from an ext3 or ext4 superblock.
+ * Returns -EINVAL for layouts we can't follow.
+ */
+extern int ljx_layout_init(struct ljx_ext3_superblock *, struct ext3_super_block *);
+
+/**
+ * Returns the block holding group descriptor block nr.
+ */
+extern ext3_fsblk_t ljx_descriptor_loc(struct ljx_ext3_superblock *, unsigned int nr);
+
+/**
+ * Decodes the on-disk descriptor of group into lsb->groups[group].
+ */
+extern void ljx_parse_group_desc(struct ljx_ext3_superblock *, unsigned int group,
+		const void *raw);
+
+/**
+ * Return the group whose inode table contains block, or whose block bitmap
+ * is block, or -1 if there is none. With flex_bg the metadata of a group
+ * may live anywhere in its flex group.
+ */
+extern int ljx_itable_group(struct ljx_ext3_superblock *, ext3_fsblk_t block);
+extern int ljx_bitmap_group(struct ljx_ext3_superblock *, ext3_fsblk_t block);
+
+#endif
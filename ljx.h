@@ -12,10 +12,18 @@
 #include "ext3.h"
 #include "boot.h"
 
-#define procfs_name "blkback-ljx"
+#define procfs_name "ljx"
 
 extern struct proc_dir_entry *proc_file;
 
-extern void ljx_init(void);
+/**
+ * Sets up the event rings and /proc/ljx, see events.h.
+ */
+extern int ljx_init(void);
+
+/**
+ * Takes down what ljx_init() set up, if anything.
+ */
+extern void ljx_exit(void);
 
 #endif
@@ -0,0 +1,18 @@
+/*
+ * log.c -- debug log levels, see log.h
+ */
+
+#include <linux/moduleparam.h>
+
+#include "log.h"
+
+unsigned int ljx_log_level[LJX_LOG_SYSTEMS] = {
+	[LJX_LOG_RING]	= LJX_LOG_ERR,
+	[LJX_LOG_GRANT]	= LJX_LOG_ERR,
+	[LJX_LOG_LABEL]	= LJX_LOG_INFO,
+	[LJX_LOG_EXT3]	= LJX_LOG_INFO,
+	[LJX_LOG_BOOT]	= LJX_LOG_INFO,
+};
+module_param_array_named(log_level, ljx_log_level, uint, NULL, 0644);
+MODULE_PARM_DESC(log_level,
+		"Log levels of ring,grant,label,ext3,boot: 0 off, 1 errors, 2 info, 3 debug");
@@ -0,0 +1,56 @@
+#ifndef _LOG_H
+#define _LOG_H
+
+#include <linux/kernel.h>
+#include <linux/ratelimit.h>
+
+/*
+ * Debug logging by subsystem. Each subsystem has a level set through the
+ * log_level module parameter, and messages above it cost a load and a
+ * compare. Messages above LJX_LOG_MAX are compiled out altogether; build with
+ * LJX_LOG_MAX=1 (see the Makefile) to keep nothing but errors. Every call
+ * site is rate limited on its own.
+ */
+
+enum ljx_log_sys {
+	LJX_LOG_RING,		/* requests and bios */
+	LJX_LOG_GRANT,		/* grant mapping */
+	LJX_LOG_LABEL,		/* labels and learning them */
+	LJX_LOG_EXT3,		/* the guest filesystem */
+	LJX_LOG_BOOT,		/* partition tables */
+	LJX_LOG_SYSTEMS
+};
+
+#define LJX_LOG_OFF		0
+#define LJX_LOG_ERR		1
+#define LJX_LOG_INFO		2
+#define LJX_LOG_DEBUG		3
+
+#ifndef LJX_LOG_MAX
+#define LJX_LOG_MAX		LJX_LOG_DEBUG
+#endif
+
+extern unsigned int ljx_log_level[LJX_LOG_SYSTEMS];
+
+#define ljx_log_on(sys, level)						\
+	((level) <= LJX_LOG_MAX && (level) <= ACCESS_ONCE(ljx_log_level[sys]))
+
+#define ljx_log(sys, level, kern, fmt, args...)				\
+	do {								\
+		static DEFINE_RATELIMIT_STATE(_ljx_rs,			\
+				DEFAULT_RATELIMIT_INTERVAL,		\
+				DEFAULT_RATELIMIT_BURST);		\
+									\
+		if (ljx_log_on(sys, level) && __ratelimit(&_ljx_rs))	\
+			printk(kern DRV_PFX "(%s:%d) " fmt ".\n",	\
+			       __func__, __LINE__, ##args);		\
+	} while (0)
+
+#define LJX_ERR(sys, fmt, args...)					\
+	ljx_log(sys, LJX_LOG_ERR, KERN_ERR, fmt, ##args)
+#define LJX_INFO(sys, fmt, args...)					\
+	ljx_log(sys, LJX_LOG_INFO, KERN_INFO, fmt, ##args)
+#define LJX_DEBUG(sys, fmt, args...)					\
+	ljx_log(sys, LJX_LOG_DEBUG, KERN_DEBUG, fmt, ##args)
+
+#endif
@@ -0,0 +1,371 @@
+/*
+ * persist.c -- keep label maps across backend restarts
+ */
+
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/fs.h>
+#include <linux/crc32.h>
+#include <linux/uaccess.h>
+#include <linux/workqueue.h>
+#include <linux/moduleparam.h>
+
+#include "persist.h"
+#include "ext3.h"
+#include "label.h"
+#include "inode_map.h"
+#include "journal.h"
+#include "boot.h"
+
+static char *persist_dir;
+module_param(persist_dir, charp, 0444);
+MODULE_PARM_DESC(persist_dir,
+		"Directory to save label maps in across reconnects (unset disables)");
+
+/* no sane map comes anywhere near this */
+#define LJX_PERSIST_MAX_SIZE	(256 << 20)
+
+static struct workqueue_struct *ljx_persist_wq;
+
+/* the maps of a torn down vbd, to be saved and freed */
+struct persist_work {
+	struct work_struct	work;
+	u32			pdevice;
+	struct ljx_labels	*labels;
+	struct ljx_bootblock	*bootblock;
+};
+
+extern int ljx_persist_init(void) {
+	/* ordered, so a load can wait out every save queued before it */
+	ljx_persist_wq = create_singlethread_workqueue("ljx_persist");
+	return ljx_persist_wq ? 0 : -ENOMEM;
+}
+
+extern void ljx_persist_exit(void) {
+	if (ljx_persist_wq)
+		destroy_workqueue(ljx_persist_wq);
+	ljx_persist_wq = NULL;
+}
+
+static char *map_path(u32 pdevice, struct ljx_ext3_superblock *lsb) {
+	if (! persist_dir || ! *persist_dir)
+		return NULL;
+	return kasprintf(GFP_KERNEL, "%s/%08x-%llu.ljx", persist_dir,
+			pdevice, (unsigned long long) lsb->start);
+}
+
+static inline u32 map_crc(const void *buf, size_t len) {
+	return crc32_le(~0, buf, len) ^ ~0;
+}
+
+static inline size_t map_size(unsigned int groups, unsigned int labels, u64 extents) {
+	return sizeof(struct ljx_persist_header) +
+		groups * sizeof(struct ljx_persist_group) +
+		labels * sizeof(struct ljx_persist_label) +
+		extents * sizeof(struct ljx_persist_extent);
+}
+
+/* the labels that belong to lsb and can be given back their processor */
+static bool saved_label(void *priv, const struct label *label) {
+	struct ljx_ext3_superblock *lsb = priv;
+
+	return label->sector >= lsb->start &&
+		label->sector < ljx_block_to_sector(lsb, lsb->blocks_count) &&
+		label->nr_sec && ljx_ext3_processor(label->label);
+}
+
+struct label_cursor {
+	struct ljx_ext3_superblock *lsb;
+	struct ljx_persist_label *rec;
+};
+
+static bool save_label(void *priv, const struct label *label) {
+	struct label_cursor *cur = priv;
+
+	if (! saved_label(cur->lsb, label))
+		return false;
+	cur->rec->sector = cpu_to_le64(label->sector);
+	cur->rec->nr_sec = cpu_to_le32(label->nr_sec);
+	cur->rec->label = cpu_to_le32(label->label);
+	cur->rec++;
+	return true;
+}
+
+struct extent_cursor {
+	struct ljx_persist_extent *rec;
+};
+
+static void save_extent(void *priv, struct ljx_extent *ext) {
+	struct extent_cursor *cur = priv;
+
+	cur->rec->start = cpu_to_le64(ext->start);
+	cur->rec->len = cpu_to_le32(ext->len);
+	cur->rec->ino = cpu_to_le32(ext->ino);
+	cur->rec->depth = ext->depth;
+	cur->rec->lblock = cpu_to_le32(ext->lblock);
+	cur->rec++;
+}
+
+static int write_map(const char *path, const void *buf, size_t len) {
+	struct file *file;
+	mm_segment_t old_fs;
+	loff_t pos = 0;
+	ssize_t ret;
+
+	file = filp_open(path, O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, 0600);
+	if (IS_ERR(file))
+		return PTR_ERR(file);
+	old_fs = get_fs();
+	set_fs(KERNEL_DS);
+	ret = vfs_write(file, (const char __user *) buf, len, &pos);
+	set_fs(old_fs);
+	if (ret == len)
+		ret = vfs_fsync(file, 0);
+	else if (ret >= 0)
+		ret = -EIO;
+	filp_close(file, NULL);
+	return ret;
+}
+
+static int save_fs(
+		u32 pdevice,
+		struct ljx_labels *labels,
+		struct ljx_ext3_superblock *lsb
+) {
+	struct ljx_persist_header *hdr;
+	struct ljx_persist_group *grec;
+	struct label_cursor lcur;
+	struct extent_cursor cur;
+	unsigned int nr_labels, i;
+	unsigned long nr_extents;
+	size_t len;
+	char *path, *buf;
+	int ret;
+
+	if (! lsb->groups || ! lsb->group_desc || ! lsb->inode_map)
+		return 0;
+	if (! (path = map_path(pdevice, lsb)))
+		return 0;
+
+	/* the vbd is gone by now, so the maps can only have shrunk */
+	nr_labels = ljx_copy_labels(labels, lsb->start, saved_label, lsb,
+			NULL, UINT_MAX);
+	nr_extents = lsb->inode_map->nr_extents;
+	len = map_size(lsb->groups_count, nr_labels, nr_extents);
+	ret = -ENOMEM;
+	if (len > LJX_PERSIST_MAX_SIZE || ! (buf = vzalloc(len)))
+		goto out;
+
+	hdr = (struct ljx_persist_header *) buf;
+	hdr->magic = cpu_to_le32(LJX_PERSIST_MAGIC);
+	hdr->version = cpu_to_le32(LJX_PERSIST_VERSION);
+	hdr->dev = cpu_to_le32(pdevice);
+	hdr->start = cpu_to_le64(lsb->start);
+	memcpy(hdr->uuid, lsb->uuid, sizeof(hdr->uuid));
+	hdr->mnt_count = cpu_to_le32(lsb->mnt_count);
+	hdr->wtime = cpu_to_le32(lsb->wtime);
+	hdr->blocks_count = cpu_to_le64(lsb->blocks_count);
+	hdr->groups_count = cpu_to_le32(lsb->groups_count);
+	if (lsb->journal) {
+		hdr->jnl_tag_size = cpu_to_le32(lsb->journal->tag_size);
+		hdr->jnl_tail_size = cpu_to_le32(lsb->journal->tail_size);
+		hdr->jnl_revoke_size = cpu_to_le32(lsb->journal->revoke_size);
+	}
+
+	grec = (struct ljx_persist_group *) (hdr + 1);
+	for (i = 0; i < lsb->groups_count; i++, grec++) {
+		grec->block_bitmap = cpu_to_le64(lsb->groups[i].block_bitmap);
+		grec->inode_bitmap = cpu_to_le64(lsb->groups[i].inode_bitmap);
+		grec->inode_table = cpu_to_le64(lsb->groups[i].inode_table);
+		grec->flags = cpu_to_le32(lsb->groups[i].flags);
+		grec->init = lsb->group_desc[i / lsb->desc_per_block].init;
+	}
+
+	lcur.lsb = lsb;
+	lcur.rec = (struct ljx_persist_label *) grec;
+	nr_labels = ljx_copy_labels(labels, lsb->start, save_label, &lcur,
+			NULL, nr_labels);
+
+	cur.rec = (struct ljx_persist_extent *) lcur.rec;
+	nr_extents = ljx_inode_map_walk(lsb->inode_map, save_extent, &cur, nr_extents);
+	/* whatever was merged away since we counted is left off the end */
+	hdr->nr_labels = cpu_to_le32(nr_labels);
+	hdr->nr_extents = cpu_to_le64(nr_extents);
+	len = map_size(lsb->groups_count, nr_labels, nr_extents);
+
+	hdr->crc = cpu_to_le32(map_crc(buf, len));
+	ret = write_map(path, buf, len);
+	vfree(buf);
+out:
+	if (ret)
+		LJX_ERR(LJX_LOG_LABEL, "could not save %s: %d", path, ret);
+	kfree(path);
+	return ret;
+}
+
+static void persist_work(struct work_struct *work) {
+	struct persist_work *pw = container_of(work, struct persist_work, work);
+	struct ljx_ext3_superblock *lsb;
+	unsigned int i;
+
+	for_each_ljx_fs(pw->bootblock, i, lsb)
+		save_fs(pw->pdevice, pw->labels, lsb);
+	ljx_bootblock_free(pw->bootblock);
+	ljx_labels_free(pw->labels);
+	kfree(pw);
+}
+
+extern void ljx_persist_save(struct xen_vbd *vbd) {
+	struct persist_work *pw;
+
+	if (! vbd->bootblock || ! persist_dir || ! *persist_dir ||
+	    ! ljx_persist_wq)
+		return;
+	pw = kmalloc(sizeof(struct persist_work), GFP_KERNEL);
+	if (! pw)
+		return;
+	INIT_WORK(&pw->work, persist_work);
+	pw->pdevice = vbd->pdevice;
+	pw->labels = vbd->labels;
+	pw->bootblock = vbd->bootblock;
+	vbd->labels = NULL;
+	vbd->bootblock = NULL;
+	queue_work(ljx_persist_wq, &pw->work);
+}
+
+/* checks that a saved map is intact and describes the live filesystem */
+static bool valid_map(
+		struct xen_vbd *vbd,
+		struct ljx_ext3_superblock *lsb,
+		struct ljx_persist_header *hdr,
+		size_t len
+) {
+	u32 crc = le32_to_cpu(hdr->crc);
+
+	hdr->crc = 0;
+	return map_crc(hdr, len) == crc &&
+		le32_to_cpu(hdr->dev) == vbd->pdevice &&
+		le64_to_cpu(hdr->start) == lsb->start &&
+		! memcmp(hdr->uuid, lsb->uuid, sizeof(hdr->uuid)) &&
+		le32_to_cpu(hdr->mnt_count) == lsb->mnt_count &&
+		le32_to_cpu(hdr->wtime) == lsb->wtime &&
+		le64_to_cpu(hdr->blocks_count) == lsb->blocks_count &&
+		le32_to_cpu(hdr->groups_count) == lsb->groups_count;
+}
+
+static int restore_map(
+		struct xen_vbd *vbd,
+		struct ljx_ext3_superblock *lsb,
+		struct ljx_persist_header *hdr
+) {
+	struct ljx_persist_group *grec = (struct ljx_persist_group *) (hdr + 1);
+	struct ljx_persist_label *lrec;
+	struct ljx_persist_extent *erec;
+	unsigned int nr_labels = le32_to_cpu(hdr->nr_labels), i;
+	u64 nr_extents = le64_to_cpu(hdr->nr_extents), e;
+	sector_t end = ljx_block_to_sector(lsb, lsb->blocks_count);
+	struct label *labels;
+	int ret;
+
+	lrec = (struct ljx_persist_label *) (grec + lsb->groups_count);
+	erec = (struct ljx_persist_extent *) (lrec + nr_labels);
+
+	labels = vmalloc(max(nr_labels, 1U) * sizeof(struct label));
+	if (! labels)
+		return -ENOMEM;
+	for (i = 0; i < nr_labels; i++) {
+		labels[i].sector = le64_to_cpu(lrec[i].sector);
+		labels[i].nr_sec = le32_to_cpu(lrec[i].nr_sec);
+		labels[i].label = le32_to_cpu(lrec[i].label);
+		labels[i].processor = ljx_ext3_processor(labels[i].label);
+		if (! labels[i].processor || labels[i].sector < lsb->start ||
+		    labels[i].sector >= end || labels[i].nr_sec > end - labels[i].sector ||
+		    (i && labels[i].sector < labels[i - 1].sector)) {
+			ret = -EINVAL;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < lsb->groups_count; i++, grec++) {
+		lsb->groups[i].block_bitmap = le64_to_cpu(grec->block_bitmap);
+		lsb->groups[i].inode_bitmap = le64_to_cpu(grec->inode_bitmap);
+		lsb->groups[i].inode_table = le64_to_cpu(grec->inode_table);
+		lsb->groups[i].flags = le32_to_cpu(grec->flags);
+		if (grec->init)
+			lsb->group_desc[i / lsb->desc_per_block].init = true;
+	}
+	for (e = 0; e < nr_extents; e++, erec++) {
+		if (le64_to_cpu(erec->start) >= lsb->blocks_count ||
+		    le32_to_cpu(erec->len) > lsb->blocks_count - le64_to_cpu(erec->start))
+			continue;
+		ljx_inode_map_add(lsb->inode_map, le64_to_cpu(erec->start),
+				le32_to_cpu(erec->len), le32_to_cpu(erec->ino), erec->depth,
+				le32_to_cpu(erec->lblock));
+	}
+	if (lsb->journal) {
+		for (i = 0; i < nr_labels; i++)
+			if (labels[i].label == JOURNAL)
+				ljx_journal_add_area(lsb->journal, labels[i].sector,
+						labels[i].nr_sec);
+		if (le32_to_cpu(hdr->jnl_tag_size) &&
+		    le32_to_cpu(hdr->jnl_revoke_size)) {
+			lsb->journal->tag_size = le32_to_cpu(hdr->jnl_tag_size);
+			lsb->journal->tail_size = le32_to_cpu(hdr->jnl_tail_size);
+			lsb->journal->revoke_size = le32_to_cpu(hdr->jnl_revoke_size);
+		}
+	}
+	ret = ljx_insert_labels(vbd->labels, labels, nr_labels);
+out:
+	vfree(labels);
+	return ret;
+}
+
+extern int ljx_persist_load(struct xen_vbd *vbd, struct ljx_ext3_superblock *lsb) {
+	struct ljx_persist_header hdr;
+	struct file *file;
+	char *path, *buf = NULL;
+	size_t len;
+	int ret;
+
+	if (! lsb->groups || ! lsb->group_desc || ! lsb->inode_map)
+		return -EINVAL;
+	if (! (path = map_path(vbd->pdevice, lsb)))
+		return -ENOENT;
+	/* the map may be of this very vbd, saved as it disconnected */
+	if (ljx_persist_wq)
+		flush_workqueue(ljx_persist_wq);
+	file = filp_open(path, O_RDONLY | O_LARGEFILE, 0);
+	if (IS_ERR(file)) {
+		ret = PTR_ERR(file);
+		goto out;
+	}
+
+	ret = -EINVAL;
+	if (kernel_read(file, 0, (char *) &hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    le32_to_cpu(hdr.magic) != LJX_PERSIST_MAGIC ||
+	    le32_to_cpu(hdr.version) != LJX_PERSIST_VERSION ||
+	    le32_to_cpu(hdr.groups_count) != lsb->groups_count)
+		goto close;
+	len = map_size(lsb->groups_count, le32_to_cpu(hdr.nr_labels),
+			le64_to_cpu(hdr.nr_extents));
+	if (len > LJX_PERSIST_MAX_SIZE)
+		goto close;
+	ret = -ENOMEM;
+	if (! (buf = vmalloc(len)))
+		goto close;
+	ret = -EINVAL;
+	if (kernel_read(file, 0, buf, len) != len ||
+	    ! valid_map(vbd, lsb, (struct ljx_persist_header *) buf, len))
+		goto close;
+	ret = restore_map(vbd, lsb, (struct ljx_persist_header *) buf);
+	if (! ret)
+		LJX_INFO(LJX_LOG_LABEL, "restored %u labels from %s",
+				le32_to_cpu(hdr.nr_labels), path);
+
+close:
+	vfree(buf);
+	filp_close(file, NULL);
+out:
+	kfree(path);
+	return ret;
+}
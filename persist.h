@@ -0,0 +1,79 @@
+#ifndef _PERSIST_H
+#define _PERSIST_H
+
+#include <linux/kernel.h>
+
+#include "common.h"
+
+/* saved label map file, all fields little-endian */
+
+#define LJX_PERSIST_MAGIC	0x4d584a4c	/* "LJXM" */
+#define LJX_PERSIST_VERSION	3
+
+/**
+ * The file starts with this header, followed by groups_count group records,
+ * nr_labels label records sorted by sector and nr_extents inode map extents.
+ * crc is the crc32 of the whole file with crc itself zeroed.
+ */
+struct ljx_persist_header {
+	__le32		magic;
+	__le32		version;
+	__le32		crc;
+	__le32		dev;			/* vbd->pdevice */
+	__le64		start;			/* first sector of the filesystem */
+	/* must match the live superblock */
+	__u8		uuid[16];
+	__le32		mnt_count;
+	__le32		wtime;
+	__le64		blocks_count;
+	__le32		groups_count;
+	/* journal descriptor layout, learned from its superblock */
+	__le32		jnl_tag_size;
+	__le32		jnl_tail_size;
+	__le32		jnl_revoke_size;
+	__le32		nr_labels;
+	__le64		nr_extents;
+} __attribute__((packed));
+
+struct ljx_persist_group {
+	__le64		block_bitmap;
+	__le64		inode_bitmap;
+	__le64		inode_table;
+	__le32		flags;
+	__u8		init;			/* its descriptor block was parsed */
+	__u8		pad[3];
+} __attribute__((packed));
+
+struct ljx_persist_label {
+	__le64		sector;
+	__le32		nr_sec;
+	__le32		label;
+} __attribute__((packed));
+
+struct ljx_persist_extent {
+	__le64		start;
+	__le32		len;
+	__le32		ino;
+	__u8		depth;
+	__u8		pad[3];
+	__le32		lblock;
+} __attribute__((packed));
+
+extern int ljx_persist_init(void);
+extern void ljx_persist_exit(void);
+
+/**
+ * Writes the label map of every filesystem on vbd to the persist_dir module
+ * parameter directory. The writing is left to a workqueue, which takes over
+ * vbd->labels and vbd->bootblock and frees them when done; both are NULL on
+ * return if so. Must be called once nothing else uses the maps.
+ */
+extern void ljx_persist_save(struct xen_vbd *);
+
+/**
+ * Restores the saved label map of lsb, if there is one and it matches the
+ * live superblock. Returns 0 if it was restored. Process context only.
+ */
+extern int ljx_persist_load(struct xen_vbd *, struct ljx_ext3_superblock *);
+
+#endif
@@ -1,146 +1,237 @@
 /*
- * proc-ljx.c -- procfs functions for xen-blkback-ljx driver
+ * proc-ljx.c -- the event rings behind /proc/ljx, see events.h
  */
 
-#include <linux/seq_file.h>
-#include <linux/list.h>
-#include <linux/spinlock.h>
+#include <linux/cpumask.h>
+#include <linux/irqflags.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
 
 #include "ljx.h"
+#include "events.h"
 
-#define DATA_SIZE 1024
-
-#define MAX(a, b) ((a) > (b) ? (a) : (b))
-#define MIN(a, b) ((a) > (b) ? (b) : (a))
+static unsigned int event_pages = 64;
+module_param(event_pages, uint, 0444);
+MODULE_PARM_DESC(event_pages,
+		"Pages of events kept per cpu for /proc/ljx, 0 to disable");
 
 struct proc_dir_entry *proc_file;
-static LIST_HEAD(buffer_list);
-static struct buffer *current_buffer;
+bool ljx_events_enabled;
 
-struct buffer {
-	struct list_head list;
-	char *buf;
-	loff_t len;
+/*
+ * A ring's header page can be mapped writable, so the kernel keeps head and
+ * dropped here and only copies them out; all it takes from the page is tail.
+ */
+struct ring {
+	struct ljx_event_ring	*page;		/* header, then the records */
+	u64			head;
+	u64			dropped;
+	u64			reported;	/* dropped as read() last told */
 };
 
-static struct buffer *init_buf(void) {
-	struct buffer *ret = kmalloc(sizeof(char) * DATA_SIZE, 0);
-	ret->len	= 0,
-	ret->buf	= kmalloc(sizeof(char) * DATA_SIZE, 0),
-	memset(ret->buf, 0, sizeof(char) * DATA_SIZE);
+/* indexed by cpu; page is NULL for cpus we couldn't get a ring for */
+static struct ring *rings;
+static unsigned int ring_size;		/* records per ring */
+static unsigned int ring_pages;		/* pages per ring, header included */
+/* one reader at a time */
+static DEFINE_MUTEX(read_mutex);
 
-	return ret;
+static inline struct ljx_event *ring_records(struct ljx_event_ring *ring) {
+	return (struct ljx_event *) ((char *) ring + PAGE_SIZE);
 }
 
-struct user_pos {
-	struct buffer *buf;
-	loff_t offset;
-};
-
-static void *ljx_seq_start(struct seq_file *s, loff_t *pos) {
-	struct user_pos *upos;
-	
-	upos = kmalloc(sizeof(struct user_pos), GFP_KERNEL);
-	if (!upos)
-		return NULL;
-	upos->buf = list_entry(buffer_list.next, struct buffer, list);
-	upos->offset = 0;
+extern void __ljx_event(u16 type, u32 dev, sector_t sector, u32 nr_sec, u32 arg) {
+	struct ring *ring;
+	struct ljx_event *ev;
+	unsigned long flags;
+	unsigned int cpu;
+	u64 head;
+
+	local_irq_save(flags);
+	cpu = smp_processor_id();
+	ring = &rings[cpu];
+	if (! ring->page)
+		goto out;
+	head = ring->head;
+	/* the tail may come from a mapping, so don't trust it to be sane */
+	if (head - ACCESS_ONCE(ring->page->tail) >= ring_size) {
+		ring->dropped++;
+		ring->page->dropped = ring->dropped;
+		goto out;
+	}
+	ev = &ring_records(ring->page)[head & (ring_size - 1)];
+	ev->time = local_clock();
+	ev->sector = sector;
+	ev->dev = dev;
+	ev->nr_sec = nr_sec;
+	ev->type = type;
+	ev->cpu = cpu;
+	ev->arg = arg;
+	/* the record is complete before the reader can see it */
+	smp_wmb();
+	ACCESS_ONCE(ring->head) = head + 1;
+	ring->page->head = head + 1;
+out:
+	local_irq_restore(flags);
+}
 
-	return upos;
+/* copies n records from index from of ring to buf */
+static int copy_records(
+		char __user *buf,
+		struct ljx_event_ring *ring,
+		u64 from,
+		unsigned int n
+) {
+	unsigned int first = from & (ring_size - 1);
+	unsigned int part = min(n, ring_size - first);
+
+	if (copy_to_user(buf, &ring_records(ring)[first], part * sizeof(struct ljx_event)))
+		return -EFAULT;
+	if (part < n &&
+	    copy_to_user(buf + part * sizeof(struct ljx_event), ring_records(ring),
+			    (n - part) * sizeof(struct ljx_event)))
+		return -EFAULT;
+	return 0;
 }
 
-static void ljx_seq_stop(struct seq_file *s, void *v)
-{
-	kfree (v);
+/* tells buf how many events cpu's ring lost since the last call */
+static int copy_dropped(char __user *buf, struct ring *ring, unsigned int cpu,
+		u64 dropped) {
+	struct ljx_event ev = {
+		.time	= local_clock(),
+		.type	= LJX_EV_DROPPED,
+		.cpu	= cpu,
+		.arg	= min_t(u64, dropped - ring->reported, ~0U),
+	};
+
+	if (copy_to_user(buf, &ev, sizeof(ev)))
+		return -EFAULT;
+	ring->reported = dropped;
+	return 0;
 }
 
-static void *ljx_seq_next(struct seq_file *s, void *v, loff_t *pos) {
-	struct user_pos *upos;
-	loff_t byte_in_buf;
-       
-	upos = (struct user_pos *) v;
-	byte_in_buf = ++upos->offset % DATA_SIZE;
-
-	if (byte_in_buf == 0) {
-		if (upos->buf->list.next == &buffer_list)
-			/* we have reached the end */
-			return 0;
-		/* must move to next buf */
-		upos->buf = list_entry(upos->buf->list.next, struct buffer, list);
-	}
-	if (byte_in_buf >= upos->buf->len) {
-		/* we have reached the very end! */
-		return 0;
+static ssize_t ljx_read(struct file *file, char __user *buf, size_t count,
+		loff_t *ppos) {
+	struct ring *ring;
+	unsigned int cpu, n;
+	size_t done = 0;
+	u64 head, tail, dropped;
+	int err = 0;
+
+	if (count < sizeof(struct ljx_event))
+		return -EINVAL;
+	if (mutex_lock_interruptible(&read_mutex))
+		return -ERESTARTSYS;
+	for_each_possible_cpu(cpu) {
+		ring = &rings[cpu];
+		if (! ring->page)
+			continue;
+		dropped = ACCESS_ONCE(ring->dropped);
+		if (dropped != ring->reported) {
+			err = copy_dropped(buf + done, ring, cpu, dropped);
+			if (err)
+				break;
+			done += sizeof(struct ljx_event);
+		}
+		head = ACCESS_ONCE(ring->head);
+		/* see the records the head covers */
+		smp_rmb();
+		tail = ACCESS_ONCE(ring->page->tail);
+		if (head - tail > ring_size)
+			/* a mapping left it in a mess; start again from now */
+			tail = head;
+		n = min_t(u64, head - tail, (count - done) / sizeof(struct ljx_event));
+		if (n) {
+			err = copy_records(buf + done, ring->page, tail, n);
+			if (err)
+				break;
+			done += n * sizeof(struct ljx_event);
+		}
+		/* done with the records before the writer may reuse them */
+		smp_mb();
+		ACCESS_ONCE(ring->page->tail) = tail + n;
+		if (count - done < sizeof(struct ljx_event))
+			break;
 	}
-
-	return upos;
+	mutex_unlock(&read_mutex);
+	return done ? done : err;
 }
 
-static int ljx_seq_show(struct seq_file *s, void *v) {
-	struct user_pos *upos;
-	loff_t byte_in_buf;
-       
-	upos = (struct user_pos *) v;
-	byte_in_buf = upos->offset % DATA_SIZE;
-
-	seq_printf(s, "%c", upos->buf->buf[byte_in_buf]);
+static int ljx_mmap(struct file *file, struct vm_area_struct *vma) {
+	unsigned long cpu = vma->vm_pgoff / ring_pages;
 
-	return 0;
+	if (vma->vm_pgoff % ring_pages || cpu >= nr_cpu_ids ||
+	    ! rings[cpu].page ||
+	    vma->vm_end - vma->vm_start > (unsigned long) ring_pages * PAGE_SIZE)
+		return -EINVAL;
+	return remap_vmalloc_range(vma, rings[cpu].page, 0);
 }
 
-static struct seq_operations ljx_seq_ops = {
-	.start = ljx_seq_start,
-	.next  = ljx_seq_next,
-	.stop  = ljx_seq_stop,
-	.show  = ljx_seq_show
+static const struct file_operations ljx_file_ops = {
+	.owner   = THIS_MODULE,
+	.read    = ljx_read,
+	.mmap    = ljx_mmap,
 };
 
-static int ljx_open(struct inode *inode, struct file *file)
-{
-	return seq_open(file, &ljx_seq_ops);
+static void free_rings(void) {
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu)
+		vfree(rings[cpu].page);
+	kfree(rings);
+	rings = NULL;
 }
 
-static struct file_operations ljx_file_ops = {
-	.open    = ljx_open,
-	.read    = seq_read,
-	.llseek  = seq_lseek,
-	.release = seq_release
-};
+extern int ljx_init(void) {
+	unsigned int cpu, nr = 0;
 
-void ljx_init() {
-	/* initialize procfs file 
-	proc_file = create_proc_entry(procfs_name, 0644, NULL);
-	if (proc_file == NULL) {
-		printk(KERN_ALERT "Error: could not initialize /proc/%s\n", procfs_name);
+	if (! event_pages)
+		return 0;
+	event_pages = roundup_pow_of_two(event_pages);
+	ring_size = event_pages * (PAGE_SIZE / sizeof(struct ljx_event));
+	ring_pages = LJX_EVENT_RING_PAGES(ring_size);
+
+	rings = kcalloc(nr_cpu_ids, sizeof(*rings), GFP_KERNEL);
+	if (! rings)
+		return -ENOMEM;
+	for_each_possible_cpu(cpu) {
+		/* zeroed, and allowed to be mapped */
+		rings[cpu].page = vmalloc_user(ring_pages * PAGE_SIZE);
+		if (! rings[cpu].page)
+			continue;
+		rings[cpu].page->size = ring_size;
+		rings[cpu].page->cpu = cpu;
+		nr++;
 	}
-	proc_file->read_proc	= procfile_read;
-	proc_file->mode		= S_IFREG | S_IRUGO;
-	proc_file->uid		= 0;
-	proc_file->gid		= 0;
-	proc_file->size		= 37;
-	*/
-	struct proc_dir_entry *entry;
-
-	/* initialize buffer list */
-	struct buffer *first_buf = init_buf();
-	list_add_tail(&first_buf->list, &buffer_list);
-	current_buffer = first_buf;
-
-	entry = create_proc_entry("ljx", 0, NULL);
-	if (entry)
-		entry->proc_fops = &ljx_file_ops;
-}
+	if (! nr)
+		goto fail;
 
-int procfile_read(char *buffer,
-	char **buffer_location,
-	off_t offset, int buffer_length, int *eof, void *data) {
-	int ret;
-	
-	if (offset > 0) {
-		ret = 0;
-	} else {
-		ret = sprintf(buffer, "Hello world!");
-	}
+	proc_file = proc_create(procfs_name, S_IRUSR, NULL, &ljx_file_ops);
+	if (! proc_file)
+		goto fail;
+	ljx_events_enabled = true;
+	return 0;
+
+fail:
+	free_rings();
+	return -ENOMEM;
+}
 
-	return ret;
+extern void ljx_exit(void) {
+	if (! rings)
+		return;
+	ljx_events_enabled = false;
+	if (proc_file)
+		remove_proc_entry(procfs_name, NULL);
+	proc_file = NULL;
+	/* let any event still being logged finish with its ring */
+	synchronize_sched();
+	free_rings();
 }
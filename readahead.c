@@ -0,0 +1,367 @@
+/*
+ * readahead.c -- file-aware readahead using the reverse block map
+ */
+
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/highmem.h>
+#include <linux/jiffies.h>
+#include <linux/hash.h>
+#include <linux/moduleparam.h>
+
+#include "readahead.h"
+#include "ext3.h"
+#include "inode_map.h"
+
+#define LJX_RA_HASH_BITS	6
+#define LJX_RA_MAX_BIO_PAGES	32
+
+/* off unless asked for: it reads from the device on no request of the guest */
+static unsigned int ra_pages;
+module_param(ra_pages, uint, 0444);
+MODULE_PARM_DESC(ra_pages, "Per-vbd readahead budget in pages (0 disables)");
+
+#define slot_sector(s)	((s) & ~((sector_t) LJX_RA_SLOT_SECTORS - 1))
+
+static inline struct hlist_head *slot_bucket(struct ljx_readahead *ra, sector_t sector) {
+	return &ra->hash[hash_long(sector / LJX_RA_SLOT_SECTORS, LJX_RA_HASH_BITS)];
+}
+
+/* must be called with ra->lock held */
+static struct ljx_ra_slot *find_slot(struct ljx_readahead *ra, sector_t sector) {
+	struct ljx_ra_slot *slot;
+	struct hlist_node *pos;
+
+	hlist_for_each_entry(slot, pos, slot_bucket(ra, sector), hash)
+		if (slot->sector == sector)
+			return slot;
+	return NULL;
+}
+
+/* must be called with ra->lock held */
+static void drop_slot(struct ljx_readahead *ra, struct ljx_ra_slot *slot) {
+	if (slot->state == RA_VALID && ! slot->hit)
+		ra->wasted += LJX_RA_SLOT_SECTORS;
+	if (slot->state != RA_EMPTY)
+		hlist_del(&slot->hash);
+	slot->state = RA_EMPTY;
+	list_move_tail(&slot->lru, &ra->lru);
+}
+
+extern struct ljx_readahead *ljx_ra_alloc(struct xen_vbd *vbd) {
+	struct ljx_readahead *ra;
+	unsigned int i, nr_pages = ra_pages;
+
+	if (! nr_pages)
+		return NULL;
+	ra = kzalloc(sizeof(struct ljx_readahead), GFP_KERNEL);
+	if (! ra)
+		return NULL;
+	ra->hash = kcalloc(1 << LJX_RA_HASH_BITS, sizeof(struct hlist_head), GFP_KERNEL);
+	ra->slots = kcalloc(nr_pages, sizeof(struct ljx_ra_slot), GFP_KERNEL);
+	if (! ra->hash || ! ra->slots)
+		goto fail;
+
+	spin_lock_init(&ra->lock);
+	INIT_LIST_HEAD(&ra->lru);
+	init_waitqueue_head(&ra->wq);
+	atomic_set(&ra->nr_bios, 0);
+	ra->vbd = vbd;
+	for (i = 0; i < (1 << LJX_RA_HASH_BITS); i++)
+		INIT_HLIST_HEAD(&ra->hash[i]);
+	for (i = 0; i < nr_pages; i++) {
+		ra->slots[i].page = alloc_page(GFP_KERNEL);
+		if (! ra->slots[i].page)
+			goto fail;
+		/* lets the completion find the slot from the bio_vec */
+		set_page_private(ra->slots[i].page, i);
+		ra->slots[i].state = RA_EMPTY;
+		list_add_tail(&ra->slots[i].lru, &ra->lru);
+		ra->nr_slots++;
+	}
+	return ra;
+
+fail:
+	ljx_ra_free(ra);
+	return NULL;
+}
+
+extern void ljx_ra_free(struct ljx_readahead *ra) {
+	unsigned int i;
+
+	if (! ra)
+		return;
+	wait_event(ra->wq, atomic_read(&ra->nr_bios) == 0);
+	for (i = 0; i < ra->nr_slots; i++)
+		__free_page(ra->slots[i].page);
+	kfree(ra->slots);
+	kfree(ra->hash);
+	kfree(ra);
+}
+
+extern int ljx_ra_read(
+		struct ljx_readahead *ra,
+		sector_t sector,
+		struct bio_vec *vec,
+		int nvec
+) {
+	struct ljx_ra_slot *slot;
+	unsigned long flags;
+	unsigned int nr_sec = 0, off, len, done;
+	sector_t s;
+	char *dst;
+	int i;
+
+	for (i = 0; i < nvec; i++)
+		nr_sec += vec[i].bv_len >> 9;
+
+	spin_lock_irqsave(&ra->lock, flags);
+	for (s = slot_sector(sector); s < sector + nr_sec; s += LJX_RA_SLOT_SECTORS) {
+		slot = find_slot(ra, s);
+		if (! slot || slot->state != RA_VALID) {
+			spin_unlock_irqrestore(&ra->lock, flags);
+			return 1;
+		}
+	}
+
+	s = sector;
+	for (i = 0; i < nvec; i++) {
+		dst = kmap_atomic(vec[i].bv_page);
+		for (done = 0; done < vec[i].bv_len; done += len, s += len >> 9) {
+			slot = find_slot(ra, slot_sector(s));
+			off = (s - slot->sector) << 9;
+			len = min_t(unsigned int, PAGE_SIZE - off, vec[i].bv_len - done);
+			memcpy(dst + vec[i].bv_offset + done,
+					page_address(slot->page) + off, len);
+			slot->hit = true;
+			list_move(&slot->lru, &ra->lru);
+		}
+		kunmap_atomic(dst);
+	}
+	ra->hits += nr_sec;
+	spin_unlock_irqrestore(&ra->lock, flags);
+	return 0;
+}
+
+extern void ljx_ra_invalidate(
+		struct ljx_readahead *ra,
+		sector_t sector,
+		unsigned int nr_sec
+) {
+	struct ljx_ra_slot *slot;
+	unsigned long flags;
+	sector_t s;
+
+	spin_lock_irqsave(&ra->lock, flags);
+	for (s = slot_sector(sector); s < sector + nr_sec; s += LJX_RA_SLOT_SECTORS) {
+		slot = find_slot(ra, s);
+		if (! slot)
+			continue;
+		if (slot->state == RA_INFLIGHT)
+			slot->state = RA_STALE;
+		else if (slot->state == RA_VALID)
+			drop_slot(ra, slot);
+	}
+	spin_unlock_irqrestore(&ra->lock, flags);
+}
+
+static void ra_end_io(struct bio *bio, int error) {
+	struct ljx_readahead *ra = bio->bi_private;
+	struct ljx_ra_slot *slot;
+	struct bio_vec *bvl;
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&ra->lock, flags);
+	__bio_for_each_segment(bvl, bio, i, 0) {
+		slot = &ra->slots[page_private(bvl->bv_page)];
+		ra->inflight--;
+		if (slot->state == RA_INFLIGHT && ! error) {
+			slot->state = RA_VALID;
+			list_add(&slot->lru, &ra->lru);
+		} else {
+			hlist_del(&slot->hash);
+			slot->state = RA_EMPTY;
+			list_add_tail(&slot->lru, &ra->lru);
+		}
+	}
+	spin_unlock_irqrestore(&ra->lock, flags);
+
+	bio_put(bio);
+	if (atomic_dec_and_test(&ra->nr_bios))
+		wake_up(&ra->wq);
+}
+
+/* claims a slot for sector, or returns NULL if it is present or over budget */
+static struct ljx_ra_slot *claim_slot(struct ljx_readahead *ra, sector_t sector) {
+	struct ljx_ra_slot *slot;
+
+	/* keep half the budget for data the guest has yet to read */
+	if (ra->inflight >= ra->nr_slots / 2 || list_empty(&ra->lru))
+		return NULL;
+	if (find_slot(ra, sector))
+		return NULL;
+	slot = list_entry(ra->lru.prev, struct ljx_ra_slot, lru);
+	drop_slot(ra, slot);
+	list_del(&slot->lru);
+	slot->sector = sector;
+	slot->state = RA_INFLIGHT;
+	slot->hit = false;
+	hlist_add_head(&slot->hash, slot_bucket(ra, sector));
+	ra->inflight++;
+	return slot;
+}
+
+/* gives back slots that were claimed but could not be submitted */
+static void release_slots(struct ljx_readahead *ra, struct ljx_ra_slot **slots, int nr) {
+	unsigned long flags;
+
+	spin_lock_irqsave(&ra->lock, flags);
+	while (nr--) {
+		hlist_del(&slots[nr]->hash);
+		slots[nr]->state = RA_EMPTY;
+		list_add_tail(&slots[nr]->lru, &ra->lru);
+		ra->inflight--;
+	}
+	spin_unlock_irqrestore(&ra->lock, flags);
+}
+
+static void submit_slots(struct ljx_readahead *ra, struct ljx_ra_slot **slots, int nr) {
+	struct bio *bio;
+	unsigned long flags;
+	int i;
+
+	if (! nr)
+		return;
+	bio = bio_alloc(GFP_NOIO, nr);
+	if (! bio)
+		goto fail;
+	bio->bi_bdev = ra->vbd->bdev;
+	bio->bi_sector = slots[0]->sector;
+	bio->bi_private = ra;
+	bio->bi_end_io = ra_end_io;
+	for (i = 0; i < nr; i++)
+		if (! bio_add_page(bio, slots[i]->page, PAGE_SIZE, 0))
+			break;
+	if (! i) {
+		bio_put(bio);
+		goto fail;
+	}
+	/* the queue would not take them all; hand the rest back */
+	release_slots(ra, slots + i, nr - i);
+
+	spin_lock_irqsave(&ra->lock, flags);
+	ra->issued += i * LJX_RA_SLOT_SECTORS;
+	spin_unlock_irqrestore(&ra->lock, flags);
+
+	atomic_inc(&ra->nr_bios);
+	submit_bio(READ, bio);
+	return;
+
+fail:
+	release_slots(ra, slots, nr);
+}
+
+/* reads sectors [start, end) into free slots */
+static void prefetch(struct ljx_readahead *ra, sector_t start, sector_t end) {
+	struct ljx_ra_slot *slots[LJX_RA_MAX_BIO_PAGES], *slot;
+	unsigned long flags;
+	sector_t s;
+	int nr = 0;
+
+	end = min_t(sector_t, end, ra->vbd->size);
+	for (s = slot_sector(start); s + LJX_RA_SLOT_SECTORS <= end;
+			s += LJX_RA_SLOT_SECTORS) {
+		spin_lock_irqsave(&ra->lock, flags);
+		slot = claim_slot(ra, s);
+		spin_unlock_irqrestore(&ra->lock, flags);
+		if (! slot || nr == LJX_RA_MAX_BIO_PAGES) {
+			/* a gap or a full bio: send what we have */
+			submit_slots(ra, slots, nr);
+			nr = 0;
+		}
+		if (slot)
+			slots[nr++] = slot;
+	}
+	submit_slots(ra, slots, nr);
+}
+
+/* must be called with ra->lock held */
+static struct ljx_ra_stream *find_stream(
+		struct ljx_readahead *ra,
+		struct ljx_ext3_superblock *fs,
+		unsigned int ino
+) {
+	struct ljx_ra_stream *stream, *oldest = &ra->streams[0];
+	int i;
+
+	for (i = 0; i < LJX_RA_STREAMS; i++) {
+		stream = &ra->streams[i];
+		if (stream->fs == fs && stream->ino == ino)
+			return stream;
+		if (time_before(stream->last_used, oldest->last_used))
+			oldest = stream;
+	}
+	memset(oldest, 0, sizeof(struct ljx_ra_stream));
+	oldest->fs = fs;
+	oldest->ino = ino;
+	return oldest;
+}
+
+extern void ljx_ra_note_read(
+		struct ljx_readahead *ra,
+		sector_t sector,
+		unsigned int nr_sec
+) {
+	struct ljx_ext3_superblock *lsb;
+	struct ljx_ra_stream *stream;
+	ext3_fsblk_t first, last, starts[LJX_RA_MAX_RUNS];
+	unsigned int ino, last_ino, window, lens[LJX_RA_MAX_RUNS];
+	unsigned char depth;
+	unsigned long flags;
+	u32 lfirst, llast, from;
+	bool sequential;
+	int i, nr;
+
+	lsb = ljx_partition_fs(ra->vbd, sector, &nr_sec);
+	if (! lsb || ! lsb->inode_map || ! nr_sec)
+		return;
+	first = ljx_sector_to_block(lsb, sector);
+	last = ljx_sector_to_block(lsb, sector + nr_sec - 1);
+	if (ljx_inode_map_lookup(lsb->inode_map, first, &ino, &depth, &lfirst) ||
+	    depth)
+		return;
+	/* where a sequential reader goes next is after this, in file order */
+	if (ljx_inode_map_lookup(lsb->inode_map, last, &last_ino, &depth, &llast) ||
+	    last_ino != ino || depth)
+		llast = lfirst + (u32) (last - first);
+	window = ra->nr_slots / 2 * LJX_RA_SLOT_SECTORS / lsb->sec_per_block;
+
+	spin_lock_irqsave(&ra->lock, flags);
+	stream = find_stream(ra, lsb, ino);
+	sequential = stream->next_lblock == lfirst;
+	stream->seq = sequential ? stream->seq + 1 : 0;
+	stream->next_lblock = llast + 1;
+	stream->last_used = jiffies;
+	/* after a seek, what we fetched ahead of the old place is no guide */
+	if (! sequential || stream->ra_lblock <= llast)
+		stream->ra_lblock = llast + 1;
+	/* top up only once the guest has eaten into the window */
+	if (! stream->seq || stream->ra_lblock - (llast + 1) > window / 2) {
+		spin_unlock_irqrestore(&ra->lock, flags);
+		return;
+	}
+	from = stream->ra_lblock;
+	spin_unlock_irqrestore(&ra->lock, flags);
+
+	nr = ljx_inode_map_file_runs(lsb->inode_map, ino, &from, window,
+			starts, lens, LJX_RA_MAX_RUNS);
+	for (i = 0; i < nr; i++)
+		prefetch(ra, ljx_block_to_sector(lsb, starts[i]),
+				ljx_block_to_sector(lsb, starts[i] + lens[i]));
+	if (nr) {
+		spin_lock_irqsave(&ra->lock, flags);
+		stream->ra_lblock = from;
+		spin_unlock_irqrestore(&ra->lock, flags);
+	}
+}
@@ -0,0 +1,94 @@
+#ifndef _READAHEAD_H
+#define _READAHEAD_H
+
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/bio.h>
+
+#include "common.h"
+
+#define LJX_RA_STREAMS		16	/* sequential streams tracked per vbd */
+#define LJX_RA_MAX_RUNS		8	/* file runs fetched per readahead */
+#define LJX_RA_SLOT_SECTORS	(PAGE_SIZE >> 9)
+
+enum ljx_ra_slot_state {
+	RA_EMPTY,
+	RA_INFLIGHT,
+	RA_VALID,
+	RA_STALE,	/* invalidated while in flight; dropped on completion */
+};
+
+/* one page of prefetched data */
+struct ljx_ra_slot {
+	struct hlist_node	hash;
+	struct list_head	lru;
+	sector_t		sector;
+	struct page		*page;
+	unsigned char		state;
+	bool			hit;
+};
+
+/* a guest file being read sequentially */
+struct ljx_ra_stream {
+	struct ljx_ext3_superblock *fs;		/* inode numbers are per filesystem */
+	unsigned int		ino;
+	/* file blocks, not disk blocks: a file need not be laid out in order */
+	u32			next_lblock;	/* where the guest should read next */
+	u32			ra_lblock;	/* where our readahead stopped */
+	unsigned int		seq;		/* consecutive sequential reads */
+	unsigned long		last_used;
+};
+
+/**
+ * Per-vbd readahead engine. Reads of guest files are followed through the
+ * reverse block map, and the next blocks of a file being read sequentially,
+ * in file order wherever they are on the disk, are fetched into a fixed
+ * budget of pages that later guest reads are served from.
+ */
+struct ljx_readahead {
+	spinlock_t		lock;
+	struct xen_vbd		*vbd;
+	unsigned int		nr_slots;	/* budget, in pages */
+	struct ljx_ra_slot	*slots;
+	struct hlist_head	*hash;
+	struct list_head	lru;		/* non-inflight slots, LRU at tail */
+	unsigned int		inflight;	/* slots being read */
+	atomic_t		nr_bios;
+	wait_queue_head_t	wq;
+	struct ljx_ra_stream	streams[LJX_RA_STREAMS];
+	/* accuracy metrics, in sectors */
+	u64			issued;
+	u64			hits;
+	u64			wasted;
+};
+
+/**
+ * Allocates the readahead engine for a vbd, with a budget set by the ra_pages
+ * module parameter. Returns NULL if readahead is disabled.
+ */
+extern struct ljx_readahead *ljx_ra_alloc(struct xen_vbd *);
+extern void ljx_ra_free(struct ljx_readahead *);
+
+/**
+ * Tries to satisfy a guest read from prefetched pages. vec describes where
+ * the data should go. Returns 0 if every sector was copied, 1 otherwise.
+ */
+extern int ljx_ra_read(struct ljx_readahead *, sector_t sector,
+		struct bio_vec *vec, int nvec);
+
+/**
+ * Feeds a guest read to the stream detector, issuing readahead when a file
+ * is being read sequentially. Must be called from process context.
+ */
+extern void ljx_ra_note_read(struct ljx_readahead *, sector_t sector,
+		unsigned int nr_sec);
+
+/**
+ * Drops prefetched data overlapping a write or discard.
+ */
+extern void ljx_ra_invalidate(struct ljx_readahead *, sector_t sector,
+		unsigned int nr_sec);
+
+#endif
@@ -0,0 +1,87 @@
+/*
+ * sample.c -- inspect fewer bios when the backend is busy
+ */
+
+#include <linux/jiffies.h>
+#include <linux/math64.h>
+#include <linux/moduleparam.h>
+
+#include "sample.h"
+
+static unsigned int sample_rate = 1;
+module_param(sample_rate, uint, 0644);
+MODULE_PARM_DESC(sample_rate,
+		"Inspect one in this many data bios (metadata bios are always inspected)");
+
+static unsigned int sample_cpu_pct = 80;
+module_param(sample_cpu_pct, uint, 0644);
+MODULE_PARM_DESC(sample_cpu_pct,
+		"Sample fewer bios while xenblkd is busy more than this percent of the time");
+
+static unsigned int sample_ring_pct = 75;
+module_param(sample_ring_pct, uint, 0644);
+MODULE_PARM_DESC(sample_ring_pct,
+		"Sample fewer bios while the ring is fuller than this percent");
+
+static unsigned int sample_max_shift = 6;
+module_param(sample_max_shift, uint, 0644);
+MODULE_PARM_DESC(sample_max_shift,
+		"Back off to at most one in sample_rate << sample_max_shift bios");
+
+/* how often the load is weighed */
+#define LJX_SAMPLE_WINDOW	(HZ / 10)
+/* keeps the sampling period in an unsigned int */
+#define LJX_SAMPLE_MAX_SHIFT	16
+
+extern void ljx_sample_init(struct ljx_sampler *s) {
+	memset(s, 0, sizeof(*s));
+	s->window_start = jiffies;
+}
+
+extern unsigned int ljx_sample_bio(struct ljx_sampler *s) {
+	unsigned int period = max(sample_rate, 1U) << ACCESS_ONCE(s->shift);
+
+	if (period > 1 && atomic_inc_return(&s->tick) % period) {
+		atomic64_inc(&s->skipped);
+		return 0;
+	}
+	atomic64_inc(&s->sampled);
+	return period;
+}
+
+extern void ljx_sample_load(struct ljx_sampler *s, u64 busy_ns) {
+	unsigned long elapsed = jiffies - s->window_start;
+	unsigned int cpu_pct, shift = s->shift;
+
+	s->busy_ns += busy_ns;
+	if (elapsed < LJX_SAMPLE_WINDOW)
+		return;
+
+	cpu_pct = div64_u64(s->busy_ns * 100, (u64) jiffies_to_usecs(elapsed) * 1000);
+	if (cpu_pct > sample_cpu_pct || s->ring_pct > sample_ring_pct) {
+		if (shift < min(sample_max_shift, LJX_SAMPLE_MAX_SHIFT)) {
+			shift++;
+			s->backoffs++;
+		}
+	} else if (shift && cpu_pct < sample_cpu_pct / 2 &&
+		   s->ring_pct < sample_ring_pct / 2)
+		shift--;
+	ACCESS_ONCE(s->shift) = min(shift, sample_max_shift);
+
+	s->last_cpu_pct = cpu_pct;
+	s->last_ring_pct = s->ring_pct;
+	s->window_start = jiffies;
+	s->busy_ns = 0;
+	s->ring_pct = 0;
+}
+
+extern ssize_t ljx_sample_show(struct ljx_sampler *s, char *buf, size_t size) {
+	return scnprintf(buf, size,
+			"period %u\ncpu_pct %u\nring_pct %u\nbackoffs %lu\n"
+			"metadata %llu\nsampled %llu\nskipped %llu\n",
+			max(sample_rate, 1U) << ACCESS_ONCE(s->shift),
+			s->last_cpu_pct, s->last_ring_pct, s->backoffs,
+			(unsigned long long) atomic64_read(&s->metadata),
+			(unsigned long long) atomic64_read(&s->sampled),
+			(unsigned long long) atomic64_read(&s->skipped));
+}
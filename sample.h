@@ -0,0 +1,58 @@
+#ifndef _SAMPLE_H
+#define _SAMPLE_H
+
+#include <linux/kernel.h>
+#include <linux/atomic.h>
+
+/**
+ * How much of a vbd's I/O we look into. Bios that touch metadata labels are
+ * always processed, or we lose track of the guest's metadata. Other bios are
+ * inspected one in sample_rate << shift, where shift grows while xenblkd is
+ * busy or the ring is filling up, and shrinks again once they calm down.
+ */
+struct ljx_sampler {
+	atomic_t		tick;
+	unsigned int		shift;		/* current back off */
+	/* load over the current window, kept by xenblkd */
+	unsigned long		window_start;
+	u64			busy_ns;
+	unsigned int		ring_pct;	/* highest ring occupancy */
+	unsigned int		last_cpu_pct;
+	unsigned int		last_ring_pct;
+	/* decisions */
+	atomic64_t		metadata;	/* metadata bios, always inspected */
+	atomic64_t		sampled;
+	atomic64_t		skipped;
+	unsigned long		backoffs;
+};
+
+extern void ljx_sample_init(struct ljx_sampler *);
+
+/**
+ * Decides whether to inspect a bio that touches no metadata. Returns 0 to
+ * skip it, or how many bios it stands for, to scale what is counted from it.
+ */
+extern unsigned int ljx_sample_bio(struct ljx_sampler *);
+
+static inline void ljx_sample_metadata(struct ljx_sampler *s) {
+	atomic64_inc(&s->metadata);
+}
+
+/**
+ * Called by xenblkd with how many requests are waiting on the ring.
+ */
+static inline void ljx_sample_ring(struct ljx_sampler *s, unsigned int used,
+		unsigned int size) {
+	if (size)
+		s->ring_pct = max(s->ring_pct, used * 100 / size);
+}
+
+/**
+ * Called by xenblkd with the time it spent on a batch of requests. Adjusts
+ * the back off once per window.
+ */
+extern void ljx_sample_load(struct ljx_sampler *, u64 busy_ns);
+
+extern ssize_t ljx_sample_show(struct ljx_sampler *, char *buf, size_t size);
+
+#endif
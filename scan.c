@@ -0,0 +1,332 @@
+/*
+ * scan.c -- bulk reads of group descriptors and block bitmaps
+ */
+
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/sort.h>
+#include <linux/jiffies.h>
+#include <linux/workqueue.h>
+#include <linux/moduleparam.h>
+
+#include "scan.h"
+#include "ext3.h"
+#include "label.h"
+#include "util.h"
+#include "layout.h"
+
+static unsigned int scan_rate = 16384;
+module_param(scan_rate, uint, 0644);
+MODULE_PARM_DESC(scan_rate,
+		"Attach time metadata scan rate per vbd in KiB/s (0 for no limit)");
+
+static struct workqueue_struct *ljx_scan_wq;
+
+/* one batched read: a run of descriptor blocks, or of bitmap blocks */
+struct scan_io {
+	struct work_struct	work;
+	struct ljx_scan		*scan;
+	struct xen_vbd		*vbd;
+	struct ljx_ext3_superblock *lsb;
+	struct bio		*bio;
+	sector_t		sector;
+	unsigned int		nr_blocks;
+	int			desc;		/* first descriptor block, or -1 */
+	int			error;
+};
+
+extern int ljx_scan_init(void) {
+	/* unbound, so the parsing of a batch spreads over all CPUs */
+	ljx_scan_wq = alloc_workqueue("ljx_scan", WQ_UNBOUND | WQ_MEM_RECLAIM, 0);
+	return ljx_scan_wq ? 0 : -ENOMEM;
+}
+
+extern void ljx_scan_exit(void) {
+	if (ljx_scan_wq)
+		destroy_workqueue(ljx_scan_wq);
+	ljx_scan_wq = NULL;
+}
+
+static void parse_descriptors(struct scan_io *io) {
+	struct ljx_ext3_superblock *lsb = io->lsb;
+	unsigned int i;
+	char *buf;
+
+	buf = kmalloc(lsb->block_size, GFP_NOIO);
+	if (! buf)
+		return;
+	for (i = 0; i < io->nr_blocks; i++) {
+		if (copy_block(io->bio, buf, i * lsb->block_size, lsb->block_size))
+			break;
+		ljx_ext3_parse_desc_block(lsb, io->desc + i, buf);
+		atomic_inc(&io->scan->desc_done);
+	}
+	kfree(buf);
+}
+
+static void scan_io_work(struct work_struct *work) {
+	struct scan_io *io = container_of(work, struct scan_io, work);
+	struct ljx_scan *scan = io->scan;
+	struct bio *bio = io->bio;
+	int i;
+
+	if (! io->error) {
+		/* completion advanced (and maybe remapped) the bio */
+		bio->bi_sector = io->sector;
+		bio->bi_size = io->nr_blocks * io->lsb->block_size;
+		bio->bi_idx = 0;
+		if (io->desc >= 0)
+			parse_descriptors(io);
+		else {
+			/* the bitmap labels are in place by now */
+			ljx_process_labels(bio, io->vbd, NULL);
+			atomic_add(io->nr_blocks, &scan->bitmap_done);
+		}
+	}
+
+	for (i = 0; i < bio->bi_vcnt; i++)
+		__free_page(bio->bi_io_vec[i].bv_page);
+	bio_put(bio);
+	kfree(io);
+	atomic_dec(&scan->inflight);
+	wake_up(&scan->wq);
+}
+
+static void scan_end_io(struct bio *bio, int error) {
+	struct scan_io *io = bio->bi_private;
+
+	io->error = error || ! test_bit(BIO_UPTODATE, &bio->bi_flags);
+	/* parsing allocates and walks labels; keep it out of irq context */
+	queue_work(ljx_scan_wq, &io->work);
+}
+
+/*
+ * Sleeps until issuing another nr_bytes keeps us under scan_rate. Returns
+ * -EINTR if the scan was stopped meanwhile.
+ */
+static int throttle(struct ljx_scan *scan, unsigned int nr_bytes) {
+	unsigned int rate = scan_rate;
+	unsigned long due;
+
+	scan->bytes += nr_bytes;
+	if (! rate)
+		return 0;
+	due = scan->start + div64_u64(scan->bytes * HZ, rate * 1024ULL);
+	if (time_before(jiffies, due))
+		wait_event_timeout(scan->wq, scan->stop, due - jiffies);
+	return scan->stop ? -EINTR : 0;
+}
+
+/* reads nr_blocks from block without waiting for them */
+static int scan_read(
+		struct ljx_scan *scan,
+		struct xen_vbd *vbd,
+		struct ljx_ext3_superblock *lsb,
+		ext3_fsblk_t block,
+		unsigned int nr_blocks,
+		int desc
+) {
+	unsigned int nr_bytes = nr_blocks * lsb->block_size, len;
+	struct scan_io *io;
+	struct bio *bio;
+	struct page *page;
+	int i, ret;
+
+	wait_event(scan->wq, atomic_read(&scan->inflight) < LJX_SCAN_INFLIGHT);
+	if ((ret = throttle(scan, nr_bytes)))
+		return ret;
+
+	io = kzalloc(sizeof(struct scan_io), GFP_NOIO);
+	if (! io)
+		return -ENOMEM;
+	bio = bio_alloc(GFP_NOIO, DIV_ROUND_UP(nr_bytes, PAGE_SIZE));
+	if (! bio) {
+		kfree(io);
+		return -ENOMEM;
+	}
+	INIT_WORK(&io->work, scan_io_work);
+	io->scan = scan;
+	io->vbd = vbd;
+	io->lsb = lsb;
+	io->bio = bio;
+	io->sector = ljx_block_to_sector(lsb, block);
+	io->nr_blocks = nr_blocks;
+	io->desc = desc;
+
+	bio->bi_bdev = vbd->bdev;
+	bio->bi_sector = io->sector;
+	bio->bi_private = io;
+	bio->bi_end_io = scan_end_io;
+	while (bio->bi_size < nr_bytes) {
+		len = min_t(unsigned int, nr_bytes - bio->bi_size, PAGE_SIZE);
+		page = alloc_page(GFP_NOIO);
+		if (! page)
+			goto fail;
+		if (bio_add_page(bio, page, len, 0) < len) {
+			__free_page(page);
+			goto fail;
+		}
+	}
+
+	atomic_inc(&scan->inflight);
+	submit_bio(READ, bio);
+	return 0;
+
+fail:
+	for (i = 0; i < bio->bi_vcnt; i++)
+		__free_page(bio->bi_io_vec[i].bv_page);
+	bio_put(bio);
+	kfree(io);
+	return -ENOMEM;
+}
+
+/* blocks per bio: what the queue takes, and no more than a bio can hold */
+static unsigned int max_blocks(struct xen_vbd *vbd, struct ljx_ext3_superblock *lsb) {
+	unsigned int max_sec = min_t(unsigned int,
+			queue_max_sectors(bdev_get_queue(vbd->bdev)), BIO_MAX_SECTORS);
+
+	return max(max_sec / lsb->sec_per_block, 1U);
+}
+
+static void scan_descriptors(
+		struct ljx_scan *scan,
+		struct xen_vbd *vbd,
+		struct ljx_ext3_superblock *lsb
+) {
+	unsigned int db_count = DIV_ROUND_UP(lsb->groups_count, lsb->desc_per_block);
+	unsigned int max = max_blocks(vbd, lsb), i, n;
+
+	scan->desc_total += db_count;
+	for (i = 0; i < db_count && ! scan->stop; i += n) {
+		/* without meta_bg the descriptor blocks are one contiguous run */
+		for (n = 1; i + n < db_count && n < max; n++)
+			if (lsb->group_desc[i + n].location !=
+			    lsb->group_desc[i + n - 1].location + 1)
+				break;
+		if (scan_read(scan, vbd, lsb, lsb->group_desc[i].location, n, i))
+			break;
+	}
+}
+
+static int label_cmp(const void *a, const void *b) {
+	const struct label *la = a, *lb = b;
+
+	if (la->sector < lb->sector)
+		return -1;
+	return la->sector > lb->sector;
+}
+
+/* labels what every parsed descriptor points at, in one pass */
+static int build_labels(
+		struct ljx_scan *scan,
+		struct xen_vbd *vbd,
+		struct ljx_ext3_superblock *lsb
+) {
+	struct label *labels;
+	unsigned int group, n = 0;
+	int ret;
+
+	labels = vmalloc(lsb->groups_count * LJX_GROUP_LABELS * sizeof(struct label));
+	if (! labels)
+		return -ENOMEM;
+	for (group = 0; group < lsb->groups_count; group++)
+		if (lsb->group_desc[group / lsb->desc_per_block].init)
+			n += ljx_ext3_group_labels(lsb, group, labels + n);
+	sort(labels, n, sizeof(struct label), label_cmp, NULL);
+	ret = ljx_insert_labels(vbd->labels, labels, n);
+	if (! ret)
+		scan->labels += n;
+	vfree(labels);
+	return ret;
+}
+
+static int block_cmp(const void *a, const void *b) {
+	const ext3_fsblk_t *ba = a, *bb = b;
+
+	if (*ba < *bb)
+		return -1;
+	return *ba > *bb;
+}
+
+static int scan_bitmaps(
+		struct ljx_scan *scan,
+		struct xen_vbd *vbd,
+		struct ljx_ext3_superblock *lsb
+) {
+	unsigned int max = max_blocks(vbd, lsb), group, i, n, nr = 0;
+	struct ljx_ext3_group *g;
+	ext3_fsblk_t *blocks;
+
+	blocks = vmalloc(lsb->groups_count * sizeof(ext3_fsblk_t));
+	if (! blocks)
+		return -ENOMEM;
+	for (group = 0; group < lsb->groups_count; group++) {
+		g = &lsb->groups[group];
+		/* an uninitialized bitmap is not on disk yet */
+		if (g->block_bitmap && ! (g->flags & LJX_EXT4_BG_BLOCK_UNINIT))
+			blocks[nr++] = g->block_bitmap;
+	}
+	/* with flex_bg, whole flex groups of bitmaps come out contiguous */
+	sort(blocks, nr, sizeof(ext3_fsblk_t), block_cmp, NULL);
+	scan->bitmap_total += nr;
+
+	for (i = 0; i < nr && ! scan->stop; i += n) {
+		for (n = 1; i + n < nr && n < max; n++)
+			if (blocks[i + n] != blocks[i + n - 1] + 1)
+				break;
+		if (scan_read(scan, vbd, lsb, blocks[i], n, -1))
+			break;
+	}
+	vfree(blocks);
+	return 0;
+}
+
+extern int ljx_scan_fs(
+		struct ljx_scan *scan,
+		struct xen_vbd *vbd,
+		struct ljx_ext3_superblock *lsb,
+		bool restored
+) {
+	int ret;
+
+	if (! ljx_scan_wq || ! lsb->group_desc || ! lsb->groups)
+		return -EINVAL;
+	if (! scan->start)
+		scan->start = jiffies;
+
+	if (! restored) {
+		scan_descriptors(scan, vbd, lsb);
+		wait_event(scan->wq, ! atomic_read(&scan->inflight));
+		if (scan->stop)
+			return 0;
+		if ((ret = build_labels(scan, vbd, lsb)))
+			return ret;
+	}
+
+	if (! lsb->block_bitmap)
+		return 0;
+	ret = scan_bitmaps(scan, vbd, lsb);
+	wait_event(scan->wq, ! atomic_read(&scan->inflight));
+	return ret;
+}
+
+extern void ljx_scan_flush(void) {
+	if (ljx_scan_wq)
+		flush_workqueue(ljx_scan_wq);
+}
+
+extern ssize_t ljx_scan_show(struct ljx_scan *scan, char *buf, size_t size) {
+	unsigned long elapsed;
+	u64 kbps = 0;
+
+	elapsed = (scan->end ? scan->end : jiffies) - scan->start;
+	if (scan->start && elapsed)
+		kbps = div64_u64(scan->bytes * HZ, (u64) elapsed * 1024);
+	return scnprintf(buf, size,
+			"descriptors %u %u\nbitmaps %u %u\nlabels %u\nkbps %llu\n",
+			atomic_read(&scan->desc_done), scan->desc_total,
+			atomic_read(&scan->bitmap_done), scan->bitmap_total,
+			scan->labels, (unsigned long long) kbps);
+}
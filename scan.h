@@ -0,0 +1,80 @@
+#ifndef _SCAN_H
+#define _SCAN_H
+
+#include <linux/kernel.h>
+#include <linux/wait.h>
+#include <linux/atomic.h>
+#include <linux/jiffies.h>
+
+#include "common.h"
+
+#define LJX_SCAN_INFLIGHT	8	/* reads in flight per vbd */
+
+/**
+ * Background read of every group descriptor block of a filesystem, and of
+ * every block bitmap if the bitmap tracker wants them. Reads are batched
+ * into multi-block bios, rate limited by the scan_rate module parameter and
+ * parsed in parallel on a workqueue. The labels the descriptors lead to are
+ * then built in one sorted pass instead of one ljx_insert_label() at a time.
+ */
+struct ljx_scan {
+	atomic_t		inflight;
+	wait_queue_head_t	wq;
+	bool			stop;		/* the vbd is going away */
+	/* progress, in blocks */
+	atomic_t		desc_done;
+	unsigned int		desc_total;
+	atomic_t		bitmap_done;
+	unsigned int		bitmap_total;
+	unsigned int		labels;		/* built in bulk */
+	u64			bytes;		/* issued */
+	unsigned long		start;		/* jiffies, 0 until started */
+	unsigned long		end;		/* jiffies, 0 while running */
+};
+
+extern int ljx_scan_init(void);
+extern void ljx_scan_exit(void);
+
+static inline void ljx_scan_setup(struct ljx_scan *scan) {
+	atomic_set(&scan->inflight, 0);
+	init_waitqueue_head(&scan->wq);
+}
+
+/**
+ * Scans the metadata of one filesystem on vbd. Sleeps until every read has
+ * been parsed, so must be called from process context. If restored is set
+ * the labels came from a saved map and only the bitmaps are read.
+ */
+extern int ljx_scan_fs(struct ljx_scan *, struct xen_vbd *, struct ljx_ext3_superblock *,
+		bool restored);
+
+/**
+ * Makes a scan in progress stop issuing reads, including one waiting out
+ * scan_rate. ljx_scan_fs() returns once the reads in flight are parsed.
+ */
+static inline void ljx_scan_stop(struct ljx_scan *scan) {
+	scan->stop = true;
+	wake_up(&scan->wq);
+}
+
+/**
+ * Waits until no parsing work touches any scan, even to wake it up, so that
+ * a stopped scan can be freed.
+ */
+extern void ljx_scan_flush(void);
+
+/**
+ * Marks the end of scanning, for the throughput figure
+ */
+static inline void ljx_scan_done(struct ljx_scan *scan) {
+	if (scan->start)
+		scan->end = jiffies;
+}
+
+/**
+ * Formats scan progress as "descriptors done total", "bitmaps done total",
+ * "labels n" and "kbps n" lines. Returns the number of bytes written.
+ */
+extern ssize_t ljx_scan_show(struct ljx_scan *, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,31 @@
+/*
+ * stats.c -- per cpu request counters
+ */
+
+#include "stats.h"
+
+extern struct ljx_stats __percpu *ljx_stats_alloc(void) {
+	return alloc_percpu(struct ljx_stats);
+}
+
+extern void ljx_stats_free(struct ljx_stats __percpu *stats) {
+	if (stats)
+		free_percpu(stats);
+}
+
+extern u64 ljx_stat_read(struct ljx_stats __percpu *stats, enum ljx_stat stat) {
+	const struct ljx_stats *s;
+	unsigned int start;
+	u64 sum = 0, count;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		s = per_cpu_ptr(stats, cpu);
+		do {
+			start = u64_stats_fetch_begin(&s->syncp);
+			count = s->count[stat];
+		} while (u64_stats_fetch_retry(&s->syncp, start));
+		sum += count;
+	}
+	return sum;
+}
@@ -0,0 +1,69 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <linux/kernel.h>
+#include <linux/irqflags.h>
+#include <linux/percpu.h>
+#include <linux/u64_stats_sync.h>
+
+/*
+ * Request counters of a blkif. They only ever go up; print_stats() logs the
+ * difference from what it printed last.
+ */
+enum ljx_stat {
+	LJX_ST_RD_REQ,
+	LJX_ST_WR_REQ,
+	LJX_ST_F_REQ,
+	LJX_ST_DS_REQ,
+	LJX_ST_RD_SECT,
+	LJX_ST_WR_SECT,
+	LJX_ST_F_SECT,		/* data carried by flushes and barriers */
+	LJX_ST_DS_SECT,
+	LJX_ST_RD_BYTES,
+	LJX_ST_WR_BYTES,
+	LJX_ST_ERRORS,		/* responses other than BLKIF_RSP_OKAY */
+	LJX_ST_OO_REQ,		/* no pending_req free, the ring waits */
+	LJX_ST_OO_BIO,		/* a bio allocation failed the request */
+	/* journal writes submitted under a shared plug, and how many plugs */
+	LJX_ST_JNL_REQ,
+	LJX_ST_JNL_BATCH,
+	LJX_STATS
+};
+
+/**
+ * One block of counters per cpu. Requests are counted by xenblkd and errors
+ * in bio completion, so updates are made with interrupts off; syncp lets a
+ * 32-bit reader see whole values.
+ */
+struct ljx_stats {
+	u64			count[LJX_STATS];
+	struct u64_stats_sync	syncp;
+};
+
+extern struct ljx_stats __percpu *ljx_stats_alloc(void);
+extern void ljx_stats_free(struct ljx_stats __percpu *);
+
+static inline void ljx_stat_add(struct ljx_stats __percpu *stats,
+		enum ljx_stat stat, u64 n) {
+	struct ljx_stats *s;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	s = this_cpu_ptr(stats);
+	u64_stats_update_begin(&s->syncp);
+	s->count[stat] += n;
+	u64_stats_update_end(&s->syncp);
+	local_irq_restore(flags);
+}
+
+static inline void ljx_stat_inc(struct ljx_stats __percpu *stats,
+		enum ljx_stat stat) {
+	ljx_stat_add(stats, stat, 1);
+}
+
+/**
+ * Returns a counter summed over all cpus.
+ */
+extern u64 ljx_stat_read(struct ljx_stats __percpu *, enum ljx_stat);
+
+#endif
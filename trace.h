@@ -0,0 +1,163 @@
+/*
+ * trace.h -- tracepoints along the request path, under events/ljx/
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ljx
+
+#if !defined(_LJX_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _LJX_TRACE_H
+
+#include <linux/tracepoint.h>
+
+#include "common.h"
+
+/* what every request event carries: who, where, how big and what */
+DECLARE_EVENT_CLASS(ljx_req,
+
+	TP_PROTO(struct xen_blkif *blkif, sector_t sector, unsigned int nr_seg,
+		 unsigned int op),
+
+	TP_ARGS(blkif, sector, nr_seg, op),
+
+	TP_STRUCT__entry(
+		__field(	domid_t,	domid	)
+		__field(	blkif_vdev_t,	handle	)
+		__field(	sector_t,	sector	)
+		__field(	unsigned int,	nr_seg	)
+		__field(	unsigned int,	op	)
+	),
+
+	TP_fast_assign(
+		__entry->domid	= blkif->domid;
+		__entry->handle	= blkif->vbd.handle;
+		__entry->sector	= sector;
+		__entry->nr_seg	= nr_seg;
+		__entry->op	= op;
+	),
+
+	TP_printk("dom %u vbd %u op %u sector %llu seg %u",
+		  __entry->domid, __entry->handle, __entry->op,
+		  (unsigned long long)__entry->sector, __entry->nr_seg)
+);
+
+/* a request was copied off the ring */
+DEFINE_EVENT(ljx_req, ljx_ring_consume,
+	TP_PROTO(struct xen_blkif *blkif, sector_t sector, unsigned int nr_seg,
+		 unsigned int op),
+	TP_ARGS(blkif, sector, nr_seg, op)
+);
+
+/* its grants were mapped, or unmapped again */
+DEFINE_EVENT(ljx_req, ljx_grant_map,
+	TP_PROTO(struct xen_blkif *blkif, sector_t sector, unsigned int nr_seg,
+		 unsigned int op),
+	TP_ARGS(blkif, sector, nr_seg, op)
+);
+
+DEFINE_EVENT(ljx_req, ljx_grant_unmap,
+	TP_PROTO(struct xen_blkif *blkif, sector_t sector, unsigned int nr_seg,
+		 unsigned int op),
+	TP_ARGS(blkif, sector, nr_seg, op)
+);
+
+/* one of its bios went to the device; sector and seg are the bio's */
+DEFINE_EVENT(ljx_req, ljx_bio_submit,
+	TP_PROTO(struct xen_blkif *blkif, sector_t sector, unsigned int nr_seg,
+		 unsigned int op),
+	TP_ARGS(blkif, sector, nr_seg, op)
+);
+
+/* looking into a completed bio, see reflect_on_bio() */
+DEFINE_EVENT(ljx_req, ljx_introspect_start,
+	TP_PROTO(struct xen_blkif *blkif, sector_t sector, unsigned int nr_seg,
+		 unsigned int op),
+	TP_ARGS(blkif, sector, nr_seg, op)
+);
+
+DEFINE_EVENT(ljx_req, ljx_introspect_end,
+	TP_PROTO(struct xen_blkif *blkif, sector_t sector, unsigned int nr_seg,
+		 unsigned int op),
+	TP_ARGS(blkif, sector, nr_seg, op)
+);
+
+/* the events that also carry an outcome */
+DECLARE_EVENT_CLASS(ljx_req_status,
+
+	TP_PROTO(struct xen_blkif *blkif, sector_t sector, unsigned int nr_seg,
+		 unsigned int op, int status),
+
+	TP_ARGS(blkif, sector, nr_seg, op, status),
+
+	TP_STRUCT__entry(
+		__field(	domid_t,	domid	)
+		__field(	blkif_vdev_t,	handle	)
+		__field(	sector_t,	sector	)
+		__field(	unsigned int,	nr_seg	)
+		__field(	unsigned int,	op	)
+		__field(	int,		status	)
+	),
+
+	TP_fast_assign(
+		__entry->domid	= blkif->domid;
+		__entry->handle	= blkif->vbd.handle;
+		__entry->sector	= sector;
+		__entry->nr_seg	= nr_seg;
+		__entry->op	= op;
+		__entry->status	= status;
+	),
+
+	TP_printk("dom %u vbd %u op %u sector %llu seg %u status %d",
+		  __entry->domid, __entry->handle, __entry->op,
+		  (unsigned long long)__entry->sector, __entry->nr_seg,
+		  __entry->status)
+);
+
+/* a bio came back from the device, with its error */
+DEFINE_EVENT(ljx_req_status, ljx_bio_complete,
+	TP_PROTO(struct xen_blkif *blkif, sector_t sector, unsigned int nr_seg,
+		 unsigned int op, int status),
+	TP_ARGS(blkif, sector, nr_seg, op, status)
+);
+
+/* the response went onto the ring, with its BLKIF_RSP_* status */
+DEFINE_EVENT(ljx_req_status, ljx_response,
+	TP_PROTO(struct xen_blkif *blkif, sector_t sector, unsigned int nr_seg,
+		 unsigned int op, int status),
+	TP_ARGS(blkif, sector, nr_seg, op, status)
+);
+
+/* labels belong to a vbd, not a guest, so this one names the device */
+TRACE_EVENT(ljx_label_insert,
+
+	TP_PROTO(u32 dev, sector_t sector, unsigned int nr_sec, unsigned int type),
+
+	TP_ARGS(dev, sector, nr_sec, type),
+
+	TP_STRUCT__entry(
+		__field(	u32,		dev	)
+		__field(	sector_t,	sector	)
+		__field(	unsigned int,	nr_sec	)
+		__field(	unsigned int,	type	)
+	),
+
+	TP_fast_assign(
+		__entry->dev	= dev;
+		__entry->sector	= sector;
+		__entry->nr_sec	= nr_sec;
+		__entry->type	= type;
+	),
+
+	TP_printk("dev %x sector %llu nr_sec %u type %u",
+		  __entry->dev, (unsigned long long)__entry->sector,
+		  __entry->nr_sec, __entry->type)
+);
+
+#endif
+
+/* this header is not in include/trace/events, see CFLAGS in the Makefile */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE trace
+#include <trace/define_trace.h>
@@ -0,0 +1,165 @@
+/*
+ * block.h -- bios, block devices and the odd bit of the VFS, see shim_blk.c
+ */
+
+#ifndef _SHIM_BLOCK_H
+#define _SHIM_BLOCK_H
+
+struct bio;
+typedef void (bio_end_io_t)(struct bio *, int);
+
+struct bio_vec {
+	struct page		*bv_page;
+	unsigned int		bv_len;
+	unsigned int		bv_offset;
+};
+
+struct block_device;
+
+struct bio {
+	sector_t		bi_sector;
+	struct bio		*bi_next;	/* on a plug or completion queue */
+	struct block_device	*bi_bdev;
+	unsigned long		bi_flags;
+	unsigned long		bi_rw;
+	unsigned short		bi_vcnt;
+	unsigned short		bi_idx;
+	unsigned short		bi_max_vecs;
+	unsigned int		bi_size;
+	int			bi_error;	/* shim: what bi_end_io gets */
+	bio_end_io_t		*bi_end_io;
+	void			*bi_private;
+	struct bio_vec		*bi_io_vec;
+	struct bio_vec		bi_inline_vecs[0];
+};
+
+#define BIO_UPTODATE		0
+#define BIO_MAX_PAGES		256
+#define BIO_MAX_SECTORS		(BIO_MAX_PAGES * (PAGE_SIZE >> 9))
+
+#define REQ_WRITE		(1UL << 0)
+#define REQ_SYNC		(1UL << 4)
+#define REQ_META		(1UL << 5)
+#define REQ_DISCARD		(1UL << 7)
+#define REQ_NOIDLE		(1UL << 10)
+#define REQ_FLUSH		(1UL << 20)
+#define REQ_FUA			(1UL << 21)
+
+#define READ			0
+#define WRITE			REQ_WRITE
+#define READA			READ
+#define READ_SYNC		(READ | REQ_SYNC)
+#define WRITE_SYNC		(WRITE | REQ_SYNC | REQ_NOIDLE)
+#define WRITE_ODIRECT		(WRITE | REQ_SYNC)
+#define WRITE_FLUSH		(WRITE | REQ_SYNC | REQ_NOIDLE | REQ_FLUSH)
+
+#define bio_data_dir(bio)	((bio)->bi_rw & REQ_WRITE)
+#define bio_sectors(bio)	((bio)->bi_size >> 9)
+#define bio_iovec_idx(bio, i)	(&((bio)->bi_io_vec[(i)]))
+#define __bio_for_each_segment(bvl, bio, i, start_idx)			\
+	for (bvl = bio_iovec_idx((bio), (start_idx)), i = (start_idx);	\
+	     i < (bio)->bi_vcnt;					\
+	     bvl++, i++)
+#define bio_for_each_segment(bvl, bio, i)				\
+	__bio_for_each_segment(bvl, bio, i, (bio)->bi_idx)
+
+extern struct bio *bio_alloc(gfp_t, unsigned int nr_iovecs);
+extern void bio_put(struct bio *);
+extern int bio_add_page(struct bio *, struct page *, unsigned int len,
+		unsigned int offset);
+extern void bio_endio(struct bio *, int error);
+extern void submit_bio(int rw, struct bio *);
+
+/* bios submitted while a plug is open go down together when it closes */
+struct blk_plug {
+	struct bio		*head;
+	struct bio		**tail;
+};
+
+extern void blk_start_plug(struct blk_plug *);
+extern void blk_finish_plug(struct blk_plug *);
+
+struct gendisk {
+	sector_t		capacity;
+	int			flags;
+	char			disk_name[32];
+};
+
+#define GENHD_FL_REMOVABLE	1
+#define GENHD_FL_CD		8
+
+struct hd_struct {
+	sector_t		start_sect;
+	sector_t		nr_sects;
+};
+
+struct queue_limits {
+	unsigned int		discard_granularity;
+	unsigned int		discard_alignment;
+};
+
+struct request_queue {
+	unsigned int		flush_flags;
+	bool			discard;
+	struct queue_limits	limits;
+};
+
+struct address_space;
+
+struct inode {
+	unsigned long		i_ino;
+	loff_t			i_size;
+	void			*i_private;
+	struct address_space	*i_mapping;
+};
+
+struct file {
+	void			*private_data;
+};
+
+struct shim_bdev_ops;
+
+struct block_device {
+	struct hd_struct	*bd_part;	/* NULL: the whole disk */
+	struct gendisk		*bd_disk;
+	struct inode		*bd_inode;
+	struct request_queue	*bd_queue;
+	unsigned int		bd_block_size;
+	const struct shim_bdev_ops *ops;
+	void			*priv;
+};
+
+static inline sector_t get_capacity(struct gendisk *disk) { return disk->capacity; }
+static inline struct request_queue *bdev_get_queue(struct block_device *bdev) {
+	return bdev->bd_queue;
+}
+static inline unsigned int bdev_logical_block_size(struct block_device *bdev) {
+	return bdev->bd_block_size;
+}
+#define blk_queue_discard(q)		((q)->discard)
+#define blk_queue_secdiscard(q)		0
+
+#define BLKDEV_DISCARD_SECURE	0x01
+extern int blkdev_issue_discard(struct block_device *, sector_t sector,
+		sector_t nr_sects, gfp_t, unsigned long flags);
+
+#define FMODE_READ		0x1
+#define FMODE_WRITE		0x2
+#define FMODE_EXCL		0x80
+
+/**
+ * Opens a device for the module to use: "ram:<MiB>" for memory, or
+ * "file:<path>" for a file or block device driven through Linux AIO, and
+ * "direct:<path>" for the same with O_DIRECT. Returns NULL with a message.
+ */
+extern struct block_device *shim_bdev_open(const char *spec, bool readonly);
+extern void shim_bdev_close(struct block_device *);
+
+/* what a device backend does with a list of bios; see shim_blk.c */
+struct shim_bdev_ops {
+	void	(*submit)(struct block_device *, struct bio *list);
+	int	(*discard)(struct block_device *, sector_t, sector_t);
+	void	(*close)(struct block_device *);
+};
+
+#endif
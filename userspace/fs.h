@@ -0,0 +1,162 @@
+/*
+ * fs.h -- the ext3 and jbd on-disk formats, as linux/ext3_fs.h and
+ * linux/jbd.h of 3.3 have them
+ */
+
+#ifndef _SHIM_FS_H
+#define _SHIM_FS_H
+
+#define EXT3_SUPER_MAGIC			0xef53
+#define EXT3_MIN_BLOCK_SIZE			1024
+#define EXT3_GOOD_OLD_INODE_SIZE		128
+
+#define EXT3_FEATURE_RO_COMPAT_SPARSE_SUPER	0x0001
+#define EXT3_FEATURE_INCOMPAT_RECOVER		0x0004
+#define EXT3_FEATURE_INCOMPAT_META_BG		0x0010
+
+struct ext3_super_block {
+/*00*/	__le32	s_inodes_count;
+	__le32	s_blocks_count;
+	__le32	s_r_blocks_count;
+	__le32	s_free_blocks_count;
+/*10*/	__le32	s_free_inodes_count;
+	__le32	s_first_data_block;
+	__le32	s_log_block_size;
+	__le32	s_log_frag_size;
+/*20*/	__le32	s_blocks_per_group;
+	__le32	s_frags_per_group;
+	__le32	s_inodes_per_group;
+	__le32	s_mtime;
+/*30*/	__le32	s_wtime;
+	__le16	s_mnt_count;
+	__le16	s_max_mnt_count;
+	__le16	s_magic;
+	__le16	s_state;
+	__le16	s_errors;
+	__le16	s_minor_rev_level;
+/*40*/	__le32	s_lastcheck;
+	__le32	s_checkinterval;
+	__le32	s_creator_os;
+	__le32	s_rev_level;
+/*50*/	__le16	s_def_resuid;
+	__le16	s_def_resgid;
+	__le32	s_first_ino;
+	__le16	s_inode_size;
+	__le16	s_block_group_nr;
+	__le32	s_feature_compat;
+/*60*/	__le32	s_feature_incompat;
+	__le32	s_feature_ro_compat;
+/*68*/	__u8	s_uuid[16];
+/*78*/	char	s_volume_name[16];
+/*88*/	char	s_last_mounted[64];
+/*C8*/	__le32	s_algorithm_usage_bitmap;
+	__u8	s_prealloc_blocks;
+	__u8	s_prealloc_dir_blocks;
+	__le16	s_reserved_gdt_blocks;
+/*D0*/	__u8	s_journal_uuid[16];
+/*E0*/	__le32	s_journal_inum;
+	__le32	s_journal_dev;
+	__le32	s_last_orphan;
+	__le32	s_hash_seed[4];
+	__u8	s_def_hash_version;
+	__u8	s_reserved_char_pad;
+	__u16	s_reserved_word_pad;
+/*100*/	__le32	s_default_mount_opts;
+	__le32	s_first_meta_bg;
+	__le32	s_mkfs_time;
+	__le32	s_jnl_blocks[17];
+/*150*/	__le32	s_blocks_count_hi;
+	__le32	s_r_blocks_count_hi;
+	__le32	s_free_blocks_count_hi;
+	__le16	s_min_extra_isize;
+	__le16	s_want_extra_isize;
+	__le32	s_flags;
+	__le16	s_raid_stride;
+	__le16	s_mmp_interval;
+	__le64	s_mmp_block;
+	__le32	s_raid_stripe_width;
+	__u8	s_log_groups_per_flex;
+	__u8	s_reserved_char_pad2;
+	__le16	s_reserved_pad;
+	__u32	s_reserved[162];
+};
+
+#define EXT3_NDIR_BLOCKS	12
+#define EXT3_IND_BLOCK		EXT3_NDIR_BLOCKS
+#define EXT3_DIND_BLOCK		(EXT3_IND_BLOCK + 1)
+#define EXT3_TIND_BLOCK		(EXT3_DIND_BLOCK + 1)
+#define EXT3_N_BLOCKS		(EXT3_TIND_BLOCK + 1)
+
+struct ext3_inode {
+	__le16	i_mode;
+	__le16	i_uid;
+	__le32	i_size;
+	__le32	i_atime;
+	__le32	i_ctime;
+	__le32	i_mtime;
+	__le32	i_dtime;
+	__le16	i_gid;
+	__le16	i_links_count;
+	__le32	i_blocks;
+	__le32	i_flags;
+	__le32	l_i_reserved1;
+	__le32	i_block[EXT3_N_BLOCKS];
+	__le32	i_generation;
+	__le32	i_file_acl;
+	__le32	i_dir_acl;
+	__le32	i_faddr;
+	__u8	l_i_osd2[12];
+	__le16	i_extra_isize;
+	__le16	i_pad1;
+};
+
+#define JFS_MAGIC_NUMBER	0xc03b3998U
+
+#define JFS_DESCRIPTOR_BLOCK	1
+#define JFS_COMMIT_BLOCK	2
+#define JFS_SUPERBLOCK_V1	3
+#define JFS_SUPERBLOCK_V2	4
+#define JFS_REVOKE_BLOCK	5
+
+typedef struct journal_header_s {
+	__be32	h_magic;
+	__be32	h_blocktype;
+	__be32	h_sequence;
+} journal_header_t;
+
+typedef struct journal_block_tag_s {
+	__be32	t_blocknr;
+	__be32	t_flags;
+} journal_block_tag_t;
+
+typedef struct journal_revoke_header_s {
+	journal_header_t r_header;
+	__be32	r_count;
+} journal_revoke_header_t;
+
+#define JFS_FLAG_ESCAPE		1
+#define JFS_FLAG_SAME_UUID	2
+#define JFS_FLAG_DELETED	4
+#define JFS_FLAG_LAST_TAG	8
+
+typedef struct journal_superblock_s {
+	journal_header_t s_header;
+	__be32	s_blocksize;
+	__be32	s_maxlen;
+	__be32	s_first;
+	__be32	s_sequence;
+	__be32	s_start;
+	__be32	s_errno;
+	__be32	s_feature_compat;
+	__be32	s_feature_incompat;
+	__be32	s_feature_ro_compat;
+	__u8	s_uuid[16];
+	__be32	s_nr_users;
+	__be32	s_dynsuper;
+	__be32	s_max_transaction;
+	__be32	s_max_trans_data;
+	__u32	s_padding[44];
+	__u8	s_users[16 * 48];
+} journal_superblock_t;
+
+#endif
@@ -0,0 +1,139 @@
+/*
+ * fs_stubs.c -- the parts of the module ringbench leaves out
+ *
+ * The harness disk has no partition table or filesystem the module knows,
+ * so the request path asks these and gets what it would get for a raw
+ * disk: no filesystem, no readahead, nothing to trace. xenbus is replaced
+ * by ringbench.c setting up the interface itself.
+ */
+
+#include "../common.h"
+#include "../bitmap.h"
+#include "../events.h"
+#include "../heat.h"
+#include "../hot_files.h"
+#include "../journal.h"
+#include "../label.h"
+#include "../persist.h"
+#include "../readahead.h"
+#include "../scan.h"
+
+bool ljx_events_enabled;
+
+void __ljx_event(u16 type, u32 dev, sector_t sector, u32 nr_sec, u32 arg) {
+}
+
+int ljx_init(void) {
+	return 0;
+}
+
+int ljx_bitmap_init(void) {
+	return 0;
+}
+
+int ljx_scan_init(void) {
+	return 0;
+}
+
+int ljx_persist_init(void) {
+	return 0;
+}
+
+void ljx_exit(void) {
+}
+
+void ljx_bitmap_exit(void) {
+}
+
+void ljx_scan_exit(void) {
+}
+
+void ljx_persist_exit(void) {
+}
+
+struct ljx_ext3_superblock *ljx_partition_fs(struct xen_vbd *vbd, sector_t sector,
+		unsigned int *nr_sec) {
+	return NULL;
+}
+
+process_bio_fn *ljx_ext3_processor(label_t type) {
+	return NULL;
+}
+
+/* without a filesystem nothing below is reached */
+
+void ljx_bitmap_note_write(struct ljx_block_bitmap *bitmap, ext3_fsblk_t block,
+		unsigned int nr_blocks) {
+	BUG();
+}
+
+int ljx_bitmap_zero_read(struct ljx_block_bitmap *bitmap, ext3_fsblk_t block,
+		unsigned int nr_blocks, struct bio_vec *vec, int nvec) {
+	BUG();
+}
+
+bool ljx_journal_contains(struct ljx_journal *journal, sector_t sector,
+		unsigned int nr_sec) {
+	BUG();
+}
+
+void ljx_journal_note_write(struct ljx_journal *journal, sector_t sector,
+		unsigned int nr_sec) {
+	BUG();
+}
+
+/* and these are off in ringbench's vbd */
+
+int ljx_ra_read(struct ljx_readahead *ra, sector_t sector, struct bio_vec *vec,
+		int nvec) {
+	BUG();
+}
+
+void ljx_ra_note_read(struct ljx_readahead *ra, sector_t sector,
+		unsigned int nr_sec) {
+	BUG();
+}
+
+void ljx_ra_invalidate(struct ljx_readahead *ra, sector_t sector,
+		unsigned int nr_sec) {
+	BUG();
+}
+
+void ljx_heat_add(struct ljx_heat *heat, sector_t sector, unsigned int nr_sec) {
+	BUG();
+}
+
+unsigned int ljx_hot_files_account(struct ljx_hot_files *hot,
+		struct ljx_ext3_superblock *lsb, sector_t sector, unsigned int nr_sec,
+		unsigned int weight, bool write) {
+	BUG();
+}
+
+/* xenbus */
+
+int xen_blkif_interface_init(void) {
+	return 0;
+}
+
+int xen_blkif_xenbus_init(void) {
+	return 0;
+}
+
+int xen_blkbk_flush_diskcache(struct xenbus_transaction xbt,
+		struct backend_info *be, int state) {
+	return 0;
+}
+
+int xen_blkbk_barrier(struct xenbus_transaction xbt, struct backend_info *be,
+		int state) {
+	return 0;
+}
+
+struct xenbus_device *xen_blkbk_xenbus(struct backend_info *be) {
+	static struct xenbus_device dev = {
+		.nodename	= "backend/vbd/0/0",
+		.state		= XenbusStateConnected,
+	};
+
+	return &dev;
+}
@@ -0,0 +1,797 @@
+/*
+ * kernel.h -- just enough of the 3.3 kernel API to run the module's request
+ * path in a process
+ *
+ * Every kernel header the module includes is an empty file in the build
+ * directory (see the Makefile); this file is force-included instead and has
+ * everything. Per-cpu data is per thread: each thread started through
+ * shim_thread_start() is its own cpu, so code that counts with interrupts
+ * off on the local cpu stays race free without them.
+ */
+
+#ifndef _SHIM_KERNEL_H
+#define _SHIM_KERNEL_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+
+/* types */
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef unsigned long long u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef long long s64;
+typedef u8 __u8;
+typedef u16 __u16;
+typedef u32 __u32;
+typedef u64 __u64;
+typedef s8 __s8;
+typedef s16 __s16;
+typedef s32 __s32;
+typedef s64 __s64;
+typedef u16 __le16;
+typedef u32 __le32;
+typedef u64 __le64;
+typedef u16 __be16;
+typedef u32 __be32;
+typedef u64 __be64;
+typedef unsigned long sector_t;
+typedef unsigned int gfp_t;
+typedef unsigned int fmode_t;
+typedef unsigned short umode_t;
+typedef unsigned long ext3_fsblk_t;
+typedef unsigned int tid_t;
+
+#define __init
+#define __exit
+#define __user
+#define __iomem
+#define __percpu
+#define __read_mostly
+#define __packed		__attribute__((packed))
+#define __aligned(x)		__attribute__((aligned(x)))
+#define __must_check
+
+#define likely(x)		__builtin_expect(!!(x), 1)
+#define unlikely(x)		__builtin_expect(!!(x), 0)
+#define barrier()		__asm__ __volatile__("" ::: "memory")
+#define mb()			__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define rmb()			__atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define wmb()			__atomic_thread_fence(__ATOMIC_RELEASE)
+#define smp_mb()		mb()
+#define smp_rmb()		rmb()
+#define smp_wmb()		wmb()
+#define ACCESS_ONCE(x)		(*(volatile typeof(x) *) &(x))
+
+#define BUG()			shim_bug(__FILE__, __LINE__)
+#define BUG_ON(x)		do { if (unlikely(x)) BUG(); } while (0)
+#define WARN_ON(x)		({ int __w = !!(x); if (__w) shim_warn(__FILE__, __LINE__); __w; })
+#define WARN_ON_ONCE(x)		WARN_ON(x)
+#define BUILD_BUG_ON(x)		((void) sizeof(char[1 - 2 * !!(x)]))
+
+#define ARRAY_SIZE(a)		(sizeof(a) / sizeof((a)[0]))
+#define DIV_ROUND_UP(n, d)	(((n) + (d) - 1) / (d))
+#define ALIGN(x, a)		(((x) + (a) - 1) & ~((typeof(x)) (a) - 1))
+#define IS_ALIGNED(x, a)	(((x) & ((typeof(x)) (a) - 1)) == 0)
+#define roundup(x, y)		((((x) + ((y) - 1)) / (y)) * (y))
+#define min(a, b)		({ typeof(a) __a = (a); typeof(b) __b = (b); __a < __b ? __a : __b; })
+#define max(a, b)		({ typeof(a) __a = (a); typeof(b) __b = (b); __a > __b ? __a : __b; })
+#define min_t(t, a, b)		min((t) (a), (t) (b))
+#define max_t(t, a, b)		max((t) (a), (t) (b))
+#define clamp_t(t, v, lo, hi)	min_t(t, max_t(t, v, lo), hi)
+#define swap(a, b)		do { typeof(a) __t = (a); (a) = (b); (b) = __t; } while (0)
+#define container_of(ptr, type, member)					\
+	((type *) ((char *) (ptr) - offsetof(type, member)))
+
+#define BITS_PER_LONG		64
+#define BITS_TO_LONGS(n)	DIV_ROUND_UP(n, BITS_PER_LONG)
+#define BIT_MASK(nr)		(1UL << ((nr) % BITS_PER_LONG))
+#define BIT_WORD(nr)		((nr) / BITS_PER_LONG)
+
+extern void shim_bug(const char *file, int line) __attribute__((noreturn));
+extern void shim_warn(const char *file, int line);
+
+/* arithmetic */
+
+#define do_div(n, base)		({ u32 __r = (n) % (base); (n) /= (base); __r; })
+#define sector_div(n, base)	do_div(n, base)
+
+static inline u64 div_u64(u64 a, u32 b) { return a / b; }
+static inline u64 div64_u64(u64 a, u64 b) { return a / b; }
+static inline int fls(unsigned int x) { return x ? 32 - __builtin_clz(x) : 0; }
+static inline int fls64(u64 x) { return x ? 64 - __builtin_clzll(x) : 0; }
+static inline unsigned long __ffs(unsigned long x) { return __builtin_ctzl(x); }
+static inline int ilog2(u64 x) { return fls64(x) - 1; }
+static inline unsigned long hweight_long(unsigned long w) { return __builtin_popcountl(w); }
+static inline bool is_power_of_2(unsigned long n) { return n && ! (n & (n - 1)); }
+static inline unsigned long roundup_pow_of_two(unsigned long n) {
+	return n <= 1 ? 1 : 1UL << fls64(n - 1);
+}
+
+/* the module only builds for little endian x86 */
+#define le16_to_cpu(x)		((u16) (x))
+#define le32_to_cpu(x)		((u32) (x))
+#define le64_to_cpu(x)		((u64) (x))
+#define cpu_to_le16(x)		((u16) (x))
+#define cpu_to_le32(x)		((u32) (x))
+#define cpu_to_le64(x)		((u64) (x))
+#define be16_to_cpu(x)		__builtin_bswap16(x)
+#define be32_to_cpu(x)		__builtin_bswap32(x)
+#define be64_to_cpu(x)		__builtin_bswap64(x)
+#define cpu_to_be32(x)		__builtin_bswap32(x)
+#define le16_to_cpup(p)		(*(const u16 *) (p))
+#define le32_to_cpup(p)		(*(const u32 *) (p))
+#define le64_to_cpup(p)		(*(const u64 *) (p))
+#define be32_to_cpup(p)		be32_to_cpu(*(const u32 *) (p))
+
+/* errors */
+
+#define MAX_ERRNO		4095
+#define ERESTARTSYS		512
+#define IS_ERR_VALUE(x)		((unsigned long) (x) >= (unsigned long) -MAX_ERRNO)
+static inline void *ERR_PTR(long e) { return (void *) e; }
+static inline long PTR_ERR(const void *p) { return (long) p; }
+static inline bool IS_ERR(const void *p) { return IS_ERR_VALUE((unsigned long) p); }
+static inline bool IS_ERR_OR_NULL(const void *p) { return ! p || IS_ERR(p); }
+
+/* printing */
+
+#define KERN_EMERG		""
+#define KERN_ALERT		""
+#define KERN_ERR		""
+#define KERN_WARNING		""
+#define KERN_NOTICE		""
+#define KERN_INFO		""
+#define KERN_DEBUG		""
+#define KERN_CONT		""
+
+extern int printk(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+#define pr_alert(fmt, ...)	printk(fmt, ##__VA_ARGS__)
+#define pr_err(fmt, ...)	printk(fmt, ##__VA_ARGS__)
+#define pr_warn(fmt, ...)	printk(fmt, ##__VA_ARGS__)
+#define pr_notice(fmt, ...)	printk(fmt, ##__VA_ARGS__)
+#define pr_info(fmt, ...)	printk(fmt, ##__VA_ARGS__)
+#define pr_debug(fmt, ...)	do { if (0) printk(fmt, ##__VA_ARGS__); } while (0)
+
+struct ratelimit_state {
+	int			interval;
+	int			burst;
+};
+#define DEFAULT_RATELIMIT_INTERVAL	(5 * HZ)
+#define DEFAULT_RATELIMIT_BURST		10
+#define DEFINE_RATELIMIT_STATE(name, i, b)				\
+	struct ratelimit_state name = { i, b }
+/* printk() decides, so every message costs what formatting it costs */
+#define __ratelimit(rs)		((void) (rs), 1)
+
+extern int scnprintf(char *buf, size_t size, const char *fmt, ...)
+	__attribute__((format(printf, 3, 4)));
+extern void *memchr_inv(const void *start, int c, size_t bytes);
+
+/* modules */
+
+struct module;
+#define THIS_MODULE		((struct module *) 0)
+/* module parameters can be set by name, see shim_param_set() */
+extern void shim_param_register(const char *name, void *var, const char *type,
+		unsigned int nr);
+extern int shim_param_set(const char *name, const char *value);
+#define module_param_named(name, var, type, perm)			\
+	static void __attribute__((constructor)) __shim_param_##name(void) { \
+		shim_param_register(#name, &(var), #type, 1);		\
+	}
+#define module_param(name, type, perm)					\
+	module_param_named(name, name, type, perm)
+#define module_param_array_named(name, var, type, nump, perm)		\
+	static void __attribute__((constructor)) __shim_param_##name(void) { \
+		shim_param_register(#name, (var), #type, ARRAY_SIZE(var)); \
+	}
+#define MODULE_PARM_DESC(name, desc)	struct __shim_swallow_semicolon
+#define MODULE_LICENSE(x)		struct __shim_swallow_semicolon
+#define MODULE_ALIAS(x)			struct __shim_swallow_semicolon
+#define MODULE_AUTHOR(x)		struct __shim_swallow_semicolon
+#define MODULE_DESCRIPTION(x)		struct __shim_swallow_semicolon
+#define EXPORT_SYMBOL(x)		struct __shim_swallow_semicolon
+#define EXPORT_SYMBOL_GPL(x)		struct __shim_swallow_semicolon
+#define module_init(fn)							\
+	int shim_module_init(void) { return fn(); }
+#define module_exit(fn)							\
+	void shim_module_exit(void) { fn(); }
+
+/* memory */
+
+#define GFP_KERNEL		0x00u
+#define GFP_ATOMIC		0x01u
+#define GFP_NOIO		0x02u
+#define GFP_NOFS		0x04u
+#define __GFP_NOWARN		0x10u
+#define __GFP_ZERO		0x20u
+
+static inline void *kmalloc(size_t size, gfp_t gfp) {
+	return (gfp & __GFP_ZERO) ? calloc(1, size ? size : 1) : malloc(size ? size : 1);
+}
+static inline void *kzalloc(size_t size, gfp_t gfp) { return calloc(1, size ? size : 1); }
+static inline void *kcalloc(size_t n, size_t size, gfp_t gfp) { return calloc(n ? n : 1, size); }
+static inline void kfree(const void *p) { free((void *) p); }
+static inline void *vmalloc(unsigned long size) { return malloc(size ? size : 1); }
+static inline void *vzalloc(unsigned long size) { return calloc(1, size ? size : 1); }
+static inline void vfree(const void *p) { free((void *) p); }
+
+#define PAGE_SHIFT		12
+#define PAGE_SIZE		(1UL << PAGE_SHIFT)
+#define PAGE_MASK		(~(PAGE_SIZE - 1))
+#define PFN_DOWN(x)		((x) >> PAGE_SHIFT)
+
+/* pages are page aligned mappings of their own, so grants can replace them */
+struct page {
+	void			*virtual;
+	struct page		*hash;
+};
+
+extern struct page *alloc_page(gfp_t);
+extern void __free_page(struct page *);
+extern unsigned long get_zeroed_page(gfp_t);
+extern unsigned long __get_free_page(gfp_t);
+extern void free_page(unsigned long);
+extern struct page *shim_virt_to_page(const void *);
+#define virt_to_page(addr)	shim_virt_to_page((const void *) (unsigned long) (addr))
+
+static inline void *page_address(const struct page *page) { return page->virtual; }
+static inline unsigned long page_to_pfn(const struct page *page) {
+	return (unsigned long) page->virtual >> PAGE_SHIFT;
+}
+static inline void *pfn_to_kaddr(unsigned long pfn) { return (void *) (pfn << PAGE_SHIFT); }
+static inline void *kmap(struct page *page) { return page->virtual; }
+static inline void kunmap(struct page *page) { }
+static inline void *kmap_atomic(struct page *page) { return page->virtual; }
+#define kunmap_atomic(addr)	((void) (addr))
+static inline void flush_dcache_page(struct page *page) { }
+
+/* lists */
+
+struct list_head {
+	struct list_head	*next, *prev;
+};
+
+struct hlist_head {
+	struct hlist_node	*first;
+};
+
+struct hlist_node {
+	struct hlist_node	*next, **pprev;
+};
+
+#define LIST_HEAD_INIT(name)	{ &(name), &(name) }
+#define LIST_HEAD(name)		struct list_head name = LIST_HEAD_INIT(name)
+
+static inline void INIT_LIST_HEAD(struct list_head *list) {
+	list->next = list;
+	list->prev = list;
+}
+
+static inline void __list_add(struct list_head *new, struct list_head *prev,
+		struct list_head *next) {
+	next->prev = new;
+	new->next = next;
+	new->prev = prev;
+	prev->next = new;
+}
+
+static inline void list_add(struct list_head *new, struct list_head *head) {
+	__list_add(new, head, head->next);
+}
+
+static inline void list_add_tail(struct list_head *new, struct list_head *head) {
+	__list_add(new, head->prev, head);
+}
+
+static inline void __list_del(struct list_head *prev, struct list_head *next) {
+	next->prev = prev;
+	prev->next = next;
+}
+
+static inline void list_del(struct list_head *entry) {
+	__list_del(entry->prev, entry->next);
+	entry->next = entry->prev = NULL;
+}
+
+static inline void list_del_init(struct list_head *entry) {
+	__list_del(entry->prev, entry->next);
+	INIT_LIST_HEAD(entry);
+}
+
+static inline void list_move(struct list_head *list, struct list_head *head) {
+	__list_del(list->prev, list->next);
+	list_add(list, head);
+}
+
+static inline void list_move_tail(struct list_head *list, struct list_head *head) {
+	__list_del(list->prev, list->next);
+	list_add_tail(list, head);
+}
+
+static inline int list_empty(const struct list_head *head) {
+	return head->next == head;
+}
+
+static inline int list_is_last(const struct list_head *list,
+		const struct list_head *head) {
+	return list->next == head;
+}
+
+static inline void list_splice_init(struct list_head *list, struct list_head *head) {
+	if (list_empty(list))
+		return;
+	list->next->prev = head;
+	list->prev->next = head->next;
+	head->next->prev = list->prev;
+	head->next = list->next;
+	INIT_LIST_HEAD(list);
+}
+
+static inline void list_splice_tail_init(struct list_head *list, struct list_head *head) {
+	if (list_empty(list))
+		return;
+	list->prev->next = head;
+	list->next->prev = head->prev;
+	head->prev->next = list->next;
+	head->prev = list->prev;
+	INIT_LIST_HEAD(list);
+}
+
+#define list_entry(ptr, type, member)	container_of(ptr, type, member)
+#define list_first_entry(ptr, type, member)				\
+	list_entry((ptr)->next, type, member)
+#define list_for_each(pos, head)					\
+	for (pos = (head)->next; pos != (head); pos = pos->next)
+#define list_for_each_safe(pos, n, head)				\
+	for (pos = (head)->next, n = pos->next; pos != (head);		\
+	     pos = n, n = pos->next)
+#define list_for_each_entry(pos, head, member)				\
+	for (pos = list_entry((head)->next, typeof(*pos), member);	\
+	     &pos->member != (head);					\
+	     pos = list_entry(pos->member.next, typeof(*pos), member))
+#define list_for_each_entry_reverse(pos, head, member)			\
+	for (pos = list_entry((head)->prev, typeof(*pos), member);	\
+	     &pos->member != (head);					\
+	     pos = list_entry(pos->member.prev, typeof(*pos), member))
+#define list_for_each_entry_continue(pos, head, member)			\
+	for (pos = list_entry(pos->member.next, typeof(*pos), member);	\
+	     &pos->member != (head);					\
+	     pos = list_entry(pos->member.next, typeof(*pos), member))
+#define list_for_each_entry_safe(pos, n, head, member)			\
+	for (pos = list_entry((head)->next, typeof(*pos), member),	\
+	     n = list_entry(pos->member.next, typeof(*pos), member);	\
+	     &pos->member != (head);					\
+	     pos = n, n = list_entry(n->member.next, typeof(*n), member))
+
+#define INIT_HLIST_HEAD(ptr)	((ptr)->first = NULL)
+
+static inline void hlist_add_head(struct hlist_node *n, struct hlist_head *h) {
+	n->next = h->first;
+	if (h->first)
+		h->first->pprev = &n->next;
+	h->first = n;
+	n->pprev = &h->first;
+}
+
+static inline void hlist_del(struct hlist_node *n) {
+	*n->pprev = n->next;
+	if (n->next)
+		n->next->pprev = n->pprev;
+}
+
+#define hlist_entry(ptr, type, member)	container_of(ptr, type, member)
+#define hlist_for_each_entry(tpos, pos, head, member)			\
+	for (pos = (head)->first;					\
+	     pos && ((tpos = hlist_entry(pos, typeof(*tpos), member)), 1); \
+	     pos = pos->next)
+#define hlist_for_each_entry_safe(tpos, pos, n, head, member)		\
+	for (pos = (head)->first;					\
+	     pos && ((n = pos->next), 1) &&				\
+		((tpos = hlist_entry(pos, typeof(*tpos), member)), 1);	\
+	     pos = n)
+
+/* bits */
+
+static inline int test_bit(long nr, const volatile unsigned long *addr) {
+	return 1UL & (addr[BIT_WORD(nr)] >> (nr % BITS_PER_LONG));
+}
+static inline void __set_bit(long nr, volatile unsigned long *addr) {
+	addr[BIT_WORD(nr)] |= BIT_MASK(nr);
+}
+static inline void __clear_bit(long nr, volatile unsigned long *addr) {
+	addr[BIT_WORD(nr)] &= ~BIT_MASK(nr);
+}
+static inline int __test_and_set_bit(long nr, volatile unsigned long *addr) {
+	int old = test_bit(nr, addr);
+
+	__set_bit(nr, addr);
+	return old;
+}
+static inline void set_bit(long nr, volatile unsigned long *addr) {
+	__atomic_fetch_or(&addr[BIT_WORD(nr)], BIT_MASK(nr), __ATOMIC_SEQ_CST);
+}
+static inline void clear_bit(long nr, volatile unsigned long *addr) {
+	__atomic_fetch_and(&addr[BIT_WORD(nr)], ~BIT_MASK(nr), __ATOMIC_SEQ_CST);
+}
+static inline int test_and_set_bit(long nr, volatile unsigned long *addr) {
+	return !! (__atomic_fetch_or(&addr[BIT_WORD(nr)], BIT_MASK(nr),
+				__ATOMIC_SEQ_CST) & BIT_MASK(nr));
+}
+static inline int test_and_clear_bit(long nr, volatile unsigned long *addr) {
+	return !! (__atomic_fetch_and(&addr[BIT_WORD(nr)], ~BIT_MASK(nr),
+				__ATOMIC_SEQ_CST) & BIT_MASK(nr));
+}
+extern unsigned long find_next_bit(const unsigned long *addr, unsigned long size,
+		unsigned long offset);
+extern unsigned long find_next_zero_bit(const unsigned long *addr,
+		unsigned long size, unsigned long offset);
+#define find_first_bit(addr, size)	find_next_bit(addr, size, 0)
+#define find_first_zero_bit(addr, size)	find_next_zero_bit(addr, size, 0)
+#define for_each_set_bit(bit, addr, size)				\
+	for ((bit) = find_first_bit(addr, size); (bit) < (size);	\
+	     (bit) = find_next_bit(addr, size, (bit) + 1))
+/* little endian bitmaps, such as ext3's, are the native ones here */
+#define test_bit_le(nr, addr)		test_bit(nr, (unsigned long *) (addr))
+#define __set_bit_le(nr, addr)		__set_bit(nr, (unsigned long *) (addr))
+#define find_next_bit_le(addr, size, offset)				\
+	find_next_bit((const unsigned long *) (addr), size, offset)
+#define find_next_zero_bit_le(addr, size, offset)			\
+	find_next_zero_bit((const unsigned long *) (addr), size, offset)
+
+/* atomics */
+
+typedef struct {
+	int			counter;
+} atomic_t;
+
+typedef struct {
+	long			counter;
+} atomic64_t;
+
+#define ATOMIC_INIT(i)		{ (i) }
+#define atomic_read(v)		__atomic_load_n(&(v)->counter, __ATOMIC_RELAXED)
+#define atomic_set(v, i)	__atomic_store_n(&(v)->counter, (i), __ATOMIC_RELAXED)
+#define atomic_add(i, v)	((void) __atomic_add_fetch(&(v)->counter, (i), __ATOMIC_SEQ_CST))
+#define atomic_sub(i, v)	((void) __atomic_sub_fetch(&(v)->counter, (i), __ATOMIC_SEQ_CST))
+#define atomic_inc(v)		atomic_add(1, v)
+#define atomic_dec(v)		atomic_sub(1, v)
+#define atomic_inc_return(v)	__atomic_add_fetch(&(v)->counter, 1, __ATOMIC_SEQ_CST)
+#define atomic_dec_return(v)	__atomic_sub_fetch(&(v)->counter, 1, __ATOMIC_SEQ_CST)
+#define atomic_add_return(i, v)	__atomic_add_fetch(&(v)->counter, (i), __ATOMIC_SEQ_CST)
+#define atomic_dec_and_test(v)	(atomic_dec_return(v) == 0)
+#define atomic_cmpxchg(v, o, n)						\
+	({ int __o = (o); __atomic_compare_exchange_n(&(v)->counter, &__o, (n), \
+			0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); __o; })
+#define atomic64_read(v)	atomic_read(v)
+#define atomic64_set(v, i)	atomic_set(v, i)
+#define atomic64_add(i, v)	atomic_add(i, v)
+#define atomic64_inc(v)		atomic_inc(v)
+#define atomic64_inc_return(v)	atomic_inc_return(v)
+#define xchg(p, n)		__atomic_exchange_n(p, n, __ATOMIC_SEQ_CST)
+#define cmpxchg(p, o, n)						\
+	({ typeof(*(p)) __o = (o); __atomic_compare_exchange_n(p, &__o, (n), \
+			0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); __o; })
+
+/* cpus: one per thread, see shim_thread_start() */
+
+#define NR_CPUS			16
+extern unsigned int nr_cpu_ids;
+extern __thread unsigned int shim_cpu;
+
+#define smp_processor_id()	(shim_cpu)
+#define raw_smp_processor_id()	(shim_cpu)
+#define get_cpu()		(shim_cpu)
+#define put_cpu()		do { } while (0)
+#define num_online_cpus()	(nr_cpu_ids)
+#define for_each_possible_cpu(cpu)					\
+	for ((cpu) = 0; (cpu) < nr_cpu_ids; (cpu)++)
+#define for_each_online_cpu(cpu)	for_each_possible_cpu(cpu)
+
+/* nothing else runs on a thread's cpu, so there is nothing to keep out */
+#define local_irq_save(flags)		((flags) = 0)
+#define local_irq_restore(flags)	((void) (flags))
+#define local_irq_disable()		do { } while (0)
+#define local_irq_enable()		do { } while (0)
+#define preempt_disable()		do { } while (0)
+#define preempt_enable()		do { } while (0)
+#define in_interrupt()			0
+
+#define alloc_percpu(type)	((type *) calloc(NR_CPUS, sizeof(type)))
+#define free_percpu(p)		free(p)
+#define per_cpu_ptr(p, cpu)	(&(p)[cpu])
+#define this_cpu_ptr(p)		per_cpu_ptr(p, shim_cpu)
+
+struct u64_stats_sync {
+	unsigned int		seq;
+};
+#define u64_stats_update_begin(s)	((void) (s))
+#define u64_stats_update_end(s)		((void) (s))
+#define u64_stats_fetch_begin(s)	((void) (s), 0U)
+#define u64_stats_fetch_retry(s, start)	((void) (s), (void) (start), 0)
+
+/* locks; spinlocks sleep, since threads here don't own a cpu */
+
+typedef struct {
+	pthread_mutex_t		m;
+} spinlock_t;
+
+#define __SPIN_LOCK_UNLOCKED(name)	{ PTHREAD_MUTEX_INITIALIZER }
+#define DEFINE_SPINLOCK(name)		spinlock_t name = __SPIN_LOCK_UNLOCKED(name)
+#define spin_lock_init(l)		pthread_mutex_init(&(l)->m, NULL)
+#define spin_lock(l)			pthread_mutex_lock(&(l)->m)
+#define spin_unlock(l)			pthread_mutex_unlock(&(l)->m)
+#define spin_trylock(l)			(pthread_mutex_trylock(&(l)->m) == 0)
+#define spin_lock_irq(l)		spin_lock(l)
+#define spin_unlock_irq(l)		spin_unlock(l)
+#define spin_lock_bh(l)			spin_lock(l)
+#define spin_unlock_bh(l)		spin_unlock(l)
+#define spin_lock_irqsave(l, flags)	do { (flags) = 0; spin_lock(l); } while (0)
+#define spin_unlock_irqrestore(l, flags) do { (void) (flags); spin_unlock(l); } while (0)
+#define assert_spin_locked(l)		do { } while (0)
+
+struct mutex {
+	pthread_mutex_t		m;
+};
+
+#define DEFINE_MUTEX(name)		struct mutex name = { PTHREAD_MUTEX_INITIALIZER }
+#define mutex_init(l)			pthread_mutex_init(&(l)->m, NULL)
+#define mutex_lock(l)			pthread_mutex_lock(&(l)->m)
+#define mutex_lock_interruptible(l)	pthread_mutex_lock(&(l)->m)
+#define mutex_trylock(l)		(pthread_mutex_trylock(&(l)->m) == 0)
+#define mutex_unlock(l)			pthread_mutex_unlock(&(l)->m)
+
+/* time */
+
+#define HZ			250
+#define NSEC_PER_USEC		1000L
+#define NSEC_PER_MSEC		1000000L
+#define NSEC_PER_SEC		1000000000L
+#define USEC_PER_SEC		1000000L
+
+typedef union {
+	s64			tv64;
+} ktime_t;
+
+static inline u64 shim_now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64) ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static inline ktime_t ktime_get(void) {
+	ktime_t kt = { .tv64 = shim_now_ns() };
+
+	return kt;
+}
+static inline ktime_t ktime_sub(ktime_t a, ktime_t b) {
+	ktime_t kt = { .tv64 = a.tv64 - b.tv64 };
+
+	return kt;
+}
+static inline ktime_t ktime_add_ns(ktime_t a, u64 ns) {
+	ktime_t kt = { .tv64 = a.tv64 + ns };
+
+	return kt;
+}
+static inline s64 ktime_to_ns(ktime_t kt) { return kt.tv64; }
+static inline s64 ktime_to_us(ktime_t kt) { return kt.tv64 / NSEC_PER_USEC; }
+static inline s64 ktime_to_ms(ktime_t kt) { return kt.tv64 / NSEC_PER_MSEC; }
+
+/* jiffies count from when the process started */
+extern unsigned long shim_jiffies(void);
+#define jiffies			shim_jiffies()
+#define time_after(a, b)	((long) ((b) - (a)) < 0)
+#define time_before(a, b)	time_after(b, a)
+#define time_after_eq(a, b)	((long) ((a) - (b)) >= 0)
+static inline unsigned long msecs_to_jiffies(unsigned int ms) {
+	return DIV_ROUND_UP((unsigned long) ms * HZ, 1000);
+}
+static inline unsigned int jiffies_to_msecs(unsigned long j) { return j * 1000 / HZ; }
+static inline unsigned int jiffies_to_usecs(unsigned long j) { return j * 1000000 / HZ; }
+
+extern void msleep(unsigned int ms);
+extern void ssleep(unsigned int s);
+static inline void cond_resched(void) { }
+
+/* threads */
+
+struct task_struct {
+	char			comm[16];
+	pthread_t		thread;
+	int			(*fn)(void *);
+	void			*data;
+	unsigned int		cpu;
+	volatile bool		should_stop;
+	int			ret;
+};
+
+extern __thread struct task_struct *shim_current;
+#define current			shim_current
+
+extern struct task_struct *kthread_run(int (*fn)(void *), void *data,
+		const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+extern int kthread_stop(struct task_struct *);
+extern bool kthread_should_stop(void);
+static inline bool try_to_freeze(void) { return false; }
+static inline void set_freezable(void) { }
+
+/* wait queues; waiters look again now and then so kthread_stop() needs no wake up */
+
+typedef struct {
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+} wait_queue_head_t;
+
+extern void init_waitqueue_head(wait_queue_head_t *);
+extern void wake_up(wait_queue_head_t *);
+#define wake_up_all(wq)			wake_up(wq)
+#define wake_up_interruptible(wq)	wake_up(wq)
+#define wake_up_interruptible_all(wq)	wake_up(wq)
+extern long shim_wait(wait_queue_head_t *, long timeout_ns);
+
+#define SHIM_WAIT_POLL_NS	(10 * NSEC_PER_MSEC)
+
+#define __shim_wait_event(wq, cond, timeout_ns)				\
+	({								\
+		u64 __end = shim_now_ns() + (timeout_ns);		\
+		long __ret = 1;						\
+									\
+		pthread_mutex_lock(&(wq).lock);				\
+		while (! (cond)) {					\
+			if (shim_now_ns() >= __end) {			\
+				__ret = 0;				\
+				break;					\
+			}						\
+			shim_wait(&(wq), min_t(u64, SHIM_WAIT_POLL_NS,	\
+					__end - shim_now_ns()));	\
+		}							\
+		pthread_mutex_unlock(&(wq).lock);			\
+		__ret;							\
+	})
+
+#define wait_event(wq, cond)						\
+	((void) __shim_wait_event(wq, cond, ~0ULL >> 2))
+#define wait_event_interruptible(wq, cond)				\
+	({ __shim_wait_event(wq, cond, ~0ULL >> 2); 0; })
+#define wait_event_timeout(wq, cond, timeout)				\
+	(__shim_wait_event(wq, cond,					\
+			(u64) (timeout) * (NSEC_PER_SEC / HZ)) ? max(1L, (long) (timeout)) : 0)
+#define wait_event_interruptible_timeout(wq, cond, timeout)		\
+	wait_event_timeout(wq, cond, timeout)
+
+struct completion {
+	unsigned int		done;
+	wait_queue_head_t	wait;
+};
+
+extern void init_completion(struct completion *);
+#define INIT_COMPLETION(c)	((c).done = 0)
+extern void complete(struct completion *);
+extern void complete_all(struct completion *);
+extern void wait_for_completion(struct completion *);
+extern long wait_for_completion_timeout(struct completion *, unsigned long timeout);
+#define wait_for_completion_interruptible_timeout(c, timeout)		\
+	wait_for_completion_timeout(c, timeout)
+
+/* work queues; all work runs on one worker thread */
+
+struct work_struct;
+typedef void (*work_func_t)(struct work_struct *);
+
+struct work_struct {
+	struct list_head	entry;
+	work_func_t		func;
+	bool			pending;
+	u64			due_ns;		/* when it may run, 0 for now */
+};
+
+struct delayed_work {
+	struct work_struct	work;
+};
+
+struct workqueue_struct;
+
+#define INIT_WORK(w, f)							\
+	do { INIT_LIST_HEAD(&(w)->entry); (w)->func = (f); (w)->pending = false; } while (0)
+#define INIT_DELAYED_WORK(w, f)		INIT_WORK(&(w)->work, f)
+#define to_delayed_work(w)		container_of(w, struct delayed_work, work)
+
+extern struct workqueue_struct *alloc_workqueue(const char *, unsigned int flags,
+		int max_active);
+#define create_singlethread_workqueue(name)	alloc_workqueue(name, 0, 1)
+#define WQ_NON_REENTRANT	0x01
+#define WQ_UNBOUND		0x02
+#define WQ_MEM_RECLAIM		0x08
+extern void destroy_workqueue(struct workqueue_struct *);
+extern bool queue_work(struct workqueue_struct *, struct work_struct *);
+extern bool queue_delayed_work(struct workqueue_struct *, struct delayed_work *,
+		unsigned long delay);
+extern bool schedule_work(struct work_struct *);
+extern bool schedule_delayed_work(struct delayed_work *, unsigned long delay);
+extern bool cancel_work_sync(struct work_struct *);
+extern bool cancel_delayed_work_sync(struct delayed_work *);
+extern void flush_workqueue(struct workqueue_struct *);
+extern void flush_scheduled_work(void);
+
+/* misc */
+
+extern void get_random_bytes(void *buf, int nbytes);
+extern void sort(void *base, size_t num, size_t size,
+		int (*cmp)(const void *, const void *),
+		void (*swap)(void *, void *, int));
+extern void list_sort(void *priv, struct list_head *head,
+		int (*cmp)(void *priv, struct list_head *a, struct list_head *b));
+extern u32 crc32_le(u32 crc, const unsigned char *p, size_t len);
+
+static inline u32 hash_32(u32 val, unsigned int bits) {
+	u32 hash = val * 0x9e370001UL;
+
+	return hash >> (32 - bits);
+}
+
+static inline u32 shim_rol32(u32 word, unsigned int shift) {
+	return (word << shift) | (word >> (32 - shift));
+}
+
+/* the final mix of Bob Jenkins' lookup3, as linux/jhash.h has it */
+static inline u32 jhash_3words(u32 a, u32 b, u32 c, u32 initval) {
+	a += 0xdeadbeef + (3 << 2) + initval;
+	b += 0xdeadbeef + (3 << 2) + initval;
+	c += 0xdeadbeef + (3 << 2) + initval;
+	c ^= b; c -= shim_rol32(b, 14);
+	a ^= c; a -= shim_rol32(c, 11);
+	b ^= a; b -= shim_rol32(a, 25);
+	c ^= b; c -= shim_rol32(b, 16);
+	a ^= c; a -= shim_rol32(c, 4);
+	b ^= a; b -= shim_rol32(a, 14);
+	c ^= b; c -= shim_rol32(b, 24);
+	return c;
+}
+static inline u32 jhash_2words(u32 a, u32 b, u32 initval) {
+	return jhash_3words(a, b, 0, initval);
+}
+
+static inline bool capable(int cap) { return true; }
+#define CAP_SYS_ADMIN		21
+
+#define S_IRUSR			00400
+#define S_IWUSR			00200
+#define S_IRUGO			00444
+#define S_IWUGO			00222
+#define S_IFMT			00170000
+#define S_IFREG			0100000
+#define S_IFDIR			0040000
+#define S_ISREG(m)		(((m) & S_IFMT) == S_IFREG)
+#define S_ISDIR(m)		(((m) & S_IFMT) == S_IFDIR)
+
+#define MAJOR(dev)		((unsigned int) ((dev) >> 20))
+#define MINOR(dev)		((unsigned int) ((dev) & ((1U << 20) - 1)))
+#define MKDEV(ma, mi)		(((ma) << 20) | (mi))
+
+#include "block.h"
+#include "fs.h"
+#include "stubs.h"
+#include "xen.h"
+
+#endif
@@ -0,0 +1,15 @@
+/*
+ * label_stubs.c -- the parts of the module labelfuzz and labelbench leave out
+ *
+ * They build the labels and the ext3 parsing that fills them in, with the
+ * partition code, inode map and free space tracking that parsing feeds.
+ * Events go nowhere.
+ */
+
+#include "../common.h"
+#include "../events.h"
+
+bool ljx_events_enabled;
+
+void __ljx_event(u16 type, u32 dev, sector_t sector, u32 nr_sec, u32 arg) {
+}
@@ -0,0 +1,242 @@
+/*
+ * labelbench.c -- how fast the label store is at 1K to 10M labels
+ *
+ * For each size, labels of alternating types are put every 16 sectors with
+ * one sorted ljx_insert_labels(), kept either on the list (no processor,
+ * as boot.c's labels) or in the map of a filesystem that covers them all
+ * (ext3 processors, one block each). Then, each for a fixed time:
+ *
+ *   find    ljx_process_labels() on random 8 sector bios
+ *   insert  a new label in a random gap
+ *   merge   a label overlapping one of its type, which grows it
+ *   split   a label of another type inside one, which splits it in three
+ *
+ * In the map every block holds one type, so there merge and split relabel
+ * a whole block. Every insert is a single ljx_insert_label() at a random
+ * place, as when the ext3 parser learns of a block. There is no memory
+ * limit.
+ */
+
+#include <getopt.h>
+#include <time.h>
+
+#include "../common.h"
+#include "../label.h"
+#include "../boot.h"
+#include "shim.h"
+
+#define MAX_SIZES		16
+#define SPACING			16	/* sectors from one label to the next */
+#define SPB			8	/* of the filesystem of the map store */
+
+static u64 rand_state = 1;
+static double seconds = 1;
+
+static u64 next_rand(void) {
+	/* xorshift64* */
+	rand_state ^= rand_state >> 12;
+	rand_state ^= rand_state << 25;
+	rand_state ^= rand_state >> 27;
+	return rand_state * 0x2545f4914f6cdd1dULL;
+}
+
+static u64 now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* what a test does to label i, of n */
+typedef void (test_fn)(struct xen_vbd *, unsigned long i, bool map);
+
+static label_t type_of(unsigned long i) {
+	return i & 1 ? JOURNAL : INODE_BLOCK;
+}
+
+static process_bio_fn *processor_of(label_t type, bool map) {
+	return map ? ljx_ext3_processor(type) : NULL;
+}
+
+static void find(struct xen_vbd *vbd, unsigned long i, bool map) {
+	struct bio bio = {
+		.bi_sector	= (sector_t) i * SPACING + next_rand() % SPACING,
+		.bi_size	= 8 << 9,
+	};
+	unsigned int nr_sec[LJX_LABEL_TYPES];
+
+	ljx_process_labels(&bio, vbd, nr_sec);
+}
+
+static void insert(struct xen_vbd *vbd, unsigned long i, bool map) {
+	/* blocks are 8 sectors, so the map store's gaps hold one */
+	ljx_insert_label(vbd->labels, (sector_t) i * SPACING + 8, map ? SPB : 2,
+			GROUP_DESC, processor_of(GROUP_DESC, map));
+}
+
+static void merge(struct xen_vbd *vbd, unsigned long i, bool map) {
+	ljx_insert_label(vbd->labels, (sector_t) i * SPACING + (map ? 0 : 4),
+			SPB, type_of(i), processor_of(type_of(i), map));
+}
+
+static void split(struct xen_vbd *vbd, unsigned long i, bool map) {
+	ljx_insert_label(vbd->labels, (sector_t) i * SPACING + (map ? 0 : 2),
+			map ? SPB : 2, EXTENT_BLOCK, processor_of(EXTENT_BLOCK, map));
+}
+
+/* runs test at random labels for the set time, returns calls per second */
+static double run(struct xen_vbd *vbd, unsigned long n, bool map, test_fn *test) {
+	u64 start = now_ns(), end = start + seconds * 1e9, t = start, calls = 0;
+	unsigned int i;
+
+	do {
+		for (i = 0; i < 16; i++)
+			test(vbd, next_rand() % n, map);
+		calls += 16;
+		t = now_ns();
+	} while (t < end);
+	return calls * 1e9 / (t - start);
+}
+
+static size_t labels_bytes(struct ljx_labels *labels) {
+	size_t bytes = labels->nr_chunks * PAGE_SIZE;
+	unsigned int i;
+
+	for (i = 0; i < labels->nr_maps; i++)
+		if (labels->maps[i].leaves)
+			bytes += labels->maps[i].nr_leaves * sizeof(u8 *) +
+				labels->maps[i].nr_used * PAGE_SIZE;
+	return bytes;
+}
+
+static void print_rate(double per_sec) {
+	if (per_sec >= 1e6)
+		printf(" %8.2fM", per_sec / 1e6);
+	else if (per_sec >= 1e3)
+		printf(" %8.2fK", per_sec / 1e3);
+	else
+		printf(" %9.1f", per_sec);
+}
+
+static int bench(unsigned long n, bool map) {
+	struct xen_vbd vbd = {
+		.pdevice	= 1,
+		.size		= (sector_t) n * SPACING,
+	};
+	struct label *batch;
+	unsigned long i;
+	u64 t;
+	int ret;
+
+	vbd.labels = ljx_labels_alloc(vbd.pdevice);
+	vbd.bootblock = ljx_bootblock_alloc();
+	batch = calloc(n, sizeof(*batch));
+	if (! vbd.labels || ! vbd.bootblock || ! batch) {
+		fprintf(stderr, "out of memory\n");
+		return -1;
+	}
+	if (map && ljx_labels_add_fs(vbd.labels, 0, vbd.size / SPB, SPB)) {
+		fprintf(stderr, "can't add a filesystem of %lu blocks\n",
+				(unsigned long) (vbd.size / SPB));
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		batch[i].sector = (sector_t) i * SPACING;
+		batch[i].nr_sec = SPB;
+		batch[i].label = type_of(i);
+		batch[i].processor = processor_of(type_of(i), map);
+	}
+
+	/* the map takes over once the labels are in, off the clock */
+	t = now_ns();
+	ret = ljx_insert_labels(vbd.labels, batch, n);
+	t = now_ns() - t;
+	flush_scheduled_work();
+	free(batch);
+	if (ret) {
+		fprintf(stderr, "out of memory for %lu labels\n", n);
+		return -1;
+	}
+
+	printf("%9lu %-5s", n, map ? "map" : "list");
+	print_rate(n * 1e9 / max_t(u64, t, 1));
+	printf(" %7.2f", (double) labels_bytes(vbd.labels) / n);
+	print_rate(run(&vbd, n, map, find));
+	print_rate(run(&vbd, n, map, insert));
+	print_rate(run(&vbd, n, map, merge));
+	print_rate(run(&vbd, n, map, split));
+	printf("\n");
+	fflush(stdout);
+
+	ljx_labels_free(vbd.labels);
+	ljx_bootblock_free(vbd.bootblock);
+	return 0;
+}
+
+static void usage(void) {
+	fprintf(stderr,
+"usage: labelbench [options]\n"
+"  -N LABELS    how many labels to start with, repeatable\n"
+"               (default 1000, 10000, 100000, 1000000 and 10000000)\n"
+"  -s STORE     list or map, repeatable (default both)\n"
+"  -t SECONDS   to run each test for (default 1)\n"
+"  -S SEED      for the places tested (default 1)\n");
+	exit(2);
+}
+
+int main(int argc, char **argv) {
+	static const unsigned long default_sizes[] = {
+		1000, 10000, 100000, 1000000, 10000000,
+	};
+	unsigned long sizes[MAX_SIZES];
+	unsigned int nr_sizes = 0, i;
+	bool list = false, map = false;
+	int c;
+
+	while ((c = getopt(argc, argv, "N:s:t:S:h")) != -1) {
+		switch (c) {
+		case 'N':
+			if (nr_sizes == MAX_SIZES)
+				usage();
+			sizes[nr_sizes] = strtoul(optarg, NULL, 0);
+			if (! sizes[nr_sizes++])
+				usage();
+			break;
+		case 's':
+			if (! strcmp(optarg, "list"))
+				list = true;
+			else if (! strcmp(optarg, "map"))
+				map = true;
+			else
+				usage();
+			break;
+		case 't':
+			seconds = atof(optarg);
+			break;
+		case 'S':
+			rand_state = strtoull(optarg, NULL, 0) | 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc)
+		usage();
+	if (! nr_sizes) {
+		memcpy(sizes, default_sizes, sizeof(default_sizes));
+		nr_sizes = ARRAY_SIZE(default_sizes);
+	}
+	if (! list && ! map)
+		list = map = true;
+	shim_quiet = true;
+	shim_param_set("label_mem", "0");
+
+	printf("   labels store   batch/s   B/label    find/s  insert/s   merge/s   split/s\n");
+	for (i = 0; i < nr_sizes; i++) {
+		if (list && bench(sizes[i], false))
+			return 1;
+		if (map && bench(sizes[i], true))
+			return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,1256 @@
+/*
+ * labelfuzz.c -- checks the label store and the ext3 parser against models
+ *
+ * Each round runs random inserts into the labels of a vbd and compares them,
+ * after every few steps, against a plain array of one label type per sector:
+ * single inserts, sorted batches, inserts into a filesystem whose labels
+ * move to a map by block, and inserts into labels over their memory limit.
+ * Lookups through ljx_process_labels() are checked against the array too.
+ *
+ * Then it writes random ext3 images, partitioned or not, with block mapped
+ * and extent mapped files and a journal, reads them through the module the
+ * way a guest would until the labels stop changing, and checks that every
+ * metadata block was found with the right type and owner, and nothing else.
+ * Images with random bytes written over their metadata only have to leave
+ * the labels sane; build with -fsanitize=address to catch the rest, see
+ * README.
+ */
+
+#include <getopt.h>
+#include <stdarg.h>
+
+#include "../common.h"
+#include "../label.h"
+#include "../boot.h"
+#include "../ext3.h"
+#include "../layout.h"
+#include "../inode_map.h"
+#include "../bitmap.h"
+#include "../hot_files.h"
+#include "shim.h"
+
+#define MAX_SECTORS		(1 << 18)
+#define LIST_SECTORS		(1 << 16)
+#define MAP_START		4096	/* of the filesystem in the map phase */
+#define MAP_SPB			8
+#define BIO_PAGES		16
+#define MAX_PASSES		16
+
+static u64 seed = 1, rand_state;
+static const char *phase = "setup";
+static unsigned long step;
+static unsigned int rounds = 4;
+
+/* what each sector should hold: a label type plus one, or 0 for none */
+static u8 *model, *actual;
+static sector_t nr_sectors;
+static struct label *copied;
+static unsigned int nr_copied;
+
+static void fail(int line, const char *fmt, ...)
+	__attribute__((noreturn, format(printf, 2, 3)));
+
+static void fail(int line, const char *fmt, ...) {
+	va_list args;
+
+	fprintf(stderr, "labelfuzz: %s, step %lu: ", phase, step);
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	fprintf(stderr, "\n(labelfuzz.c:%d, from -S %llu -n %u)\n", line,
+			(unsigned long long) seed, rounds);
+	exit(1);
+}
+
+#define CHECK(cond, fmt, args...)					\
+	do {								\
+		if (! (cond))						\
+			fail(__LINE__, fmt, ## args);			\
+	} while (0)
+
+static u64 next_rand(void) {
+	/* xorshift64* */
+	rand_state ^= rand_state >> 12;
+	rand_state ^= rand_state << 25;
+	rand_state ^= rand_state >> 27;
+	return rand_state * 0x2545f4914f6cdd1dULL;
+}
+
+static unsigned int below(unsigned int n) {
+	return next_rand() % n;
+}
+
+static const char *type_name(u8 code) {
+	return code ? ljx_label_name(code - 1) : "nothing";
+}
+
+static sector_t label_end(const struct label *label) {
+	return label->sector + label->nr_sec;
+}
+
+static struct request_queue queue;
+static struct block_device bdev = { .bd_queue = &queue };
+
+static struct xen_vbd *vbd_alloc(sector_t size) {
+	struct xen_vbd *vbd = calloc(1, sizeof(*vbd));
+
+	CHECK(vbd, "out of memory");
+	vbd->pdevice = 1;
+	vbd->bdev = &bdev;
+	vbd->size = size;
+	vbd->labels = ljx_labels_alloc(vbd->pdevice);
+	vbd->bootblock = ljx_bootblock_alloc();
+	CHECK(vbd->labels && vbd->bootblock, "out of memory");
+	return vbd;
+}
+
+static void vbd_free(struct xen_vbd *vbd) {
+	flush_scheduled_work();
+	ljx_labels_free(vbd->labels);
+	ljx_bootblock_free(vbd->bootblock);
+	free(vbd);
+}
+
+/*
+ * The list must be sorted, without empty or overlapping labels, and every
+ * label of the chunks either on it or free. Unless the labels were coarsened,
+ * no two neighbours of a type may touch, as they would have been merged.
+ * The tree must hold the same labels in the same order.
+ */
+static void check_list(struct ljx_labels *labels, bool merged) {
+	struct label *label, *prev = NULL;
+	struct list_head *pos;
+	struct rb_node *node;
+	unsigned int nr = 0, nr_free = 0;
+	unsigned long flags;
+
+	spin_lock_irqsave(&labels->lock, flags);
+	node = rb_first(&labels->tree);
+	list_for_each_entry(label, &labels->list, list) {
+		CHECK(node == &label->node, "label %u at %llu is not next in the tree",
+				nr, (unsigned long long) label->sector);
+		node = rb_next(node);
+		CHECK(label->nr_sec, "empty label at %llu",
+				(unsigned long long) label->sector);
+		CHECK(label->label < UNLABELED, "label at %llu has type %d",
+				(unsigned long long) label->sector, label->label);
+		if (prev) {
+			CHECK(label_end(prev) <= label->sector,
+					"labels at %llu and %llu overlap",
+					(unsigned long long) prev->sector,
+					(unsigned long long) label->sector);
+			CHECK(! merged || prev->label != label->label ||
+					label_end(prev) < label->sector,
+					"%s labels at %llu and %llu were not merged",
+					ljx_label_name(label->label),
+					(unsigned long long) prev->sector,
+					(unsigned long long) label->sector);
+		}
+		prev = label;
+		nr++;
+	}
+	CHECK(! node, "the tree has more labels than the list");
+	list_for_each(pos, &labels->free)
+		nr_free++;
+	CHECK(nr == labels->nr_labels, "%u labels on the list, nr_labels is %u",
+			nr, labels->nr_labels);
+	CHECK(nr + nr_free == labels->nr_chunks * LJX_LABELS_PER_CHUNK,
+			"%u labels used and %u free in %u chunks", nr, nr_free,
+			labels->nr_chunks);
+	spin_unlock_irqrestore(&labels->lock, flags);
+}
+
+static bool any_label(void *priv, const struct label *label) {
+	return true;
+}
+
+/* copies every label, from the list and the maps, into types by sector */
+static void read_labels(struct ljx_labels *labels, u8 *types, bool strict) {
+	struct label *label;
+	unsigned int i;
+	sector_t s;
+
+	nr_copied = ljx_copy_labels(labels, 0, any_label, NULL, copied, MAX_SECTORS);
+	memset(types, 0, nr_sectors);
+	for (i = 0; i < nr_copied; i++) {
+		label = &copied[i];
+		CHECK(label->nr_sec && label->sector < nr_sectors &&
+				label->nr_sec <= nr_sectors - label->sector,
+				"%s label at %llu+%u is outside the disk of %llu",
+				ljx_label_name(label->label),
+				(unsigned long long) label->sector, label->nr_sec,
+				(unsigned long long) nr_sectors);
+		CHECK(! i || copied[i - 1].sector <= label->sector,
+				"labels at %llu and %llu copied out of order",
+				(unsigned long long) copied[i - 1].sector,
+				(unsigned long long) label->sector);
+		for (s = label->sector; s < label_end(label); s++) {
+			CHECK(! strict || ! types[s], "%s and %s labels overlap at %llu",
+					type_name(types[s]), ljx_label_name(label->label),
+					(unsigned long long) s);
+			types[s] = label->label + 1;
+		}
+	}
+}
+
+static void compare_model(struct ljx_labels *labels) {
+	unsigned int i;
+	sector_t s;
+
+	check_list(labels, true);
+	read_labels(labels, actual, true);
+	for (s = 0; s < nr_sectors; s++)
+		CHECK(actual[s] == model[s], "sector %llu holds %s, should hold %s",
+				(unsigned long long) s, type_name(actual[s]),
+				type_name(model[s]));
+	for (i = 0; i < nr_copied; i++)
+		CHECK(copied[i].processor == ljx_ext3_processor(copied[i].label),
+				"%s label at %llu lost its processor",
+				ljx_label_name(copied[i].label),
+				(unsigned long long) copied[i].sector);
+}
+
+/*
+ * Looks up random bios, which no processor will look into: there is no
+ * filesystem on the vbd.
+ */
+static void check_lookups(struct xen_vbd *vbd, unsigned int n) {
+	unsigned int nr_sec[LJX_LABEL_TYPES], want[LJX_LABEL_TYPES];
+	unsigned int len, runs, num, i;
+	struct bio bio;
+	sector_t s;
+
+	while (n--) {
+		len = 1 + below(below(4) ? 64 : 1024);
+		memset(&bio, 0, sizeof(bio));
+		bio.bi_sector = below(nr_sectors - len + 1);
+		bio.bi_size = len << 9;
+		memset(want, 0, sizeof(want));
+		runs = 0;
+		for (s = bio.bi_sector; s < bio.bi_sector + len; s++) {
+			want[model[s] ? model[s] - 1 : UNLABELED]++;
+			if (model[s] && (s == bio.bi_sector || model[s - 1] != model[s]))
+				runs++;
+		}
+		num = ljx_process_labels(&bio, vbd, nr_sec);
+		CHECK(num == runs, "bio at %llu+%u found %u labels, not %u",
+				(unsigned long long) bio.bi_sector, len, num, runs);
+		for (i = 0; i < LJX_LABEL_TYPES; i++)
+			CHECK(nr_sec[i] == want[i],
+					"bio at %llu+%u has %u %s sectors, not %u",
+					(unsigned long long) bio.bi_sector, len, nr_sec[i],
+					ljx_label_name(i), want[i]);
+	}
+}
+
+/* mostly short labels, now and then up to max units of align sectors */
+static void random_label(struct label *label, sector_t first, sector_t end,
+		unsigned int align, unsigned int max, const label_t *types,
+		unsigned int nr_types) {
+	unsigned int units = (end - first) / align, len;
+
+	max = min(max, units);
+	len = 1 + below(below(8) ? min(max, 16U) : max);
+	label->sector = first + (sector_t) below(units - len + 1) * align;
+	label->nr_sec = len * align;
+	label->label = types[below(nr_types)];
+	label->processor = ljx_ext3_processor(label->label);
+}
+
+static int insert(struct ljx_labels *labels, const struct label *label) {
+	memset(model + label->sector, label->label + 1, label->nr_sec);
+	return ljx_insert_label(labels, label->sector, label->nr_sec, label->label,
+			label->processor);
+}
+
+/* sorts a batch by sector, keeping the order of equal ones, and inserts it */
+static int insert_batch(struct ljx_labels *labels, struct label *batch,
+		unsigned int n) {
+	struct label tmp;
+	unsigned int i, j;
+
+	for (i = 1; i < n; i++) {
+		tmp = batch[i];
+		for (j = i; j && batch[j - 1].sector > tmp.sector; j--)
+			batch[j] = batch[j - 1];
+		batch[j] = tmp;
+	}
+	for (i = 0; i < n; i++)
+		memset(model + batch[i].sector, batch[i].label + 1, batch[i].nr_sec);
+	return ljx_insert_labels(labels, batch, n);
+}
+
+static const label_t list_types[] = {
+	INODE_BLOCK, INDIRECT_BLOCK, JOURNAL, DATA,
+};
+
+static const label_t map_types[] = {
+	GROUP_DESC, INODE_BLOCK, BLOCK_BITMAP, INDIRECT_BLOCK, EXTENT_BLOCK, JOURNAL,
+};
+
+static void fuzz_list(unsigned long steps, bool batched) {
+	struct label batch[32];
+	struct xen_vbd *vbd;
+	unsigned int n, i;
+
+	phase = batched ? "batched inserts" : "inserts";
+	nr_sectors = LIST_SECTORS;
+	memset(model, 0, nr_sectors);
+	vbd = vbd_alloc(nr_sectors);
+	for (step = 0; step < steps; step++) {
+		n = batched ? 1 + below(ARRAY_SIZE(batch)) : 1;
+		for (i = 0; i < n; i++)
+			random_label(&batch[i], 0, nr_sectors, 1, 4096, list_types,
+					ARRAY_SIZE(list_types));
+		CHECK(! (batched ? insert_batch(vbd->labels, batch, n) :
+					insert(vbd->labels, batch)), "out of memory");
+		if (step < 256 || ! (step % 64)) {
+			compare_model(vbd->labels);
+			check_lookups(vbd, 4);
+		}
+	}
+	compare_model(vbd->labels);
+	vbd_free(vbd);
+}
+
+/*
+ * Block aligned labels inside a filesystem, which move to a map once there
+ * are enough of them, and some outside it that stay on the list.
+ */
+static void fuzz_map(unsigned long steps) {
+	struct label batch[8];
+	struct xen_vbd *vbd;
+	unsigned int n, i;
+
+	phase = "inserts into a map";
+	nr_sectors = MAX_SECTORS;
+	memset(model, 0, nr_sectors);
+	vbd = vbd_alloc(nr_sectors);
+	CHECK(! ljx_labels_add_fs(vbd->labels, MAP_START,
+				(nr_sectors - MAP_START) / MAP_SPB, MAP_SPB),
+			"can't add the filesystem");
+	for (step = 0; step < steps; step++) {
+		n = below(4) ? 1 : 1 + below(ARRAY_SIZE(batch));
+		for (i = 0; i < n; i++)
+			if (below(10))
+				random_label(&batch[i], MAP_START, nr_sectors, MAP_SPB, 64,
+						map_types, ARRAY_SIZE(map_types));
+			else
+				/* never touching the filesystem */
+				random_label(&batch[i], 0, MAP_START - 64, 1, 64,
+						list_types, ARRAY_SIZE(list_types));
+		CHECK(! (n > 1 ? insert_batch(vbd->labels, batch, n) :
+					insert(vbd->labels, batch)), "out of memory");
+		if (! (step % 256))
+			flush_scheduled_work();
+		if (! (step % 32)) {
+			compare_model(vbd->labels);
+			check_lookups(vbd, 4);
+		}
+	}
+	flush_scheduled_work();
+	compare_model(vbd->labels);
+	CHECK(steps < 2000 || vbd->labels->maps[0].leaves,
+			"the labels never moved to a map");
+	vbd_free(vbd);
+}
+
+/*
+ * With room for only a few chunks of labels, neighbours are merged across
+ * gaps: every sector we labelled has to keep its type, but gaps may fill.
+ * When a label had to be dropped we carry on from what is left.
+ */
+static void fuzz_limit(unsigned long steps) {
+	struct xen_vbd *vbd;
+	struct label label;
+	unsigned long dropped;
+	sector_t s;
+	int ret;
+
+	phase = "inserts over the memory limit";
+	nr_sectors = LIST_SECTORS;
+	memset(model, 0, nr_sectors);
+	CHECK(! shim_param_set("label_mem", "16"), "no label_mem parameter");
+	vbd = vbd_alloc(nr_sectors);
+	shim_param_set("label_mem", "0");
+	for (step = 0; step < steps; step++) {
+		random_label(&label, 0, nr_sectors, 1, 64, list_types,
+				ARRAY_SIZE(list_types));
+		dropped = vbd->labels->dropped;
+		ret = ljx_insert_label(vbd->labels, label.sector, label.nr_sec,
+				label.label, label.processor);
+		if (! ret)
+			memset(model + label.sector, label.label + 1, label.nr_sec);
+		if (ret || vbd->labels->dropped != dropped) {
+			check_list(vbd->labels, false);
+			read_labels(vbd->labels, model, true);
+			continue;
+		}
+		if (step % 16)
+			continue;
+		check_list(vbd->labels, false);
+		read_labels(vbd->labels, actual, true);
+		for (s = 0; s < nr_sectors; s++)
+			CHECK(! model[s] || actual[s] == model[s],
+					"sector %llu holds %s, should hold %s",
+					(unsigned long long) s, type_name(actual[s]),
+					type_name(model[s]));
+	}
+	CHECK(vbd->labels->nr_chunks <= 4, "%u chunks, over the limit",
+			vbd->labels->nr_chunks);
+	CHECK(steps < 2000 || vbd->labels->coarsened,
+			"nothing was merged to stay in the limit");
+	vbd_free(vbd);
+}
+
+/* a random ext3 image, and what the module should learn from it */
+struct image {
+	char			*disk;
+	sector_t		start;		/* of the filesystem */
+	unsigned int		log, block_size, spb, first_data_block;
+	unsigned int		blocks_per_group, inodes_per_group, inode_size;
+	unsigned int		inodes_per_block, itable_blocks, groups;
+	unsigned long		blocks;
+	unsigned long		inode_table[4];
+	unsigned long		block_bitmap[4];
+	bool			uninit[4];
+	unsigned long		*used;		/* blocks taken */
+	unsigned long		cursor;
+	unsigned int		*owner;		/* inode of each block, or 0 */
+	u8			*depth;
+	u32			*lblock;	/* file block it holds or maps */
+	unsigned long		meta[4096];	/* blocks worth mutating */
+	unsigned int		nr_meta;
+};
+
+static struct image img;
+
+static char *block_data(unsigned long block) {
+	return img.disk + (img.start + block * img.spb) * 512;
+}
+
+static void expect(unsigned long block, unsigned int n, label_t type) {
+	memset(model + img.start + block * img.spb, type + 1, n * img.spb);
+}
+
+static void own(unsigned long block, unsigned int n, unsigned int ino,
+		unsigned int depth, u32 lblock) {
+	for (; n--; block++, lblock++) {
+		img.owner[block] = ino;
+		img.depth[block] = depth;
+		img.lblock[block] = lblock;
+	}
+}
+
+static void add_meta(unsigned long block) {
+	if (img.nr_meta < ARRAY_SIZE(img.meta))
+		img.meta[img.nr_meta++] = block;
+}
+
+static void take(unsigned long block, unsigned int n) {
+	for (; n--; block++)
+		__set_bit(block, img.used);
+}
+
+/* finds n free blocks in a row, mostly just after the last ones */
+static unsigned long alloc_run(unsigned int n) {
+	unsigned long block, i;
+
+	block = below(4) ? img.cursor + below(4) :
+		img.first_data_block + 1 + below(img.blocks - img.first_data_block - 1);
+	for (; block + n <= img.blocks; block += i + 1) {
+		for (i = 0; i < n && ! test_bit(block + i, img.used); i++)
+			;
+		if (i == n) {
+			take(block, n);
+			img.cursor = block + n;
+			return block;
+		}
+	}
+	return 0;
+}
+
+static void add_data(unsigned long block, unsigned int n, unsigned int ino,
+		u32 lblock, bool journal) {
+	own(block, n, ino, 0, lblock);
+	if (journal) {
+		expect(block, n, JOURNAL);
+		add_meta(block);
+	} else
+		/* nothing should ever look in here */
+		memset(block_data(block), 0xff & next_rand(), n * img.block_size);
+}
+
+/*
+ * An indirect block depth levels above the data, and what it maps from file
+ * block lblock on.
+ */
+static unsigned long add_indirect(unsigned int ino, unsigned int depth,
+		u32 lblock, unsigned int max, bool journal) {
+	unsigned long block = alloc_run(1), child;
+	__le32 *ptrs;
+	unsigned int n, i, d;
+	u32 span = 1;
+
+	if (! block)
+		return 0;
+	for (d = 1; d < depth; d++)
+		span *= img.block_size / 4;
+	own(block, 1, ino, depth, lblock);
+	expect(block, 1, INDIRECT_BLOCK);
+	add_meta(block);
+	ptrs = (__le32 *) block_data(block);
+	n = 1 + below(max);
+	/* mostly in a row, now and then after holes */
+	for (i = below(2) ? 0 : below(img.block_size / 4); n-- &&
+	     i < img.block_size / 4; i += below(4) ? 1 : 1 + below(64)) {
+		child = depth > 1 ?
+			add_indirect(ino, depth - 1, lblock + i * span, 4, journal) :
+			alloc_run(1);
+		if (! child)
+			break;
+		if (depth == 1)
+			add_data(child, 1, ino, lblock + i, journal);
+		ptrs[i] = cpu_to_le32(child);
+	}
+	return block;
+}
+
+/*
+ * An extent tree node of size bytes at node, depth levels above the data,
+ * mapping the file from *lblock on, which it moves past what it mapped.
+ */
+static void add_extents(void *node, size_t size, unsigned int ino,
+		unsigned int depth, u32 *lblock, bool journal) {
+	struct ljx_ext4_extent_header *eh = node;
+	struct ljx_ext4_extent *ex = (struct ljx_ext4_extent *) (eh + 1);
+	struct ljx_ext4_extent_idx *ix = (struct ljx_ext4_extent_idx *) (eh + 1);
+	unsigned int max = (size - sizeof(*eh)) / sizeof(*ex), n, i, len;
+	unsigned long block;
+
+	n = 1 + below(min(max, 6U));
+	eh->eh_magic = cpu_to_le16(LJX_EXT4_EXT_MAGIC);
+	eh->eh_max = cpu_to_le16(max);
+	eh->eh_depth = cpu_to_le16(depth);
+	for (i = 0; i < n; i++) {
+		len = depth ? 1 : 1 + below(16);
+		block = alloc_run(len);
+		if (! block)
+			break;
+		if (depth) {
+			own(block, 1, ino, depth, *lblock);
+			expect(block, 1, EXTENT_BLOCK);
+			add_meta(block);
+			ix[i].ei_block = cpu_to_le32(*lblock);
+			ix[i].ei_leaf_lo = cpu_to_le32(block);
+			add_extents(block_data(block), img.block_size, ino, depth - 1,
+					lblock, journal);
+		} else {
+			ex[i].ee_block = cpu_to_le32(*lblock);
+			ex[i].ee_start_lo = cpu_to_le32(block);
+			/* some of them uninitialized */
+			ex[i].ee_len = cpu_to_le16(below(4) ? len :
+					len + LJX_EXT4_EXT_INIT_MAX_LEN);
+			add_data(block, len, ino, *lblock, journal);
+			/* now and then with a hole after */
+			*lblock += len + (below(4) ? 0 : below(64));
+		}
+		eh->eh_entries = cpu_to_le16(i + 1);
+	}
+}
+
+static struct ext3_inode *inode_data(unsigned int ino) {
+	unsigned int group = (ino - 1) / img.inodes_per_group;
+	unsigned int i = (ino - 1) % img.inodes_per_group;
+
+	return (struct ext3_inode *) (block_data(img.inode_table[group] +
+				i / img.inodes_per_block) +
+			i % img.inodes_per_block * img.inode_size);
+}
+
+static void add_file(unsigned int ino, bool journal) {
+	u32 apb = img.block_size / 4, lblock = 0;
+	struct ext3_inode raw;
+	unsigned long block;
+	unsigned int i, n;
+
+	memset(&raw, 0, sizeof(raw));
+	raw.i_mode = cpu_to_le16((below(4) ? S_IFREG : S_IFDIR) | 0644);
+	raw.i_links_count = cpu_to_le16(1);
+	switch (below(5)) {
+	case 0:
+		raw.i_flags = cpu_to_le32(LJX_EXT4_EXTENTS_FL);
+		add_extents(raw.i_block, sizeof(raw.i_block), ino, 0, &lblock,
+				journal);
+		break;
+	case 1:
+		raw.i_flags = cpu_to_le32(LJX_EXT4_EXTENTS_FL);
+		add_extents(raw.i_block, sizeof(raw.i_block), ino, 1 + below(2),
+				&lblock, journal);
+		break;
+	default:
+		n = 1 + below(EXT3_NDIR_BLOCKS);
+		for (i = 0; i < n; i++) {
+			block = alloc_run(1);
+			if (! block)
+				break;
+			add_data(block, 1, ino, i, journal);
+			raw.i_block[i] = cpu_to_le32(block);
+		}
+		lblock = EXT3_NDIR_BLOCKS;
+		for (i = EXT3_IND_BLOCK; i < EXT3_N_BLOCKS; i++) {
+			if (! below(3))
+				raw.i_block[i] = cpu_to_le32(add_indirect(ino,
+							i - EXT3_IND_BLOCK + 1, lblock,
+							16, journal));
+			lblock += i == EXT3_IND_BLOCK ? apb : apb * apb;
+		}
+	}
+	memcpy(inode_data(ino), &raw, EXT3_GOOD_OLD_INODE_SIZE);
+}
+
+/* an inode whose block pointers must not be followed */
+static void add_decoy(unsigned int ino) {
+	struct ext3_inode raw;
+	unsigned int i;
+
+	memset(&raw, 0, sizeof(raw));
+	raw.i_mode = cpu_to_le16(S_IFREG | 0644);
+	raw.i_links_count = cpu_to_le16(1);
+	switch (below(3)) {
+	case 0:
+		/* deleted */
+		raw.i_links_count = 0;
+		break;
+	case 1:
+		/* a fast symlink, its target where the pointers would be */
+		raw.i_mode = cpu_to_le16(0120777);
+		break;
+	default:
+		raw.i_flags = cpu_to_le32(LJX_EXT4_INLINE_DATA_FL);
+	}
+	for (i = 0; i < EXT3_N_BLOCKS; i++)
+		raw.i_block[i] = cpu_to_le32(img.first_data_block + 1 +
+				below(img.blocks - img.first_data_block - 1));
+	memcpy(inode_data(ino), &raw, EXT3_GOOD_OLD_INODE_SIZE);
+}
+
+static void write_mbr(void) {
+	struct bootblock *mbr = (struct bootblock *) img.disk;
+
+	mbr->partition[0].status = 0x80;
+	mbr->partition[0].partition_type = 0x83;
+	mbr->partition[0].lba_start = cpu_to_le32(img.start);
+	mbr->partition[0].sectors = cpu_to_le32(img.blocks * img.spb);
+	mbr->signature = cpu_to_le16(0xaa55);
+}
+
+static void write_super(bool journal) {
+	struct ext3_super_block *sb = (struct ext3_super_block *)
+		(img.disk + img.start * 512 + 1024);
+
+	sb->s_inodes_count = cpu_to_le32(img.inodes_per_group * img.groups);
+	sb->s_blocks_count = cpu_to_le32(img.blocks);
+	sb->s_first_data_block = cpu_to_le32(img.first_data_block);
+	sb->s_log_block_size = cpu_to_le32(img.log);
+	sb->s_log_frag_size = cpu_to_le32(img.log);
+	sb->s_blocks_per_group = cpu_to_le32(img.blocks_per_group);
+	sb->s_frags_per_group = cpu_to_le32(img.blocks_per_group);
+	sb->s_inodes_per_group = cpu_to_le32(img.inodes_per_group);
+	sb->s_wtime = cpu_to_le32(next_rand());
+	sb->s_mnt_count = cpu_to_le16(below(100));
+	sb->s_magic = cpu_to_le16(EXT3_SUPER_MAGIC);
+	sb->s_rev_level = cpu_to_le32(1);
+	sb->s_first_ino = cpu_to_le32(11);
+	sb->s_inode_size = cpu_to_le16(img.inode_size);
+	sb->s_feature_incompat = cpu_to_le32(LJX_EXT4_FEATURE_INCOMPAT_EXTENTS);
+	sb->s_journal_inum = cpu_to_le32(journal ? 8 : 0);
+	*(u64 *) sb->s_uuid = next_rand();
+}
+
+/* writes each group's block bitmap, with the blocks set in used taken */
+static void write_bitmaps(const unsigned long *used) {
+	unsigned long block, first, end;
+	unsigned int g;
+	char *bits;
+
+	for (g = 0; g < img.groups; g++) {
+		first = img.first_data_block + g * img.blocks_per_group;
+		end = min(first + img.blocks_per_group, img.blocks);
+		bits = block_data(img.block_bitmap[g]);
+		memset(bits, 0, img.block_size);
+		/* little endian, as ours are */
+		for (block = first; block < end; block++)
+			if (test_bit(block, used))
+				__set_bit(block - first, (unsigned long *) bits);
+	}
+}
+
+static void build_image(void) {
+	struct ljx_ext4_group_desc *desc;
+	unsigned long first, gdt = 0;
+	unsigned int g, ino, nr_files;
+	bool journal = below(3);
+
+	free(img.disk);
+	free(img.used);
+	free(img.owner);
+	free(img.depth);
+	free(img.lblock);
+	memset(&img, 0, sizeof(img));
+	img.log = below(3);
+	img.block_size = EXT3_MIN_BLOCK_SIZE << img.log;
+	img.spb = img.block_size / 512;
+	img.first_data_block = ! img.log;
+	img.blocks_per_group = 1024 << below(3);
+	img.groups = 1 + below(4);
+	img.blocks = img.first_data_block + img.groups * img.blocks_per_group -
+		below(img.blocks_per_group / 2);
+	img.inode_size = 128 << below(2);
+	img.inodes_per_group = 16 << below(4);
+	img.inodes_per_block = img.block_size / img.inode_size;
+	img.itable_blocks = DIV_ROUND_UP(img.inodes_per_group, img.inodes_per_block);
+	img.start = below(2) ? 2048 : 0;
+
+	nr_sectors = img.start + img.blocks * img.spb;
+	CHECK(nr_sectors <= MAX_SECTORS, "image of %llu sectors",
+			(unsigned long long) nr_sectors);
+	img.disk = calloc(nr_sectors, 512);
+	img.used = calloc(BITS_TO_LONGS(img.blocks), sizeof(long));
+	img.owner = calloc(img.blocks, sizeof(*img.owner));
+	img.depth = calloc(img.blocks, 1);
+	img.lblock = calloc(img.blocks, sizeof(*img.lblock));
+	CHECK(img.disk && img.used && img.owner && img.depth && img.lblock,
+			"out of memory");
+
+	/* where the module looks before it knows anything */
+	memset(model, 0, nr_sectors);
+	model[0] = BOOTBLOCK + 1;
+	memset(model + 2, SUPERBLOCK + 1, 2);
+	if (img.start) {
+		write_mbr();
+		memset(model + img.start + 2, SUPERBLOCK + 1, 2);
+	}
+
+	/* superblock and descriptors, then each group's bitmaps and inodes */
+	take(0, img.first_data_block + 1);
+	for (g = 0; g < img.groups; g++) {
+		first = img.first_data_block + g * img.blocks_per_group;
+		if (! g) {
+			gdt = first + 1;
+			take(gdt, 1);
+			expect(gdt, 1, GROUP_DESC);
+			add_meta(gdt);
+			first += 2;
+		}
+		desc = (struct ljx_ext4_group_desc *) (block_data(gdt) +
+				g * LJX_EXT4_MIN_DESC_SIZE);
+		desc->bg_block_bitmap_lo = cpu_to_le32(first);
+		desc->bg_inode_bitmap_lo = cpu_to_le32(first + 1);
+		desc->bg_inode_table_lo = cpu_to_le32(first + 2);
+		img.inode_table[g] = first + 2;
+		img.block_bitmap[g] = first;
+		take(first, 2 + img.itable_blocks);
+		img.uninit[g] = g && ! below(3);
+		if (img.uninit[g])
+			desc->bg_flags = cpu_to_le16(LJX_EXT4_BG_INODE_UNINIT);
+		else
+			expect(first + 2, img.itable_blocks, INODE_BLOCK);
+		add_meta(first + 2 + below(img.itable_blocks));
+	}
+	write_super(journal);
+	img.cursor = img.inode_table[0] + img.itable_blocks;
+
+	if (journal)
+		add_file(8, true);
+	nr_files = 4 + below(60);
+	for (ino = 11; nr_files && ino <= img.groups * img.inodes_per_group;
+	     ino += 1 + below(3)) {
+		g = (ino - 1) / img.inodes_per_group;
+		if (img.uninit[g]) {
+			/* whatever is there is never read */
+			if (! below(4))
+				add_file(ino, false);
+			continue;
+		}
+		if (below(6))
+			add_file(ino, false);
+		else
+			add_decoy(ino);
+		nr_files--;
+	}
+	/* files in uninitialized groups count for nothing */
+	for (first = 0; first < img.blocks; first++)
+		if (img.owner[first] && img.uninit[(img.owner[first] - 1) /
+						   img.inodes_per_group]) {
+			memset(model + img.start + first * img.spb, 0, img.spb);
+			img.owner[first] = 0;
+			img.depth[first] = 0;
+		}
+	write_bitmaps(img.used);
+}
+
+static struct page *pages[BIO_PAGES];
+
+/*
+ * A bio of the guest reading nr_sec sectors at sector, just completed, or
+ * writing what the image now holds there.
+ */
+static void guest_bio(struct xen_vbd *vbd, sector_t sector, unsigned int nr_sec,
+		unsigned long rw) {
+	struct bio *bio = bio_alloc(GFP_KERNEL, DIV_ROUND_UP(nr_sec, 8));
+	unsigned int i, len;
+
+	CHECK(bio, "out of memory");
+	bio->bi_sector = sector;
+	bio->bi_rw = rw;
+	for (i = 0; nr_sec; i++, nr_sec -= len) {
+		len = min(nr_sec, 8U);
+		memcpy(page_address(pages[i]), img.disk + (sector + i * 8) * 512,
+				len * 512);
+		CHECK(bio_add_page(bio, pages[i], len * 512, 0), "bio too big");
+	}
+	ljx_process_labels(bio, vbd, NULL);
+	bio_put(bio);
+}
+
+struct piece {
+	sector_t		sector;
+	unsigned int		nr_sec;
+};
+
+/* reads the whole disk, in order or not, in pieces of 4 to 64 KiB */
+static void read_disk(struct xen_vbd *vbd) {
+	static struct piece pieces[MAX_SECTORS / 8];
+	unsigned int n = 0, i, j, how = below(3);
+	struct piece tmp;
+	sector_t s;
+
+	for (s = 0; s < nr_sectors; s += pieces[n++].nr_sec) {
+		pieces[n].sector = s;
+		pieces[n].nr_sec = min_t(sector_t, 8 * (1 + below(BIO_PAGES)),
+				nr_sectors - s);
+	}
+	for (i = 0; how && i < n; i++) {
+		/* shuffled, or backwards so that nothing is known before it is read */
+		j = how == 1 ? i + below(n - i) : n - 1 - i;
+		if (j <= i)
+			break;
+		tmp = pieces[i];
+		pieces[i] = pieces[j];
+		pieces[j] = tmp;
+	}
+	for (i = 0; i < n; i++)
+		guest_bio(vbd, pieces[i].sector, pieces[i].nr_sec, READ);
+}
+
+static u64 fold(u64 hash, u64 v) {
+	return (hash ^ v) * 0x100000001b3ULL;
+}
+
+static void hash_extent(void *priv, struct ljx_extent *ext) {
+	u64 *hash = priv;
+
+	*hash = fold(*hash, ext->start);
+	*hash = fold(*hash, ext->len);
+	*hash = fold(*hash, ext->ino << 8 | ext->depth);
+	*hash = fold(*hash, ext->lblock);
+}
+
+/* what the module knows about the vbd, to tell when a pass taught it nothing */
+static u64 known(struct xen_vbd *vbd) {
+	struct ljx_ext3_superblock *lsb;
+	u64 hash = 0xcbf29ce484222325ULL;
+	unsigned int i;
+	sector_t s;
+
+	read_labels(vbd->labels, actual, false);
+	for (s = 0; s < nr_sectors; s++)
+		hash = fold(hash, actual[s]);
+	for_each_ljx_fs(vbd->bootblock, i, lsb)
+		ljx_inode_map_walk(lsb->inode_map, hash_extent, &hash, ULONG_MAX);
+	return hash;
+}
+
+/* reads the disk over until nothing new is learned; returns the passes */
+static unsigned int read_all(struct xen_vbd *vbd) {
+	unsigned int passes = 0;
+	u64 before, after = known(vbd);
+
+	do {
+		before = after;
+		read_disk(vbd);
+		flush_scheduled_work();
+		after = known(vbd);
+	} while (after != before && ++passes < MAX_PASSES);
+	return passes;
+}
+
+static struct ljx_ext3_superblock *image_fs(struct xen_vbd *vbd) {
+	struct ljx_ext3_superblock *lsb;
+	unsigned int i;
+
+	for_each_ljx_fs(vbd->bootblock, i, lsb)
+		return lsb;
+	return NULL;
+}
+
+/*
+ * Reads the image a block at a time, and then all at once, charging the
+ * reads to a report of the hottest files. Each must be found to hold as
+ * much file data as the image has there, and a file read far more than the
+ * rest must be in the report with at least what it was charged.
+ */
+static void check_hot_files(struct ljx_ext3_superblock *lsb) {
+	struct ljx_hot_files *hot = vzalloc(sizeof(*hot));
+	unsigned long block, first = below(img.blocks), nr_blocks = 0, total = 0;
+	unsigned int ino = 0, weight, data, i;
+
+	CHECK(hot, "out of memory");
+	spin_lock_init(&hot->lock);
+	for (block = first; block < first + img.blocks; block++)
+		if (img.owner[block % img.blocks] && ! img.depth[block % img.blocks]) {
+			ino = img.owner[block % img.blocks];
+			break;
+		}
+
+	for (block = 0; block < img.blocks; block++) {
+		weight = ino && img.owner[block] == ino ? 1000 : 1;
+		data = ljx_hot_files_account(hot, lsb, img.start + block * img.spb,
+				img.spb, weight, false);
+		CHECK(data == (img.owner[block] && ! img.depth[block] ? img.spb : 0),
+				"block %lu of inode %u at depth %u taken for %u sectors of data",
+				block, img.owner[block], img.depth[block], data);
+		total += data;
+		if (ino && img.owner[block] == ino && ! img.depth[block])
+			nr_blocks++;
+	}
+	data = ljx_hot_files_account(hot, lsb, img.start, img.blocks * img.spb, 1, true);
+	CHECK(data == total, "the whole image taken for %u sectors of data, not %lu",
+			data, total);
+
+	for (i = 0; ino && i < hot->nr; i++)
+		if (hot->heap[i].ino == ino && hot->heap[i].fs == lsb->start)
+			break;
+	CHECK(! ino || i < hot->nr, "inode %u, read %lu blocks at a weight of 1000, "
+			"is not among the %u hot files", ino, nr_blocks, hot->nr);
+	CHECK(! ino || hot->heap[i].bytes >= nr_blocks * img.block_size * 1000ULL,
+			"inode %u counted for %llu bytes, less than the %llu read",
+			ino, (unsigned long long) hot->heap[i].bytes,
+			nr_blocks * img.block_size * 1000ULL);
+	vfree(hot);
+}
+
+/*
+ * Follows a file through ljx_inode_map_file_runs() from its start: every
+ * data block of it must come out once, in file order, wherever it is on
+ * the disk.
+ */
+static void check_file_order(struct ljx_ext3_superblock *lsb, unsigned int ino) {
+	ext3_fsblk_t starts[4];
+	unsigned long block, nr_blocks = 0, found = 0;
+	unsigned int lens[4], max = 1 + below(64), i, j;
+	u32 lblock = 0, next = 0;
+	bool first = true;
+	int nr;
+
+	for (block = 0; block < img.blocks; block++)
+		if (img.owner[block] == ino && ! img.depth[block])
+			nr_blocks++;
+	while ((nr = ljx_inode_map_file_runs(lsb->inode_map, ino, &lblock, max,
+					starts, lens, ARRAY_SIZE(starts)))) {
+		for (i = 0; i < nr; i++)
+			for (j = 0; j < lens[i]; j++) {
+				block = starts[i] + j;
+				CHECK(block < img.blocks && img.owner[block] == ino &&
+						! img.depth[block] &&
+						(first || img.lblock[block] >= next),
+						"inode %u: block %lu (inode %u, depth %u, "
+						"file block %u) came after file block %u",
+						ino, block, block < img.blocks ? img.owner[block] : 0,
+						block < img.blocks ? img.depth[block] : 0,
+						block < img.blocks ? img.lblock[block] : 0, next);
+				next = img.lblock[block] + 1;
+				first = false;
+				found++;
+			}
+		CHECK(lblock == next, "inode %u: runs end at file block %u, "
+				"not where the last one did, %u", ino, lblock, next);
+	}
+	CHECK(found == nr_blocks, "inode %u: %lu data blocks in file order, not %lu",
+			ino, found, nr_blocks);
+}
+
+static void fuzz_image(void) {
+	struct ljx_ext3_superblock *lsb;
+	struct xen_vbd *vbd;
+	unsigned int passes, ino;
+	unsigned long block;
+	unsigned char depth;
+	u32 lblock;
+	sector_t s;
+
+	phase = "reading an ext3 image";
+	build_image();
+	vbd = vbd_alloc(nr_sectors);
+	CHECK(! ljx_boot_label(vbd), "can't label the boot block");
+	passes = read_all(vbd);
+	CHECK(passes < MAX_PASSES, "still learning after %u passes", passes);
+
+	lsb = image_fs(vbd);
+	CHECK(lsb, "no filesystem found on a %u byte block image at %llu",
+			img.block_size, (unsigned long long) img.start);
+	CHECK(lsb->start == img.start && lsb->blocks_count == img.blocks &&
+			lsb->block_size == img.block_size,
+			"found %llu blocks of %u at %llu, not %lu of %u at %llu",
+			(unsigned long long) lsb->blocks_count, lsb->block_size,
+			(unsigned long long) lsb->start, img.blocks, img.block_size,
+			(unsigned long long) img.start);
+	check_list(vbd->labels, true);
+	read_labels(vbd->labels, actual, true);
+	for (s = 0; s < nr_sectors; s++)
+		CHECK(actual[s] == model[s],
+				"sector %llu (block %llu) holds %s, should hold %s",
+				(unsigned long long) s,
+				(unsigned long long) (s - min(s, img.start)) / img.spb,
+				type_name(actual[s]), type_name(model[s]));
+	for (block = 0; block < img.blocks; block++) {
+		if (ljx_inode_map_lookup(lsb->inode_map, block, &ino, &depth,
+					&lblock)) {
+			CHECK(! img.owner[block], "block %lu of inode %u was not found",
+					block, img.owner[block]);
+			continue;
+		}
+		CHECK(ino == img.owner[block] && depth == img.depth[block] &&
+				lblock == img.lblock[block],
+				"block %lu mapped to inode %u at depth %u, file block %u, "
+				"not %u at %u, %u", block, ino, depth, lblock,
+				img.owner[block], img.depth[block], img.lblock[block]);
+	}
+	for (block = 0; block < img.blocks; block++)
+		if (img.owner[block] && ! img.depth[block] && ! below(4))
+			check_file_order(lsb, img.owner[block]);
+	check_hot_files(lsb);
+	vbd_free(vbd);
+}
+
+static void check_extent(void *priv, struct ljx_extent *ext) {
+	struct ljx_ext3_superblock *lsb = priv;
+
+	CHECK(ext->len && ext->start < lsb->blocks_count &&
+			ext->len <= lsb->blocks_count - ext->start,
+			"inode %u mapped to blocks %llu+%u of %llu",
+			ext->ino, (unsigned long long) ext->start, ext->len,
+			(unsigned long long) lsb->blocks_count);
+}
+
+/* writes random bytes over the metadata, often whole words of block numbers */
+static void mutate(void) {
+	unsigned int n = 1 + below(32), offset;
+	char *data;
+	u32 v;
+
+	while (n--) {
+		if (! below(8)) {
+			data = img.disk + img.start * 512 + 1024;
+			offset = below(1024);
+		} else {
+			data = block_data(img.meta[below(img.nr_meta)]);
+			offset = below(img.block_size);
+		}
+		switch (below(5)) {
+		case 0:
+			data[offset] = next_rand();
+			continue;
+		case 1:
+			/* sizes and counts */
+			v = 1 << below(16);
+			memcpy(data + (offset & ~1), &v, 2);
+			continue;
+		case 2:
+			v = img.blocks - below(4);
+			break;
+		case 3:
+			v = ~0U >> below(32);
+			break;
+		default:
+			v = below(img.blocks + 1);
+		}
+		offset &= ~3;
+		memcpy(data + offset, &v, min(4U, (img.block_size - offset)));
+	}
+}
+
+static void fuzz_mutated(void) {
+	struct ljx_ext3_superblock *lsb;
+	struct xen_vbd *vbd;
+	unsigned int i;
+
+	phase = "reading a mutated ext3 image";
+	build_image();
+	mutate();
+	vbd = vbd_alloc(nr_sectors);
+	CHECK(! ljx_boot_label(vbd), "can't label the boot block");
+	read_all(vbd);
+	check_list(vbd->labels, false);
+	read_labels(vbd->labels, actual, false);
+	for_each_ljx_fs(vbd->bootblock, i, lsb) {
+		CHECK(ljx_block_to_sector(lsb, lsb->blocks_count) <= nr_sectors,
+				"filesystem of %llu blocks runs off the disk",
+				(unsigned long long) lsb->blocks_count);
+		ljx_inode_map_walk(lsb->inode_map, check_extent, lsb, ULONG_MAX);
+	}
+	vbd_free(vbd);
+}
+
+/*
+ * Free blocks must only be served as zeroes once we know their group's
+ * bitmap is current: read from a clean filesystem, or written back by the
+ * guest since we attached to one that needs its journal recovered.
+ */
+static void check_zero_reads(struct ljx_ext3_superblock *lsb,
+		const unsigned long *synced, bool clean) {
+	struct bio_vec vec = { pages[0], img.block_size, 0 };
+	unsigned long block;
+	unsigned int g;
+	bool served;
+
+	for (block = img.first_data_block; block < img.blocks; block++) {
+		g = (block - img.first_data_block) / img.blocks_per_group;
+		served = ! ljx_bitmap_zero_read(lsb->block_bitmap, block, 1, &vec, 1);
+		CHECK(served == ((clean || test_bit(g, synced)) &&
+					! test_bit(block, img.used)),
+				"block %lu (%s, group %u %s) %s as zeroes", block,
+				test_bit(block, img.used) ? "taken" : "free", g,
+				test_bit(g, synced) ? "written back" :
+				clean ? "clean" : "not written back",
+				served ? "served" : "not served");
+	}
+}
+
+static void fuzz_bitmaps(void) {
+	struct ext3_super_block *sb;
+	struct ljx_ext3_superblock *lsb;
+	struct xen_vbd *vbd;
+	unsigned long synced = 0, block;
+	bool clean = below(2);
+	unsigned int g;
+
+	phase = clean ? "serving free blocks of a clean image" :
+		"serving free blocks after a reconnect";
+	build_image();
+	if (! clean) {
+		/* a running guest whose latest allocations are only in its journal */
+		sb = (struct ext3_super_block *) (img.disk + img.start * 512 + 1024);
+		sb->s_feature_incompat |= cpu_to_le32(EXT3_FEATURE_INCOMPAT_RECOVER);
+		for (block = 0; block < img.blocks; block++)
+			if (img.owner[block] && below(2))
+				__clear_bit(block, img.used);
+		write_bitmaps(img.used);
+		for (block = 0; block < img.blocks; block++)
+			if (img.owner[block])
+				__set_bit(block, img.used);
+	}
+
+	CHECK(! shim_param_set("skip_free_reads", "1"), "no skip_free_reads parameter");
+	vbd = vbd_alloc(nr_sectors);
+	CHECK(! ljx_boot_label(vbd), "can't label the boot block");
+	read_all(vbd);
+	lsb = image_fs(vbd);
+	CHECK(lsb && lsb->block_bitmap, "no bitmaps kept for the image");
+	check_zero_reads(lsb, &synced, clean);
+
+	/* the guest writes some of the bitmaps back, as they really are */
+	write_bitmaps(img.used);
+	for (g = 0; g < img.groups; g++) {
+		if (below(3)) {
+			guest_bio(vbd, img.start + img.block_bitmap[g] * img.spb,
+					img.spb, WRITE);
+			__set_bit(g, &synced);
+		}
+	}
+	check_zero_reads(lsb, &synced, clean);
+	vbd_free(vbd);
+	shim_param_set("skip_free_reads", "0");
+}
+
+static void usage(void) {
+	fprintf(stderr,
+"usage: labelfuzz [options]\n"
+"  -n ROUNDS    how many rounds to run (default 4)\n"
+"  -s STEPS     inserts per phase of a round (default 20000)\n"
+"  -i IMAGES    ext3 images per round, a quarter of them intact (default 40)\n"
+"  -S SEED      (default 1)\n"
+"  -v           show what the module logs\n");
+	exit(2);
+}
+
+int main(int argc, char **argv) {
+	unsigned long steps = 20000;
+	unsigned int images = 40, round, i;
+	int c;
+
+	shim_quiet = true;
+	while ((c = getopt(argc, argv, "n:s:i:S:vh")) != -1) {
+		switch (c) {
+		case 'n':
+			rounds = atoi(optarg);
+			break;
+		case 's':
+			steps = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			images = atoi(optarg);
+			break;
+		case 'S':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'v':
+			shim_quiet = false;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc)
+		usage();
+	rand_state = (seed + 1) * 0x9e3779b97f4a7c15ULL;
+
+	model = malloc(MAX_SECTORS);
+	actual = malloc(MAX_SECTORS);
+	copied = calloc(MAX_SECTORS, sizeof(*copied));
+	for (i = 0; i < BIO_PAGES; i++)
+		pages[i] = alloc_page(GFP_KERNEL);
+	if (! model || ! actual || ! copied || ! pages[BIO_PAGES - 1]) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	for (round = 0; round < rounds; round++) {
+		fuzz_list(steps, false);
+		fuzz_list(steps, true);
+		fuzz_map(steps);
+		fuzz_limit(steps);
+		for (step = 0; step < images; step++) {
+			if (step % 4)
+				fuzz_mutated();
+			else {
+				fuzz_image();
+				fuzz_bitmaps();
+			}
+		}
+		printf("round %u ok\n", round);
+	}
+
+	for (i = 0; i < BIO_PAGES; i++)
+		__free_page(pages[i]);
+	free(model);
+	free(actual);
+	free(copied);
+	free(img.disk);
+	free(img.used);
+	free(img.owner);
+	free(img.depth);
+	free(img.lblock);
+	return 0;
+}
@@ -0,0 +1,267 @@
+/*
+ * rbtree.c -- red-black trees, as lib/rbtree.c of 3.3 has them
+ */
+
+#include "shim.h"
+
+#define RB_RED		0
+#define RB_BLACK	1
+
+#define rb_color(r)	((r)->__rb_parent_color & 1)
+#define rb_is_red(r)	(! rb_color(r))
+#define rb_is_black(r)	rb_color(r)
+#define rb_set_red(r)	do { (r)->__rb_parent_color &= ~1; } while (0)
+#define rb_set_black(r)	do { (r)->__rb_parent_color |= 1; } while (0)
+
+static inline void rb_set_parent(struct rb_node *rb, struct rb_node *p) {
+	rb->__rb_parent_color = (rb->__rb_parent_color & 3) | (unsigned long) p;
+}
+
+static inline void rb_set_color(struct rb_node *rb, int color) {
+	rb->__rb_parent_color = (rb->__rb_parent_color & ~1) | color;
+}
+
+static void rotate_left(struct rb_node *node, struct rb_root *root) {
+	struct rb_node *right = node->rb_right;
+	struct rb_node *parent = rb_parent(node);
+
+	if ((node->rb_right = right->rb_left))
+		rb_set_parent(right->rb_left, node);
+	right->rb_left = node;
+	rb_set_parent(right, parent);
+	if (! parent)
+		root->rb_node = right;
+	else if (node == parent->rb_left)
+		parent->rb_left = right;
+	else
+		parent->rb_right = right;
+	rb_set_parent(node, right);
+}
+
+static void rotate_right(struct rb_node *node, struct rb_root *root) {
+	struct rb_node *left = node->rb_left;
+	struct rb_node *parent = rb_parent(node);
+
+	if ((node->rb_left = left->rb_right))
+		rb_set_parent(left->rb_right, node);
+	left->rb_right = node;
+	rb_set_parent(left, parent);
+	if (! parent)
+		root->rb_node = left;
+	else if (node == parent->rb_right)
+		parent->rb_right = left;
+	else
+		parent->rb_left = left;
+	rb_set_parent(node, left);
+}
+
+void rb_insert_color(struct rb_node *node, struct rb_root *root) {
+	struct rb_node *parent, *gparent, *uncle, *tmp;
+
+	while ((parent = rb_parent(node)) && rb_is_red(parent)) {
+		gparent = rb_parent(parent);
+		if (parent == gparent->rb_left) {
+			uncle = gparent->rb_right;
+			if (uncle && rb_is_red(uncle)) {
+				rb_set_black(uncle);
+				rb_set_black(parent);
+				rb_set_red(gparent);
+				node = gparent;
+				continue;
+			}
+			if (parent->rb_right == node) {
+				rotate_left(parent, root);
+				tmp = parent;
+				parent = node;
+				node = tmp;
+			}
+			rb_set_black(parent);
+			rb_set_red(gparent);
+			rotate_right(gparent, root);
+		} else {
+			uncle = gparent->rb_left;
+			if (uncle && rb_is_red(uncle)) {
+				rb_set_black(uncle);
+				rb_set_black(parent);
+				rb_set_red(gparent);
+				node = gparent;
+				continue;
+			}
+			if (parent->rb_left == node) {
+				rotate_right(parent, root);
+				tmp = parent;
+				parent = node;
+				node = tmp;
+			}
+			rb_set_black(parent);
+			rb_set_red(gparent);
+			rotate_left(gparent, root);
+		}
+	}
+	rb_set_black(root->rb_node);
+}
+
+static void erase_color(struct rb_node *node, struct rb_node *parent,
+		struct rb_root *root) {
+	struct rb_node *other;
+
+	while ((! node || rb_is_black(node)) && node != root->rb_node) {
+		if (parent->rb_left == node) {
+			other = parent->rb_right;
+			if (rb_is_red(other)) {
+				rb_set_black(other);
+				rb_set_red(parent);
+				rotate_left(parent, root);
+				other = parent->rb_right;
+			}
+			if ((! other->rb_left || rb_is_black(other->rb_left)) &&
+			    (! other->rb_right || rb_is_black(other->rb_right))) {
+				rb_set_red(other);
+				node = parent;
+				parent = rb_parent(node);
+				continue;
+			}
+			if (! other->rb_right || rb_is_black(other->rb_right)) {
+				rb_set_black(other->rb_left);
+				rb_set_red(other);
+				rotate_right(other, root);
+				other = parent->rb_right;
+			}
+			rb_set_color(other, rb_color(parent));
+			rb_set_black(parent);
+			rb_set_black(other->rb_right);
+			rotate_left(parent, root);
+		} else {
+			other = parent->rb_left;
+			if (rb_is_red(other)) {
+				rb_set_black(other);
+				rb_set_red(parent);
+				rotate_right(parent, root);
+				other = parent->rb_left;
+			}
+			if ((! other->rb_left || rb_is_black(other->rb_left)) &&
+			    (! other->rb_right || rb_is_black(other->rb_right))) {
+				rb_set_red(other);
+				node = parent;
+				parent = rb_parent(node);
+				continue;
+			}
+			if (! other->rb_left || rb_is_black(other->rb_left)) {
+				rb_set_black(other->rb_right);
+				rb_set_red(other);
+				rotate_left(other, root);
+				other = parent->rb_left;
+			}
+			rb_set_color(other, rb_color(parent));
+			rb_set_black(parent);
+			rb_set_black(other->rb_left);
+			rotate_right(parent, root);
+		}
+		node = root->rb_node;
+		break;
+	}
+	if (node)
+		rb_set_black(node);
+}
+
+void rb_erase(struct rb_node *node, struct rb_root *root) {
+	struct rb_node *child, *parent, *old, *left;
+	int color;
+
+	if (! node->rb_left)
+		child = node->rb_right;
+	else if (! node->rb_right)
+		child = node->rb_left;
+	else {
+		/* put the next node in its place */
+		old = node;
+		node = node->rb_right;
+		while ((left = node->rb_left))
+			node = left;
+		if (! rb_parent(old))
+			root->rb_node = node;
+		else if (rb_parent(old)->rb_left == old)
+			rb_parent(old)->rb_left = node;
+		else
+			rb_parent(old)->rb_right = node;
+
+		child = node->rb_right;
+		parent = rb_parent(node);
+		color = rb_color(node);
+		if (parent == old)
+			parent = node;
+		else {
+			if (child)
+				rb_set_parent(child, parent);
+			parent->rb_left = child;
+			node->rb_right = old->rb_right;
+			rb_set_parent(old->rb_right, node);
+		}
+		node->__rb_parent_color = old->__rb_parent_color;
+		node->rb_left = old->rb_left;
+		rb_set_parent(old->rb_left, node);
+		goto color;
+	}
+
+	parent = rb_parent(node);
+	color = rb_color(node);
+	if (child)
+		rb_set_parent(child, parent);
+	if (! parent)
+		root->rb_node = child;
+	else if (parent->rb_left == node)
+		parent->rb_left = child;
+	else
+		parent->rb_right = child;
+color:
+	if (color == RB_BLACK)
+		erase_color(child, parent, root);
+}
+
+struct rb_node *rb_first(const struct rb_root *root) {
+	struct rb_node *n = root->rb_node;
+
+	if (! n)
+		return NULL;
+	while (n->rb_left)
+		n = n->rb_left;
+	return n;
+}
+
+struct rb_node *rb_last(const struct rb_root *root) {
+	struct rb_node *n = root->rb_node;
+
+	if (! n)
+		return NULL;
+	while (n->rb_right)
+		n = n->rb_right;
+	return n;
+}
+
+struct rb_node *rb_next(const struct rb_node *node) {
+	struct rb_node *parent;
+
+	if (node->rb_right) {
+		node = node->rb_right;
+		while (node->rb_left)
+			node = node->rb_left;
+		return (struct rb_node *) node;
+	}
+	while ((parent = rb_parent(node)) && node == parent->rb_right)
+		node = parent;
+	return parent;
+}
+
+struct rb_node *rb_prev(const struct rb_node *node) {
+	struct rb_node *parent;
+
+	if (node->rb_left) {
+		node = node->rb_left;
+		while (node->rb_right)
+			node = node->rb_right;
+		return (struct rb_node *) node;
+	}
+	while ((parent = rb_parent(node)) && node == parent->rb_left)
+		node = parent;
+	return parent;
+}
@@ -0,0 +1,734 @@
+/*
+ * ringbench.c -- drives blkback's request path through a shared ring
+ *
+ * The module's own blkback-ljx.c serves a ring that this program fills the
+ * way blkfront would, from the main thread, with a mix of requests. It
+ * reports requests per second, the latency a guest would see from pushing
+ * a request to taking its response off the ring, and the cpu time spent per
+ * request: by each backend thread (xenblkd, the event channel handler, the
+ * AIO reaper) and by the whole process. See README for the details of
+ * what is emulated.
+ */
+
+#include <getopt.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "../common.h"
+#include "../label.h"
+#include "../label_io.h"
+#include "shim.h"
+
+extern int shim_module_init(void);
+
+#define DOMID			1
+#define MAX_MIX			8
+#define SEG_PAGES		BLKIF_MAX_SEGMENTS_PER_REQUEST
+#define SEC_PER_PAGE		(PAGE_SIZE >> 9)
+
+/* latencies, log-linear: 16 buckets to every power of two */
+#define LAT_SUB_BITS		4
+#define LAT_BUCKETS		(64 << LAT_SUB_BITS)
+
+struct lat_hist {
+	u64			count;
+	u64			sum;
+	u64			max;
+	u64			bucket[LAT_BUCKETS];
+};
+
+static unsigned int lat_bucket(u64 ns) {
+	int msb;
+
+	if (ns < (1 << LAT_SUB_BITS))
+		return ns;
+	msb = fls64(ns) - 1;
+	return (msb - LAT_SUB_BITS + 1) << LAT_SUB_BITS |
+		((ns >> (msb - LAT_SUB_BITS)) & ((1 << LAT_SUB_BITS) - 1));
+}
+
+/* the middle of a bucket */
+static u64 lat_value(unsigned int bucket) {
+	unsigned int e = bucket >> LAT_SUB_BITS;
+	u64 m = bucket & ((1 << LAT_SUB_BITS) - 1);
+
+	if (! e)
+		return m;
+	return ((m | 1 << LAT_SUB_BITS) << (e - 1)) + ((1ULL << (e - 1)) >> 1);
+}
+
+static void lat_add(struct lat_hist *hist, u64 ns) {
+	hist->bucket[lat_bucket(ns)]++;
+	hist->count++;
+	hist->sum += ns;
+	hist->max = max(hist->max, ns);
+}
+
+static u64 lat_percentile(const struct lat_hist *hist, double pct) {
+	u64 rank = (u64) (hist->count * pct / 100.0 + 0.5), seen = 0;
+	unsigned int i;
+
+	rank = clamp_t(u64, rank, 1, hist->count);
+	for (i = 0; i < LAT_BUCKETS; i++) {
+		seen += hist->bucket[i];
+		if (seen >= rank)
+			return min(lat_value(i), hist->max);
+	}
+	return hist->max;
+}
+
+/* one kind of request in the mix */
+struct mix {
+	u8			op;		/* BLKIF_OP_* */
+	unsigned int		nr_sec;
+	bool			seq;
+	unsigned int		weight;
+	sector_t		next;		/* where a sequential one goes */
+	/* results */
+	u64			errors;
+	struct lat_hist		lat;
+};
+
+struct slot {
+	struct mix		*mix;
+	u64			start;
+	grant_ref_t		gref;		/* the first of SEG_PAGES */
+};
+
+struct frontend {
+	struct blkif_front_ring	ring;
+	char			*mem;		/* the guest's memory */
+	int			evtchn;		/* we get notified here */
+	int			remote;		/* and notify the backend here */
+	sector_t		nr_sectors;
+	unsigned int		depth;
+	struct slot		*slots;
+	unsigned int		*free_ids;
+	unsigned int		nr_free;
+	struct mix		mix[MAX_MIX];
+	unsigned int		nr_mix;
+	unsigned int		total_weight;
+	u64			rand;
+	/* results */
+	struct lat_hist		lat;
+	u64			done;
+	u64			bytes;
+	u64			kicks;		/* notifications sent */
+	u64			waits;		/* times we slept for responses */
+};
+
+static u64 next_rand(struct frontend *fe) {
+	/* xorshift64* */
+	fe->rand ^= fe->rand >> 12;
+	fe->rand ^= fe->rand << 25;
+	fe->rand ^= fe->rand >> 27;
+	return fe->rand * 0x2545f4914f6cdd1dULL;
+}
+
+static const char *op_name(u8 op) {
+	switch (op) {
+	case BLKIF_OP_READ:
+		return "read";
+	case BLKIF_OP_WRITE:
+		return "write";
+	case BLKIF_OP_WRITE_BARRIER:
+		return "barrier";
+	case BLKIF_OP_FLUSH_DISKCACHE:
+		return "flush";
+	case BLKIF_OP_DISCARD:
+		return "discard";
+	default:
+		return "?";
+	}
+}
+
+/* op,KiB,rand|seq,weight */
+static int parse_mix(struct frontend *fe, const char *arg) {
+	struct mix *m = &fe->mix[fe->nr_mix];
+	char op[16], pattern[8];
+	unsigned int kib;
+	int n;
+
+	if (fe->nr_mix == MAX_MIX)
+		return -1;
+	memset(m, 0, sizeof(*m));
+	m->weight = 1;
+	strcpy(pattern, "rand");
+	n = sscanf(arg, "%15[a-z],%u,%7[a-z],%u", op, &kib, pattern, &m->weight);
+	if (n < 2)
+		return -1;
+	for (m->op = 0; m->op <= BLKIF_OP_DISCARD; m->op++)
+		if (! strcmp(op, op_name(m->op)))
+			break;
+	if (m->op > BLKIF_OP_DISCARD)
+		return -1;
+	m->nr_sec = kib * 2;
+	m->seq = ! strcmp(pattern, "seq");
+	if (! m->seq && strcmp(pattern, "rand"))
+		return -1;
+	if (m->op != BLKIF_OP_DISCARD && m->nr_sec > SEG_PAGES * SEC_PER_PAGE) {
+		fprintf(stderr, "%s: at most %lu KiB a request\n", arg,
+				SEG_PAGES * PAGE_SIZE >> 10);
+		return -1;
+	}
+	if (! m->nr_sec && m->op != BLKIF_OP_FLUSH_DISKCACHE &&
+	    m->op != BLKIF_OP_WRITE_BARRIER)
+		return -1;
+	fe->total_weight += m->weight;
+	fe->nr_mix++;
+	return 0;
+}
+
+static sector_t pick_sector(struct frontend *fe, struct mix *m) {
+	sector_t sector;
+
+	if (m->nr_sec > fe->nr_sectors)
+		return 0;
+	if (m->seq) {
+		if (m->next + m->nr_sec > fe->nr_sectors)
+			m->next = 0;
+		sector = m->next;
+		m->next += m->nr_sec;
+		return sector;
+	}
+	/* page aligned, as a guest's page cache would have it */
+	return next_rand(fe) % ((fe->nr_sectors - m->nr_sec) / SEC_PER_PAGE + 1) *
+		SEC_PER_PAGE;
+}
+
+static void fill_request(struct frontend *fe, struct mix *m, sector_t sector,
+		unsigned int id) {
+	struct blkif_request *req;
+	unsigned int i, left = m->nr_sec;
+
+	req = RING_GET_REQUEST(&fe->ring, fe->ring.req_prod_pvt);
+	fe->ring.req_prod_pvt++;
+	req->operation = m->op;
+	if (m->op == BLKIF_OP_DISCARD) {
+		req->u.discard.flag = 0;
+		req->u.discard.id = id;
+		req->u.discard.sector_number = sector;
+		req->u.discard.nr_sectors = m->nr_sec;
+		return;
+	}
+	req->u.rw.nr_segments = DIV_ROUND_UP(m->nr_sec, SEC_PER_PAGE);
+	req->u.rw.handle = 0;
+	req->u.rw.id = id;
+	req->u.rw.sector_number = sector;
+	for (i = 0; i < req->u.rw.nr_segments; i++) {
+		req->u.rw.seg[i].gref = fe->slots[id].gref + i;
+		req->u.rw.seg[i].first_sect = 0;
+		req->u.rw.seg[i].last_sect = min_t(unsigned int, left, SEC_PER_PAGE) - 1;
+		left -= req->u.rw.seg[i].last_sect + 1;
+	}
+}
+
+static struct mix *pick_mix(struct frontend *fe) {
+	unsigned int i, r = next_rand(fe) % fe->total_weight;
+
+	for (i = 0; r >= fe->mix[i].weight; i++)
+		r -= fe->mix[i].weight;
+	return &fe->mix[i];
+}
+
+static void kick(struct frontend *fe) {
+	u64 one = 1;
+	int notify;
+
+	RING_PUSH_REQUESTS_AND_CHECK_NOTIFY(&fe->ring, notify);
+	if (! notify)
+		return;
+	fe->kicks++;
+	if (write(fe->remote, &one, sizeof(one)) != sizeof(one))
+		BUG();
+}
+
+static void wait_for_responses(struct frontend *fe) {
+	int more;
+	u64 count;
+
+	RING_FINAL_CHECK_FOR_RESPONSES(&fe->ring, more);
+	if (more)
+		return;
+	fe->waits++;
+	if (read(fe->evtchn, &count, sizeof(count)) != sizeof(count))
+		BUG();
+}
+
+/* takes the responses off the ring; returns how many there were */
+static unsigned int take_responses(struct frontend *fe, bool record) {
+	struct blkif_response *rsp;
+	struct slot *slot;
+	RING_IDX i, rp;
+	u64 now, ns;
+
+	rp = fe->ring.sring->rsp_prod;
+	rmb(); /* see the responses up to rp */
+	if (rp == fe->ring.rsp_cons)
+		return 0;
+	now = shim_now_ns();
+	for (i = fe->ring.rsp_cons; i != rp; i++) {
+		rsp = RING_GET_RESPONSE(&fe->ring, i);
+		BUG_ON(rsp->id >= fe->depth);
+		slot = &fe->slots[rsp->id];
+		if (record) {
+			ns = now - slot->start;
+			lat_add(&fe->lat, ns);
+			lat_add(&slot->mix->lat, ns);
+			if (rsp->status != BLKIF_RSP_OKAY)
+				slot->mix->errors++;
+			fe->done++;
+			if (slot->mix->op == BLKIF_OP_READ || slot->mix->op == BLKIF_OP_WRITE)
+				fe->bytes += (u64) slot->mix->nr_sec << 9;
+		}
+		fe->free_ids[fe->nr_free++] = rsp->id;
+	}
+	i = rp - fe->ring.rsp_cons;
+	fe->ring.rsp_cons = rp;
+	return i;
+}
+
+/* issues one request on its own and waits for it; returns its status */
+static int sync_request(struct frontend *fe, u8 op, sector_t sector,
+		unsigned int nr_sec, unsigned int id) {
+	struct mix m = { .op = op, .nr_sec = nr_sec };
+	struct blkif_response *rsp;
+
+	fill_request(fe, &m, sector, id);
+	kick(fe);
+	while (fe->ring.sring->rsp_prod == fe->ring.rsp_cons)
+		wait_for_responses(fe);
+	rmb();
+	rsp = RING_GET_RESPONSE(&fe->ring, fe->ring.rsp_cons);
+	fe->ring.rsp_cons++;
+	return rsp->status;
+}
+
+static char *slot_page(struct frontend *fe, unsigned int id, unsigned int seg) {
+	return fe->mem + ((size_t) (fe->slots[id].gref + seg) << PAGE_SHIFT);
+}
+
+/*
+ * Writes a pattern through the ring and reads it back into another slot,
+ * to show grants, the ring and the device all work before timing them.
+ */
+static int self_test(struct frontend *fe) {
+	unsigned int i, nr_sec = SEG_PAGES * SEC_PER_PAGE;
+	int err;
+
+	if (fe->depth < 2 || fe->nr_sectors < nr_sec)
+		return 0;
+	for (i = 0; i < SEG_PAGES * PAGE_SIZE; i++)
+		slot_page(fe, 0, 0)[i] = (char) (i * 7 + i / PAGE_SIZE);
+	memset(slot_page(fe, 1, 0), 0, SEG_PAGES * PAGE_SIZE);
+	err = sync_request(fe, BLKIF_OP_WRITE, 0, nr_sec, 0);
+	if (! err)
+		err = sync_request(fe, BLKIF_OP_READ, 0, nr_sec, 1);
+	if (! err && memcmp(slot_page(fe, 0, 0), slot_page(fe, 1, 0),
+			    SEG_PAGES * PAGE_SIZE))
+		err = -EIO;
+	if (err)
+		fprintf(stderr, "self test failed: %d\n", err);
+	return err;
+}
+
+/* cpu time used so far */
+struct cpu_snap {
+	const char		*names[16];
+	u64			ns[16];
+	unsigned int		nr;
+	u64			frontend;
+	u64			process;
+};
+
+static u64 cpu_clock(clockid_t clock) {
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return (u64) ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void cpu_snap(struct cpu_snap *snap) {
+	snap->nr = shim_threads_cpu(snap->names, snap->ns, ARRAY_SIZE(snap->ns));
+	snap->frontend = cpu_clock(CLOCK_THREAD_CPUTIME_ID);
+	snap->process = cpu_clock(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+struct run {
+	double			seconds;
+	double			warmup;
+	u64			max_reqs;
+	/* filled in */
+	u64			elapsed;
+	struct cpu_snap		start;
+	struct cpu_snap		end;
+	struct shim_xen_stats	xen;
+};
+
+static void run(struct frontend *fe, struct run *r) {
+	u64 begin = shim_now_ns(), end = 0, measure, issued = 0;
+	bool issuing = true, measuring;
+	unsigned int id, inflight = 0;
+	struct mix *m;
+
+	measure = begin + (u64) (r->warmup * NSEC_PER_SEC);
+	measuring = ! r->warmup;
+	if (r->seconds)
+		end = measure + (u64) (r->seconds * NSEC_PER_SEC);
+	cpu_snap(&r->start);
+	r->xen = shim_xen_stats;
+
+	for (;;) {
+		while (issuing && inflight < fe->depth) {
+			id = fe->free_ids[--fe->nr_free];
+			m = pick_mix(fe);
+			fe->slots[id].mix = m;
+			fe->slots[id].start = shim_now_ns();
+			fill_request(fe, m, pick_sector(fe, m), id);
+			inflight++;
+			if (measuring && r->max_reqs && ++issued == r->max_reqs)
+				issuing = false;
+		}
+		kick(fe);
+
+		inflight -= take_responses(fe, measuring);
+		if (! measuring && shim_now_ns() >= measure) {
+			measuring = true;
+			cpu_snap(&r->start);
+			r->xen = shim_xen_stats;
+			begin = shim_now_ns();
+		}
+		if (issuing && end && shim_now_ns() >= end)
+			issuing = false;
+		if (! inflight && ! issuing)
+			break;
+		if (issuing && inflight < fe->depth)
+			continue;
+		wait_for_responses(fe);
+	}
+	r->elapsed = shim_now_ns() - begin;
+	cpu_snap(&r->end);
+}
+
+/* the backend, set up as xenbus.c would for a guest connecting */
+
+static struct xen_blkif *backend_connect(struct block_device *bdev,
+		void *ring, int evtchn) {
+	struct request_queue *q = bdev_get_queue(bdev);
+	struct xen_blkif *blkif;
+	struct xen_vbd *vbd;
+	int irq;
+
+	blkif = kzalloc(sizeof(*blkif), GFP_KERNEL);
+	if (! blkif)
+		return NULL;
+	blkif->stats = ljx_stats_alloc();
+	blkif->domid = DOMID;
+	spin_lock_init(&blkif->blk_ring_lock);
+	atomic_set(&blkif->refcnt, 1);
+	init_waitqueue_head(&blkif->wq);
+	init_completion(&blkif->drain_complete);
+	atomic_set(&blkif->drain, 0);
+	blkif->st_print = jiffies;
+	init_waitqueue_head(&blkif->waiting_to_free);
+
+	vbd = &blkif->vbd;
+	vbd->handle = 51712;		/* xvda */
+	vbd->pdevice = MKDEV(202, 0);
+	vbd->bdev = bdev;
+	vbd->size = vbd_sz(vbd);
+	vbd->flush_support = q->flush_flags != 0;
+	vbd->labels = ljx_labels_alloc(vbd->pdevice);
+	ljx_sample_init(&vbd->sample);
+	vbd->lat = ljx_lat_alloc();
+	vbd->label_io = ljx_label_io_alloc();
+	if (! blkif->stats || ! vbd->labels)
+		return NULL;
+
+	blkif->blk_protocol = BLKIF_PROTOCOL_NATIVE;
+	blkif->blk_backend_type = BLKIF_BACKEND_PHY;
+	blkif->blk_ring = ring;
+	BACK_RING_INIT(&blkif->blk_rings.native, (struct blkif_sring *) ring,
+			PAGE_SIZE);
+	irq = bind_interdomain_evtchn_to_irqhandler(DOMID, evtchn, xen_blkif_be_int,
+			0, "blkif-backend", blkif);
+	if (irq < 0)
+		return NULL;
+	blkif->irq = irq;
+
+	blkif->xenblkd = kthread_run(xen_blkif_schedule, blkif, "blkback.%d.xvda",
+			DOMID);
+	if (IS_ERR(blkif->xenblkd))
+		return NULL;
+	return blkif;
+}
+
+static void backend_disconnect(struct xen_blkif *blkif) {
+	kthread_stop(blkif->xenblkd);
+	atomic_dec(&blkif->refcnt);
+	wait_event(blkif->waiting_to_free, atomic_read(&blkif->refcnt) == 0);
+	unbind_from_irqhandler(blkif->irq, blkif);
+}
+
+/* reporting */
+
+static const char *stat_names[LJX_STATS] = {
+	[LJX_ST_RD_REQ]		= "rd_req",
+	[LJX_ST_WR_REQ]		= "wr_req",
+	[LJX_ST_F_REQ]		= "f_req",
+	[LJX_ST_DS_REQ]		= "ds_req",
+	[LJX_ST_RD_SECT]	= "rd_sect",
+	[LJX_ST_WR_SECT]	= "wr_sect",
+	[LJX_ST_F_SECT]		= "f_sect",
+	[LJX_ST_DS_SECT]	= "ds_sect",
+	[LJX_ST_RD_BYTES]	= "rd_bytes",
+	[LJX_ST_WR_BYTES]	= "wr_bytes",
+	[LJX_ST_ERRORS]		= "errors",
+	[LJX_ST_OO_REQ]		= "oo_req",
+	[LJX_ST_OO_BIO]		= "oo_bio",
+	[LJX_ST_JNL_REQ]	= "jnl_req",
+	[LJX_ST_JNL_BATCH]	= "jnl_batch",
+};
+
+static const char *stage_names[LJX_LAT_STAGES] = {
+	[LJX_LAT_MAP]		= "map",
+	[LJX_LAT_SUBMIT]	= "submit",
+	[LJX_LAT_DEVICE]	= "device",
+	[LJX_LAT_INTROSPECT]	= "introspect",
+	[LJX_LAT_RESPONSE]	= "response",
+};
+
+static void print_lat(const char *what, const struct lat_hist *lat) {
+	if (! lat->count)
+		return;
+	printf("%-22s avg %8.1f  p50 %8.1f  p90 %8.1f  p99 %8.1f  p99.9 %8.1f  max %8.1f\n",
+			what, (double) lat->sum / lat->count / 1000,
+			lat_percentile(lat, 50) / 1000.0, lat_percentile(lat, 90) / 1000.0,
+			lat_percentile(lat, 99) / 1000.0, lat_percentile(lat, 99.9) / 1000.0,
+			lat->max / 1000.0);
+}
+
+static double per_req(u64 ns, u64 reqs) {
+	return reqs ? (double) ns / reqs / 1000 : 0;
+}
+
+static void report(struct frontend *fe, struct run *r) {
+	double secs = (double) r->elapsed / NSEC_PER_SEC;
+	u64 backend = 0, ns;
+	unsigned int i, j;
+	char what[64];
+
+	printf("requests  %llu in %.2f s, %.0f IOPS, %.1f MiB/s\n",
+			(unsigned long long) fe->done, secs, fe->done / secs,
+			fe->bytes / secs / (1 << 20));
+	printf("latency (us)\n");
+	print_lat("  all", &fe->lat);
+	for (i = 0; i < fe->nr_mix; i++) {
+		snprintf(what, sizeof(what), "  %s %u KiB %s", op_name(fe->mix[i].op),
+				fe->mix[i].nr_sec / 2, fe->mix[i].seq ? "seq" : "rand");
+		print_lat(what, &fe->mix[i].lat);
+		if (fe->mix[i].errors)
+			printf("%-22s %llu errors\n", "",
+					(unsigned long long) fe->mix[i].errors);
+	}
+
+	printf("cpu (us/request)\n");
+	for (i = 0; i < r->end.nr; i++) {
+		ns = r->end.ns[i];
+		for (j = 0; j < r->start.nr; j++)
+			if (r->start.names[j] == r->end.names[i])
+				ns -= r->start.ns[j];
+		backend += ns;
+		printf("  %-20s %8.2f\n", r->end.names[i], per_req(ns, fe->done));
+	}
+	printf("  %-20s %8.2f\n", "backend", per_req(backend, fe->done));
+	printf("  %-20s %8.2f\n", "frontend",
+			per_req(r->end.frontend - r->start.frontend, fe->done));
+	printf("  %-20s %8.2f\n", "process",
+			per_req(r->end.process - r->start.process, fe->done));
+
+	printf("events (/request)\n");
+	printf("  %-20s %8.3f\n", "to backend", (double) fe->kicks / max(fe->done, 1ULL));
+	printf("  %-20s %8.3f\n", "backend irqs",
+			(double) (atomic64_read(&shim_xen_stats.irqs) -
+				  atomic64_read(&r->xen.irqs)) / max(fe->done, 1ULL));
+	printf("  %-20s %8.3f\n", "to frontend",
+			(double) (atomic64_read(&shim_xen_stats.notify) -
+				  atomic64_read(&r->xen.notify)) / max(fe->done, 1ULL));
+	printf("  %-20s %8.3f\n", "frontend waits", (double) fe->waits / max(fe->done, 1ULL));
+	printf("  %-20s %8.3f\n", "grants mapped",
+			(double) (atomic64_read(&shim_xen_stats.maps) -
+				  atomic64_read(&r->xen.maps)) / max(fe->done, 1ULL));
+}
+
+static void report_module(struct xen_blkif *blkif) {
+	struct xen_vbd *vbd = &blkif->vbd;
+	char buf[4096];
+	int i;
+
+	printf("module stats\n");
+	for (i = 0; i < LJX_STATS; i++)
+		printf("  %-20s %llu\n", stat_names[i],
+				(unsigned long long) ljx_stat_read(blkif->stats, i));
+	for (i = 0; vbd->lat && i < LJX_LAT_STAGES; i++) {
+		ljx_lat_show(vbd->lat, i, buf, sizeof(buf));
+		printf("module latency %s (count sum, then low high count in ns)\n%s",
+				stage_names[i], buf);
+	}
+	ljx_sample_show(&vbd->sample, buf, sizeof(buf));
+	printf("module sampling\n%s", buf);
+	if (vbd->label_io) {
+		ljx_label_io_show(vbd->label_io, buf, sizeof(buf));
+		printf("module label io (rd_ops rd_bytes wr_ops wr_bytes)\n%s", buf);
+	}
+}
+
+static void usage(void) {
+	fprintf(stderr,
+"usage: ringbench [options]\n"
+"  -d DEV       ram:<MiB> (default ram:256), file:<path> or direct:<path>\n"
+"  -m MIX       op,KiB[,rand|seq[,weight]], repeatable; op is read, write,\n"
+"               flush, barrier or discard (default read,4,rand,1)\n"
+"  -q DEPTH     requests in flight, at most the ring size (default 32)\n"
+"  -t SECONDS   how long to run (default 5 unless -n is given)\n"
+"  -n REQUESTS  how many requests to run\n"
+"  -w SECONDS   run this long before measuring\n"
+"  -p NAME=VAL  set a module parameter, e.g. -p sample_rate=8\n"
+"  -S SEED      for the random offsets and mix (default 1)\n"
+"  -V           check a write and read back before running; only done\n"
+"               by default on ram, since it overwrites the first 44 KiB\n"
+"  -s           print the module's own counters and histograms too\n");
+	exit(2);
+}
+
+int main(int argc, char **argv) {
+	struct frontend fe = { .depth = 32, .rand = 1 };
+	struct run r = { .seconds = 0 };
+	const char *dev = "ram:256";
+	struct block_device *bdev;
+	struct xen_blkif *blkif;
+	struct blkif_sring *sring;
+	bool verify = false, show_module = false;
+	unsigned int i, nr_pages;
+	int c, back_evtchn;
+	char *eq;
+
+	while ((c = getopt(argc, argv, "d:m:q:t:n:w:p:S:Vsh")) != -1) {
+		switch (c) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 'm':
+			if (parse_mix(&fe, optarg)) {
+				fprintf(stderr, "bad mix %s\n", optarg);
+				usage();
+			}
+			break;
+		case 'q':
+			fe.depth = atoi(optarg);
+			break;
+		case 't':
+			r.seconds = atof(optarg);
+			break;
+		case 'n':
+			r.max_reqs = strtoull(optarg, NULL, 0);
+			break;
+		case 'w':
+			r.warmup = atof(optarg);
+			break;
+		case 'p':
+			eq = strchr(optarg, '=');
+			if (! eq)
+				usage();
+			*eq = 0;
+			if (shim_param_set(optarg, eq + 1)) {
+				fprintf(stderr, "can't set %s to %s\n", optarg, eq + 1);
+				return 2;
+			}
+			break;
+		case 'S':
+			fe.rand = strtoull(optarg, NULL, 0) | 1;
+			break;
+		case 'V':
+			verify = true;
+			break;
+		case 's':
+			show_module = true;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc)
+		usage();
+	if (! fe.nr_mix)
+		parse_mix(&fe, "read,4,rand,1");
+	if (! r.seconds && ! r.max_reqs)
+		r.seconds = 5;
+
+	if (shim_module_init()) {
+		fprintf(stderr, "module init failed\n");
+		return 1;
+	}
+	bdev = shim_bdev_open(dev, false);
+	if (! bdev)
+		return 1;
+	fe.nr_sectors = get_capacity(bdev->bd_disk);
+	if (! strncmp(dev, "ram:", 4))
+		verify = true;
+
+	/* guest memory: the ring, then SEG_PAGES for every request slot */
+	nr_pages = 1 + fe.depth * SEG_PAGES;
+	fe.mem = shim_guest_alloc(nr_pages);
+	fe.evtchn = eventfd(0, 0);
+	back_evtchn = eventfd(0, 0);
+	fe.slots = calloc(fe.depth, sizeof(*fe.slots));
+	fe.free_ids = calloc(fe.depth, sizeof(*fe.free_ids));
+	if (! fe.mem || fe.evtchn < 0 || back_evtchn < 0 || ! fe.slots ||
+	    ! fe.free_ids) {
+		fprintf(stderr, "can't set up the guest\n");
+		return 1;
+	}
+	sring = (struct blkif_sring *) fe.mem;
+	SHARED_RING_INIT(sring);
+	FRONT_RING_INIT(&fe.ring, sring, PAGE_SIZE);
+	if (! fe.depth || fe.depth > RING_SIZE(&fe.ring)) {
+		fprintf(stderr, "depth must be 1 to %u\n", RING_SIZE(&fe.ring));
+		return 2;
+	}
+	for (i = 0; i < fe.depth; i++) {
+		fe.slots[i].gref = 1 + i * SEG_PAGES;
+		fe.free_ids[fe.nr_free++] = fe.depth - 1 - i;
+	}
+
+	/* the backend maps the ring page at an address of its own */
+	blkif = backend_connect(bdev, shim_guest_map(0), back_evtchn);
+	if (! blkif) {
+		fprintf(stderr, "can't connect the backend\n");
+		return 1;
+	}
+	shim_evtchn_set_remote(blkif->irq, fe.evtchn);
+	fe.remote = back_evtchn;
+
+	if (verify && self_test(&fe))
+		return 1;
+
+	printf("device    %s, %llu MiB, depth %u\n", dev,
+			(unsigned long long) fe.nr_sectors >> 11, fe.depth);
+	for (i = 0; i < fe.nr_mix; i++)
+		printf("mix       %s %u KiB %s, weight %u\n", op_name(fe.mix[i].op),
+				fe.mix[i].nr_sec / 2, fe.mix[i].seq ? "seq" : "rand",
+				fe.mix[i].weight);
+	fflush(stdout);
+
+	run(&fe, &r);
+	report(&fe, &r);
+	if (show_module)
+		report_module(blkif);
+
+	backend_disconnect(blkif);
+	shim_bdev_close(bdev);
+	free(fe.slots);
+	free(fe.free_ids);
+	return 0;
+}
@@ -0,0 +1,703 @@
+/*
+ * shim.c -- the kernel services of kernel.h, on top of pthreads and libc
+ */
+
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <unistd.h>
+
+#include "shim.h"
+
+unsigned int nr_cpu_ids = NR_CPUS;
+__thread unsigned int shim_cpu;
+__thread struct task_struct *shim_current;
+
+void shim_bug(const char *file, int line) {
+	fprintf(stderr, "BUG at %s:%d\n", file, line);
+	abort();
+}
+
+void shim_warn(const char *file, int line) {
+	fprintf(stderr, "WARNING at %s:%d\n", file, line);
+}
+
+bool shim_quiet;
+
+int printk(const char *fmt, ...) {
+	va_list args;
+	size_t n = strlen(fmt);
+	int len;
+
+	if (shim_quiet)
+		return 0;
+	va_start(args, fmt);
+	len = vfprintf(stderr, fmt, args);
+	va_end(args);
+	/* the kernel ends a line it was not given an end for */
+	if (n && fmt[n - 1] != '\n')
+		fputc('\n', stderr);
+	return len;
+}
+
+int scnprintf(char *buf, size_t size, const char *fmt, ...) {
+	va_list args;
+	int len;
+
+	if (! size)
+		return 0;
+	va_start(args, fmt);
+	len = vsnprintf(buf, size, fmt, args);
+	va_end(args);
+	return len < (int) size ? len : (int) size - 1;
+}
+
+void *memchr_inv(const void *start, int c, size_t bytes) {
+	const u8 *p = start;
+
+	for (; bytes; p++, bytes--)
+		if (*p != (u8) c)
+			return (void *) p;
+	return NULL;
+}
+
+/* module parameters */
+
+struct shim_param {
+	const char		*name;
+	void			*var;
+	const char		*type;
+	unsigned int		nr;
+};
+
+static struct shim_param params[64];
+static unsigned int nr_params;
+
+void shim_param_register(const char *name, void *var, const char *type,
+		unsigned int nr) {
+	if (nr_params == ARRAY_SIZE(params))
+		BUG();
+	params[nr_params].name = name;
+	params[nr_params].var = var;
+	params[nr_params].type = type;
+	params[nr_params].nr = nr;
+	nr_params++;
+}
+
+static int set_one(struct shim_param *p, unsigned int i, const char *value) {
+	char *end;
+	long long v;
+
+	/* module_param() hands the type on, so <stdbool.h> has expanded it */
+	if (! strcmp(p->type, "bool") || ! strcmp(p->type, "_Bool")) {
+		((bool *) p->var)[i] = *value == 'y' || *value == 'Y' || *value == '1';
+		return 0;
+	}
+	v = strtoll(value, &end, 0);
+	if (end == value || *end)
+		return -EINVAL;
+	if (! strcmp(p->type, "int") || ! strcmp(p->type, "uint"))
+		((int *) p->var)[i] = v;
+	else if (! strcmp(p->type, "long") || ! strcmp(p->type, "ulong"))
+		((long *) p->var)[i] = v;
+	else
+		return -EINVAL;
+	return 0;
+}
+
+int shim_param_set(const char *name, const char *value) {
+	char buf[256], *tok, *save;
+	unsigned int i, j;
+	int err;
+
+	for (i = 0; i < nr_params; i++) {
+		if (strcmp(params[i].name, name))
+			continue;
+		snprintf(buf, sizeof(buf), "%s", value);
+		for (j = 0, tok = strtok_r(buf, ",", &save); tok;
+		     j++, tok = strtok_r(NULL, ",", &save)) {
+			if (j == params[i].nr)
+				return -EINVAL;
+			err = set_one(&params[i], j, tok);
+			if (err)
+				return err;
+		}
+		return 0;
+	}
+	return -ENOENT;
+}
+
+/* time */
+
+static u64 boot_ns;
+
+static void __attribute__((constructor)) shim_boot(void) {
+	boot_ns = shim_now_ns();
+}
+
+unsigned long shim_jiffies(void) {
+	/* like the kernel, start close to a wrap to catch bad comparisons */
+	return (unsigned long) (-300 * HZ) +
+		(shim_now_ns() - boot_ns) / (NSEC_PER_SEC / HZ);
+}
+
+void msleep(unsigned int ms) {
+	struct timespec ts = {
+		.tv_sec		= ms / 1000,
+		.tv_nsec	= (ms % 1000) * NSEC_PER_MSEC,
+	};
+
+	shim_flush_plug();
+	while (nanosleep(&ts, &ts) && errno == EINTR)
+		;
+}
+
+void ssleep(unsigned int s) {
+	msleep(s * 1000);
+}
+
+/* threads */
+
+struct shim_thread {
+	char			name[16];
+	pthread_t		thread;
+	clockid_t		clock;
+	bool			alive;
+};
+
+static struct shim_thread threads[32];
+static unsigned int nr_threads;
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct thread_start {
+	void			*(*fn)(void *);
+	void			*arg;
+	struct shim_thread	*t;
+	unsigned int		cpu;
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	bool			started;
+};
+
+static void *thread_main(void *arg) {
+	struct thread_start *start = arg;
+	void *(*fn)(void *) = start->fn;
+	void *fn_arg = start->arg;
+
+	shim_cpu = start->cpu;
+	pthread_getcpuclockid(pthread_self(), &start->t->clock);
+	pthread_mutex_lock(&start->lock);
+	start->started = true;
+	pthread_cond_signal(&start->cond);
+	pthread_mutex_unlock(&start->lock);
+	return fn(fn_arg);
+}
+
+int shim_thread_start(pthread_t *thread, const char *name,
+		void *(*fn)(void *), void *arg) {
+	struct thread_start start = {
+		.fn	= fn,
+		.arg	= arg,
+		.lock	= PTHREAD_MUTEX_INITIALIZER,
+		.cond	= PTHREAD_COND_INITIALIZER,
+	};
+	struct shim_thread *t;
+	int err;
+
+	pthread_mutex_lock(&threads_lock);
+	if (nr_threads == ARRAY_SIZE(threads)) {
+		pthread_mutex_unlock(&threads_lock);
+		return -ENOMEM;
+	}
+	t = &threads[nr_threads];
+	/* the main thread is cpu 0, everything else gets one of its own */
+	start.cpu = ++nr_threads % NR_CPUS;
+	pthread_mutex_unlock(&threads_lock);
+
+	snprintf(t->name, sizeof(t->name), "%s", name);
+	start.t = t;
+	err = pthread_create(&t->thread, NULL, thread_main, &start);
+	if (err)
+		return -err;
+	pthread_setname_np(t->thread, t->name);
+	pthread_mutex_lock(&start.lock);
+	while (! start.started)
+		pthread_cond_wait(&start.cond, &start.lock);
+	pthread_mutex_unlock(&start.lock);
+	t->alive = true;
+	*thread = t->thread;
+	return 0;
+}
+
+void shim_thread_exited(pthread_t thread) {
+	unsigned int i;
+
+	pthread_mutex_lock(&threads_lock);
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_equal(threads[i].thread, thread))
+			threads[i].alive = false;
+	pthread_mutex_unlock(&threads_lock);
+}
+
+static u64 clock_ns(clockid_t clock) {
+	struct timespec ts;
+
+	if (clock_gettime(clock, &ts))
+		return 0;
+	return (u64) ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+unsigned int shim_threads_cpu(const char **names, u64 *ns, unsigned int max) {
+	unsigned int i, nr = 0;
+
+	pthread_mutex_lock(&threads_lock);
+	for (i = 0; i < nr_threads && nr < max; i++) {
+		if (! threads[i].alive)
+			continue;
+		names[nr] = threads[i].name;
+		ns[nr++] = clock_ns(threads[i].clock);
+	}
+	pthread_mutex_unlock(&threads_lock);
+	return nr;
+}
+
+static void *kthread_main(void *arg) {
+	struct task_struct *task = arg;
+
+	shim_current = task;
+	task->ret = task->fn(task->data);
+	return NULL;
+}
+
+struct task_struct *kthread_run(int (*fn)(void *), void *data,
+		const char *fmt, ...) {
+	struct task_struct *task;
+	va_list args;
+	int err;
+
+	task = calloc(1, sizeof(*task));
+	if (! task)
+		return ERR_PTR(-ENOMEM);
+	va_start(args, fmt);
+	vsnprintf(task->comm, sizeof(task->comm), fmt, args);
+	va_end(args);
+	task->fn = fn;
+	task->data = data;
+	err = shim_thread_start(&task->thread, task->comm, kthread_main, task);
+	if (err) {
+		free(task);
+		return ERR_PTR(err);
+	}
+	return task;
+}
+
+int kthread_stop(struct task_struct *task) {
+	int ret;
+
+	task->should_stop = true;
+	pthread_join(task->thread, NULL);
+	shim_thread_exited(task->thread);
+	ret = task->ret;
+	free(task);
+	return ret;
+}
+
+bool kthread_should_stop(void) {
+	return current && ACCESS_ONCE(current->should_stop);
+}
+
+/* wait queues and completions */
+
+void init_waitqueue_head(wait_queue_head_t *wq) {
+	pthread_condattr_t attr;
+
+	pthread_mutex_init(&wq->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&wq->cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+void wake_up(wait_queue_head_t *wq) {
+	pthread_mutex_lock(&wq->lock);
+	pthread_cond_broadcast(&wq->cond);
+	pthread_mutex_unlock(&wq->lock);
+}
+
+/* called with wq->lock held, like schedule() with the task on the queue */
+long shim_wait(wait_queue_head_t *wq, long timeout_ns) {
+	u64 end = shim_now_ns() + timeout_ns;
+	struct timespec ts = {
+		.tv_sec		= end / NSEC_PER_SEC,
+		.tv_nsec	= end % NSEC_PER_SEC,
+	};
+
+	shim_flush_plug();
+	return pthread_cond_timedwait(&wq->cond, &wq->lock, &ts);
+}
+
+void init_completion(struct completion *c) {
+	c->done = 0;
+	init_waitqueue_head(&c->wait);
+}
+
+void complete(struct completion *c) {
+	pthread_mutex_lock(&c->wait.lock);
+	c->done++;
+	pthread_cond_broadcast(&c->wait.cond);
+	pthread_mutex_unlock(&c->wait.lock);
+}
+
+void complete_all(struct completion *c) {
+	pthread_mutex_lock(&c->wait.lock);
+	c->done = UINT_MAX / 2;
+	pthread_cond_broadcast(&c->wait.cond);
+	pthread_mutex_unlock(&c->wait.lock);
+}
+
+long wait_for_completion_timeout(struct completion *c, unsigned long timeout) {
+	u64 end = shim_now_ns() + (u64) timeout * (NSEC_PER_SEC / HZ);
+	long ret = 1;
+
+	pthread_mutex_lock(&c->wait.lock);
+	while (! c->done) {
+		if (shim_now_ns() >= end) {
+			ret = 0;
+			break;
+		}
+		shim_wait(&c->wait, min_t(u64, SHIM_WAIT_POLL_NS, end - shim_now_ns()));
+	}
+	if (ret)
+		c->done--;
+	pthread_mutex_unlock(&c->wait.lock);
+	return ret;
+}
+
+void wait_for_completion(struct completion *c) {
+	while (! wait_for_completion_timeout(c, HZ))
+		;
+}
+
+/* work queues */
+
+struct workqueue_struct {
+	struct list_head	list;		/* on queues */
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	struct list_head	works;
+	struct work_struct	*running;
+	pthread_t		thread;
+	bool			stop;
+};
+
+static LIST_HEAD(queues);
+static pthread_mutex_t queues_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct workqueue_struct *system_wq;
+static pthread_once_t system_wq_once = PTHREAD_ONCE_INIT;
+
+static void *worker(void *arg) {
+	struct workqueue_struct *wq = arg;
+	struct work_struct *work, *next;
+	struct timespec ts;
+	u64 now, wake;
+
+	pthread_mutex_lock(&wq->lock);
+	while (! wq->stop) {
+		now = shim_now_ns();
+		wake = now + SHIM_WAIT_POLL_NS;
+		next = NULL;
+		list_for_each_entry(work, &wq->works, entry) {
+			if (work->due_ns <= now) {
+				next = work;
+				break;
+			}
+			wake = min(wake, work->due_ns);
+		}
+		if (! next) {
+			ts.tv_sec = wake / NSEC_PER_SEC;
+			ts.tv_nsec = wake % NSEC_PER_SEC;
+			pthread_cond_timedwait(&wq->cond, &wq->lock, &ts);
+			continue;
+		}
+		list_del_init(&next->entry);
+		next->pending = false;
+		wq->running = next;
+		pthread_mutex_unlock(&wq->lock);
+		next->func(next);
+		pthread_mutex_lock(&wq->lock);
+		wq->running = NULL;
+		pthread_cond_broadcast(&wq->cond);
+	}
+	pthread_mutex_unlock(&wq->lock);
+	return NULL;
+}
+
+struct workqueue_struct *alloc_workqueue(const char *name, unsigned int flags,
+		int max_active) {
+	struct workqueue_struct *wq;
+	pthread_condattr_t attr;
+
+	wq = calloc(1, sizeof(*wq));
+	if (! wq)
+		return NULL;
+	pthread_mutex_init(&wq->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&wq->cond, &attr);
+	pthread_condattr_destroy(&attr);
+	INIT_LIST_HEAD(&wq->works);
+	if (shim_thread_start(&wq->thread, name, worker, wq)) {
+		free(wq);
+		return NULL;
+	}
+	pthread_mutex_lock(&queues_lock);
+	list_add_tail(&wq->list, &queues);
+	pthread_mutex_unlock(&queues_lock);
+	return wq;
+}
+
+void destroy_workqueue(struct workqueue_struct *wq) {
+	pthread_mutex_lock(&queues_lock);
+	list_del(&wq->list);
+	pthread_mutex_unlock(&queues_lock);
+	flush_workqueue(wq);
+	pthread_mutex_lock(&wq->lock);
+	wq->stop = true;
+	pthread_cond_broadcast(&wq->cond);
+	pthread_mutex_unlock(&wq->lock);
+	pthread_join(wq->thread, NULL);
+	shim_thread_exited(wq->thread);
+	free(wq);
+}
+
+static bool __queue_work(struct workqueue_struct *wq, struct work_struct *work,
+		u64 due_ns) {
+	bool queued = false;
+
+	pthread_mutex_lock(&wq->lock);
+	if (! work->pending) {
+		work->pending = true;
+		work->due_ns = due_ns;
+		list_add_tail(&work->entry, &wq->works);
+		pthread_cond_broadcast(&wq->cond);
+		queued = true;
+	}
+	pthread_mutex_unlock(&wq->lock);
+	return queued;
+}
+
+bool queue_work(struct workqueue_struct *wq, struct work_struct *work) {
+	return __queue_work(wq, work, 0);
+}
+
+bool queue_delayed_work(struct workqueue_struct *wq, struct delayed_work *dwork,
+		unsigned long delay) {
+	return __queue_work(wq, &dwork->work,
+			shim_now_ns() + (u64) delay * (NSEC_PER_SEC / HZ));
+}
+
+static void system_wq_init(void) {
+	system_wq = alloc_workqueue("events", 0, 0);
+	BUG_ON(! system_wq);
+}
+
+static struct workqueue_struct *get_system_wq(void) {
+	pthread_once(&system_wq_once, system_wq_init);
+	return system_wq;
+}
+
+bool schedule_work(struct work_struct *work) {
+	return queue_work(get_system_wq(), work);
+}
+
+bool schedule_delayed_work(struct delayed_work *dwork, unsigned long delay) {
+	return queue_delayed_work(get_system_wq(), dwork, delay);
+}
+
+static bool cancel_on(struct workqueue_struct *wq, struct work_struct *work) {
+	bool pending;
+
+	pthread_mutex_lock(&wq->lock);
+	pending = work->pending;
+	if (pending) {
+		list_del_init(&work->entry);
+		work->pending = false;
+	}
+	while (wq->running == work)
+		pthread_cond_wait(&wq->cond, &wq->lock);
+	pthread_mutex_unlock(&wq->lock);
+	return pending;
+}
+
+bool cancel_work_sync(struct work_struct *work) {
+	struct workqueue_struct *wq;
+	bool pending = false;
+
+	/* the work doesn't know its queue, so look on all of them */
+	pthread_mutex_lock(&queues_lock);
+	list_for_each_entry(wq, &queues, list)
+		pending |= cancel_on(wq, work);
+	pthread_mutex_unlock(&queues_lock);
+	return pending;
+}
+
+bool cancel_delayed_work_sync(struct delayed_work *dwork) {
+	return cancel_work_sync(&dwork->work);
+}
+
+void flush_workqueue(struct workqueue_struct *wq) {
+	pthread_mutex_lock(&wq->lock);
+	while (! list_empty(&wq->works) || wq->running)
+		pthread_cond_wait(&wq->cond, &wq->lock);
+	pthread_mutex_unlock(&wq->lock);
+}
+
+void flush_scheduled_work(void) {
+	if (system_wq)
+		flush_workqueue(system_wq);
+}
+
+/* pages: each its own mapping, so that a grant can be mapped over it */
+
+#define PAGE_HASH_BITS		10
+
+static struct page *page_hash[1 << PAGE_HASH_BITS];
+static pthread_mutex_t page_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline unsigned int page_bucket(const void *addr) {
+	return hash_32((u32) ((unsigned long) addr >> PAGE_SHIFT), PAGE_HASH_BITS);
+}
+
+struct page *alloc_page(gfp_t gfp) {
+	struct page *page;
+	void *addr;
+
+	page = malloc(sizeof(*page));
+	if (! page)
+		return NULL;
+	addr = mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED) {
+		free(page);
+		return NULL;
+	}
+	page->virtual = addr;
+	pthread_mutex_lock(&page_lock);
+	page->hash = page_hash[page_bucket(addr)];
+	page_hash[page_bucket(addr)] = page;
+	pthread_mutex_unlock(&page_lock);
+	return page;
+}
+
+struct page *shim_virt_to_page(const void *addr) {
+	struct page *page;
+
+	addr = (const void *) ((unsigned long) addr & PAGE_MASK);
+	pthread_mutex_lock(&page_lock);
+	for (page = page_hash[page_bucket(addr)]; page; page = page->hash)
+		if (page->virtual == addr)
+			break;
+	pthread_mutex_unlock(&page_lock);
+	BUG_ON(! page);
+	return page;
+}
+
+void __free_page(struct page *page) {
+	struct page **p;
+
+	pthread_mutex_lock(&page_lock);
+	for (p = &page_hash[page_bucket(page->virtual)]; *p != page; p = &(*p)->hash)
+		;
+	*p = page->hash;
+	pthread_mutex_unlock(&page_lock);
+	munmap(page->virtual, PAGE_SIZE);
+	free(page);
+}
+
+unsigned long __get_free_page(gfp_t gfp) {
+	struct page *page = alloc_page(gfp);
+
+	return page ? (unsigned long) page->virtual : 0;
+}
+
+unsigned long get_zeroed_page(gfp_t gfp) {
+	/* fresh anonymous memory is zero */
+	return __get_free_page(gfp);
+}
+
+void free_page(unsigned long addr) {
+	if (addr)
+		__free_page(virt_to_page((void *) addr));
+}
+
+/* odds and ends */
+
+void get_random_bytes(void *buf, int nbytes) {
+	u8 *p = buf;
+	ssize_t n;
+
+	while (nbytes > 0) {
+		n = getrandom(p, nbytes, 0);
+		if (n <= 0)
+			BUG();
+		p += n;
+		nbytes -= n;
+	}
+}
+
+void sort(void *base, size_t num, size_t size,
+		int (*cmp)(const void *, const void *),
+		void (*swap_fn)(void *, void *, int)) {
+	qsort(base, num, size, cmp);
+}
+
+/* an insertion sort: stable, like the kernel's, and the lists are short */
+void list_sort(void *priv, struct list_head *head,
+		int (*cmp)(void *priv, struct list_head *a, struct list_head *b)) {
+	struct list_head *pos, *next, *at;
+
+	for (pos = head->next->next; pos != head; pos = next) {
+		next = pos->next;
+		for (at = pos->prev; at != head && cmp(priv, at, pos) > 0; at = at->prev)
+			;
+		if (at == pos->prev)
+			continue;
+		list_del(pos);
+		list_add(pos, at);
+	}
+}
+
+static u32 crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_init(void) {
+	u32 i, j, c;
+
+	for (i = 0; i < 256; i++) {
+		for (c = i, j = 0; j < 8; j++)
+			c = c & 1 ? (c >> 1) ^ 0xedb88320 : c >> 1;
+		crc_table[i] = c;
+	}
+}
+
+u32 crc32_le(u32 crc, const unsigned char *p, size_t len) {
+	pthread_once(&crc_once, crc_init);
+	while (len--)
+		crc = (crc >> 8) ^ crc_table[(crc ^ *p++) & 0xff];
+	return crc;
+}
+
+unsigned long find_next_bit(const unsigned long *addr, unsigned long size,
+		unsigned long offset) {
+	for (; offset < size; offset++)
+		if (test_bit(offset, addr))
+			return offset;
+	return size;
+}
+
+unsigned long find_next_zero_bit(const unsigned long *addr, unsigned long size,
+		unsigned long offset) {
+	for (; offset < size; offset++)
+		if (! test_bit(offset, addr))
+			return offset;
+	return size;
+}
@@ -0,0 +1,54 @@
+#ifndef _SHIM_H
+#define _SHIM_H
+
+/*
+ * What the harness itself gets from the shims, beyond the kernel API.
+ */
+
+/**
+ * Starts fn(arg) on a thread that is a cpu of its own, see kernel.h, and
+ * whose cpu time shim_threads_cpu() reports under name.
+ */
+extern int shim_thread_start(pthread_t *, const char *name,
+		void *(*fn)(void *), void *arg);
+extern void shim_thread_exited(pthread_t);
+
+/**
+ * Fills in the name and cpu time so far of up to max running threads, and
+ * returns how many there are.
+ */
+extern unsigned int shim_threads_cpu(const char **names, u64 *ns, unsigned int max);
+
+/**
+ * Submits whatever the plug of this thread holds, as the kernel does before
+ * a task sleeps.
+ */
+extern void shim_flush_plug(void);
+
+/**
+ * Sets up nr_pages of guest memory. Grant reference n is page n of it.
+ * Returns the guest's own mapping, or NULL.
+ */
+extern void *shim_guest_alloc(unsigned int nr_pages);
+
+/**
+ * Maps the page of a grant at a fresh address, as xenbus does the ring.
+ */
+extern void *shim_guest_map(grant_ref_t);
+
+/* drops everything the module printk()s, while set */
+extern bool shim_quiet;
+
+/* what went through the emulated hypervisor */
+struct shim_xen_stats {
+	atomic64_t		maps;		/* grants mapped */
+	atomic64_t		unmaps;
+	atomic64_t		map_calls;	/* grant table ops */
+	atomic64_t		unmap_calls;
+	atomic64_t		notify;		/* notify_remote_via_irq() */
+	atomic64_t		irqs;		/* handler calls */
+};
+
+extern struct shim_xen_stats shim_xen_stats;
+
+#endif
@@ -0,0 +1,476 @@
+/*
+ * shim_blk.c -- bios and the devices they go to
+ *
+ * "ram:<MiB>" copies in submit_bio() and completes there too, as brd does,
+ * so it costs nothing but the request path itself. "file:<path>" and
+ * "direct:<path>" (O_DIRECT) hand each bio to Linux AIO as one vectored
+ * read or write, and a reaper thread completes them as they come back, like
+ * the completion interrupt of a real disk. A flush without data is an
+ * asynchronous fdatasync, and data sent with a flush is written with
+ * RWF_DSYNC, which gives the ordering of REQ_FLUSH without a separate
+ * cache flush ahead of it.
+ */
+
+#include <fcntl.h>
+#include <linux/aio_abi.h>
+#include <linux/falloc.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "shim.h"
+
+struct bio *bio_alloc(gfp_t gfp, unsigned int nr_iovecs) {
+	struct bio *bio;
+
+	bio = calloc(1, sizeof(*bio) + nr_iovecs * sizeof(struct bio_vec));
+	if (! bio)
+		return NULL;
+	bio->bi_flags = 1UL << BIO_UPTODATE;
+	bio->bi_max_vecs = nr_iovecs;
+	bio->bi_io_vec = bio->bi_inline_vecs;
+	return bio;
+}
+
+void bio_put(struct bio *bio) {
+	free(bio);
+}
+
+int bio_add_page(struct bio *bio, struct page *page, unsigned int len,
+		unsigned int offset) {
+	struct bio_vec *bv;
+
+	if (bio->bi_vcnt >= bio->bi_max_vecs ||
+	    ((bio->bi_size + len) >> 9) > BIO_MAX_SECTORS)
+		return 0;
+	bv = &bio->bi_io_vec[bio->bi_vcnt++];
+	bv->bv_page = page;
+	bv->bv_len = len;
+	bv->bv_offset = offset;
+	bio->bi_size += len;
+	return len;
+}
+
+/* like a request completing: the bio is advanced past what it moved */
+void bio_endio(struct bio *bio, int error) {
+	if (error)
+		clear_bit(BIO_UPTODATE, &bio->bi_flags);
+	else {
+		bio->bi_sector += bio->bi_size >> 9;
+		bio->bi_size = 0;
+		bio->bi_idx = bio->bi_vcnt;
+	}
+	bio->bi_end_io(bio, error);
+}
+
+static __thread struct blk_plug *plug;
+
+void blk_start_plug(struct blk_plug *p) {
+	p->head = NULL;
+	p->tail = &p->head;
+	/* nested plugs leave it to the outermost */
+	if (! plug)
+		plug = p;
+}
+
+/* hands a list to each device in turn, in the order it was submitted */
+static void submit_list(struct bio *list) {
+	struct block_device *bdev;
+	struct bio *bio, *run, **tail;
+
+	while (list) {
+		bdev = list->bi_bdev;
+		run = NULL;
+		tail = &run;
+		while (list && list->bi_bdev == bdev) {
+			bio = list;
+			list = bio->bi_next;
+			bio->bi_next = NULL;
+			*tail = bio;
+			tail = &bio->bi_next;
+		}
+		bdev->ops->submit(bdev, run);
+	}
+}
+
+void blk_finish_plug(struct blk_plug *p) {
+	if (plug != p)
+		return;
+	plug = NULL;
+	submit_list(p->head);
+}
+
+void shim_flush_plug(void) {
+	struct bio *list;
+
+	if (! plug || ! plug->head)
+		return;
+	list = plug->head;
+	plug->head = NULL;
+	plug->tail = &plug->head;
+	submit_list(list);
+}
+
+void submit_bio(int rw, struct bio *bio) {
+	bio->bi_rw |= rw;
+	bio->bi_next = NULL;
+	if (plug) {
+		*plug->tail = bio;
+		plug->tail = &bio->bi_next;
+		return;
+	}
+	bio->bi_bdev->ops->submit(bio->bi_bdev, bio);
+}
+
+int blkdev_issue_discard(struct block_device *bdev, sector_t sector,
+		sector_t nr_sects, gfp_t gfp, unsigned long flags) {
+	if (! bdev->ops->discard)
+		return -EOPNOTSUPP;
+	if (sector + nr_sects > get_capacity(bdev->bd_disk))
+		return -EINVAL;
+	return bdev->ops->discard(bdev, sector, nr_sects);
+}
+
+/* ram */
+
+struct ram_dev {
+	char			*mem;
+	size_t			size;
+};
+
+static void ram_submit(struct block_device *bdev, struct bio *list) {
+	struct ram_dev *ram = bdev->priv;
+	struct bio_vec *bv;
+	struct bio *bio;
+	size_t pos;
+	char *buf;
+	int i;
+
+	while ((bio = list)) {
+		list = bio->bi_next;
+		pos = (size_t) bio->bi_sector << 9;
+		if (pos + bio->bi_size > ram->size) {
+			bio_endio(bio, -EIO);
+			continue;
+		}
+		bio_for_each_segment(bv, bio, i) {
+			buf = (char *) page_address(bv->bv_page) + bv->bv_offset;
+			if (bio->bi_rw & REQ_WRITE)
+				memcpy(ram->mem + pos, buf, bv->bv_len);
+			else
+				memcpy(buf, ram->mem + pos, bv->bv_len);
+			pos += bv->bv_len;
+		}
+		bio_endio(bio, 0);
+	}
+}
+
+static int ram_discard(struct block_device *bdev, sector_t sector,
+		sector_t nr_sects) {
+	struct ram_dev *ram = bdev->priv;
+
+	memset(ram->mem + (sector << 9), 0, nr_sects << 9);
+	return 0;
+}
+
+static void ram_close(struct block_device *bdev) {
+	struct ram_dev *ram = bdev->priv;
+
+	munmap(ram->mem, ram->size);
+	free(ram);
+}
+
+static const struct shim_bdev_ops ram_ops = {
+	.submit		= ram_submit,
+	.discard	= ram_discard,
+	.close		= ram_close,
+};
+
+static int ram_open(struct block_device *bdev, const char *arg) {
+	struct ram_dev *ram;
+	char *end;
+	size_t mib;
+
+	mib = strtoul(arg, &end, 0);
+	if (! mib || *end) {
+		fprintf(stderr, "ram:%s: want a size in MiB\n", arg);
+		return -EINVAL;
+	}
+	ram = calloc(1, sizeof(*ram));
+	if (! ram)
+		return -ENOMEM;
+	ram->size = mib << 20;
+	ram->mem = mmap(NULL, ram->size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (ram->mem == MAP_FAILED) {
+		free(ram);
+		return -ENOMEM;
+	}
+	bdev->priv = ram;
+	bdev->ops = &ram_ops;
+	bdev->bd_disk->capacity = ram->size >> 9;
+	bdev->bd_queue->discard = true;
+	return 0;
+}
+
+/* Linux AIO, through the system calls since libaio needn't be installed */
+
+#define AIO_EVENTS		1024
+#define AIO_BATCH		64
+
+struct aio_dev {
+	int			fd;
+	aio_context_t		ctx;
+	pthread_t		reaper;
+	volatile bool		stop;
+	bool			no_aio_fsync;	/* fdatasync inline instead */
+};
+
+/* what the kernel knows a bio by while it is in flight */
+struct aio_io {
+	struct iocb		cb;
+	struct bio		*bio;
+	struct iovec		iov[0];
+};
+
+static inline long io_setup(unsigned int nr, aio_context_t *ctx) {
+	return syscall(SYS_io_setup, nr, ctx);
+}
+
+static inline long io_destroy(aio_context_t ctx) {
+	return syscall(SYS_io_destroy, ctx);
+}
+
+static inline long io_submit(aio_context_t ctx, long nr, struct iocb **cbs) {
+	return syscall(SYS_io_submit, ctx, nr, cbs);
+}
+
+static inline long io_getevents(aio_context_t ctx, long min_nr, long nr,
+		struct io_event *events, struct timespec *timeout) {
+	return syscall(SYS_io_getevents, ctx, min_nr, nr, events, timeout);
+}
+
+static void aio_complete(struct aio_io *io, long res) {
+	struct bio *bio = io->bio;
+	int error = 0;
+
+	if (res < 0)
+		error = res;
+	else if ((unsigned long) res != bio->bi_size && io->cb.aio_lio_opcode !=
+		 IOCB_CMD_FDSYNC)
+		error = -EIO;
+	free(io);
+	bio_endio(bio, error);
+}
+
+static void *aio_reaper(void *arg) {
+	struct aio_dev *dev = arg;
+	struct io_event events[AIO_BATCH];
+	struct timespec timeout;
+	long i, nr;
+
+	while (! dev->stop) {
+		/* looks up now and then to see whether it should stop */
+		timeout.tv_sec = 0;
+		timeout.tv_nsec = 100 * NSEC_PER_MSEC;
+		nr = io_getevents(dev->ctx, 1, AIO_BATCH, events, &timeout);
+		for (i = 0; i < nr; i++)
+			aio_complete((struct aio_io *) (unsigned long) events[i].data,
+					events[i].res);
+	}
+	return NULL;
+}
+
+static struct aio_io *aio_prep(struct aio_dev *dev, struct bio *bio) {
+	struct aio_io *io;
+	struct bio_vec *bv;
+	int i, n = 0;
+
+	io = calloc(1, sizeof(*io) + bio->bi_vcnt * sizeof(struct iovec));
+	if (! io)
+		return NULL;
+	io->bio = bio;
+	io->cb.aio_data = (unsigned long) io;
+	io->cb.aio_fildes = dev->fd;
+	if (! bio->bi_size) {
+		io->cb.aio_lio_opcode = IOCB_CMD_FDSYNC;
+		return io;
+	}
+	bio_for_each_segment(bv, bio, i) {
+		io->iov[n].iov_base = (char *) page_address(bv->bv_page) + bv->bv_offset;
+		io->iov[n++].iov_len = bv->bv_len;
+	}
+	io->cb.aio_lio_opcode = bio->bi_rw & REQ_WRITE ? IOCB_CMD_PWRITEV :
+		IOCB_CMD_PREADV;
+	io->cb.aio_buf = (unsigned long) io->iov;
+	io->cb.aio_nbytes = n;
+	io->cb.aio_offset = (long long) bio->bi_sector << 9;
+	if (bio->bi_rw & (REQ_FLUSH | REQ_FUA))
+		io->cb.aio_rw_flags = RWF_DSYNC;
+	return io;
+}
+
+static void aio_submit(struct block_device *bdev, struct bio *list) {
+	struct aio_dev *dev = bdev->priv;
+	struct iocb *cbs[AIO_BATCH];
+	struct aio_io *io;
+	struct bio *bio;
+	long nr = 0, done, i;
+
+	while (list || nr) {
+		while (list && nr < AIO_BATCH) {
+			bio = list;
+			list = bio->bi_next;
+			bio->bi_next = NULL;
+			io = aio_prep(dev, bio);
+			if (! io) {
+				bio_endio(bio, -ENOMEM);
+				continue;
+			}
+			if (io->cb.aio_lio_opcode == IOCB_CMD_FDSYNC && dev->no_aio_fsync) {
+				aio_complete(io, fdatasync(dev->fd) ? -errno : 0);
+				continue;
+			}
+			cbs[nr++] = &io->cb;
+		}
+		if (! nr)
+			break;
+		done = io_submit(dev->ctx, nr, cbs);
+		if (done < 0) {
+			done = -errno;
+			if (done == -EAGAIN)
+				continue;
+			io = (struct aio_io *) (unsigned long) cbs[0]->aio_data;
+			/* older kernels and some filesystems can't fsync by AIO */
+			if (done == -EINVAL && io->cb.aio_lio_opcode == IOCB_CMD_FDSYNC) {
+				dev->no_aio_fsync = true;
+				aio_complete(io, fdatasync(dev->fd) ? -errno : 0);
+			} else
+				aio_complete(io, done);
+			done = 1;
+		}
+		nr -= done;
+		for (i = 0; i < nr; i++)
+			cbs[i] = cbs[i + done];
+	}
+}
+
+static int aio_discard(struct block_device *bdev, sector_t sector,
+		sector_t nr_sects) {
+	struct aio_dev *dev = bdev->priv;
+
+	if (! fallocate(dev->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+			(off_t) sector << 9, (off_t) nr_sects << 9))
+		return 0;
+	return errno == EOPNOTSUPP ? -EOPNOTSUPP : -errno;
+}
+
+static void aio_close(struct block_device *bdev) {
+	struct aio_dev *dev = bdev->priv;
+
+	dev->stop = true;
+	pthread_join(dev->reaper, NULL);
+	shim_thread_exited(dev->reaper);
+	io_destroy(dev->ctx);
+	close(dev->fd);
+	free(dev);
+}
+
+static const struct shim_bdev_ops aio_ops = {
+	.submit		= aio_submit,
+	.discard	= aio_discard,
+	.close		= aio_close,
+};
+
+static int aio_open(struct block_device *bdev, const char *path, bool direct,
+		bool readonly) {
+	struct aio_dev *dev;
+	struct stat st;
+	off_t size;
+	int err;
+
+	dev = calloc(1, sizeof(*dev));
+	if (! dev)
+		return -ENOMEM;
+	dev->fd = open(path, (readonly ? O_RDONLY : O_RDWR) | (direct ? O_DIRECT : 0));
+	if (dev->fd < 0) {
+		err = -errno;
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		goto fail;
+	}
+	if (fstat(dev->fd, &st))
+		goto fail_errno;
+	size = S_ISBLK(st.st_mode) ? lseek(dev->fd, 0, SEEK_END) : st.st_size;
+	if (size < (off_t) PAGE_SIZE) {
+		fprintf(stderr, "%s: too small to be a disk\n", path);
+		err = -EINVAL;
+		goto fail_close;
+	}
+	if (io_setup(AIO_EVENTS, &dev->ctx))
+		goto fail_errno;
+	err = shim_thread_start(&dev->reaper, "aio-reaper", aio_reaper, dev);
+	if (err) {
+		io_destroy(dev->ctx);
+		goto fail_close;
+	}
+	bdev->priv = dev;
+	bdev->ops = &aio_ops;
+	bdev->bd_disk->capacity = size >> 9;
+	bdev->bd_queue->discard = S_ISREG(st.st_mode);
+	bdev->bd_queue->flush_flags = REQ_FLUSH | REQ_FUA;
+	return 0;
+
+ fail_errno:
+	err = -errno;
+	fprintf(stderr, "%s: %s\n", path, strerror(errno));
+ fail_close:
+	close(dev->fd);
+ fail:
+	free(dev);
+	return err;
+}
+
+struct block_device *shim_bdev_open(const char *spec, bool readonly) {
+	struct block_device *bdev;
+	int err = -EINVAL;
+
+	bdev = calloc(1, sizeof(*bdev));
+	if (! bdev)
+		return NULL;
+	bdev->bd_disk = calloc(1, sizeof(*bdev->bd_disk));
+	bdev->bd_queue = calloc(1, sizeof(*bdev->bd_queue));
+	bdev->bd_inode = calloc(1, sizeof(*bdev->bd_inode));
+	if (! bdev->bd_disk || ! bdev->bd_queue || ! bdev->bd_inode)
+		goto fail;
+	bdev->bd_block_size = 512;
+	snprintf(bdev->bd_disk->disk_name, sizeof(bdev->bd_disk->disk_name), "%s",
+			spec);
+	if (! strncmp(spec, "ram:", 4))
+		err = ram_open(bdev, spec + 4);
+	else if (! strncmp(spec, "file:", 5))
+		err = aio_open(bdev, spec + 5, false, readonly);
+	else if (! strncmp(spec, "direct:", 7))
+		err = aio_open(bdev, spec + 7, true, readonly);
+	else
+		fprintf(stderr, "%s: want ram:<MiB>, file:<path> or direct:<path>\n",
+				spec);
+	if (! err)
+		return bdev;
+
+ fail:
+	free(bdev->bd_disk);
+	free(bdev->bd_queue);
+	free(bdev->bd_inode);
+	free(bdev);
+	return NULL;
+}
+
+void shim_bdev_close(struct block_device *bdev) {
+	bdev->ops->close(bdev);
+	free(bdev->bd_disk);
+	free(bdev->bd_queue);
+	free(bdev->bd_inode);
+	free(bdev);
+}
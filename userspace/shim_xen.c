@@ -0,0 +1,190 @@
+/*
+ * shim_xen.c -- grants and event channels without a hypervisor
+ *
+ * The guest's memory is a memfd. Mapping a grant maps the granted page of it
+ * over the backend page at host_addr, read only if the grant is, so the
+ * backend does I/O straight to and from guest memory as it does under Xen;
+ * unmapping puts fresh anonymous memory back. The mmap calls cost what the
+ * map and unmap hypercalls do in kind if not in size: a page table update
+ * and a TLB flush per page.
+ *
+ * An event channel is a pair of eventfds. The backend's irq handler runs on
+ * a thread of its own that reads its eventfd, and notify_remote_via_irq()
+ * writes the other one. Like event channels, an eventfd is a pending flag:
+ * notifications sent before the handler runs are delivered once.
+ */
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "shim.h"
+
+struct shim_xen_stats shim_xen_stats;
+
+static int guest_fd = -1;
+static unsigned int guest_pages;
+
+void *shim_guest_alloc(unsigned int nr_pages) {
+	void *base;
+
+	guest_fd = memfd_create("guest", 0);
+	if (guest_fd < 0)
+		return NULL;
+	if (ftruncate(guest_fd, (off_t) nr_pages << PAGE_SHIFT))
+		goto fail;
+	base = mmap(NULL, (size_t) nr_pages << PAGE_SHIFT, PROT_READ | PROT_WRITE,
+			MAP_SHARED, guest_fd, 0);
+	if (base == MAP_FAILED)
+		goto fail;
+	guest_pages = nr_pages;
+	return base;
+
+ fail:
+	close(guest_fd);
+	guest_fd = -1;
+	return NULL;
+}
+
+void *shim_guest_map(grant_ref_t ref) {
+	void *addr;
+
+	if (ref >= guest_pages)
+		return NULL;
+	addr = mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, guest_fd,
+			(off_t) ref << PAGE_SHIFT);
+	return addr == MAP_FAILED ? NULL : addr;
+}
+
+/* machine frames of the guest start here, so a bad one stands out */
+#define GUEST_FRAME_BASE	0x100000UL
+
+static void map_grant(struct gnttab_map_grant_ref *map) {
+	int prot = PROT_READ;
+	void *addr;
+
+	if (map->ref >= guest_pages || ! (map->flags & GNTMAP_host_map)) {
+		map->status = GNTST_bad_gntref;
+		return;
+	}
+	if (! (map->flags & GNTMAP_readonly))
+		prot |= PROT_WRITE;
+	addr = mmap((void *) (unsigned long) map->host_addr, PAGE_SIZE, prot,
+			MAP_SHARED | MAP_FIXED, guest_fd, (off_t) map->ref << PAGE_SHIFT);
+	if (addr == MAP_FAILED) {
+		map->status = GNTST_general_error;
+		return;
+	}
+	map->status = GNTST_okay;
+	map->handle = map->ref;
+	map->dev_bus_addr = (u64) (GUEST_FRAME_BASE + map->ref) << PAGE_SHIFT;
+	atomic64_inc(&shim_xen_stats.maps);
+}
+
+static void unmap_grant(struct gnttab_unmap_grant_ref *unmap) {
+	void *addr;
+
+	addr = mmap((void *) (unsigned long) unmap->host_addr, PAGE_SIZE,
+			PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+			-1, 0);
+	unmap->status = addr == MAP_FAILED ? GNTST_general_error : GNTST_okay;
+	atomic64_inc(&shim_xen_stats.unmaps);
+}
+
+int HYPERVISOR_grant_table_op(unsigned int cmd, void *uop, unsigned int count) {
+	unsigned int i;
+
+	switch (cmd) {
+	case GNTTABOP_map_grant_ref:
+		atomic64_inc(&shim_xen_stats.map_calls);
+		for (i = 0; i < count; i++)
+			map_grant((struct gnttab_map_grant_ref *) uop + i);
+		return 0;
+	case GNTTABOP_unmap_grant_ref:
+		atomic64_inc(&shim_xen_stats.unmap_calls);
+		for (i = 0; i < count; i++)
+			unmap_grant((struct gnttab_unmap_grant_ref *) uop + i);
+		return 0;
+	default:
+		return -ENOSYS;
+	}
+}
+
+/* event channels */
+
+#define SHIM_IRQS		16
+
+struct shim_irq {
+	int			evtchn;		/* eventfd the handler waits on */
+	int			remote;		/* eventfd to notify */
+	irq_handler_t		handler;
+	void			*dev_id;
+	pthread_t		thread;
+	volatile bool		stop;
+};
+
+static struct shim_irq irqs[SHIM_IRQS];
+
+static void *irq_thread(void *arg) {
+	struct shim_irq *irq = arg;
+	u64 count;
+
+	while (! irq->stop) {
+		if (read(irq->evtchn, &count, sizeof(count)) != sizeof(count))
+			continue;
+		if (irq->stop)
+			break;
+		atomic64_inc(&shim_xen_stats.irqs);
+		irq->handler(irq - irqs, irq->dev_id);
+	}
+	return NULL;
+}
+
+int bind_interdomain_evtchn_to_irqhandler(unsigned int remote_domain,
+		unsigned int evtchn, irq_handler_t handler, unsigned long irqflags,
+		const char *devname, void *dev_id) {
+	struct shim_irq *irq;
+	int nr, err;
+
+	/* irq 0 means unbound to blkback */
+	for (nr = 1; nr < SHIM_IRQS; nr++)
+		if (! irqs[nr].handler)
+			break;
+	if (nr == SHIM_IRQS)
+		return -ENOSPC;
+	irq = &irqs[nr];
+	irq->evtchn = evtchn;
+	irq->remote = -1;
+	irq->handler = handler;
+	irq->dev_id = dev_id;
+	irq->stop = false;
+	err = shim_thread_start(&irq->thread, devname, irq_thread, irq);
+	if (err) {
+		irq->handler = NULL;
+		return err;
+	}
+	return nr;
+}
+
+void unbind_from_irqhandler(unsigned int nr, void *dev_id) {
+	struct shim_irq *irq = &irqs[nr];
+	u64 one = 1;
+
+	irq->stop = true;
+	if (write(irq->evtchn, &one, sizeof(one)) != sizeof(one))
+		BUG();
+	pthread_join(irq->thread, NULL);
+	shim_thread_exited(irq->thread);
+	irq->handler = NULL;
+}
+
+void shim_evtchn_set_remote(unsigned int nr, int fd) {
+	irqs[nr].remote = fd;
+}
+
+void notify_remote_via_irq(int nr) {
+	u64 one = 1;
+
+	atomic64_inc(&shim_xen_stats.notify);
+	if (write(irqs[nr].remote, &one, sizeof(one)) != sizeof(one))
+		BUG();
+}
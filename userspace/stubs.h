@@ -0,0 +1,89 @@
+/*
+ * stubs.h -- kernel facilities the request path names but never needs
+ * working here: tracepoints, debugfs, seq_file and procfs
+ */
+
+#ifndef _SHIM_STUBS_H
+#define _SHIM_STUBS_H
+
+/* tracepoints compile to nothing, as with tracing configured out */
+
+#define TP_PROTO(args...)	args
+#define TP_ARGS(args...)	args
+#define TP_STRUCT__entry(args...)
+#define TP_fast_assign(args...)
+#define TP_printk(fmt, args...)
+#define DECLARE_EVENT_CLASS(name, proto, args, tstruct, assign, print)
+#define DEFINE_EVENT(template, name, proto, args)			\
+	static inline void trace_##name(proto) { }
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print)		\
+	static inline void trace_##name(proto) { }
+
+/* red-black trees, see rbtree.c */
+
+struct rb_node {
+	unsigned long		__rb_parent_color;
+	struct rb_node		*rb_right;
+	struct rb_node		*rb_left;
+} __attribute__((aligned(sizeof(long))));
+
+struct rb_root {
+	struct rb_node		*rb_node;
+};
+
+#define RB_ROOT			(struct rb_root) { NULL, }
+#define rb_entry(ptr, type, member)	container_of(ptr, type, member)
+#define rb_parent(r)		((struct rb_node *) ((r)->__rb_parent_color & ~3))
+#define RB_EMPTY_ROOT(root)	((root)->rb_node == NULL)
+
+static inline void rb_link_node(struct rb_node *node, struct rb_node *parent,
+		struct rb_node **rb_link) {
+	node->__rb_parent_color = (unsigned long) parent;
+	node->rb_left = node->rb_right = NULL;
+	*rb_link = node;
+}
+
+extern void rb_insert_color(struct rb_node *, struct rb_root *);
+extern void rb_erase(struct rb_node *, struct rb_root *);
+extern struct rb_node *rb_next(const struct rb_node *);
+extern struct rb_node *rb_prev(const struct rb_node *);
+extern struct rb_node *rb_first(const struct rb_root *);
+extern struct rb_node *rb_last(const struct rb_root *);
+
+/* debugfs and seq_file: nothing is ever created, so nothing is ever read */
+
+struct dentry;
+struct seq_file {
+	void			*private;
+};
+
+struct file_operations {
+	struct module		*owner;
+	int			(*open)(struct inode *, struct file *);
+	ssize_t			(*read)(struct file *, char __user *, size_t, loff_t *);
+	ssize_t			(*write)(struct file *, const char __user *, size_t,
+					loff_t *);
+	loff_t			(*llseek)(struct file *, loff_t, int);
+	int			(*mmap)(struct file *, void *);
+	int			(*release)(struct inode *, struct file *);
+};
+
+static inline struct dentry *debugfs_create_dir(const char *name,
+		struct dentry *parent) {
+	return NULL;
+}
+static inline struct dentry *debugfs_create_file(const char *name, umode_t mode,
+		struct dentry *parent, void *data, const struct file_operations *fops) {
+	return NULL;
+}
+static inline void debugfs_remove(struct dentry *dentry) { }
+static inline void debugfs_remove_recursive(struct dentry *dentry) { }
+
+extern int seq_printf(struct seq_file *, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+extern ssize_t seq_read(struct file *, char __user *, size_t, loff_t *);
+extern loff_t seq_lseek(struct file *, loff_t, int);
+extern int single_open(struct file *, int (*)(struct seq_file *, void *), void *);
+extern int single_release(struct inode *, struct file *);
+
+#endif
@@ -0,0 +1,332 @@
+/*
+ * xen.h -- the Xen interfaces blkback talks through: shared rings, the block
+ * interface, grant tables, event channels and xenbus. The ring and request
+ * layouts are those of xen/interface/io/{ring,blkif}.h for x86_64; grants
+ * and event channels are emulated in shim_xen.c.
+ */
+
+#ifndef _SHIM_XEN_H
+#define _SHIM_XEN_H
+
+typedef u16 domid_t;
+typedef u32 grant_ref_t;
+typedef u32 grant_handle_t;
+
+static inline int xen_pv_domain(void) { return 1; }
+static inline int xen_domain(void) { return 1; }
+
+/* grant tables: a grant reference is a page of the guest's memory */
+
+#define GNTMAP_host_map		(1 << 1)
+#define GNTMAP_readonly		(1 << 2)
+
+#define GNTST_okay		0
+#define GNTST_bad_gntref	(-4)
+#define GNTST_general_error	(-1)
+
+#define GNTTABOP_map_grant_ref		0
+#define GNTTABOP_unmap_grant_ref	1
+
+struct gnttab_map_grant_ref {
+	u64			host_addr;
+	u32			flags;
+	grant_ref_t		ref;
+	domid_t			dom;
+	s16			status;
+	grant_handle_t		handle;
+	u64			dev_bus_addr;
+};
+
+struct gnttab_unmap_grant_ref {
+	u64			host_addr;
+	u64			dev_bus_addr;
+	grant_handle_t		handle;
+	s16			status;
+};
+
+static inline void gnttab_set_map_op(struct gnttab_map_grant_ref *map,
+		unsigned long addr, u32 flags, grant_ref_t ref, domid_t domid) {
+	map->host_addr = addr;
+	map->flags = flags;
+	map->ref = ref;
+	map->dom = domid;
+}
+
+static inline void gnttab_set_unmap_op(struct gnttab_unmap_grant_ref *unmap,
+		unsigned long addr, u32 flags, grant_handle_t handle) {
+	unmap->host_addr = addr;
+	unmap->handle = handle;
+	unmap->dev_bus_addr = 0;
+}
+
+extern int HYPERVISOR_grant_table_op(unsigned int cmd, void *uop,
+		unsigned int count);
+
+/* there is no p2m to fix up: the mapping itself moved the page */
+static inline int m2p_add_override(unsigned long mfn, struct page *page,
+		struct gnttab_map_grant_ref *kmap_op) {
+	return 0;
+}
+static inline int m2p_remove_override(struct page *page, bool clear_pte) {
+	return 0;
+}
+
+/* event channels: an eventfd each way, see shim_xen.c */
+
+typedef enum {
+	IRQ_NONE,
+	IRQ_HANDLED
+} irqreturn_t;
+
+typedef irqreturn_t (*irq_handler_t)(int, void *);
+
+/**
+ * Calls handler(irq, dev_id) from a thread of its own whenever evtchn, an
+ * eventfd, is signalled. Returns the irq, or a negative errno.
+ */
+extern int bind_interdomain_evtchn_to_irqhandler(unsigned int remote_domain,
+		unsigned int evtchn, irq_handler_t handler, unsigned long irqflags,
+		const char *devname, void *dev_id);
+extern void unbind_from_irqhandler(unsigned int irq, void *dev_id);
+
+/**
+ * Sets the eventfd notify_remote_via_irq(irq) signals.
+ */
+extern void shim_evtchn_set_remote(unsigned int irq, int fd);
+extern void notify_remote_via_irq(int irq);
+
+/* xenbus: the harness has no store, so writes go nowhere */
+
+enum xenbus_state {
+	XenbusStateUnknown,
+	XenbusStateInitialising,
+	XenbusStateInitWait,
+	XenbusStateInitialised,
+	XenbusStateConnected,
+	XenbusStateClosing,
+	XenbusStateClosed,
+	XenbusStateReconfiguring,
+	XenbusStateReconfigured
+};
+
+struct xenbus_transaction {
+	u32			id;
+};
+
+#define XBT_NIL			((struct xenbus_transaction) { 0 })
+
+struct xenbus_device {
+	const char		*nodename;
+	enum xenbus_state	state;
+};
+
+static inline int xenbus_transaction_start(struct xenbus_transaction *t) {
+	t->id = 1;
+	return 0;
+}
+static inline int xenbus_transaction_end(struct xenbus_transaction t, int abort) {
+	return 0;
+}
+static inline int xenbus_printf(struct xenbus_transaction t, const char *dir,
+		const char *node, const char *fmt, ...) {
+	return 0;
+}
+
+/* shared rings, as xen/interface/io/ring.h has them */
+
+typedef unsigned int RING_IDX;
+
+#define __RD2(_x)	(((_x) & 0x00000002) ? 0x2 : ((_x) & 0x1))
+#define __RD4(_x)	(((_x) & 0x0000000c) ? __RD2((_x)>>2)<<2 : __RD2(_x))
+#define __RD8(_x)	(((_x) & 0x000000f0) ? __RD4((_x)>>4)<<4 : __RD4(_x))
+#define __RD16(_x)	(((_x) & 0x0000ff00) ? __RD8((_x)>>8)<<8 : __RD8(_x))
+#define __RD32(_x)	(((_x) & 0xffff0000) ? __RD16((_x)>>16)<<16 : __RD16(_x))
+
+#define __CONST_RING_SIZE(_s, _sz)					\
+	(__RD32(((_sz) - offsetof(struct _s##_sring, ring)) /		\
+		sizeof(((struct _s##_sring *)0)->ring[0])))
+
+#define __RING_SIZE(_s, _sz)						\
+	(__RD32(((_sz) - (long)&(_s)->ring + (long)(_s)) / sizeof((_s)->ring[0])))
+
+#define DEFINE_RING_TYPES(__name, __req_t, __rsp_t)			\
+									\
+union __name##_sring_entry {						\
+	__req_t req;							\
+	__rsp_t rsp;							\
+};									\
+									\
+struct __name##_sring {							\
+	RING_IDX req_prod, req_event;					\
+	RING_IDX rsp_prod, rsp_event;					\
+	uint8_t pad[48];						\
+	union __name##_sring_entry ring[1]; /* variable-length */	\
+};									\
+									\
+struct __name##_front_ring {						\
+	RING_IDX req_prod_pvt;						\
+	RING_IDX rsp_cons;						\
+	unsigned int nr_ents;						\
+	struct __name##_sring *sring;					\
+};									\
+									\
+struct __name##_back_ring {						\
+	RING_IDX rsp_prod_pvt;						\
+	RING_IDX req_cons;						\
+	unsigned int nr_ents;						\
+	struct __name##_sring *sring;					\
+}
+
+#define SHARED_RING_INIT(_s) do {					\
+	(_s)->req_prod  = (_s)->rsp_prod  = 0;				\
+	(_s)->req_event = (_s)->rsp_event = 1;				\
+	memset((_s)->pad, 0, sizeof((_s)->pad));			\
+} while (0)
+
+#define FRONT_RING_INIT(_r, _s, __size) do {				\
+	(_r)->req_prod_pvt = 0;						\
+	(_r)->rsp_cons = 0;						\
+	(_r)->nr_ents = __RING_SIZE(_s, __size);			\
+	(_r)->sring = (_s);						\
+} while (0)
+
+#define BACK_RING_INIT(_r, _s, __size) do {				\
+	(_r)->rsp_prod_pvt = 0;						\
+	(_r)->req_cons = 0;						\
+	(_r)->nr_ents = __RING_SIZE(_s, __size);			\
+	(_r)->sring = (_s);						\
+} while (0)
+
+#define RING_SIZE(_r)		((_r)->nr_ents)
+
+#define RING_FREE_REQUESTS(_r)						\
+	(RING_SIZE(_r) - ((_r)->req_prod_pvt - (_r)->rsp_cons))
+
+#define RING_FULL(_r)		(RING_FREE_REQUESTS(_r) == 0)
+
+#define RING_HAS_UNCONSUMED_RESPONSES(_r)				\
+	((_r)->sring->rsp_prod - (_r)->rsp_cons)
+
+#define RING_HAS_UNCONSUMED_REQUESTS(_r)				\
+	({								\
+		unsigned int req = (_r)->sring->req_prod - (_r)->req_cons; \
+		unsigned int rsp = RING_SIZE(_r) -			\
+			((_r)->req_cons - (_r)->rsp_prod_pvt);		\
+		req < rsp ? req : rsp;					\
+	})
+
+#define RING_GET_REQUEST(_r, _idx)					\
+	(&((_r)->sring->ring[((_idx) & (RING_SIZE(_r) - 1))].req))
+
+#define RING_GET_RESPONSE(_r, _idx)					\
+	(&((_r)->sring->ring[((_idx) & (RING_SIZE(_r) - 1))].rsp))
+
+#define RING_REQUEST_CONS_OVERFLOW(_r, _cons)				\
+	(((_cons) - (_r)->rsp_prod_pvt) >= RING_SIZE(_r))
+
+#define RING_PUSH_REQUESTS_AND_CHECK_NOTIFY(_r, _notify) do {		\
+	RING_IDX __old = (_r)->sring->req_prod;				\
+	RING_IDX __new = (_r)->req_prod_pvt;				\
+	wmb(); /* back sees requests /before/ updated producer index */	\
+	(_r)->sring->req_prod = __new;					\
+	mb(); /* back sees new requests /before/ we check req_event */	\
+	(_notify) = ((RING_IDX)(__new - (_r)->sring->req_event) <	\
+		     (RING_IDX)(__new - __old));			\
+} while (0)
+
+#define RING_PUSH_RESPONSES_AND_CHECK_NOTIFY(_r, _notify) do {		\
+	RING_IDX __old = (_r)->sring->rsp_prod;				\
+	RING_IDX __new = (_r)->rsp_prod_pvt;				\
+	wmb(); /* front sees responses /before/ updated producer index */ \
+	(_r)->sring->rsp_prod = __new;					\
+	mb(); /* front sees new responses /before/ we check rsp_event */ \
+	(_notify) = ((RING_IDX)(__new - (_r)->sring->rsp_event) <	\
+		     (RING_IDX)(__new - __old));			\
+} while (0)
+
+#define RING_FINAL_CHECK_FOR_REQUESTS(_r, _work_to_do) do {		\
+	(_work_to_do) = RING_HAS_UNCONSUMED_REQUESTS(_r);		\
+	if (_work_to_do)						\
+		break;							\
+	(_r)->sring->req_event = (_r)->req_cons + 1;			\
+	mb();								\
+	(_work_to_do) = RING_HAS_UNCONSUMED_REQUESTS(_r);		\
+} while (0)
+
+#define RING_FINAL_CHECK_FOR_RESPONSES(_r, _work_to_do) do {		\
+	(_work_to_do) = RING_HAS_UNCONSUMED_RESPONSES(_r);		\
+	if (_work_to_do)						\
+		break;							\
+	(_r)->sring->rsp_event = (_r)->rsp_cons + 1;			\
+	mb();								\
+	(_work_to_do) = RING_HAS_UNCONSUMED_RESPONSES(_r);		\
+} while (0)
+
+/* the block interface, as xen/interface/io/blkif.h has it */
+
+typedef u16 blkif_vdev_t;
+typedef u64 blkif_sector_t;
+
+#define BLKIF_OP_READ			0
+#define BLKIF_OP_WRITE			1
+#define BLKIF_OP_WRITE_BARRIER		2
+#define BLKIF_OP_FLUSH_DISKCACHE	3
+#define BLKIF_OP_DISCARD		5
+
+#define BLKIF_MAX_SEGMENTS_PER_REQUEST	11
+
+struct blkif_request_segment {
+	grant_ref_t		gref;
+	u8			first_sect, last_sect;
+};
+
+struct blkif_request_rw {
+	u8			nr_segments;
+	blkif_vdev_t		handle;
+	u32			_pad1;
+	u64			id;
+	blkif_sector_t		sector_number;
+	struct blkif_request_segment seg[BLKIF_MAX_SEGMENTS_PER_REQUEST];
+} __attribute__((__packed__));
+
+#define BLKIF_DISCARD_SECURE		(1 << 0)
+
+struct blkif_request_discard {
+	u8			flag;
+	blkif_vdev_t		_pad1;
+	u32			_pad2;
+	u64			id;
+	blkif_sector_t		sector_number;
+	u64			nr_sectors;
+	u8			_pad3;
+} __attribute__((__packed__));
+
+struct blkif_request {
+	u8			operation;
+	union {
+		struct blkif_request_rw rw;
+		struct blkif_request_discard discard;
+	} u;
+} __attribute__((__packed__));
+
+struct blkif_response {
+	u64			id;
+	u8			operation;
+	s16			status;
+};
+
+#define BLKIF_RSP_EOPNOTSUPP	-2
+#define BLKIF_RSP_ERROR		-1
+#define BLKIF_RSP_OKAY		0
+
+DEFINE_RING_TYPES(blkif, struct blkif_request, struct blkif_response);
+
+#define VDISK_CDROM		0x1
+#define VDISK_REMOVABLE		0x2
+#define VDISK_READONLY		0x4
+
+#define XEN_IO_PROTO_ABI_X86_32		"x86_32-abi"
+#define XEN_IO_PROTO_ABI_X86_64		"x86_64-abi"
+#define XEN_IO_PROTO_ABI_NATIVE		XEN_IO_PROTO_ABI_X86_64
+
+#endif
@@ -5,22 +5,30 @@
  * Starts from byte start_offset and does size bytes.
  */
 extern int copy_block(struct bio *bio, char *buf, size_t start_offset, size_t size) {
-	unsigned int seg_idx, intra_idx, byte_idx;
+	unsigned int seg_idx, len;
 	struct bio_vec *bvl;
 	char *bufPtr = buf;
 	char *data;
+	size_t byte_idx, skip;
 
 	byte_idx = 0;
 	__bio_for_each_segment(bvl, bio, seg_idx, 0) {
+		if (bufPtr >= buf + size)
+			break;
+		/* skip whole segments that end before start_offset */
+		if (byte_idx + bvl->bv_len <= start_offset) {
+			byte_idx += bvl->bv_len;
+			continue;
+		}
+		skip = start_offset > byte_idx ? start_offset - byte_idx : 0;
+		len = min_t(size_t, bvl->bv_len - skip, buf + size - bufPtr);
 		data = kmap_atomic(bvl->bv_page);
-		if (! data) 
+		if (! data)
 			return -ENOMEM;
-		for (intra_idx = bvl->bv_offset;
-				bufPtr < buf + size && intra_idx < bvl->bv_offset + bvl->bv_len;
-				intra_idx++, byte_idx++)
-			if (byte_idx >= start_offset)
-				*(bufPtr++) = data[intra_idx];
+		memcpy(bufPtr, data + bvl->bv_offset + skip, len);
 		kunmap_atomic(data);
+		bufPtr += len;
+		byte_idx += bvl->bv_len;
 	}
 
 	return 0;
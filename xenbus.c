@@ -17,9 +17,20 @@
 #include <stdarg.h>
 #include <linux/module.h>
 #include <linux/kthread.h>
+#include <linux/debugfs.h>
 #include <xen/events.h>
 #include <xen/grant_table.h>
 #include "common.h"
+#include "inode_map.h"
+#include "readahead.h"
+#include "bitmap.h"
+#include "journal.h"
+#include "discover.h"
+#include "label.h"
+#include "label_io.h"
+#include "persist.h"
+#include "heat.h"
+#include "hot_files.h"
 
 struct backend_info {
 	struct xenbus_device	*dev;
@@ -110,6 +121,11 @@ static struct xen_blkif *xen_blkif_alloc(domid_t domid)
 		return ERR_PTR(-ENOMEM);
 
 	memset(blkif, 0, sizeof(*blkif));
+	blkif->stats = ljx_stats_alloc();
+	if (!blkif->stats) {
+		kmem_cache_free(xen_blkif_cachep, blkif);
+		return ERR_PTR(-ENOMEM);
+	}
 	blkif->domid = domid;
 	spin_lock_init(&blkif->blk_ring_lock);
 	atomic_set(&blkif->refcnt, 1);
@@ -200,6 +216,7 @@ void xen_blkif_free(struct xen_blkif *blkif)
 {
 	if (!atomic_dec_and_test(&blkif->refcnt))
 		BUG();
+	ljx_stats_free(blkif->stats);
 	kmem_cache_free(xen_blkif_cachep, blkif);
 }
 
@@ -230,22 +247,202 @@ int __init xen_blkif_interface_init(void)
 	}								\
 	static DEVICE_ATTR(name, S_IRUGO, show_##name, NULL)
 
-VBD_SHOW(oo_req,  "%d\n", be->blkif->st_oo_req);
-VBD_SHOW(rd_req,  "%d\n", be->blkif->st_rd_req);
-VBD_SHOW(wr_req,  "%d\n", be->blkif->st_wr_req);
-VBD_SHOW(f_req,  "%d\n", be->blkif->st_f_req);
-VBD_SHOW(ds_req,  "%d\n", be->blkif->st_ds_req);
-VBD_SHOW(rd_sect, "%d\n", be->blkif->st_rd_sect);
-VBD_SHOW(wr_sect, "%d\n", be->blkif->st_wr_sect);
+#define VBD_SHOW_STAT(name, stat)					\
+	VBD_SHOW(name, "%llu\n",					\
+		 (unsigned long long)ljx_stat_read(be->blkif->stats, stat))
+
+VBD_SHOW_STAT(oo_req, LJX_ST_OO_REQ);
+VBD_SHOW_STAT(oo_bio, LJX_ST_OO_BIO);
+VBD_SHOW_STAT(rd_req, LJX_ST_RD_REQ);
+VBD_SHOW_STAT(wr_req, LJX_ST_WR_REQ);
+VBD_SHOW_STAT(f_req, LJX_ST_F_REQ);
+VBD_SHOW_STAT(ds_req, LJX_ST_DS_REQ);
+VBD_SHOW_STAT(rd_sect, LJX_ST_RD_SECT);
+VBD_SHOW_STAT(wr_sect, LJX_ST_WR_SECT);
+VBD_SHOW_STAT(f_sect, LJX_ST_F_SECT);
+VBD_SHOW_STAT(ds_sect, LJX_ST_DS_SECT);
+VBD_SHOW_STAT(rd_bytes, LJX_ST_RD_BYTES);
+VBD_SHOW_STAT(wr_bytes, LJX_ST_WR_BYTES);
+VBD_SHOW_STAT(errors, LJX_ST_ERRORS);
+VBD_SHOW_STAT(jnl_req, LJX_ST_JNL_REQ);
+VBD_SHOW_STAT(jnl_batch, LJX_ST_JNL_BATCH);
+
+/* readahead counters, 0 while the vbd has no readahead */
+#define VBD_SHOW_RA(name, field)					\
+	VBD_SHOW(name, "%llu\n", be->blkif->vbd.ra ?			\
+		 (unsigned long long)be->blkif->vbd.ra->field : 0ULL)
+
+VBD_SHOW_RA(ra_issued_sect, issued);
+VBD_SHOW_RA(ra_hit_sect, hits);
+VBD_SHOW_RA(ra_wasted_sect, wasted);
+VBD_SHOW_RA(ra_budget_pages, nr_slots);
+
+/* sums a counter of a per filesystem tracker over every partition */
+#define VBD_SHOW_FS(name, tracker, field)				\
+	static ssize_t show_##name(struct device *_dev,			\
+				   struct device_attribute *attr,	\
+				   char *buf)				\
+	{								\
+		struct xenbus_device *dev = to_xenbus_device(_dev);	\
+		struct backend_info *be = dev_get_drvdata(&dev->dev);	\
+		struct ljx_bootblock *bb = be->blkif->vbd.bootblock;	\
+		struct ljx_ext3_superblock *lsb;			\
+		unsigned long long sum = 0;				\
+		unsigned int i;						\
+									\
+		if (!bb)						\
+			return sprintf(buf, "0\n");			\
+		for_each_ljx_fs(bb, i, lsb) {				\
+			if (lsb->tracker)				\
+				sum += lsb->tracker->field;		\
+		}							\
+		return sprintf(buf, "%llu\n", sum);			\
+	}								\
+	static DEVICE_ATTR(name, S_IRUGO, show_##name, NULL)
+
+#define VBD_SHOW_BITMAP(name, field) VBD_SHOW_FS(name, block_bitmap, field)
+
+VBD_SHOW_BITMAP(synth_discard_sect, discarded_sect);
+VBD_SHOW_BITMAP(synth_discard_reused, reused_blocks);
+VBD_SHOW_BITMAP(synth_discard_dropped, dropped_blocks);
+VBD_SHOW_BITMAP(free_read_bytes, skipped_bytes);
+
+#define VBD_SHOW_JOURNAL(name, field) VBD_SHOW_FS(name, journal, field)
+
+VBD_SHOW_JOURNAL(journal_commits, commits);
+VBD_SHOW_JOURNAL(journal_partial, partial);
+VBD_SHOW_JOURNAL(journal_revokes, revoke_records);
+
+/* histograms of the guest's journal transactions, see ljx_hist_show() */
+#define VBD_SHOW_JOURNAL_HIST(name, field)				\
+	static ssize_t show_##name(struct device *_dev,			\
+				   struct device_attribute *attr,	\
+				   char *buf)				\
+	{								\
+		struct xenbus_device *dev = to_xenbus_device(_dev);	\
+		struct backend_info *be = dev_get_drvdata(&dev->dev);	\
+		struct ljx_bootblock *bb = be->blkif->vbd.bootblock;	\
+		struct ljx_ext3_superblock *lsb;			\
+		struct ljx_hist hist;					\
+		unsigned long flags;					\
+		unsigned int i;						\
+		bool any = false;					\
+									\
+		memset(&hist, 0, sizeof(hist));				\
+		if (!bb)						\
+			return 0;					\
+		for_each_ljx_fs(bb, i, lsb) {				\
+			if (!lsb->journal)				\
+				continue;				\
+			spin_lock_irqsave(&lsb->journal->lock, flags);	\
+			ljx_hist_merge(&hist, &lsb->journal->field);	\
+			spin_unlock_irqrestore(&lsb->journal->lock, flags); \
+			any = true;					\
+		}							\
+		return any ? ljx_hist_show(&hist, buf, PAGE_SIZE) : 0;	\
+	}								\
+	static DEVICE_ATTR(name, S_IRUGO, show_##name, NULL)
+
+VBD_SHOW_JOURNAL_HIST(journal_txn_blocks, txn_log_blocks);
+VBD_SHOW_JOURNAL_HIST(journal_txn_meta, txn_meta_blocks);
+VBD_SHOW_JOURNAL_HIST(journal_commit_us, commit_us);
+
+/* progress of the attach time metadata scan, see ljx_scan_show() */
+static ssize_t show_scan(struct device *_dev,
+			 struct device_attribute *attr, char *buf)
+{
+	struct xenbus_device *dev = to_xenbus_device(_dev);
+	struct backend_info *be = dev_get_drvdata(&dev->dev);
+	struct ljx_discover *d = be->blkif->vbd.discover;
+
+	if (!d)
+		return 0;
+	return ljx_scan_show(&d->scan, buf, PAGE_SIZE);
+}
+static DEVICE_ATTR(scan, S_IRUGO, show_scan, NULL);
+
+/* how many bios we have been inspecting, see ljx_sample_show() */
+static ssize_t show_sampling(struct device *_dev,
+			     struct device_attribute *attr, char *buf)
+{
+	struct xenbus_device *dev = to_xenbus_device(_dev);
+	struct backend_info *be = dev_get_drvdata(&dev->dev);
+
+	return ljx_sample_show(&be->blkif->vbd.sample, buf, PAGE_SIZE);
+}
+static DEVICE_ATTR(sampling, S_IRUGO, show_sampling, NULL);
+
+/* what the labels and each filesystem's indexes take up, in bytes */
+static ssize_t show_memory(struct device *_dev,
+			   struct device_attribute *attr, char *buf)
+{
+	struct xenbus_device *dev = to_xenbus_device(_dev);
+	struct backend_info *be = dev_get_drvdata(&dev->dev);
+	struct xen_vbd *vbd = &be->blkif->vbd;
+	struct ljx_ext3_superblock *lsb;
+	unsigned int i;
+	ssize_t len;
+
+	if (!vbd->labels)
+		return 0;
+	len = ljx_labels_show_mem(vbd->labels, buf, PAGE_SIZE);
+	if (!vbd->bootblock)
+		return len;
+	for_each_ljx_fs(vbd->bootblock, i, lsb) {
+		len += ljx_ext3_show_mem(lsb, buf + len, PAGE_SIZE - len);
+	}
+	return len;
+}
+static DEVICE_ATTR(memory, S_IRUGO, show_memory, NULL);
+
+/* ops and bytes read and written by label type, see label_io.h */
+static ssize_t show_label_io(struct device *_dev,
+			     struct device_attribute *attr, char *buf)
+{
+	struct xenbus_device *dev = to_xenbus_device(_dev);
+	struct backend_info *be = dev_get_drvdata(&dev->dev);
+	struct xen_vbd *vbd = &be->blkif->vbd;
+
+	if (!vbd->label_io)
+		return 0;
+	return ljx_label_io_show(vbd->label_io, buf, PAGE_SIZE);
+}
+static DEVICE_ATTR(label_io, S_IRUGO, show_label_io, NULL);
 
 static struct attribute *xen_vbdstat_attrs[] = {
 	&dev_attr_oo_req.attr,
+	&dev_attr_oo_bio.attr,
 	&dev_attr_rd_req.attr,
 	&dev_attr_wr_req.attr,
 	&dev_attr_f_req.attr,
 	&dev_attr_ds_req.attr,
 	&dev_attr_rd_sect.attr,
 	&dev_attr_wr_sect.attr,
+	&dev_attr_f_sect.attr,
+	&dev_attr_ds_sect.attr,
+	&dev_attr_rd_bytes.attr,
+	&dev_attr_wr_bytes.attr,
+	&dev_attr_errors.attr,
+	&dev_attr_jnl_req.attr,
+	&dev_attr_jnl_batch.attr,
+	&dev_attr_ra_issued_sect.attr,
+	&dev_attr_ra_hit_sect.attr,
+	&dev_attr_ra_wasted_sect.attr,
+	&dev_attr_ra_budget_pages.attr,
+	&dev_attr_synth_discard_sect.attr,
+	&dev_attr_synth_discard_reused.attr,
+	&dev_attr_synth_discard_dropped.attr,
+	&dev_attr_free_read_bytes.attr,
+	&dev_attr_journal_commits.attr,
+	&dev_attr_journal_partial.attr,
+	&dev_attr_journal_revokes.attr,
+	&dev_attr_journal_txn_blocks.attr,
+	&dev_attr_journal_txn_meta.attr,
+	&dev_attr_journal_commit_us.attr,
+	&dev_attr_scan.attr,
+	&dev_attr_memory.attr,
+	&dev_attr_sampling.attr,
+	&dev_attr_label_io.attr,
 	NULL
 };
 
@@ -254,6 +451,91 @@ static struct attribute_group xen_vbdstat_group = {
 	.attrs = xen_vbdstat_attrs,
 };
 
+#define VBD_SHOW_LAT(name, stage)					\
+	static ssize_t show_lat_##name(struct device *_dev,		\
+				       struct device_attribute *attr,	\
+				       char *buf)			\
+	{								\
+		struct xenbus_device *dev = to_xenbus_device(_dev);	\
+		struct backend_info *be = dev_get_drvdata(&dev->dev);	\
+		struct xen_vbd *vbd = &be->blkif->vbd;			\
+									\
+		if (!vbd->lat)						\
+			return 0;					\
+		return ljx_lat_show(vbd->lat, stage, buf, PAGE_SIZE);	\
+	}								\
+	static struct device_attribute dev_attr_lat_##name =		\
+		__ATTR(name, S_IRUGO, show_lat_##name, NULL)
+
+VBD_SHOW_LAT(consume_map, LJX_LAT_MAP);
+VBD_SHOW_LAT(map_submit, LJX_LAT_SUBMIT);
+VBD_SHOW_LAT(device, LJX_LAT_DEVICE);
+VBD_SHOW_LAT(introspect, LJX_LAT_INTROSPECT);
+VBD_SHOW_LAT(response, LJX_LAT_RESPONSE);
+
+static struct attribute *xen_vbdlat_attrs[] = {
+	&dev_attr_lat_consume_map.attr,
+	&dev_attr_lat_map_submit.attr,
+	&dev_attr_lat_device.attr,
+	&dev_attr_lat_introspect.attr,
+	&dev_attr_lat_response.attr,
+	NULL
+};
+
+/* nanosecond histograms of each stage of a request, see lat.h */
+static struct attribute_group xen_vbdlat_group = {
+	.name = "latency",
+	.attrs = xen_vbdlat_attrs,
+};
+
+#define VBD_SHOW_LABEL_LAT(name, type)					\
+	static ssize_t show_label_lat_##name(struct device *_dev,	\
+					     struct device_attribute *attr, \
+					     char *buf)			\
+	{								\
+		struct xenbus_device *dev = to_xenbus_device(_dev);	\
+		struct backend_info *be = dev_get_drvdata(&dev->dev);	\
+		struct xen_vbd *vbd = &be->blkif->vbd;			\
+									\
+		if (!vbd->label_io)					\
+			return 0;					\
+		return ljx_label_io_show_lat(vbd->label_io, type, buf,	\
+					     PAGE_SIZE);		\
+	}								\
+	static struct device_attribute dev_attr_label_lat_##name =	\
+		__ATTR(name, S_IRUGO, show_label_lat_##name, NULL)
+
+VBD_SHOW_LABEL_LAT(superblock, SUPERBLOCK);
+VBD_SHOW_LABEL_LAT(bootblock, BOOTBLOCK);
+VBD_SHOW_LABEL_LAT(inode_block, INODE_BLOCK);
+VBD_SHOW_LABEL_LAT(group_desc, GROUP_DESC);
+VBD_SHOW_LABEL_LAT(block_bitmap, BLOCK_BITMAP);
+VBD_SHOW_LABEL_LAT(indirect_block, INDIRECT_BLOCK);
+VBD_SHOW_LABEL_LAT(extent_block, EXTENT_BLOCK);
+VBD_SHOW_LABEL_LAT(journal, JOURNAL);
+VBD_SHOW_LABEL_LAT(data, DATA);
+VBD_SHOW_LABEL_LAT(unlabeled, UNLABELED);
+
+static struct attribute *xen_vbdlabel_lat_attrs[] = {
+	&dev_attr_label_lat_superblock.attr,
+	&dev_attr_label_lat_bootblock.attr,
+	&dev_attr_label_lat_inode_block.attr,
+	&dev_attr_label_lat_group_desc.attr,
+	&dev_attr_label_lat_block_bitmap.attr,
+	&dev_attr_label_lat_indirect_block.attr,
+	&dev_attr_label_lat_extent_block.attr,
+	&dev_attr_label_lat_journal.attr,
+	&dev_attr_label_lat_data.attr,
+	&dev_attr_label_lat_unlabeled.attr,
+	NULL
+};
+
+/* device latency of the bios touching each label type */
+static struct attribute_group xen_vbdlabel_lat_group = {
+	.name = "label_latency",
+	.attrs = xen_vbdlabel_lat_attrs,
+};
+
 VBD_SHOW(physical_device, "%x:%x\n", be->major, be->minor);
 VBD_SHOW(mode, "%s\n", be->mode);
 
@@ -273,8 +555,18 @@ int xenvbd_sysfs_addif(struct xenbus_device *dev)
 	if (error)
 		goto fail3;
 
+	error = sysfs_create_group(&dev->dev.kobj, &xen_vbdlat_group);
+	if (error)
+		goto fail4;
+
+	error = sysfs_create_group(&dev->dev.kobj, &xen_vbdlabel_lat_group);
+	if (error)
+		goto fail5;
+
 	return 0;
 
+fail5:	sysfs_remove_group(&dev->dev.kobj, &xen_vbdlabel_lat_group);
+fail4:	sysfs_remove_group(&dev->dev.kobj, &xen_vbdlat_group);
 fail3:	sysfs_remove_group(&dev->dev.kobj, &xen_vbdstat_group);
 fail2:	device_remove_file(&dev->dev, &dev_attr_mode);
 fail1:	device_remove_file(&dev->dev, &dev_attr_physical_device);
@@ -283,24 +575,65 @@ fail1:	device_remove_file(&dev->dev, &dev_attr_physical_device);
 
 void xenvbd_sysfs_delif(struct xenbus_device *dev)
 {
+	sysfs_remove_group(&dev->dev.kobj, &xen_vbdlabel_lat_group);
+	sysfs_remove_group(&dev->dev.kobj, &xen_vbdlat_group);
 	sysfs_remove_group(&dev->dev.kobj, &xen_vbdstat_group);
 	device_remove_file(&dev->dev, &dev_attr_mode);
 	device_remove_file(&dev->dev, &dev_attr_physical_device);
 }
 
 
+/* the ljx directory in debugfs, for the heatmaps and hot files */
+static struct dentry *ljx_debugfs;
+
 static void xen_vbd_free(struct xen_vbd *vbd)
 {
+	struct ljx_ext3_superblock *lsb;
+	unsigned int i;
+
+	/* snapshots read the labels */
+	ljx_heat_free(vbd->heat);
+	vbd->heat = NULL;
+	ljx_hot_files_free(vbd->hot);
+	vbd->hot = NULL;
+	debugfs_remove_recursive(vbd->debugfs);
+	vbd->debugfs = NULL;
+	/* reads labels and the bdev, so stop it first */
+	ljx_discover_stop(vbd->discover);
+	vbd->discover = NULL;
+	/* waits for outstanding readahead, so before the bdev goes */
+	ljx_ra_free(vbd->ra);
+	vbd->ra = NULL;
+	/* and so must synthesized discards */
+	if (vbd->bootblock)
+		for_each_ljx_fs(vbd->bootblock, i, lsb)
+			ljx_bitmap_stop(lsb->block_bitmap);
 	if (vbd->bdev)
 		blkdev_put(vbd->bdev, vbd->readonly ? FMODE_READ : FMODE_WRITE);
 	vbd->bdev = NULL;
-	if (vbd->superblock) {
-		kfree(vbd->superblock);
-		vbd->superblock = NULL;
-	}
-	/* TODO: kfree all the struct labels in the list one-by-one; right now
-	 * this is a big memory leak */
-	INIT_LIST_HEAD(&vbd->label_list);
+	/* the map is quiet now that discovery and the device are gone */
+	ljx_persist_save(vbd);
+	/* unless it took them over */
+	ljx_bootblock_free(vbd->bootblock);
+	vbd->bootblock = NULL;
+	ljx_labels_free(vbd->labels);
+	vbd->labels = NULL;
+	ljx_lat_free(vbd->lat);
+	vbd->lat = NULL;
+	ljx_label_io_free(vbd->label_io);
+	vbd->label_io = NULL;
+}
+
+static struct dentry *xen_vbd_debugfs(struct xen_blkif *blkif)
+{
+	struct dentry *dir;
+	char name[32];
+
+	if (!ljx_debugfs)
+		return NULL;
+	snprintf(name, sizeof(name), "%u-%u", blkif->domid, blkif->vbd.handle);
+	dir = debugfs_create_dir(name, ljx_debugfs);
+	return IS_ERR_OR_NULL(dir) ? NULL : dir;
 }
 
 static int xen_vbd_create(struct xen_blkif *blkif, blkif_vdev_t handle,
@@ -348,13 +681,38 @@ static int xen_vbd_create(struct xen_blkif *blkif, blkif_vdev_t handle,
 	if (q && blk_queue_secdiscard(q))
 		vbd->discard_secure = true;
 
-	if (vbd->superblock) {
-		kfree(vbd->superblock);
-		vbd->superblock = NULL;
+	ljx_bootblock_free(vbd->bootblock);
+	vbd->bootblock = NULL;
+	ljx_labels_free(vbd->labels);
+	vbd->labels = ljx_labels_alloc(vbd->pdevice);
+	if (!vbd->labels) {
+		xen_vbd_free(vbd);
+		return -ENOMEM;
 	}
-	/* TODO: kfree all the struct labels in the list one-by-one; right now
-	 * this is a big memory leak */
-	INIT_LIST_HEAD(&vbd->label_list);
+
+	/* Without these we just don't learn anything about the guest. */
+	vbd->bootblock = ljx_bootblock_alloc();
+	if (vbd->bootblock && ljx_boot_label(vbd))
+		DPRINTK("xen_vbd_create: no memory for boot labels.\n");
+
+	/* Optional: readahead just stays off if we can't get the memory. */
+	vbd->ra = ljx_ra_alloc(vbd);
+	ljx_sample_init(&vbd->sample);
+	/* Optional as well: the histograms and counters just read empty. */
+	ljx_lat_free(vbd->lat);
+	vbd->lat = ljx_lat_alloc();
+	ljx_label_io_free(vbd->label_io);
+	vbd->label_io = ljx_label_io_alloc();
+	if (!vbd->debugfs)
+		vbd->debugfs = xen_vbd_debugfs(blkif);
+	ljx_heat_free(vbd->heat);
+	vbd->heat = ljx_heat_alloc(vbd);
+	ljx_hot_files_free(vbd->hot);
+	vbd->hot = ljx_hot_files_alloc(vbd);
+
+	/* Don't wait for the guest to read its partition table. */
+	if (vbd->bootblock)
+		vbd->discover = ljx_discover_start(vbd);
 
 	DPRINTK("Successful creation of handle=%04x (dom=%u)\n",
 		handle, blkif->domid);
@@ -823,5 +1181,10 @@ static DEFINE_XENBUS_DRIVER(xen_blkbk, ,
 
 int xen_blkif_xenbus_init(void)
 {
+	ljx_debugfs = debugfs_create_dir("ljx", NULL);
+	if (IS_ERR_OR_NULL(ljx_debugfs)) {
+		pr_warn(DRV_PFX "no debugfs, heatmaps and hot files disabled\n");
+		ljx_debugfs = NULL;
+	}
 	return xenbus_register_backend(&xen_blkbk_driver);
 }